@@ -1055,6 +1055,217 @@ void mainSort ( UInt32* ptr,
 #undef CLEARMASK
 
 
+/*---------------------------------------------*/
+/*--- Suffix-array sorting                  ---*/
+/*---------------------------------------------*/
+
+/*---------------------------------------------*/
+/*--
+   Linear-time alternative to mainSort/fallbackSort,
+   selected with workFactor == BZ_WORK_SUFFIX.  Its
+   running time does not depend on how repetitive
+   the block is.
+
+   The block is rotated so that it starts at its
+   lexicographically least rotation.  If the block is
+   not periodic that rotation is a Lyndon word, for
+   which the order of the suffixes is the order of
+   the rotations, so a plain suffix array of the
+   rotated block (built by induced sorting, SA-IS,
+   with a virtual sentinel smaller than any symbol)
+   gives exactly the ordering the other sorters
+   produce.  Periodic blocks have equal rotations,
+   whose relative order decides origPtr; those are
+   left to the usual sorters so the stream stays
+   the same whichever sorter is selected.
+--*/
+
+#define SA_GET(t,i)  (((t)[(i) >> 5] >> ((i) & 31)) & 1)
+#define SA_SET(t,i)  (t)[(i) >> 5] |= ((UInt32)1 << ((i) & 31))
+#define SA_CHR(i)    (cs == 1 ? (Int32)((UChar*)s)[i] \
+                              : ((Int32*)s)[i])
+#define SA_LMS(i)    ((i) > 0 && SA_GET(t,i) && !SA_GET(t,(i)-1))
+
+
+/*---------------------------------------------*/
+static
+Int32 saMinRotation ( UChar* block, Int32 nblock, Bool* periodic )
+{
+   Int32 i, j, k, a, b;
+
+   i = 0; j = 1; k = 0;
+   while (i < nblock && j < nblock && k < nblock) {
+      a = i + k; if (a >= nblock) a -= nblock;
+      b = j + k; if (b >= nblock) b -= nblock;
+      if (block[a] == block[b]) { k++; continue; }
+      if (block[a] > block[b]) i += k + 1; else j += k + 1;
+      if (i == j) j++;
+      k = 0;
+   }
+   *periodic = (k >= nblock);
+   return i < j ? i : j;
+}
+
+
+/*---------------------------------------------*/
+static
+void saBuckets ( void* s, Int32 n, Int32 K, Int32 cs,
+                 Int32* bkt, Bool end )
+{
+   Int32 i, sum;
+
+   for (i = 0; i < K; i++) bkt[i] = 0;
+   for (i = 0; i < n; i++) bkt[SA_CHR(i)]++;
+   sum = 0;
+   for (i = 0; i < K; i++) {
+      sum += bkt[i];
+      bkt[i] = end ? sum : sum - bkt[i];
+   }
+}
+
+
+/*---------------------------------------------*/
+static
+void saInduce ( void* s, UInt32* t, Int32* SA, Int32 n, Int32 K,
+                Int32 cs, Int32* bkt )
+{
+   Int32 i, j;
+
+   /*-- L-type suffixes, starting from the sentinel --*/
+   saBuckets ( s, n, K, cs, bkt, False );
+   SA[bkt[SA_CHR(n-1)]++] = n-1;
+   for (i = 0; i < n; i++) {
+      j = SA[i] - 1;
+      if (j >= 0 && !SA_GET(t,j)) SA[bkt[SA_CHR(j)]++] = j;
+   }
+
+   /*-- S-type suffixes --*/
+   saBuckets ( s, n, K, cs, bkt, True );
+   for (i = n-1; i >= 0; i--) {
+      j = SA[i] - 1;
+      if (j >= 0 && SA_GET(t,j)) SA[--bkt[SA_CHR(j)]] = j;
+   }
+}
+
+
+/*---------------------------------------------*/
+/*--
+   Suffix array of s[0 .. n-1] (symbols 0 .. K-1,
+   1 or 4 bytes each as given by cs) into SA[0 .. n-1].
+   Type bits and buckets come from work[], which is
+   handed on to the recursion past what this level uses.
+--*/
+static
+void saSort ( void* s, Int32* SA, Int32 n, Int32 K, Int32 cs,
+              UInt32* work, UInt32* workEnd )
+{
+   UInt32* t;
+   Int32*  bkt;
+   Int32*  s1;
+   Int32   i, j, d, n1, name, prev, pos;
+   Bool    diff;
+
+   t    = work;
+   bkt  = (Int32*)(t + (n >> 5) + 1);
+   work = (UInt32*)(bkt + K);
+   AssertH ( work <= workEnd, 1008 );
+
+   /*-- classify; the virtual sentinel makes s[n-1] L-type --*/
+   for (i = 0; i <= (n >> 5); i++) t[i] = 0;
+   for (i = n-2; i >= 0; i--)
+      if (SA_CHR(i) < SA_CHR(i+1) ||
+          (SA_CHR(i) == SA_CHR(i+1) && SA_GET(t,i+1)))
+         SA_SET(t,i);
+
+   /*-- sort the LMS substrings --*/
+   saBuckets ( s, n, K, cs, bkt, True );
+   for (i = 0; i < n; i++) SA[i] = -1;
+   for (i = 1; i < n; i++)
+      if (SA_LMS(i)) SA[--bkt[SA_CHR(i)]] = i;
+   saInduce ( s, t, SA, n, K, cs, bkt );
+
+   /*-- compact them into SA[0 .. n1-1] and name them --*/
+   n1 = 0;
+   for (i = 0; i < n; i++)
+      if (SA_LMS(SA[i])) SA[n1++] = SA[i];
+   for (i = n1; i < n; i++) SA[i] = -1;
+
+   name = 0; prev = -1;
+   for (i = 0; i < n1; i++) {
+      pos = SA[i]; diff = False;
+      for (d = 0; d < n; d++) {
+         if (prev == -1 || pos+d == n || prev+d == n ||
+             SA_CHR(pos+d) != SA_CHR(prev+d) ||
+             SA_GET(t,pos+d) != SA_GET(t,prev+d)) {
+            diff = True; break;
+         }
+         if (d > 0 && (SA_LMS(pos+d) || SA_LMS(prev+d))) break;
+      }
+      if (diff) { name++; prev = pos; }
+      SA[n1 + (pos >> 1)] = name - 1;
+   }
+   s1 = SA + n - n1;
+   for (i = n-1, j = n-1; i >= n1; i--)
+      if (SA[i] >= 0) SA[j--] = SA[i];
+
+   /*-- sort the LMS suffixes, recursing if the names clash --*/
+   if (name < n1) {
+      saSort ( s1, SA, n1, name, sizeof(Int32), work, workEnd );
+   } else {
+      for (i = 0; i < n1; i++) SA[s1[i]] = i;
+   }
+
+   /*-- and induce the full order from them --*/
+   saBuckets ( s, n, K, cs, bkt, True );
+   for (i = 1, j = 0; i < n; i++)
+      if (SA_LMS(i)) s1[j++] = i;
+   for (i = 0; i < n1; i++) SA[i] = s1[SA[i]];
+   for (i = n1; i < n; i++) SA[i] = -1;
+   for (i = n1-1; i >= 0; i--) {
+      j = SA[i]; SA[i] = -1;
+      SA[--bkt[SA_CHR(j)]] = j;
+   }
+   saInduce ( s, t, SA, n, K, cs, bkt );
+}
+
+#undef SA_GET
+#undef SA_SET
+#undef SA_CHR
+#undef SA_LMS
+
+
+/*---------------------------------------------*/
+/*--
+   Returns False, leaving everything untouched,
+   if the block is periodic.
+--*/
+static
+Bool suffixSort ( UInt32* ptr, UChar* block, UChar* text,
+                  UInt32* work, Int32 nblock, Int32 verb )
+{
+   Int32 i, r;
+   Bool  periodic;
+
+   r = saMinRotation ( block, nblock, &periodic );
+   if (periodic) return False;
+
+   if (verb >= 4)
+      VPrintf1 ( "        suffix sort, rotation %d\n", r );
+
+   for (i = r; i < nblock; i++) text[i-r] = block[i];
+   for (i = 0; i < r; i++) text[nblock-r+i] = block[i];
+
+   saSort ( text, (Int32*)ptr, nblock, 256, 1,
+            work, work + BZ_SA_WORK(nblock) );
+
+   for (i = 0; i < nblock; i++) {
+      ptr[i] += r;
+      if (ptr[i] >= (UInt32)nblock) ptr[i] -= nblock;
+   }
+   return True;
+}
+
+
 /*---------------------------------------------*/
 /* Pre:
       nblock > 0
@@ -1067,6 +1278,7 @@ void mainSort ( UInt32* ptr,
       All other areas of block destroyed
       ftab [ 0 .. 65536 ] destroyed
       arr1 [0 .. nblock-1] holds sorted order
+      sawork, if allocated, destroyed
 */
 void BZ2_blockSort ( EState* s )
 {
@@ -1081,7 +1293,16 @@ void BZ2_blockSort ( EState* s )
    Int32   budgetInit;
    Int32   i;
 
-   if (nblock < 10000) {
+   /* Free space past the end of the block, for quadrant
+      or for suffixSort's copy of the block.
+   */
+   i = nblock+BZ_N_OVERSHOOT;
+   if (i & 1) i++;
+
+   if (wfact == BZ_WORK_SUFFIX &&
+       suffixSort ( ptr, block, &(block[i]), s->sawork, nblock, verb )) {
+      /* sorted; periodic blocks go on to the usual sorters */
+   } else if (nblock < 10000) {
       fallbackSort ( s->arr1, s->arr2, ftab, nblock, verb );
    } else {
       /* Calculate the location for quadrant, remembering to get
@@ -1089,8 +1310,6 @@ void BZ2_blockSort ( EState* s )
          2-byte aligned -- this should be ok since block is really
          the first section of arr2.
       */
-      i = nblock+BZ_N_OVERSHOOT;
-      if (i & 1) i++;
       quadrant = (UInt16*)(&(block[i]));
 
       /* (wfact-1) / 3 puts the default-factor-30
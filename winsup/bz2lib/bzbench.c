@@ -0,0 +1,339 @@
+
+/* Throughput benchmark and regression check for libbzip2.
+
+      bzbench [-b levels] [-w workfactors] [-p threads] [-r reps]
+              [-c baseline] file ...
+
+   Compresses and decompresses each file in memory at every
+   combination of block size (-b, default 1,5,9), work factor
+   (-w, default 30; 251 selects the suffix-array sorter) and
+   thread count (-p, default 1), checks that the data comes back
+   intact, and prints one tab-separated line per combination
+   giving the compressed size and the best of -r (default 3)
+   speeds in MB of uncompressed data per second.
+
+   Given the output of an earlier run with -c, it also reports
+   the change in speed on each line and overall, and fails if a
+   file now compresses to a different size, which a change meant
+   only to speed things up should never cause.  `make bench' runs
+   it over a standard corpus, leaving the results in bench.tsv;
+   keep a copy of that and pass it back with
+   `make bench BASELINE=copy'.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+#include "bzlib.h"
+
+#define MAX_LIST 16
+
+typedef struct {
+   char   name[256];
+   int    level, work, threads;
+   double bytes, zbytes, cRate, dRate;
+   unsigned long sum;
+} Result;
+
+static int     levels[MAX_LIST]  = { 1, 5, 9 }, nLevels  = 3;
+static int     works[MAX_LIST]   = { 30 },      nWorks   = 1;
+static int     threads[MAX_LIST] = { 1 },       nThreads = 1;
+static int     reps = 3;
+static Result* base;
+static int     nBase;
+
+static double  cLogSum, dLogSum;
+static int     nCompared;
+
+
+static double now ( void )
+{
+   struct timeval tv;
+   gettimeofday ( &tv, NULL );
+   return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+/* So that a baseline line is only held against a run over the
+   same data. */
+static unsigned long checksum ( unsigned char* p, unsigned n )
+{
+   unsigned long a = 1, b = 0;
+   while (n-- > 0) { a = (a + *p++) % 65521; b = (b + a) % 65521; }
+   return (b << 16) | a;
+}
+
+
+static int parseList ( char* s, int* list, int lo, int hi )
+{
+   int n = 0;
+   char* end;
+   while (n < MAX_LIST) {
+      list[n] = (int)strtol ( s, &end, 10 );
+      if (end == s || list[n] < lo || list[n] > hi) return 0;
+      n++;
+      if (*end == '\0') return n;
+      if (*end != ',') return 0;
+      s = end + 1;
+   }
+   return 0;
+}
+
+
+static int compressBuf ( char* src, unsigned n, char* dst, unsigned* dn,
+                         int level, int work, int nth )
+{
+   bz_stream s;
+   int       ret;
+
+   s.bzalloc = NULL;
+   s.bzfree  = NULL;
+   s.opaque  = NULL;
+   ret = BZ2_bzCompressInitMT ( &s, level, 0, work, nth );
+   if (ret != BZ_OK) return ret;
+   s.next_in   = src;
+   s.avail_in  = n;
+   s.next_out  = dst;
+   s.avail_out = *dn;
+   do ret = BZ2_bzCompress ( &s, BZ_FINISH );
+      while (ret == BZ_FINISH_OK && s.avail_out > 0);
+   if (ret == BZ_STREAM_END) {
+      *dn -= s.avail_out;
+      ret = BZ_OK;
+   } else if (ret == BZ_FINISH_OK)
+      ret = BZ_OUTBUFF_FULL;
+   BZ2_bzCompressEnd ( &s );
+   return ret;
+}
+
+
+static int decompressBuf ( char* src, unsigned n, char* dst, unsigned* dn,
+                           int nth )
+{
+   bz_stream s;
+   int       ret;
+
+   s.bzalloc = NULL;
+   s.bzfree  = NULL;
+   s.opaque  = NULL;
+   ret = BZ2_bzDecompressInitMT ( &s, 0, 0, nth );
+   if (ret != BZ_OK) return ret;
+   s.next_in   = src;
+   s.avail_in  = n;
+   s.next_out  = dst;
+   s.avail_out = *dn;
+   ret = BZ2_bzDecompress ( &s );
+   if (ret == BZ_STREAM_END) {
+      *dn -= s.avail_out;
+      ret = BZ_OK;
+   } else if (ret == BZ_OK)
+      ret = s.avail_out == 0 ? BZ_OUTBUFF_FULL : BZ_UNEXPECTED_EOF;
+   BZ2_bzDecompressEnd ( &s );
+   return ret;
+}
+
+
+static char* readFile ( char* name, unsigned* n )
+{
+   FILE*    f = fopen ( name, "rb" );
+   char*    buf = NULL;
+   unsigned cap = 0, got;
+
+   *n = 0;
+   if (f == NULL) return NULL;
+   do {
+      if (*n == cap) {
+         cap = cap ? 2 * cap : 1 << 20;
+         buf = realloc ( buf, cap );
+         if (buf == NULL) { fclose ( f ); return NULL; }
+      }
+      got = fread ( buf + *n, 1, cap - *n, f );
+      *n += got;
+   } while (got > 0);
+   if (ferror ( f )) { free ( buf ); buf = NULL; }
+   fclose ( f );
+   return buf;
+}
+
+
+static void readBaseline ( char* name )
+{
+   FILE*  f = fopen ( name, "r" );
+   char   line[512];
+   Result r;
+   int    cap = 0;
+
+   if (f == NULL) {
+      fprintf ( stderr, "bzbench: can't read baseline `%s'\n", name );
+      exit ( 2 );
+   }
+   while (fgets ( line, sizeof(line), f ) != NULL) {
+      if (line[0] == '#') continue;
+      if (sscanf ( line, "%255[^\t]\t%lf\t%lx\t%d\t%d\t%d\t%lf\t%lf\t%lf",
+                   r.name, &r.bytes, &r.sum, &r.level, &r.work,
+                   &r.threads, &r.zbytes, &r.cRate, &r.dRate ) != 9)
+         continue;
+      if (nBase == cap) {
+         cap = cap ? 2 * cap : 64;
+         base = realloc ( base, cap * sizeof(Result) );
+         if (base == NULL) exit ( 2 );
+      }
+      base[nBase++] = r;
+   }
+   fclose ( f );
+}
+
+
+/* Returns 1 if r disagrees with the baseline. */
+static int compare ( Result* r )
+{
+   int    i;
+   Result* b;
+
+   for (i = 0; i < nBase; i++) {
+      b = &base[i];
+      if (strcmp ( b->name, r->name ) == 0 && b->sum == r->sum &&
+          b->level == r->level && b->work == r->work &&
+          b->threads == r->threads) break;
+   }
+   if (i == nBase) return 0;
+
+   fprintf ( stderr, "%-24s -%d w%-3d p%-2d  compress %+6.1f%%  "
+             "decompress %+6.1f%%%s\n",
+             r->name, r->level, r->work, r->threads,
+             100.0 * (r->cRate / b->cRate - 1.0),
+             100.0 * (r->dRate / b->dRate - 1.0),
+             b->zbytes != r->zbytes ? "  SIZE CHANGED" : "" );
+   cLogSum += log ( r->cRate / b->cRate );
+   dLogSum += log ( r->dRate / b->dRate );
+   nCompared++;
+   return b->zbytes != r->zbytes;
+}
+
+
+static int bench ( char* name )
+{
+   char     *src, *z, *back;
+   unsigned n, zcap, zn, bn;
+   int      l, w, t, k, ret, bad = 0;
+   double   t0, cBest, dBest;
+   Result   r;
+   char*    p;
+
+   src = readFile ( name, &n );
+   if (src == NULL) {
+      fprintf ( stderr, "bzbench: can't read `%s'\n", name );
+      return 1;
+   }
+   zcap = n + n / 100 + 600;
+   z    = malloc ( zcap );
+   back = malloc ( n + 1 );
+   if (z == NULL || back == NULL) {
+      fprintf ( stderr, "bzbench: out of memory for `%s'\n", name );
+      exit ( 2 );
+   }
+
+   p = strrchr ( name, '/' );
+   strncpy ( r.name, p ? p + 1 : name, sizeof(r.name) - 1 );
+   r.name[sizeof(r.name) - 1] = '\0';
+   r.bytes = n;
+   r.sum   = checksum ( (unsigned char*)src, n );
+
+   for (l = 0; l < nLevels; l++)
+   for (w = 0; w < nWorks; w++)
+   for (t = 0; t < nThreads; t++) {
+      cBest = dBest = 1e30;
+      zn = bn = 0;
+      ret = BZ_OK;
+      for (k = 0; k < reps; k++) {
+         zn  = zcap;
+         t0  = now();
+         ret = compressBuf ( src, n, z, &zn, levels[l], works[w],
+                             threads[t] );
+         t0  = now() - t0;
+         if (ret != BZ_OK) break;
+         if (t0 < cBest) cBest = t0;
+
+         bn  = n + 1;
+         t0  = now();
+         ret = decompressBuf ( z, zn, back, &bn, threads[t] );
+         t0  = now() - t0;
+         if (ret != BZ_OK) break;
+         if (t0 < dBest) dBest = t0;
+         if (bn != n || memcmp ( src, back, n ) != 0) { ret = -100; break; }
+      }
+      if (ret != BZ_OK) {
+         fprintf ( stderr, "bzbench: %s -%d w%d p%d: %s (%d)\n",
+                   r.name, levels[l], works[w], threads[t],
+                   ret == -100 ? "data changed in round trip"
+                               : "library error", ret );
+         bad = 1;
+         continue;
+      }
+
+      r.level   = levels[l];
+      r.work    = works[w];
+      r.threads = threads[t];
+      r.zbytes  = zn;
+      r.cRate   = n / 1000000.0 / (cBest > 1e-6 ? cBest : 1e-6);
+      r.dRate   = n / 1000000.0 / (dBest > 1e-6 ? dBest : 1e-6);
+      printf ( "%s\t%.0f\t%08lx\t%d\t%d\t%d\t%.0f\t%.3f\t%.3f\n",
+               r.name, r.bytes, r.sum, r.level, r.work, r.threads,
+               r.zbytes, r.cRate, r.dRate );
+      fflush ( stdout );
+      if (nBase > 0) bad |= compare ( &r );
+   }
+
+   free ( src );
+   free ( z );
+   free ( back );
+   return bad;
+}
+
+
+static void usage ( void )
+{
+   fprintf ( stderr,
+             "usage: bzbench [-b levels] [-w workfactors] [-p threads]\n"
+             "               [-r reps] [-c baseline] file ...\n"
+             "lists are comma-separated, eg. -b 1,5,9\n" );
+   exit ( 2 );
+}
+
+
+int main ( int argc, char** argv )
+{
+   int i, bad = 0;
+
+   for (i = 1; i < argc && argv[i][0] == '-'; i += 2) {
+      if (i + 1 >= argc || argv[i][2] != '\0') usage ();
+      switch (argv[i][1]) {
+         case 'b': nLevels = parseList ( argv[i+1], levels, 1, 9 ); break;
+         case 'w': nWorks  = parseList ( argv[i+1], works, 0,
+                                         BZ_WORK_SUFFIX ); break;
+         case 'p': nThreads = parseList ( argv[i+1], threads, 1,
+                                          BZ_MAX_THREADS ); break;
+         case 'r': reps = atoi ( argv[i+1] ); break;
+         case 'c': readBaseline ( argv[i+1] ); break;
+         default:  usage ();
+      }
+      if (nLevels == 0 || nWorks == 0 || nThreads == 0 || reps < 1)
+         usage ();
+   }
+   if (i >= argc) usage ();
+
+   printf ( "# bzbench, libbzip2 %s, best of %d\n",
+            BZ2_bzlibVersion(), reps );
+   printf ( "#file\tbytes\tsum\tlevel\twork\tthreads\tzbytes\t"
+            "comp_MB/s\tdecomp_MB/s\n" );
+   for (; i < argc; i++) bad |= bench ( argv[i] );
+
+   if (nCompared > 0)
+      fprintf ( stderr, "overall (geometric mean)   "
+                "compress %+6.1f%%  decompress %+6.1f%%\n",
+                100.0 * (exp ( cLogSum / nCompared ) - 1.0),
+                100.0 * (exp ( dLogSum / nCompared ) - 1.0) );
+   return bad;
+}
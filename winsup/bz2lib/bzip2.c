@@ -211,6 +211,7 @@
 #if BZ_LCCWIN32
 #   include <io.h>
 #   include <fcntl.h>
+#   include <time.h>
 #   include <sys\stat.h>
 
 #   define NORETURN       /**/
@@ -315,6 +316,8 @@ Char    *progName;
 Char    progNameReally[FILE_NAME_LEN];
 FILE    *outputHandleJustInCase;
 Int32   workFactor;
+Int32   numThreads;
+Int32   ioBufSize;
 
 static void    panic                 ( Char* )   NORETURN;
 static void    ioError               ( void )    NORETURN;
@@ -508,6 +511,295 @@ void uInt64_toAscii ( char* outbuf, UInt64* n )
 }
 
 
+/*---------------------------------------------------*/
+/*--- Overlapped file I/O                         ---*/
+/*---------------------------------------------------*/
+
+/*--
+  Streams are read and written through pairs of buffers
+  of ioBufSize bytes.  Where threads are available, a reader
+  thread fills one input buffer while the other is being
+  compressed, and a writer thread empties one output buffer
+  while the other fills, so that disk I/O overlaps the block
+  sort instead of taking turns with it.  A regular input file
+  is mapped rather than read, where mmap is available.
+--*/
+
+#if BZ_UNIX && !defined(__DJGPP__)
+#   include <sys/mman.h>
+#   define BZ_IO_MMAP
+#   ifndef BZ_NO_THREADS
+#      include <pthread.h>
+#      define BZ_IO_THREADS
+#   endif
+#endif
+
+typedef
+   struct {
+      FILE*   handle;
+      Bool    writing;
+      UChar*  buf[2];
+      Int32   n[2];
+      Bool    busy[2];     /*-- True while the thread has it --*/
+      Int32   cur;         /*-- the buffer in use here --*/
+      Int32   fill;
+      Bool    held;
+      Bool    done;
+      Bool    err;
+      Int32   errnum;
+      UChar*  map;
+      size_t  mapLen;
+      size_t  mapPos;
+#ifdef BZ_IO_THREADS
+      Bool            threaded;
+      Bool            quit;
+      pthread_t       thread;
+      pthread_mutex_t lock;
+      pthread_cond_t  cond;
+#endif
+   }
+   IOChan;
+
+
+#ifdef BZ_IO_THREADS
+/*---------------------------------------------*/
+static
+void* ioThread ( void* arg )
+{
+   IOChan* c = (IOChan*)arg;
+   Int32   i, n;
+   Bool    err;
+
+   for (i = 0; ; i ^= 1) {
+      pthread_mutex_lock ( &c->lock );
+      while (!c->busy[i] && !c->quit)
+         pthread_cond_wait ( &c->cond, &c->lock );
+      pthread_mutex_unlock ( &c->lock );
+      if (!c->busy[i]) break;
+
+      if (c->writing) {
+         n   = fwrite ( c->buf[i], sizeof(UChar), c->n[i], c->handle );
+         err = (Bool)(n != c->n[i] || ferror(c->handle));
+      } else {
+         n   = fread ( c->buf[i], sizeof(UChar), ioBufSize, c->handle );
+         err = (Bool)(ferror(c->handle) != 0);
+         c->n[i] = n;
+      }
+
+      pthread_mutex_lock ( &c->lock );
+      if (err && !c->err) { c->err = True; c->errnum = errno; }
+      c->busy[i] = False;
+      pthread_cond_broadcast ( &c->cond );
+      pthread_mutex_unlock ( &c->lock );
+      if (!c->writing && n < ioBufSize) break;
+   }
+   return NULL;
+}
+#endif
+
+
+/*---------------------------------------------*/
+static
+void ioFail ( IOChan* c )
+{
+   errno = c->errnum;
+   ioError();
+}
+
+
+/*---------------------------------------------*/
+static
+void ioOpen ( IOChan* c, FILE* f, Bool writing )
+{
+   c->handle  = f;
+   c->writing = writing;
+   c->cur     = 0;
+   c->fill    = 0;
+   c->held    = False;
+   c->done    = False;
+   c->err     = False;
+   c->errnum  = 0;
+   c->map     = NULL;
+   c->buf[0]  = c->buf[1] = NULL;
+
+#ifdef BZ_IO_MMAP
+   if (!writing) {
+      struct stat st;
+      void*       m;
+      IntNative   fd = fileno ( f );
+      if (fstat ( fd, &st ) == 0 && S_ISREG ( st.st_mode ) &&
+          st.st_size > 0 && (off_t)(size_t)st.st_size == st.st_size &&
+          lseek ( fd, 0, SEEK_CUR ) == 0) {
+         m = mmap ( NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED,
+                    fd, 0 );
+         if (m != MAP_FAILED) {
+#           ifdef MADV_SEQUENTIAL
+            madvise ( m, (size_t)st.st_size, MADV_SEQUENTIAL );
+#           endif
+            c->map    = (UChar*)m;
+            c->mapLen = (size_t)st.st_size;
+            c->mapPos = 0;
+            return;
+         }
+      }
+   }
+#endif
+
+   c->buf[0] = (UChar*) myMalloc ( ioBufSize );
+#ifdef BZ_IO_THREADS
+   c->threaded = False;
+   c->quit     = False;
+   c->busy[0]  = c->busy[1] = !writing;
+   c->buf[1]   = (UChar*) myMalloc ( ioBufSize );
+   if (pthread_mutex_init ( &c->lock, NULL ) != 0) return;
+   if (pthread_cond_init ( &c->cond, NULL ) != 0) {
+      pthread_mutex_destroy ( &c->lock );
+      return;
+   }
+   c->threaded = True;
+   if (pthread_create ( &c->thread, NULL, ioThread, c ) != 0) {
+      pthread_cond_destroy ( &c->cond );
+      pthread_mutex_destroy ( &c->lock );
+      c->threaded = False;
+   }
+#endif
+}
+
+
+/*---------------------------------------------*/
+/*--
+  Sets *p to the next piece of input and returns its
+  length, or 0 at the end.
+--*/
+static
+Int32 ioRead ( IOChan* c, UChar** p )
+{
+   Int32 n;
+
+   if (c->map != NULL) {
+      n = (c->mapLen - c->mapPos > (size_t)ioBufSize)
+             ? ioBufSize : (Int32)(c->mapLen - c->mapPos);
+      *p = c->map + c->mapPos;
+      c->mapPos += n;
+      return n;
+   }
+   if (c->done) { *p = NULL; return 0; }
+
+#ifdef BZ_IO_THREADS
+   if (c->threaded) {
+      pthread_mutex_lock ( &c->lock );
+      if (c->held) {
+         c->busy[c->cur] = True;
+         pthread_cond_broadcast ( &c->cond );
+         c->cur ^= 1;
+      }
+      while (c->busy[c->cur])
+         pthread_cond_wait ( &c->cond, &c->lock );
+      pthread_mutex_unlock ( &c->lock );
+      c->held = True;
+      if (c->err) ioFail ( c );
+      n = c->n[c->cur];
+      if (n < ioBufSize) c->done = True;
+      *p = c->buf[c->cur];
+      return n;
+   }
+#endif
+
+   n = fread ( c->buf[0], sizeof(UChar), ioBufSize, c->handle );
+   if (ferror(c->handle)) ioError();
+   if (n < ioBufSize) c->done = True;
+   *p = c->buf[0];
+   return n;
+}
+
+
+/*---------------------------------------------*/
+/*--
+  Writes out the c->fill bytes which have been put in
+  c->buf[c->cur].
+--*/
+static
+void ioFlush ( IOChan* c )
+{
+   Int32 n;
+
+   if (c->fill == 0) return;
+
+#ifdef BZ_IO_THREADS
+   if (c->threaded) {
+      pthread_mutex_lock ( &c->lock );
+      c->n[c->cur]    = c->fill;
+      c->busy[c->cur] = True;
+      pthread_cond_broadcast ( &c->cond );
+      c->cur ^= 1;
+      while (c->busy[c->cur])
+         pthread_cond_wait ( &c->cond, &c->lock );
+      pthread_mutex_unlock ( &c->lock );
+      c->fill = 0;
+      if (c->err) ioFail ( c );
+      return;
+   }
+#endif
+
+   n = fwrite ( c->buf[0], sizeof(UChar), c->fill, c->handle );
+   if (n != c->fill || ferror(c->handle)) ioError();
+   c->fill = 0;
+}
+
+
+/*---------------------------------------------*/
+static
+void ioClose ( IOChan* c )
+{
+   if (c->writing) ioFlush ( c );
+
+#ifdef BZ_IO_MMAP
+   if (c->map != NULL) {
+      munmap ( (void*)c->map, c->mapLen );
+      return;
+   }
+#endif
+
+#ifdef BZ_IO_THREADS
+   if (c->threaded) {
+      pthread_mutex_lock ( &c->lock );
+      c->quit = True;
+      pthread_cond_broadcast ( &c->cond );
+      pthread_mutex_unlock ( &c->lock );
+      pthread_join ( c->thread, NULL );
+      pthread_cond_destroy ( &c->cond );
+      pthread_mutex_destroy ( &c->lock );
+      if (c->err) ioFail ( c );
+   }
+#endif
+   if (c->buf[0] != NULL) free ( c->buf[0] );
+   if (c->buf[1] != NULL) free ( c->buf[1] );
+}
+
+
+/*---------------------------------------------*/
+static
+double wallClock ( void )
+{
+#if BZ_UNIX
+   struct tms t;
+   return (double)times ( &t ) / (double)sysconf ( _SC_CLK_TCK );
+#else
+   return (double)clock() / (double)CLOCKS_PER_SEC;
+#endif
+}
+
+
+/*---------------------------------------------*/
+static
+void showRate ( double nbytes, double secs )
+{
+   if (secs > 0.0)
+      fprintf ( stderr, "%.2f MB/s", nbytes / 1000000.0 / secs ); else
+      fprintf ( stderr, "- MB/s" );
+}
+
+
 /*---------------------------------------------------*/
 /*--- Processing of complete files and streams    ---*/
 /*---------------------------------------------------*/
@@ -527,12 +819,13 @@ Bool myfeof ( FILE* f )
 static 
 void compressStream ( FILE *stream, FILE *zStream )
 {
-   BZFILE* bzf = NULL;
-   UChar   ibuf[5000];
-   Int32   nIbuf;
-   UInt32  nbytes_in_lo32, nbytes_in_hi32;
-   UInt32  nbytes_out_lo32, nbytes_out_hi32;
-   Int32   bzerr, bzerr_dummy, ret;
+   bz_stream strm;
+   IOChan    in, out;
+   UChar*    p;
+   Int32     n, ret, action;
+   UInt32    nbytes_in_lo32, nbytes_in_hi32;
+   UInt32    nbytes_out_lo32, nbytes_out_hi32;
+   double    secs;
 
    SET_BINARY_MODE(stream);
    SET_BINARY_MODE(zStream);
@@ -540,26 +833,48 @@ void compressStream ( FILE *stream, FILE *zStream )
    if (ferror(stream)) goto errhandler_io;
    if (ferror(zStream)) goto errhandler_io;
 
-   bzf = BZ2_bzWriteOpen ( &bzerr, zStream, 
-                           blockSize100k, verbosity, workFactor );   
-   if (bzerr != BZ_OK) goto errhandler;
+   strm.bzalloc = NULL;
+   strm.bzfree  = NULL;
+   strm.opaque  = NULL;
+   ret = BZ2_bzCompressInitMT ( &strm, blockSize100k, verbosity,
+                                workFactor, numThreads );
+   if (ret != BZ_OK) goto errhandler_init;
 
    if (verbosity >= 2) fprintf ( stderr, "\n" );
 
+   secs = wallClock();
+   ioOpen ( &in, stream, False );
+   ioOpen ( &out, zStream, True );
+
+   strm.avail_in = 0;
+   action = BZ_RUN;
    while (True) {
 
-      if (myfeof(stream)) break;
-      nIbuf = fread ( ibuf, sizeof(UChar), 5000, stream );
-      if (ferror(stream)) goto errhandler_io;
-      if (nIbuf > 0) BZ2_bzWrite ( &bzerr, bzf, (void*)ibuf, nIbuf );
-      if (bzerr != BZ_OK) goto errhandler;
+      if (strm.avail_in == 0 && action == BZ_RUN) {
+         n = ioRead ( &in, &p );
+         if (n == 0) action = BZ_FINISH;
+         strm.next_in  = (char*)p;
+         strm.avail_in = n;
+      }
+
+      strm.next_out  = (char*)(out.buf[out.cur] + out.fill);
+      strm.avail_out = ioBufSize - out.fill;
+      ret = BZ2_bzCompress ( &strm, action );
+      out.fill = ioBufSize - strm.avail_out;
+      if (out.fill == ioBufSize) ioFlush ( &out );
+
+      if (ret == BZ_STREAM_END) break;
+      if (ret != BZ_RUN_OK && ret != BZ_FINISH_OK) goto errhandler;
 
    }
 
-   BZ2_bzWriteClose64 ( &bzerr, bzf, 0, 
-                        &nbytes_in_lo32, &nbytes_in_hi32,
-                        &nbytes_out_lo32, &nbytes_out_hi32 );
-   if (bzerr != BZ_OK) goto errhandler;
+   ioClose ( &out );
+   ioClose ( &in );
+   nbytes_in_lo32  = strm.total_in_lo32;
+   nbytes_in_hi32  = strm.total_in_hi32;
+   nbytes_out_lo32 = strm.total_out_lo32;
+   nbytes_out_hi32 = strm.total_out_hi32;
+   BZ2_bzCompressEnd ( &strm );
 
    if (ferror(zStream)) goto errhandler_io;
    ret = fflush ( zStream );
@@ -571,6 +886,7 @@ void compressStream ( FILE *stream, FILE *zStream )
    if (ferror(stream)) goto errhandler_io;
    ret = fclose ( stream );
    if (ret == EOF) goto errhandler_io;
+   secs = wallClock() - secs;
 
    if (nbytes_in_lo32 == 0 && nbytes_in_hi32 == 0) 
       nbytes_in_lo32 = 1;
@@ -588,22 +904,23 @@ void compressStream ( FILE *stream, FILE *zStream )
       uInt64_toAscii ( buf_nin, &nbytes_in );
       uInt64_toAscii ( buf_nout, &nbytes_out );
       fprintf ( stderr, "%6.3f:1, %6.3f bits/byte, "
-                        "%5.2f%% saved, %s in, %s out.\n",
+                        "%5.2f%% saved, %s in, %s out, ",
                 nbytes_in_d / nbytes_out_d,
                 (8.0 * nbytes_out_d) / nbytes_in_d,
                 100.0 * (1.0 - nbytes_out_d / nbytes_in_d),
                 buf_nin,
                 buf_nout
               );
+      showRate ( nbytes_in_d, secs );
+      fprintf ( stderr, ".\n" );
    }
 
    return;
 
    errhandler:
-   BZ2_bzWriteClose64 ( &bzerr_dummy, bzf, 1, 
-                        &nbytes_in_lo32, &nbytes_in_hi32,
-                        &nbytes_out_lo32, &nbytes_out_hi32 );
-   switch (bzerr) {
+   BZ2_bzCompressEnd ( &strm );
+   errhandler_init:
+   switch (ret) {
       case BZ_CONFIG_ERROR:
          configError(); break;
       case BZ_MEM_ERROR:
@@ -627,13 +944,15 @@ Bool uncompressStream ( FILE *zStream, FILE *stream )
 {
    BZFILE* bzf = NULL;
    Int32   bzerr, bzerr_dummy, ret, nread, streamNo, i;
-   UChar   obuf[5000];
+   IOChan  out;
    UChar   unused[BZ_MAX_UNUSED];
    Int32   nUnused;
    UChar*  unusedTmp;
+   double  nbytes, secs;
 
    nUnused = 0;
    streamNo = 0;
+   nbytes = 0.0;
 
    SET_BINARY_MODE(stream);
    SET_BINARY_MODE(zStream);
@@ -641,21 +960,27 @@ Bool uncompressStream ( FILE *zStream, FILE *stream )
    if (ferror(stream)) goto errhandler_io;
    if (ferror(zStream)) goto errhandler_io;
 
+   secs = wallClock();
+   ioOpen ( &out, stream, True );
+
    while (True) {
 
-      bzf = BZ2_bzReadOpen ( 
+      bzf = BZ2_bzReadOpenMT ( 
                &bzerr, zStream, verbosity, 
-               (int)smallMode, unused, nUnused
+               (int)smallMode, unused, nUnused, numThreads
             );
       if (bzf == NULL || bzerr != BZ_OK) goto errhandler;
       streamNo++;
 
       while (bzerr == BZ_OK) {
-         nread = BZ2_bzRead ( &bzerr, bzf, obuf, 5000 );
+         nread = BZ2_bzRead ( &bzerr, bzf, out.buf[out.cur] + out.fill,
+                              ioBufSize - out.fill );
          if (bzerr == BZ_DATA_ERROR_MAGIC) goto errhandler;
-         if ((bzerr == BZ_OK || bzerr == BZ_STREAM_END) && nread > 0)
-            fwrite ( obuf, sizeof(UChar), nread, stream );
-         if (ferror(stream)) goto errhandler_io;
+         if ((bzerr == BZ_OK || bzerr == BZ_STREAM_END) && nread > 0) {
+            out.fill += nread;
+            nbytes   += nread;
+            if (out.fill == ioBufSize) ioFlush ( &out );
+         }
       }
       if (bzerr != BZ_STREAM_END) goto errhandler;
 
@@ -675,6 +1000,7 @@ Bool uncompressStream ( FILE *zStream, FILE *stream )
    ret = fclose ( zStream );
    if (ret == EOF) goto errhandler_io;
 
+   ioClose ( &out );
    if (ferror(stream)) goto errhandler_io;
    ret = fflush ( stream );
    if (ret != 0) goto errhandler_io;
@@ -683,6 +1009,10 @@ Bool uncompressStream ( FILE *zStream, FILE *stream )
       if (ret == EOF) goto errhandler_io;
    }
    if (verbosity >= 2) fprintf ( stderr, "\n    " );
+   if (verbosity >= 1) {
+      showRate ( nbytes, wallClock() - secs );
+      fprintf ( stderr, ", " );
+   }
    return True;
 
    errhandler:
@@ -701,6 +1031,7 @@ Bool uncompressStream ( FILE *zStream, FILE *stream )
          compressedStreamEOF();
       case BZ_DATA_ERROR_MAGIC:
          if (zStream != stdin) fclose(zStream);
+         ioClose ( &out );
          if (stream != stdout) fclose(stream);
          if (streamNo == 1) {
             return False;
@@ -739,9 +1070,9 @@ Bool testStream ( FILE *zStream )
 
    while (True) {
 
-      bzf = BZ2_bzReadOpen ( 
+      bzf = BZ2_bzReadOpenMT ( 
                &bzerr, zStream, verbosity, 
-               (int)smallMode, unused, nUnused
+               (int)smallMode, unused, nUnused, numThreads
             );
       if (bzf == NULL || bzerr != BZ_OK) goto errhandler;
       streamNo++;
@@ -1658,6 +1989,9 @@ void usage ( Char *fullProgName )
       "   -V --version        display software version & license\n"
       "   -s --small          use less memory (at most 2500k)\n"
       "   -1 .. -9            set block size to 100k .. 900k\n"
+      "   -p N                use N threads (at most %d)\n"
+      "   --repetitive-best   sort blocks with the suffix-array sorter\n"
+      "   --buffer-size=N     read and write N kbytes at a time (default 1024)\n"
       "\n"
       "   If invoked as `bzip2', default action is to compress.\n"
       "              as `bunzip2',  default action is to decompress.\n"
@@ -1672,7 +2006,8 @@ void usage ( Char *fullProgName )
       ,
 
       BZ2_bzlibVersion(),
-      fullProgName
+      fullProgName,
+      BZ_MAX_THREADS
    );
 }
 
@@ -1782,6 +2117,57 @@ void addFlagsFromEnvVar ( Cell** argList, Char* varName )
 }
 
 
+/*---------------------------------------------*/
+/*--
+  `-p N' takes its count as a separate argument.  Glue
+  the two together as `-pN', so that N isn't taken for
+  a file name by the loops in main().
+--*/
+static 
+void glueThreadCounts ( Cell *argList )
+{
+   Cell  *aa, *next;
+   Char  *tmp;
+   Int32 n;
+
+   for (aa = argList; aa != NULL; aa = aa->link) {
+      if (strcmp ( aa->name, "--" ) == 0) break;
+      n = strlen ( aa->name );
+      next = aa->link;
+      if (aa->name[0] != '-' || aa->name[1] == '-' || 
+          aa->name[n-1] != 'p' || next == NULL ||
+          !isdigit ( (Int32)(next->name[0]) )) continue;
+      tmp = (Char*) myMalloc ( n + strlen(next->name) + 1 );
+      strcpy ( tmp, aa->name );
+      strcat ( tmp, next->name );
+      free ( aa->name );
+      aa->name = tmp;
+      aa->link = next->link;
+      free ( next->name );
+      free ( next );
+   }
+}
+
+
+/*---------------------------------------------*/
+static
+void setBufferSize ( Char* flag )
+{
+   Char* p = flag + 14;
+   Int32 n = 0;
+
+   while (isdigit ( (Int32)(*p) ) && n <= 1048576)
+      n = 10 * n + (*p++ - '0');
+   if (*p != '\0' || n < 16 || n > 1048576) {
+      fprintf ( stderr, "%s: Bad buffer size in `%s' "
+                "(16 to 1048576 kbytes)\n", progName, flag );
+      usage ( progName );
+      exit ( 1 );
+   }
+   ioBufSize = n * 1024;
+}
+
+
 /*---------------------------------------------*/
 #define ISFLAG(s) (strcmp(aa->name, (s))==0)
 
@@ -1812,6 +2198,8 @@ IntNative main ( IntNative argc, Char *argv[] )
    numFileNames            = 0;
    numFilesProcessed       = 0;
    workFactor              = 30;
+   numThreads              = 1;
+   ioBufSize               = 1024 * 1024;
    deleteOutputOnInterrupt = False;
    exitValue               = 0;
    i = j = 0; /* avoid bogus warning from egcs-1.1.X */
@@ -1841,6 +2229,7 @@ IntNative main ( IntNative argc, Char *argv[] )
    addFlagsFromEnvVar ( &argList,  "BZIP" );
    for (i = 1; i <= argc-1; i++)
       APPEND_FILESPEC(argList, argv[i]);
+   glueThreadCounts ( argList );
 
 
    /*-- Find the length of the longest filename --*/
@@ -1904,6 +2293,19 @@ IntNative main ( IntNative argc, Char *argv[] )
                case 'V':
                case 'L': license();            break;
                case 'v': verbosity++; break;
+               case 'p': numThreads = 0;
+                         while (isdigit ( (Int32)(aa->name[j+1]) ) &&
+                                numThreads <= BZ_MAX_THREADS)
+                            numThreads = 10 * numThreads 
+                                         + (aa->name[++j] - '0');
+                         if (numThreads < 1 || 
+                             numThreads > BZ_MAX_THREADS) {
+                            fprintf ( stderr, "%s: Bad thread count "
+                                      "in `%s'\n", progName, aa->name );
+                            usage ( progName );
+                            exit ( 1 );
+                         }
+                         break;
                case 'h': usage ( progName );
                          exit ( 0 );
                          break;
@@ -1931,9 +2333,11 @@ IntNative main ( IntNative argc, Char *argv[] )
       if (ISFLAG("--version"))           license();                  else
       if (ISFLAG("--license"))           license();                  else
       if (ISFLAG("--exponential"))       workFactor = 1;             else 
-      if (ISFLAG("--repetitive-best"))   redundant(aa->name);        else
+      if (ISFLAG("--repetitive-best"))   workFactor = BZ_WORK_SUFFIX; else
       if (ISFLAG("--repetitive-fast"))   redundant(aa->name);        else
       if (ISFLAG("--verbose"))           verbosity++;                else
+      if (strncmp ( aa->name, "--buffer-size=", 14 ) == 0)
+                                         setBufferSize ( aa->name ); else
       if (ISFLAG("--help"))              { usage ( progName ); exit ( 0 ); }
          else
          if (strncmp ( aa->name, "--", 2) == 0) {
@@ -56,6 +56,7 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include "bzlib.h"
 
 typedef  unsigned int   UInt32;
 typedef  int            Int32;
@@ -250,6 +251,49 @@ Bool endsInBz2 ( Char* name )
 }
 
 
+/*---------------------------------------------*/
+/*--
+   Write a block index, for BZ2_bzSeekOpen, to file_name.bzx.
+   Unlike recovery this decodes the whole file, since the index
+   has to give the uncompressed offset of each block, and it
+   stops at the first damaged block.
+--*/
+void buildIndex ( Char* name )
+{
+   FILE* inFile;
+   FILE* outFile;
+   Int32 ret;
+
+   strcpy ( inFileName, name );
+   strcpy ( outFileName, name );
+   strcat ( outFileName, ".bzx" );
+
+   inFile = fopen ( inFileName, "rb" );
+   if (inFile == NULL) {
+      fprintf ( stderr, "%s: can't read `%s'\n", progName, inFileName );
+      exit(1);
+   }
+   outFile = fopen ( outFileName, "wb" );
+   if (outFile == NULL) {
+      fprintf ( stderr, "%s: can't write `%s'\n",
+                progName, outFileName );
+      exit(1);
+   }
+
+   fprintf ( stderr, "%s: indexing `%s' ...\n", progName, inFileName );
+   ret = BZ2_bzIndexBuild ( inFile, outFile );
+   fclose ( inFile );
+   if (fclose ( outFile ) != 0 && ret == BZ_OK) ret = BZ_IO_ERROR;
+   if (ret != BZ_OK) {
+      fprintf ( stderr, "%s: can't index `%s' (error %d)\n",
+                progName, inFileName, ret );
+      remove ( outFileName );
+      exit(1);
+   }
+   fprintf ( stderr, "%s: wrote `%s'\n", progName, outFileName );
+}
+
+
 /*---------------------------------------------------*/
 /*---                                             ---*/
 /*---------------------------------------------------*/
@@ -284,9 +328,15 @@ Int32 main ( Int32 argc, Char** argv )
 
    fprintf ( stderr, "bzip2recover 1.0: extracts blocks from damaged .bz2 files.\n" );
 
+   if (argc == 3 && strcmp ( argv[1], "-i" ) == 0) {
+      buildIndex ( argv[2] );
+      return 0;
+   }
+
    if (argc != 2) {
-      fprintf ( stderr, "%s: usage is `%s damaged_file_name'.\n",
-                        progName, progName );
+      fprintf ( stderr, "%s: usage is `%s damaged_file_name'\n"
+                        "%s:       or `%s -i file_name' to index it.\n",
+                        progName, progName, progName, progName );
       exit(1);
    }
 
@@ -76,6 +76,144 @@
 #include "bzlib_private.h"
 
 
+/*---------------------------------------------------*/
+/*--- Worker threads                              ---*/
+/*---------------------------------------------------*/
+
+/*--
+   A minimal layer over Win32 or POSIX threads: mutexes, 
+   counting semaphores, and starting and joining threads.
+   Build with -DBZ_NO_THREADS to leave it out, in which case 
+   the parallel entry points quietly run single-threaded.
+--*/
+
+#ifndef BZ_NO_THREADS
+
+#if defined(_WIN32) && !defined(__CYGWIN__)
+
+typedef HANDLE           BZ_THREAD;
+typedef CRITICAL_SECTION BZ_MUTEX;
+typedef HANDLE           BZ_SEM;
+
+#define BZ_THREAD_PROC(fn,arg) DWORD WINAPI fn ( LPVOID arg )
+#define BZ_THREAD_EXIT         return 0
+
+static
+Bool bz_thread_create ( BZ_THREAD* t, LPTHREAD_START_ROUTINE fn, void* arg )
+{
+   DWORD id;
+   *t = CreateThread ( NULL, 0, fn, arg, 0, &id );
+   return (Bool)(*t != NULL);
+}
+
+static
+void bz_thread_join ( BZ_THREAD t )
+{
+   WaitForSingleObject ( t, INFINITE );
+   CloseHandle ( t );
+}
+
+#define bz_mutex_init(m)    InitializeCriticalSection(m)
+#define bz_mutex_lock(m)    EnterCriticalSection(m)
+#define bz_mutex_unlock(m)  LeaveCriticalSection(m)
+#define bz_mutex_destroy(m) DeleteCriticalSection(m)
+
+static
+Bool bz_sem_init ( BZ_SEM* sem )
+{
+   *sem = CreateSemaphore ( NULL, 0, 0x7fffffff, NULL );
+   return (Bool)(*sem != NULL);
+}
+
+#define bz_sem_post(sem)    ReleaseSemaphore(*(sem), 1, NULL)
+#define bz_sem_wait(sem)    WaitForSingleObject(*(sem), INFINITE)
+#define bz_sem_trywait(sem) \
+   ((Bool)(WaitForSingleObject(*(sem), 0) == WAIT_OBJECT_0))
+#define bz_sem_destroy(sem) CloseHandle(*(sem))
+
+#else
+
+#include <pthread.h>
+
+typedef pthread_t       BZ_THREAD;
+typedef pthread_mutex_t BZ_MUTEX;
+typedef struct {
+   pthread_mutex_t mutex;
+   pthread_cond_t  cond;
+   Int32           count;
+} BZ_SEM;
+
+#define BZ_THREAD_PROC(fn,arg) void* fn ( void* arg )
+#define BZ_THREAD_EXIT         return NULL
+
+static
+Bool bz_thread_create ( BZ_THREAD* t, void* (*fn)(void*), void* arg )
+{
+   return (Bool)(pthread_create ( t, NULL, fn, arg ) == 0);
+}
+
+#define bz_thread_join(t)   pthread_join(t, NULL)
+
+#define bz_mutex_init(m)    pthread_mutex_init(m, NULL)
+#define bz_mutex_lock(m)    pthread_mutex_lock(m)
+#define bz_mutex_unlock(m)  pthread_mutex_unlock(m)
+#define bz_mutex_destroy(m) pthread_mutex_destroy(m)
+
+/*-- Not sem_t: unnamed semaphores are missing on some hosts. --*/
+static
+Bool bz_sem_init ( BZ_SEM* sem )
+{
+   sem->count = 0;
+   if (pthread_mutex_init ( &sem->mutex, NULL ) != 0) return False;
+   if (pthread_cond_init ( &sem->cond, NULL ) != 0) {
+      pthread_mutex_destroy ( &sem->mutex );
+      return False;
+   }
+   return True;
+}
+
+static
+void bz_sem_post ( BZ_SEM* sem )
+{
+   pthread_mutex_lock ( &sem->mutex );
+   sem->count++;
+   pthread_cond_signal ( &sem->cond );
+   pthread_mutex_unlock ( &sem->mutex );
+}
+
+static
+void bz_sem_wait ( BZ_SEM* sem )
+{
+   pthread_mutex_lock ( &sem->mutex );
+   while (sem->count == 0)
+      pthread_cond_wait ( &sem->cond, &sem->mutex );
+   sem->count--;
+   pthread_mutex_unlock ( &sem->mutex );
+}
+
+static
+Bool bz_sem_trywait ( BZ_SEM* sem )
+{
+   Bool got;
+   pthread_mutex_lock ( &sem->mutex );
+   got = (Bool)(sem->count > 0);
+   if (got) sem->count--;
+   pthread_mutex_unlock ( &sem->mutex );
+   return got;
+}
+
+static
+void bz_sem_destroy ( BZ_SEM* sem )
+{
+   pthread_cond_destroy ( &sem->cond );
+   pthread_mutex_destroy ( &sem->mutex );
+}
+
+#endif
+
+#endif /* BZ_NO_THREADS */
+
+
 /*---------------------------------------------------*/
 /*--- Compression stuff                           ---*/
 /*---------------------------------------------------*/
@@ -160,12 +298,226 @@ Bool isempty_RL ( EState* s )
 }
 
 
+#ifndef BZ_NO_THREADS
+/*---------------------------------------------------*/
+/*--
+   The blocks of a stream being compressed in parallel.
+   job[] is a ring: blocks are handed to the workers, staged
+   for output and freed again strictly in order, so these
+   counters say which slot holds what.
+--*/
+typedef
+   struct bz_pool {
+      Int32      nThreads;
+      Int32      nJobs;
+      EState**   job;
+      BZ_SEM*    done;      /* done[i] is posted when job[i] is coded */
+      BZ_THREAD* thread;
+      BZ_MUTEX   lock;      /* guards nHanded and nTaken */
+      BZ_SEM     work;      /* posted once per block, and once to stop */
+      Int32      nHanded;   /* blocks given to the workers */
+      Int32      nTaken;    /* ... picked up by one */
+      Int32      nStaged;   /* ... spliced into the output */
+      Int32      nFreed;    /* ... and completely copied out */
+      Bool       trailer;   /* stream trailer staged */
+      UChar      tail[16];  /* stream header or trailer */
+   }
+   BZ_POOL;
+
+
+/*---------------------------------------------------*/
+static
+BZ_THREAD_PROC ( compress_worker, arg )
+{
+   BZ_POOL* p = (BZ_POOL*)arg;
+   Int32    k;
+
+   while (True) {
+      bz_sem_wait ( &p->work );
+      bz_mutex_lock ( &p->lock );
+      if (p->nTaken == p->nHanded) {
+         bz_mutex_unlock ( &p->lock );
+         break;
+      }
+      k = p->nTaken % p->nJobs;
+      p->nTaken++;
+      bz_mutex_unlock ( &p->lock );
+
+      BZ2_compressBlockMT ( p->job[k] );
+      bz_sem_post ( &p->done[k] );
+   }
+   BZ_THREAD_EXIT;
+}
+
+
+/*---------------------------------------------------*/
+static
+void free_pool ( bz_stream* strm, BZ_POOL* p )
+{
+   Int32   i;
+   EState* j;
+
+   if (p->job != NULL) {
+      for (i = 0; i < p->nJobs; i++) {
+         j = p->job[i];
+         if (j == NULL) continue;
+         if (j->arr1 != NULL) BZFREE(j->arr1);
+         if (j->arr2 != NULL) BZFREE(j->arr2);
+         if (j->ftab != NULL) BZFREE(j->ftab);
+         if (j->sawork != NULL) BZFREE(j->sawork);
+         BZFREE(j);
+      }
+      BZFREE(p->job);
+   }
+   if (p->done   != NULL) BZFREE(p->done);
+   if (p->thread != NULL) BZFREE(p->thread);
+   BZFREE(p);
+}
+
+
+/*---------------------------------------------------*/
+static
+void destroy_pool_sync ( BZ_POOL* p, Int32 nDone )
+{
+   Int32 i;
+   for (i = 0; i < nDone; i++) bz_sem_destroy ( &p->done[i] );
+   bz_sem_destroy ( &p->work );
+   bz_mutex_destroy ( &p->lock );
+}
+
+
+/*---------------------------------------------------*/
+static
+int init_pool ( bz_stream* strm, Int32 nThreads )
+{
+   EState*  s = strm->state;
+   BZ_POOL* p;
+   EState*  j;
+   Int32    i, n;
+
+   p = BZALLOC( sizeof(BZ_POOL) );
+   if (p == NULL) return BZ_MEM_ERROR;
+
+   /*-- One block per worker, and one being copied out. --*/
+   p->nThreads = 0;
+   p->nJobs    = nThreads + 1;
+   p->job      = BZALLOC( p->nJobs * sizeof(EState*) );
+   p->done     = BZALLOC( p->nJobs * sizeof(BZ_SEM) );
+   p->thread   = BZALLOC( nThreads * sizeof(BZ_THREAD) );
+   if (p->job != NULL)
+      for (i = 0; i < p->nJobs; i++) p->job[i] = NULL;
+   if (p->job == NULL || p->done == NULL || p->thread == NULL) {
+      free_pool ( strm, p );
+      return BZ_MEM_ERROR;
+   }
+
+   n = 100000 * s->blockSize100k;
+   for (i = 0; i < p->nJobs; i++) {
+      j = BZALLOC( sizeof(EState) );
+      if (j == NULL) { free_pool ( strm, p ); return BZ_MEM_ERROR; }
+      p->job[i] = j;
+      j->arr1 = BZALLOC( n                  * sizeof(UInt32) );
+      j->arr2 = BZALLOC( (n+BZ_N_OVERSHOOT) * sizeof(UInt32) );
+      j->ftab = BZALLOC( 65537              * sizeof(UInt32) );
+      j->sawork = NULL;
+      if (s->workFactor == BZ_WORK_SUFFIX)
+         j->sawork = BZALLOC( BZ_SA_WORK(n) * sizeof(UInt32) );
+      if (j->arr1 == NULL || j->arr2 == NULL || j->ftab == NULL ||
+          (s->workFactor == BZ_WORK_SUFFIX && j->sawork == NULL)) {
+         free_pool ( strm, p );
+         return BZ_MEM_ERROR;
+      }
+      j->strm          = strm;
+      j->pool          = NULL;
+      j->blockSize100k = s->blockSize100k;
+      j->verbosity     = s->verbosity;
+      j->workFactor    = s->workFactor;
+      j->block         = (UChar*)j->arr2;
+      j->mtfv          = (UInt16*)j->arr1;
+      j->ptr           = (UInt32*)j->arr1;
+   }
+
+   bz_mutex_init ( &p->lock );
+   if (!bz_sem_init ( &p->work )) {
+      bz_mutex_destroy ( &p->lock );
+      free_pool ( strm, p );
+      return BZ_MEM_ERROR;
+   }
+   for (i = 0; i < p->nJobs; i++)
+      if (!bz_sem_init ( &p->done[i] )) break;
+   if (i < p->nJobs) {
+      destroy_pool_sync ( p, i );
+      free_pool ( strm, p );
+      return BZ_MEM_ERROR;
+   }
+
+   p->nHanded = 0;
+   p->nTaken  = 0;
+   p->nStaged = 0;
+   p->nFreed  = 0;
+   p->trailer = False;
+
+   for (i = 0; i < nThreads; i++)
+      if (!bz_thread_create ( &p->thread[i], compress_worker, p )) break;
+   p->nThreads = i;
+
+   /*-- No threads at all: carry on serially. --*/
+   if (p->nThreads == 0) {
+      destroy_pool_sync ( p, p->nJobs );
+      free_pool ( strm, p );
+      return BZ_OK;
+   }
+
+   s->pool = p;
+   BZ2_compressHeaderMT ( s, p->tail );
+   s->state = BZ_S_OUTPUT;
+   return BZ_OK;
+}
+
+
+/*---------------------------------------------------*/
+static
+void end_pool ( bz_stream* strm )
+{
+   EState*  s = strm->state;
+   BZ_POOL* p = s->pool;
+   Int32    i;
+
+   /*-- Blocks still being coded must finish before we go. --*/
+   for (i = p->nStaged; i < p->nHanded; i++)
+      bz_sem_wait ( &p->done[i % p->nJobs] );
+
+   for (i = 0; i < p->nThreads; i++)
+      bz_sem_post ( &p->work );
+   for (i = 0; i < p->nThreads; i++)
+      bz_thread_join ( p->thread[i] );
+
+   destroy_pool_sync ( p, p->nJobs );
+   free_pool ( strm, p );
+   s->pool = NULL;
+}
+#endif /* BZ_NO_THREADS */
+
+
 /*---------------------------------------------------*/
 int BZ_API(BZ2_bzCompressInit) 
                     ( bz_stream* strm, 
                      int        blockSize100k,
                      int        verbosity,
                      int        workFactor )
+{
+   return BZ2_bzCompressInitMT ( strm, blockSize100k, 
+                                 verbosity, workFactor, 1 );
+}
+
+
+/*---------------------------------------------------*/
+int BZ_API(BZ2_bzCompressInitMT) 
+                    ( bz_stream* strm, 
+                     int        blockSize100k,
+                     int        verbosity,
+                     int        workFactor,
+                     int        nThreads )
 {
    Int32   n;
    EState* s;
@@ -174,7 +526,9 @@ int BZ_API(BZ2_bzCompressInit)
 
    if (strm == NULL || 
        blockSize100k < 1 || blockSize100k > 9 ||
-       workFactor < 0 || workFactor > 250)
+       workFactor < 0 ||
+       (workFactor > 250 && workFactor != BZ_WORK_SUFFIX) ||
+       nThreads < 1 || nThreads > BZ_MAX_THREADS)
      return BZ_PARAM_ERROR;
 
    if (workFactor == 0) workFactor = 30;
@@ -188,16 +542,21 @@ int BZ_API(BZ2_bzCompressInit)
    s->arr1 = NULL;
    s->arr2 = NULL;
    s->ftab = NULL;
+   s->sawork = NULL;
 
    n       = 100000 * blockSize100k;
    s->arr1 = BZALLOC( n                  * sizeof(UInt32) );
    s->arr2 = BZALLOC( (n+BZ_N_OVERSHOOT) * sizeof(UInt32) );
    s->ftab = BZALLOC( 65537              * sizeof(UInt32) );
+   if (workFactor == BZ_WORK_SUFFIX)
+      s->sawork = BZALLOC( BZ_SA_WORK(n) * sizeof(UInt32) );
 
-   if (s->arr1 == NULL || s->arr2 == NULL || s->ftab == NULL) {
+   if (s->arr1 == NULL || s->arr2 == NULL || s->ftab == NULL ||
+       (workFactor == BZ_WORK_SUFFIX && s->sawork == NULL)) {
       if (s->arr1 != NULL) BZFREE(s->arr1);
       if (s->arr2 != NULL) BZFREE(s->arr2);
       if (s->ftab != NULL) BZFREE(s->ftab);
+      if (s->sawork != NULL) BZFREE(s->sawork);
       if (s       != NULL) BZFREE(s);
       return BZ_MEM_ERROR;
    }
@@ -215,6 +574,7 @@ int BZ_API(BZ2_bzCompressInit)
    s->mtfv              = (UInt16*)s->arr1;
    s->zbits             = NULL;
    s->ptr               = (UInt32*)s->arr1;
+   s->pool              = NULL;
 
    strm->state          = s;
    strm->total_in_lo32  = 0;
@@ -223,6 +583,16 @@ int BZ_API(BZ2_bzCompressInit)
    strm->total_out_hi32 = 0;
    init_RL ( s );
    prepare_new_block ( s );
+
+#ifndef BZ_NO_THREADS
+   if (nThreads > 1) {
+      Int32 ret = init_pool ( strm, nThreads );
+      if (ret != BZ_OK) {
+         BZ2_bzCompressEnd ( strm );
+         return ret;
+      }
+   }
+#endif
    return BZ_OK;
 }
 
@@ -231,11 +601,7 @@ int BZ_API(BZ2_bzCompressInit)
 static
 void add_pair_to_block ( EState* s )
 {
-   Int32 i;
    UChar ch = (UChar)(s->state_in_ch);
-   for (i = 0; i < s->state_in_len; i++) {
-      BZ_UPDATE_CRC( s->blockCRC, ch );
-   }
    s->inUse[s->state_in_ch] = True;
    switch (s->state_in_len) {
       case 1:
@@ -267,7 +633,12 @@ void add_pair_to_block ( EState* s )
 static
 void flush_RL ( EState* s )
 {
-   if (s->state_in_ch < 256) add_pair_to_block ( s );
+   Int32 i;
+   if (s->state_in_ch < 256) {
+      for (i = 0; i < s->state_in_len; i++)
+         BZ_UPDATE_CRC ( s->blockCRC, (UChar)(s->state_in_ch) );
+      add_pair_to_block ( s );
+   }
    init_RL ( s );
 }
 
@@ -280,7 +651,6 @@ void flush_RL ( EState* s )
    if (zchh != zs->state_in_ch &&                 \
        zs->state_in_len == 1) {                   \
       UChar ch = (UChar)(zs->state_in_ch);        \
-      BZ_UPDATE_CRC( zs->blockCRC, ch );          \
       zs->inUse[zs->state_in_ch] = True;          \
       zs->block[zs->nblock] = (UChar)ch;          \
       zs->nblock++;                               \
@@ -300,11 +670,38 @@ void flush_RL ( EState* s )
 }
 
 
+/*---------------------------------------------------*/
+/*--
+   The block CRC covers every byte taken in except
+   the pending run, which may yet go to the next
+   block.  After taking the n bytes at from, that is
+   the run pending beforehand (ch0, len0), unless it
+   is still pending, and all but the last state_in_len
+   of the n bytes.  flush_RL does the final run.
+--*/
+static
+void crc_input ( EState* s, UChar* from, UInt32 ch0, Int32 len0 )
+{
+   Int32 n    = (UChar*)(s->strm->next_in) - from;
+   Int32 len1 = s->state_in_ch < 256 ? s->state_in_len : 0;
+   Int32 i;
+
+   if (len1 > n) return;
+   if (ch0 < 256)
+      for (i = 0; i < len0; i++)
+         BZ_UPDATE_CRC ( s->blockCRC, (UChar)ch0 );
+   s->blockCRC = BZ2_crc32Update ( s->blockCRC, from, n - len1 );
+}
+
+
 /*---------------------------------------------------*/
 static
 Bool copy_input_until_stop ( EState* s )
 {
-   Bool progress_in = False;
+   Bool   progress_in = False;
+   UChar* from        = (UChar*)(s->strm->next_in);
+   UInt32 ch0         = s->state_in_ch;
+   Int32  len0        = s->state_in_len;
 
    if (s->mode == BZ_M_RUNNING) {
 
@@ -341,6 +738,7 @@ Bool copy_input_until_stop ( EState* s )
          s->avail_in_expect--;
       }
    }
+   crc_input ( s, from, ch0, len0 );
    return progress_in;
 }
 
@@ -372,6 +770,115 @@ Bool copy_output_until_stop ( EState* s )
 }
 
 
+#ifndef BZ_NO_THREADS
+/*---------------------------------------------------*/
+static
+void hand_off_block ( EState* s )
+{
+   BZ_POOL* p = s->pool;
+   EState*  j = p->job[p->nHanded % p->nJobs];
+   UInt32*  t;
+   Int32    i;
+
+   /*-- The worker gets the full arrays, we carry on in its old ones. --*/
+   t = j->arr1; j->arr1 = s->arr1; s->arr1 = t;
+   t = j->arr2; j->arr2 = s->arr2; s->arr2 = t;
+   t = j->ftab; j->ftab = s->ftab; s->ftab = t;
+   j->block = (UChar*)j->arr2;
+   j->mtfv  = (UInt16*)j->arr1;
+   j->ptr   = (UInt32*)j->arr1;
+   s->block = (UChar*)s->arr2;
+   s->mtfv  = (UInt16*)s->arr1;
+   s->ptr   = (UInt32*)s->arr1;
+
+   j->nblock   = s->nblock;
+   j->blockCRC = s->blockCRC;
+   j->blockNo  = s->blockNo;
+   for (i = 0; i < 256; i++) j->inUse[i] = s->inUse[i];
+
+   bz_mutex_lock ( &p->lock );
+   p->nHanded++;
+   bz_mutex_unlock ( &p->lock );
+   bz_sem_post ( &p->work );
+
+   prepare_new_block ( s );
+}
+
+
+/*---------------------------------------------------*/
+static
+Bool handle_compress_mt ( bz_stream* strm )
+{
+   Bool     progress_in  = False;
+   Bool     progress_out = False;
+   EState*  s = strm->state;
+   BZ_POOL* p = s->pool;
+   Bool     ending, full;
+   Int32    k;
+
+   while (True) {
+
+      if (s->state == BZ_S_OUTPUT) {
+         progress_out |= copy_output_until_stop ( s );
+         if (s->state_out_pos < s->numZ) break;
+         if (p->nFreed < p->nStaged) p->nFreed++;
+         s->state = BZ_S_INPUT;
+      }
+
+      progress_in |= copy_input_until_stop ( s );
+      ending = (Bool)(s->mode != BZ_M_RUNNING && s->avail_in_expect == 0);
+      if (ending) flush_RL ( s );
+      full = (Bool)(s->nblock >= s->nblockMAX || 
+                    (ending && s->nblock > 0));
+
+      if (full && p->nHanded - p->nFreed < p->nJobs) {
+         hand_off_block ( s );
+         continue;
+      }
+
+      if (p->nStaged < p->nHanded) {
+         /*-- Only block if there is nothing else we could do. --*/
+         k = p->nStaged % p->nJobs;
+         if (full || ending)
+            bz_sem_wait ( &p->done[k] ); 
+         else
+         if (!bz_sem_trywait ( &p->done[k] ))
+            break;
+         BZ2_spliceBlockMT ( s, p->job[k] );
+         p->nStaged++;
+         s->state = BZ_S_OUTPUT;
+         continue;
+      }
+
+      if (ending && s->mode == BZ_M_FINISHING && !p->trailer) {
+         BZ2_compressTrailerMT ( s, p->tail );
+         p->trailer = True;
+         s->state = BZ_S_OUTPUT;
+         continue;
+      }
+
+      break;
+   }
+
+   return progress_in || progress_out;
+}
+#endif /* BZ_NO_THREADS */
+
+
+/*---------------------------------------------------*/
+static
+Bool blocks_pending ( EState* s )
+{
+#ifndef BZ_NO_THREADS
+   BZ_POOL* p = s->pool;
+   if (p != NULL)
+      return (Bool)(s->nblock > 0 || p->nFreed < p->nHanded ||
+                    (s->mode == BZ_M_FINISHING && !p->trailer));
+#endif
+   return False;
+}
+
+
 /*---------------------------------------------------*/
 static
 Bool handle_compress ( bz_stream* strm )
@@ -379,6 +886,10 @@ Bool handle_compress ( bz_stream* strm )
    Bool progress_in  = False;
    Bool progress_out = False;
    EState* s = strm->state;
+
+#ifndef BZ_NO_THREADS
+   if (s->pool != NULL) return handle_compress_mt ( strm );
+#endif
    
    while (True) {
 
@@ -461,7 +972,8 @@ int BZ_API(BZ2_bzCompress) ( bz_stream *strm, int action )
             return BZ_SEQUENCE_ERROR;
          progress = handle_compress ( strm );
          if (s->avail_in_expect > 0 || !isempty_RL(s) ||
-             s->state_out_pos < s->numZ) return BZ_FLUSH_OK;
+             s->state_out_pos < s->numZ || blocks_pending(s)) 
+            return BZ_FLUSH_OK;
          s->mode = BZ_M_RUNNING;
          return BZ_RUN_OK;
 
@@ -472,7 +984,8 @@ int BZ_API(BZ2_bzCompress) ( bz_stream *strm, int action )
          progress = handle_compress ( strm );
          if (!progress) return BZ_SEQUENCE_ERROR;
          if (s->avail_in_expect > 0 || !isempty_RL(s) ||
-             s->state_out_pos < s->numZ) return BZ_FINISH_OK;
+             s->state_out_pos < s->numZ || blocks_pending(s)) 
+            return BZ_FINISH_OK;
          s->mode = BZ_M_IDLE;
          return BZ_STREAM_END;
    }
@@ -489,9 +1002,13 @@ int BZ_API(BZ2_bzCompressEnd)  ( bz_stream *strm )
    if (s == NULL) return BZ_PARAM_ERROR;
    if (s->strm != strm) return BZ_PARAM_ERROR;
 
+#ifndef BZ_NO_THREADS
+   if (s->pool != NULL) end_pool ( strm );
+#endif
    if (s->arr1 != NULL) BZFREE(s->arr1);
    if (s->arr2 != NULL) BZFREE(s->arr2);
    if (s->ftab != NULL) BZFREE(s->ftab);
+   if (s->sawork != NULL) BZFREE(s->sawork);
    BZFREE(strm->state);
 
    strm->state = NULL;   
@@ -510,37 +1027,7 @@ int BZ_API(BZ2_bzDecompressInit)
                        int        verbosity,
                        int        small )
 {
-   DState* s;
-
-   if (!bz_config_ok()) return BZ_CONFIG_ERROR;
-
-   if (strm == NULL) return BZ_PARAM_ERROR;
-   if (small != 0 && small != 1) return BZ_PARAM_ERROR;
-   if (verbosity < 0 || verbosity > 4) return BZ_PARAM_ERROR;
-
-   if (strm->bzalloc == NULL) strm->bzalloc = default_bzalloc;
-   if (strm->bzfree == NULL) strm->bzfree = default_bzfree;
-
-   s = BZALLOC( sizeof(DState) );
-   if (s == NULL) return BZ_MEM_ERROR;
-   s->strm                  = strm;
-   strm->state              = s;
-   s->state                 = BZ_X_MAGIC_1;
-   s->bsLive                = 0;
-   s->bsBuff                = 0;
-   s->calculatedCombinedCRC = 0;
-   strm->total_in_lo32      = 0;
-   strm->total_in_hi32      = 0;
-   strm->total_out_lo32     = 0;
-   strm->total_out_hi32     = 0;
-   s->smallDecompress       = (Bool)small;
-   s->ll4                   = NULL;
-   s->ll16                  = NULL;
-   s->tt                    = NULL;
-   s->currBlockNo           = 0;
-   s->verbosity             = verbosity;
-
-   return BZ_OK;
+   return BZ2_bzDecompressInitMT ( strm, verbosity, small, 1 );
 }
 
 
@@ -558,7 +1045,6 @@ void unRLE_obuf_to_output_FAST ( DState* s )
             if (s->strm->avail_out == 0) return;
             if (s->state_out_len == 0) break;
             *( (UChar*)(s->strm->next_out) ) = s->state_out_ch;
-            BZ_UPDATE_CRC ( s->calculatedBlockCRC, s->state_out_ch );
             s->state_out_len--;
             s->strm->next_out++;
             s->strm->avail_out--;
@@ -599,7 +1085,6 @@ void unRLE_obuf_to_output_FAST ( DState* s )
    } else {
 
       /* restore */
-      UInt32        c_calculatedBlockCRC = s->calculatedBlockCRC;
       UChar         c_state_out_ch       = s->state_out_ch;
       Int32         c_state_out_len      = s->state_out_len;
       Int32         c_nblock_used        = s->nblock_used;
@@ -622,7 +1107,6 @@ void unRLE_obuf_to_output_FAST ( DState* s )
                if (cs_avail_out == 0) goto return_notr;
                if (c_state_out_len == 1) break;
                *( (UChar*)(cs_next_out) ) = c_state_out_ch;
-               BZ_UPDATE_CRC ( c_calculatedBlockCRC, c_state_out_ch );
                c_state_out_len--;
                cs_next_out++;
                cs_avail_out--;
@@ -633,7 +1117,6 @@ void unRLE_obuf_to_output_FAST ( DState* s )
                   c_state_out_len = 1; goto return_notr;
                };
                *( (UChar*)(cs_next_out) ) = c_state_out_ch;
-               BZ_UPDATE_CRC ( c_calculatedBlockCRC, c_state_out_ch );
                cs_next_out++;
                cs_avail_out--;
             }
@@ -672,7 +1155,6 @@ void unRLE_obuf_to_output_FAST ( DState* s )
          s->strm->total_out_hi32++;
 
       /* save */
-      s->calculatedBlockCRC = c_calculatedBlockCRC;
       s->state_out_ch       = c_state_out_ch;
       s->state_out_len      = c_state_out_len;
       s->nblock_used        = c_nblock_used;
@@ -716,7 +1198,6 @@ void unRLE_obuf_to_output_SMALL ( DState* s )
             if (s->strm->avail_out == 0) return;
             if (s->state_out_len == 0) break;
             *( (UChar*)(s->strm->next_out) ) = s->state_out_ch;
-            BZ_UPDATE_CRC ( s->calculatedBlockCRC, s->state_out_ch );
             s->state_out_len--;
             s->strm->next_out++;
             s->strm->avail_out--;
@@ -762,7 +1243,6 @@ void unRLE_obuf_to_output_SMALL ( DState* s )
             if (s->strm->avail_out == 0) return;
             if (s->state_out_len == 0) break;
             *( (UChar*)(s->strm->next_out) ) = s->state_out_ch;
-            BZ_UPDATE_CRC ( s->calculatedBlockCRC, s->state_out_ch );
             s->state_out_len--;
             s->strm->next_out++;
             s->strm->avail_out--;
@@ -799,22 +1279,851 @@ void unRLE_obuf_to_output_SMALL ( DState* s )
 
 
 /*---------------------------------------------------*/
-int BZ_API(BZ2_bzDecompress) ( bz_stream *strm )
+/*-- The block CRC is taken over each stretch of output at once. --*/
+static
+void unRLE_obuf_to_output ( DState* s )
 {
-   DState* s;
-   if (strm == NULL) return BZ_PARAM_ERROR;
-   s = strm->state;
-   if (s == NULL) return BZ_PARAM_ERROR;
-   if (s->strm != strm) return BZ_PARAM_ERROR;
+   UChar* from = (UChar*)(s->strm->next_out);
+
+   if (s->smallDecompress)
+      unRLE_obuf_to_output_SMALL ( s ); else
+      unRLE_obuf_to_output_FAST  ( s );
+   s->calculatedBlockCRC
+      = BZ2_crc32Update ( s->calculatedBlockCRC, from,
+                          (UChar*)(s->strm->next_out) - from );
+}
+
+
+#ifndef BZ_NO_THREADS
+/*---------------------------------------------------*/
+/*--
+   Parallel decompression.  Blocks are not byte aligned and
+   their length is only known once decoded, so the main thread
+   scans the input bit by bit for block magics (as bzip2recover
+   does) and hands each stretch between two magics to a worker.
+   A magic can also turn up by chance inside the coded data.
+   Results are therefore taken strictly in order and each must
+   start where the previous block really ended, at pos.  One
+   that finds its stretch cut short by such a false magic is
+   decoded again on the main thread straight from the input,
+   and scanning restarts where it ends.  Positions are bit
+   offsets into the stream, modulo 2^32.
+--*/
+#define BZ_BEFORE(a,b) ((Int32)((a)-(b)) < 0)
+
+#define BZ_J_BLOCK 1
+#define BZ_J_END   2
+#define BZ_J_SHORT 100   /* result: needs bits past its span */
+
+typedef
+   struct {
+      Int32     kind;      /* BZ_J_BLOCK or BZ_J_END */
+      UInt32    start;     /* position of its magic */
+      UInt32    end;       /* first position after the block */
+      UInt32    storedCRC; /* BZ_J_END: the combined CRC */
+      UChar*    span;      /* copy of the bytes it lies in */
+      Int32     spanCap;
+      DState*   d;
+      bz_stream js;        /* d reads span, writes obuf */
+      UChar*    obuf;
+      Int32     olen;
+      Int32     opos;
+      Int32     result;
+      Bool      whole;     /* obuf holds the entire block */
+   }
+   BZ_DJOB;
+
+typedef
+   struct bz_dpool {
+      Int32      nThreads;
+      Int32      nJobs;
+      BZ_DJOB*   job;
+      BZ_SEM*    done;      /* done[i] is posted when job[i] is decoded */
+      BZ_THREAD* thread;
+      BZ_MUTEX   lock;      /* guards nPushed and nTaken */
+      BZ_SEM     work;      /* posted once per job, and once to stop */
+      Int32      nPushed;   /* jobs found by the scanner */
+      Int32      nTaken;    /* ... picked up by a worker */
+      Int32      nResolved; /* ... checked against pos */
+      Bool       headDone;  /* done[] of the oldest job was taken */
+      Bool       outActive; /* job[out] is being copied out */
+      Int32      out;
+      Bool       serial;    /* main is decoding the oldest job itself */
+      Int32      ocap;
+      UInt32     maxSpan;
+
+      UChar*     ibuf;      /* input from position ibufPos on */
+      Int32      ibufLen;
+      Int32      ibufCap;
+      UInt32     ibufPos;
+      Int32      serialOff; /* bytes of ibuf the serial decode took */
+
+      UInt32     pos;       /* where the next block must start */
+      UInt32     scan;      /* next bit the scanner looks at */
+      UInt32     scanFrom;
+      UInt32     buffHi;
+      UInt32     buffLo;
+      UInt32     cur;       /* last magic found */
+      Bool       haveCur;
+      Bool       crcWait;   /* cur is an end magic, CRC still to come */
+      Bool       scanStop;
+      Int32      scanErr;
+   }
+   BZ_DPOOL;
+
+
+/*---------------------------------------------------*/
+static
+void decode_job ( BZ_DPOOL* p, BZ_DJOB* j )
+{
+   DState* d = j->d;
+   Int32   r;
+
+   r = BZ2_decompress ( d );
+   if (r != BZ_OK) { j->result = r; return; }
+   if (d->state != BZ_X_OUTPUT) { j->result = BZ_J_SHORT; return; }
+
+   j->end = (j->start & ~7)
+            + 8 * (UInt32)((UChar*)j->js.next_in - j->span) - d->bsLive;
+
+   j->js.next_out  = (char*)j->obuf;
+   j->js.avail_out = p->ocap;
+   unRLE_obuf_to_output ( d );
+   j->olen   = p->ocap - j->js.avail_out;
+   j->opos   = 0;
+   j->whole  = (Bool)(d->nblock_used == d->save_nblock+1 &&
+                      d->state_out_len == 0);
+   j->result = BZ_OK;
+   if (j->whole) {
+      BZ_FINALISE_CRC ( d->calculatedBlockCRC );
+      if (d->calculatedBlockCRC != d->storedBlockCRC)
+         j->result = BZ_DATA_ERROR;
+   }
+}
+
+
+/*---------------------------------------------------*/
+static
+BZ_THREAD_PROC ( decompress_worker, arg )
+{
+   BZ_DPOOL* p = (BZ_DPOOL*)arg;
+   Int32     k;
 
    while (True) {
-      if (s->state == BZ_X_IDLE) return BZ_SEQUENCE_ERROR;
-      if (s->state == BZ_X_OUTPUT) {
-         if (s->smallDecompress)
-            unRLE_obuf_to_output_SMALL ( s ); else
-            unRLE_obuf_to_output_FAST  ( s );
-         if (s->nblock_used == s->save_nblock+1 && s->state_out_len == 0) {
-            BZ_FINALISE_CRC ( s->calculatedBlockCRC );
+      bz_sem_wait ( &p->work );
+      bz_mutex_lock ( &p->lock );
+      if (p->nTaken == p->nPushed) {
+         bz_mutex_unlock ( &p->lock );
+         break;
+      }
+      k = p->nTaken % p->nJobs;
+      p->nTaken++;
+      bz_mutex_unlock ( &p->lock );
+
+      if (p->job[k].kind == BZ_J_BLOCK) decode_job ( p, &p->job[k] );
+      bz_sem_post ( &p->done[k] );
+   }
+   BZ_THREAD_EXIT;
+}
+
+
+/*---------------------------------------------------*/
+static
+void free_dpool ( bz_stream* strm, BZ_DPOOL* p )
+{
+   Int32    i;
+   BZ_DJOB* j;
+
+   if (p->job != NULL) {
+      for (i = 0; i < p->nJobs; i++) {
+         j = &p->job[i];
+         if (j->span != NULL) BZFREE(j->span);
+         if (j->obuf != NULL) BZFREE(j->obuf);
+         if (j->d == NULL) continue;
+         if (j->d->tt   != NULL) BZFREE(j->d->tt);
+         if (j->d->ll16 != NULL) BZFREE(j->d->ll16);
+         if (j->d->ll4  != NULL) BZFREE(j->d->ll4);
+         BZFREE(j->d);
+      }
+      BZFREE(p->job);
+   }
+   if (p->done   != NULL) BZFREE(p->done);
+   if (p->thread != NULL) BZFREE(p->thread);
+   if (p->ibuf   != NULL) BZFREE(p->ibuf);
+   BZFREE(p);
+}
+
+
+/*---------------------------------------------------*/
+static
+void destroy_dpool_sync ( BZ_DPOOL* p, Int32 nDone )
+{
+   Int32 i;
+   for (i = 0; i < nDone; i++) bz_sem_destroy ( &p->done[i] );
+   bz_sem_destroy ( &p->work );
+   bz_mutex_destroy ( &p->lock );
+}
+
+
+/*---------------------------------------------------*/
+static
+int init_dpool ( bz_stream* strm, Int32 nThreads )
+{
+   DState*   s = strm->state;
+   BZ_DPOOL* p;
+   Int32     i;
+
+   p = BZALLOC( sizeof(BZ_DPOOL) );
+   if (p == NULL) return BZ_MEM_ERROR;
+
+   /*-- One block per worker, and one being copied out. --*/
+   p->nThreads = 0;
+   p->nJobs    = nThreads + 1;
+   p->job      = BZALLOC( p->nJobs * sizeof(BZ_DJOB) );
+   p->done     = BZALLOC( p->nJobs * sizeof(BZ_SEM) );
+   p->thread   = BZALLOC( nThreads * sizeof(BZ_THREAD) );
+   p->ibufCap  = 4096;
+   p->ibuf     = BZALLOC( p->ibufCap );
+   if (p->job != NULL)
+      for (i = 0; i < p->nJobs; i++) {
+         p->job[i].d    = NULL;
+         p->job[i].span = NULL;
+         p->job[i].obuf = NULL;
+      }
+   if (p->job == NULL || p->done == NULL || p->thread == NULL ||
+       p->ibuf == NULL) {
+      free_dpool ( strm, p );
+      return BZ_MEM_ERROR;
+   }
+
+   bz_mutex_init ( &p->lock );
+   if (!bz_sem_init ( &p->work )) {
+      bz_mutex_destroy ( &p->lock );
+      free_dpool ( strm, p );
+      return BZ_MEM_ERROR;
+   }
+   for (i = 0; i < p->nJobs; i++)
+      if (!bz_sem_init ( &p->done[i] )) break;
+   if (i < p->nJobs) {
+      destroy_dpool_sync ( p, i );
+      free_dpool ( strm, p );
+      return BZ_MEM_ERROR;
+   }
+
+   p->nPushed   = 0;
+   p->nTaken    = 0;
+   p->nResolved = 0;
+   p->headDone  = False;
+   p->outActive = False;
+   p->serial    = False;
+   p->ibufLen   = 0;
+   p->ibufPos   = 0;
+   p->pos       = 0;
+   p->scanStop  = True;
+   p->scanErr   = BZ_OK;
+
+   for (i = 0; i < nThreads; i++)
+      if (!bz_thread_create ( &p->thread[i], decompress_worker, p )) break;
+   p->nThreads = i;
+
+   /*-- No threads at all: carry on serially. --*/
+   if (p->nThreads == 0) {
+      destroy_dpool_sync ( p, p->nJobs );
+      free_dpool ( strm, p );
+      return BZ_OK;
+   }
+
+   s->pool = p;
+   return BZ_OK;
+}
+
+
+/*---------------------------------------------------*/
+static
+void end_dpool ( bz_stream* strm )
+{
+   DState*   s = strm->state;
+   BZ_DPOOL* p = s->pool;
+   Int32     i;
+
+   /*-- Blocks still being decoded must finish before we go. --*/
+   i = p->nResolved;
+   if (p->headDone) i++;
+   for (; i < p->nPushed; i++)
+      bz_sem_wait ( &p->done[i % p->nJobs] );
+
+   for (i = 0; i < p->nThreads; i++)
+      bz_sem_post ( &p->work );
+   for (i = 0; i < p->nThreads; i++)
+      bz_thread_join ( p->thread[i] );
+
+   destroy_dpool_sync ( p, p->nJobs );
+   free_dpool ( strm, p );
+   s->pool = NULL;
+}
+
+
+/*---------------------------------------------------*/
+static
+Bool alloc_djobs ( bz_stream* strm )
+{
+   DState*   s = strm->state;
+   BZ_DPOOL* p = s->pool;
+   BZ_DJOB*  j;
+   DState*   d;
+   Int32     i, n;
+
+   n       = 100000 * s->blockSize100k;
+   p->ocap = 2 * n;
+   /*-- Far more than any encoder spends on a block; past it
+        the block is left to the main thread. --*/
+   p->maxSpan = 8 * (UInt32)(n / 2 * 5 + 65536);
+
+   for (i = 0; i < p->nJobs; i++) {
+      j = &p->job[i];
+      j->spanCap = 0;
+      j->obuf    = BZALLOC( p->ocap );
+      j->d = d   = BZALLOC( sizeof(DState) );
+      if (j->obuf == NULL || d == NULL) return False;
+      d->tt   = NULL;
+      d->ll16 = NULL;
+      d->ll4  = NULL;
+      if (s->smallDecompress) {
+         d->ll16 = BZALLOC( n * sizeof(UInt16) );
+         d->ll4  = BZALLOC( ((1 + n) >> 1) * sizeof(UChar) );
+         if (d->ll16 == NULL || d->ll4 == NULL) return False;
+      } else {
+         d->tt   = BZALLOC( n * sizeof(Int32) );
+         if (d->tt == NULL) return False;
+      }
+      j->js.bzalloc      = strm->bzalloc;
+      j->js.bzfree       = strm->bzfree;
+      j->js.opaque       = strm->opaque;
+      d->strm            = &j->js;
+      d->pool            = NULL;
+      d->blockSize100k   = s->blockSize100k;
+      d->smallDecompress = s->smallDecompress;
+      d->verbosity       = 0;
+   }
+   return True;
+}
+
+
+/*---------------------------------------------------*/
+static
+void take_input ( bz_stream* strm, Int32 n )
+{
+   strm->next_in       += n;
+   strm->avail_in      -= n;
+   strm->total_in_lo32 += n;
+   if (strm->total_in_lo32 < (UInt32)n) strm->total_in_hi32++;
+}
+
+
+/*---------------------------------------------------*/
+static
+Bool append_input ( bz_stream* strm, Int32 n )
+{
+   DState*   s = strm->state;
+   BZ_DPOOL* p = s->pool;
+   UChar*    nb;
+   Int32     drop;
+
+   if (n > (Int32)strm->avail_in) n = strm->avail_in;
+   if (p->ibufLen + n > p->ibufCap) {
+      /*-- Nothing before pos is needed again. --*/
+      drop = (Int32)((p->pos - p->ibufPos) >> 3);
+      if (drop > 0) {
+         memmove ( p->ibuf, p->ibuf + drop, p->ibufLen - drop );
+         p->ibufLen -= drop;
+         p->ibufPos += 8 * drop;
+      }
+      if (p->ibufLen + n > p->ibufCap / 2) {
+         nb = BZALLOC( 2 * p->ibufCap + n );
+         if (nb == NULL) return False;
+         memcpy ( nb, p->ibuf, p->ibufLen );
+         BZFREE(p->ibuf);
+         p->ibuf    = nb;
+         p->ibufCap = 2 * p->ibufCap + n;
+      }
+   }
+   memcpy ( p->ibuf + p->ibufLen, strm->next_in, n );
+   p->ibufLen += n;
+   take_input ( strm, n );
+   return True;
+}
+
+
+/*---------------------------------------------------*/
+static
+void reset_scan ( BZ_DPOOL* p, UInt32 at )
+{
+   p->scan     = at;
+   p->scanFrom = at;
+   p->buffHi   = 0;
+   p->buffLo   = 0;
+   p->haveCur  = False;
+   p->crcWait  = False;
+   p->scanStop = False;
+}
+
+
+/*---------------------------------------------------*/
+static
+Bool push_job ( bz_stream* strm, Int32 kind, UInt32 start, UInt32 stop )
+{
+   DState*   s = strm->state;
+   BZ_DPOOL* p = s->pool;
+   BZ_DJOB*  j = &p->job[p->nPushed % p->nJobs];
+   Int32     from, n;
+
+   j->kind  = kind;
+   j->start = start;
+   if (kind == BZ_J_BLOCK) {
+      from = (Int32)((start - p->ibufPos) >> 3);
+      n    = (Int32)((stop - p->ibufPos + 7) >> 3) - from;
+      if (n > j->spanCap) {
+         if (j->span != NULL) BZFREE(j->span);
+         j->spanCap = n + n / 4;
+         j->span    = BZALLOC( j->spanCap );
+         if (j->span == NULL) { j->spanCap = 0; return False; }
+      }
+      memcpy ( j->span, p->ibuf + from, n );
+      j->js.next_in  = (char*)j->span;
+      j->js.avail_in = n;
+      BZ2_decompressBlockAt ( j->d, start & 7 );
+   } else {
+      j->storedCRC = p->buffLo;
+   }
+
+   bz_mutex_lock ( &p->lock );
+   p->nPushed++;
+   bz_mutex_unlock ( &p->lock );
+   bz_sem_post ( &p->work );
+   return True;
+}
+
+
+/*---------------------------------------------------*/
+static
+Bool scan_input ( bz_stream* strm )
+{
+   DState*   s = strm->state;
+   BZ_DPOOL* p = s->pool;
+   Bool      progress = False;
+   Bool      isBlock, isEnd;
+   UInt32    hi, lo;
+   UChar     uc;
+   Int32     b, i, k, n, taken = 0;
+
+   while (!p->scanStop && p->scanErr == BZ_OK &&
+          p->nPushed - p->nResolved + (p->outActive ? 1 : 0) < p->nJobs) {
+
+      b = (Int32)((p->scan - p->ibufPos) >> 3);
+      if (b >= p->ibufLen) {
+         if (strm->avail_in == 0) break;
+         n = strm->avail_in;
+         if (!append_input ( strm, 4096 )) 
+            { p->scanErr = BZ_MEM_ERROR; break; }
+         taken   += n - strm->avail_in;
+         progress = True;
+         b = (Int32)((p->scan - p->ibufPos) >> 3);
+      }
+
+      /*-- Inside a block, run through all of ibuf unless the
+           low 32 bits of a magic turn up. --*/
+      hi = p->buffHi;
+      lo = p->buffLo;
+      k  = (Int32)(p->scan & 7);
+      n  = (p->haveCur && !p->crcWait) ? 8 * (p->ibufLen - b) - k : 1;
+      for (i = 0; i < n; ) {
+         uc = p->ibuf[b + ((k + i) >> 3)];
+         hi = (hi << 1) | (lo >> 31);
+         lo = (lo << 1) | ((uc >> (7 - ((k + i) & 7))) & 1);
+         i++;
+         if (lo == 0x59265359 || lo == 0x45385090) break;
+      }
+      p->buffHi = hi;
+      p->buffLo = lo;
+      p->scan  += i;
+
+      if (p->crcWait) {
+         if (p->scan - p->cur < 80) continue;
+         if (!push_job ( strm, BZ_J_END, p->cur, p->scan ))
+            { p->scanErr = BZ_MEM_ERROR; break; }
+         p->crcWait  = False;
+         p->scanStop = True;
+         progress    = True;
+         continue;
+      }
+      if (p->scan - p->scanFrom < 48) continue;
+
+      isBlock = (Bool)((p->buffHi & 0xffff) == 0x3141 &&
+                       p->buffLo == 0x59265359);
+      isEnd   = (Bool)((p->buffHi & 0xffff) == 0x1772 &&
+                       p->buffLo == 0x45385090);
+      if (!isBlock && !isEnd) {
+         /*-- The first magic must sit right at pos. --*/
+         if (!p->haveCur) { p->scanErr = BZ_DATA_ERROR; break; }
+         if (p->scan - p->cur > p->maxSpan) {
+            if (!push_job ( strm, BZ_J_BLOCK, p->cur, p->scan ))
+               { p->scanErr = BZ_MEM_ERROR; break; }
+            p->haveCur  = False;
+            p->scanStop = True;
+            progress    = True;
+         }
+         continue;
+      }
+
+      if (p->haveCur &&
+          !push_job ( strm, BZ_J_BLOCK, p->cur, p->scan - 48 ))
+         { p->scanErr = BZ_MEM_ERROR; break; }
+      p->cur     = p->scan - 48;
+      p->haveCur = isBlock;
+      p->crcWait = isEnd;
+      progress   = True;
+   }
+
+   /*-- Hand back what was read ahead but not looked at, so
+        that nothing past the end of the stream is consumed. --*/
+   n = p->ibufLen - (Int32)((p->scan - p->ibufPos + 7) >> 3);
+   if (n > taken) n = taken;
+   if (n > 0) {
+      p->ibufLen          -= n;
+      strm->next_in       -= n;
+      strm->avail_in      += n;
+      if (strm->total_in_lo32 < (UInt32)n) strm->total_in_hi32--;
+      strm->total_in_lo32 -= n;
+   }
+   return progress;
+}
+
+
+/*---------------------------------------------------*/
+static
+void accept_head ( DState* s )
+{
+   BZ_DPOOL* p = s->pool;
+   Int32     k = p->nResolved % p->nJobs;
+   BZ_DJOB*  j = &p->job[k];
+
+   s->currBlockNo++;
+   if (s->verbosity >= 2)
+      VPrintf1 ( "\n    [%d: huff+mtf rt+rld", s->currBlockNo );
+   s->calculatedCombinedCRC
+      = (s->calculatedCombinedCRC << 1) |
+           (s->calculatedCombinedCRC >> 31);
+   s->calculatedCombinedCRC ^= j->d->storedBlockCRC;
+
+   p->pos       = j->end;
+   p->out       = k;
+   p->outActive = True;
+   p->nResolved++;
+   p->headDone  = False;
+}
+
+
+/*---------------------------------------------------*/
+static
+int copy_out ( bz_stream* strm )
+{
+   DState*   s = strm->state;
+   BZ_DPOOL* p = s->pool;
+   BZ_DJOB*  j = &p->job[p->out];
+   DState*   d = j->d;
+   Int32     n;
+
+   n = j->olen - j->opos;
+   if (n > (Int32)strm->avail_out) n = strm->avail_out;
+   if (n > 0) {
+      memcpy ( strm->next_out, j->obuf + j->opos, n );
+      j->opos              += n;
+      strm->next_out       += n;
+      strm->avail_out      -= n;
+      strm->total_out_lo32 += n;
+      if (strm->total_out_lo32 < (UInt32)n) strm->total_out_hi32++;
+   }
+   if (j->opos < j->olen) return BZ_OK;
+
+   /*-- What did not fit in obuf goes straight to the caller. --*/
+   if (!j->whole) {
+      d->strm = strm;
+      unRLE_obuf_to_output ( d );
+      d->strm = &j->js;
+      if (d->nblock_used != d->save_nblock+1 || d->state_out_len != 0)
+         return BZ_OK;
+      BZ_FINALISE_CRC ( d->calculatedBlockCRC );
+      j->whole = True;
+   }
+
+   if (s->verbosity >= 3)
+      VPrintf2 ( " {0x%x, 0x%x}", d->storedBlockCRC,
+                 d->calculatedBlockCRC );
+   if (s->verbosity >= 2) VPrintf0 ( "]" );
+   if (d->calculatedBlockCRC != d->storedBlockCRC)
+      return BZ_DATA_ERROR;
+   p->outActive = False;
+   return BZ_OK;
+}
+
+
+/*---------------------------------------------------*/
+/*--
+   The oldest job ran into a false magic.  Throw away
+   everything found after it and decode it again here,
+   reading ibuf and then the caller's input directly so
+   that nothing past the block is consumed.
+--*/
+static
+void collapse ( bz_stream* strm )
+{
+   DState*   s = strm->state;
+   BZ_DPOOL* p = s->pool;
+   BZ_DJOB*  j = &p->job[p->nResolved % p->nJobs];
+   Int32     i;
+
+   for (i = p->nResolved + 1; i < p->nPushed; i++)
+      bz_sem_wait ( &p->done[i % p->nJobs] );
+   bz_mutex_lock ( &p->lock );
+   p->nPushed = p->nTaken = p->nResolved + 1;
+   bz_mutex_unlock ( &p->lock );
+
+   p->serialOff   = (Int32)((p->pos - p->ibufPos) >> 3);
+   j->js.next_in  = (char*)(p->ibuf + p->serialOff);
+   j->js.avail_in = p->ibufLen - p->serialOff;
+   BZ2_decompressBlockAt ( j->d, p->pos & 7 );
+   p->serialOff++;
+   p->serial   = True;
+   p->haveCur  = False;
+   p->crcWait  = False;
+   p->scanStop = True;
+}
+
+
+/*---------------------------------------------------*/
+static
+int decode_serial ( bz_stream* strm )
+{
+   DState*   s = strm->state;
+   BZ_DPOOL* p = s->pool;
+   BZ_DJOB*  j = &p->job[p->nResolved % p->nJobs];
+   DState*   d = j->d;
+   Int32     r, n;
+
+   while (True) {
+      if (p->serialOff < p->ibufLen) {
+         j->js.next_in  = (char*)(p->ibuf + p->serialOff);
+         j->js.avail_in = p->ibufLen - p->serialOff;
+         r = BZ2_decompress ( d );
+         p->serialOff = (Int32)((UChar*)j->js.next_in - p->ibuf);
+      } else {
+         if (strm->avail_in == 0) return BZ_OK;
+         j->js.next_in  = strm->next_in;
+         j->js.avail_in = strm->avail_in;
+         r = BZ2_decompress ( d );
+         n = (Int32)(j->js.next_in - strm->next_in);
+         if (n > 0) {
+            /*-- Keep just the last byte; the scanner restarts in it. --*/
+            p->ibufPos  += 8 * (UInt32)(p->ibufLen - 1 + n);
+            p->ibuf[0]   = ((UChar*)(strm->next_in))[n-1];
+            p->ibufLen   = 1;
+            p->serialOff = 1;
+            take_input ( strm, n );
+         }
+      }
+      if (r != BZ_OK) return r;
+      if (d->state == BZ_X_OUTPUT) break;
+   }
+
+   j->end    = p->ibufPos + 8 * (UInt32)p->serialOff - d->bsLive;
+   j->olen   = 0;
+   j->opos   = 0;
+   j->whole  = False;
+   j->result = BZ_OK;
+   p->serial = False;
+   reset_scan ( p, j->end );
+   return BZ_OK;
+}
+
+
+/*---------------------------------------------------*/
+static
+int read_header_mt ( bz_stream* strm )
+{
+   DState*   s = strm->state;
+   BZ_DPOOL* p = s->pool;
+   UChar     uc;
+
+   while (p->ibufLen < 4) {
+      if (strm->avail_in == 0) return BZ_OK;
+      if (!append_input ( strm, 1 )) return BZ_MEM_ERROR;
+      uc = p->ibuf[p->ibufLen-1];
+      switch (p->ibufLen) {
+         case 1: if (uc != 'B') return BZ_DATA_ERROR_MAGIC; break;
+         case 2: if (uc != 'Z') return BZ_DATA_ERROR_MAGIC; break;
+         case 3: if (uc != 'h') return BZ_DATA_ERROR_MAGIC; break;
+         default:
+            if (uc < '1' || uc > '9') return BZ_DATA_ERROR_MAGIC;
+      }
+   }
+
+   s->blockSize100k = p->ibuf[3] - '0';
+   if (!alloc_djobs ( strm )) return BZ_MEM_ERROR;
+   p->pos = 32;
+   reset_scan ( p, 32 );
+   s->state = BZ_X_BLKHDR_1;
+   return BZ_OK;
+}
+
+
+/*---------------------------------------------------*/
+static
+int decompress_mt ( bz_stream* strm )
+{
+   DState*   s = strm->state;
+   BZ_DPOOL* p = s->pool;
+   BZ_DJOB*  j;
+   Int32     r, k;
+
+   if (s->state == BZ_X_MAGIC_1) {
+      r = read_header_mt ( strm );
+      if (r != BZ_OK || s->state == BZ_X_MAGIC_1) return r;
+   }
+
+   while (True) {
+
+      if (p->outActive) {
+         r = copy_out ( strm );
+         if (r != BZ_OK) return r;
+         if (p->outActive) {
+            /*-- Caller's buffer is full; keep the workers busy. --*/
+            scan_input ( strm );
+            return BZ_OK;
+         }
+      }
+
+      if (p->serial) {
+         r = decode_serial ( strm );
+         if (r != BZ_OK || p->serial) return r;
+         accept_head ( s );
+         continue;
+      }
+
+      if (p->nResolved < p->nPushed) {
+         k = p->nResolved % p->nJobs;
+         j = &p->job[k];
+         if (!p->headDone) {
+            if (!bz_sem_trywait ( &p->done[k] )) {
+               if (scan_input ( strm )) continue;
+               bz_sem_wait ( &p->done[k] );
+            }
+            p->headDone = True;
+         }
+         if (BZ_BEFORE(j->start, p->pos)) {
+            /*-- A false magic near the end of the last block. --*/
+            p->nResolved++;
+            p->headDone = False;
+            continue;
+         }
+         if (j->start != p->pos) return BZ_DATA_ERROR;
+         if (j->kind == BZ_J_END) {
+            s->storedCombinedCRC = j->storedCRC;
+            if (s->verbosity >= 3)
+               VPrintf2 ( "\n    combined CRCs: stored = 0x%x, computed = 0x%x",
+                          s->storedCombinedCRC, s->calculatedCombinedCRC );
+            if (s->calculatedCombinedCRC != s->storedCombinedCRC)
+               return BZ_DATA_ERROR;
+            s->state = BZ_X_IDLE;
+            return BZ_STREAM_END;
+         }
+         if (j->result == BZ_J_SHORT) { collapse ( strm ); continue; }
+         if (j->result != BZ_OK) return j->result;
+         accept_head ( s );
+         continue;
+      }
+
+      if (p->scanErr != BZ_OK) return p->scanErr;
+      if (p->scanStop) reset_scan ( p, p->pos );
+      if (!scan_input ( strm )) return BZ_OK;
+   }
+}
+#endif /* BZ_NO_THREADS */
+
+
+/*---------------------------------------------------*/
+int BZ_API(BZ2_bzDecompressInitMT) 
+                     ( bz_stream* strm, 
+                       int        verbosity,
+                       int        small,
+                       int        nThreads )
+{
+   DState* s;
+
+   if (!bz_config_ok()) return BZ_CONFIG_ERROR;
+
+   if (strm == NULL) return BZ_PARAM_ERROR;
+   if (small != 0 && small != 1) return BZ_PARAM_ERROR;
+   if (verbosity < 0 || verbosity > 4) return BZ_PARAM_ERROR;
+   if (nThreads < 1 || nThreads > BZ_MAX_THREADS) return BZ_PARAM_ERROR;
+
+   if (strm->bzalloc == NULL) strm->bzalloc = default_bzalloc;
+   if (strm->bzfree == NULL) strm->bzfree = default_bzfree;
+
+   s = BZALLOC( sizeof(DState) );
+   if (s == NULL) return BZ_MEM_ERROR;
+   s->strm                  = strm;
+   strm->state              = s;
+   s->state                 = BZ_X_MAGIC_1;
+   s->bsLive                = 0;
+   s->bsBuff                = 0;
+   s->calculatedCombinedCRC = 0;
+   strm->total_in_lo32      = 0;
+   strm->total_in_hi32      = 0;
+   strm->total_out_lo32     = 0;
+   strm->total_out_hi32     = 0;
+   s->smallDecompress       = (Bool)small;
+   s->ll4                   = NULL;
+   s->ll16                  = NULL;
+   s->tt                    = NULL;
+   s->currBlockNo           = 0;
+   s->verbosity             = verbosity;
+   s->pool                  = NULL;
+
+#ifndef BZ_NO_THREADS
+   if (nThreads > 1) {
+      Int32 ret = init_dpool ( strm, nThreads );
+      if (ret != BZ_OK) {
+         BZ2_bzDecompressEnd ( strm );
+         return ret;
+      }
+   }
+#endif
+   return BZ_OK;
+}
+
+
+/*---------------------------------------------------*/
+int BZ_API(BZ2_bzDecompress) ( bz_stream *strm )
+{
+   DState* s;
+   if (strm == NULL) return BZ_PARAM_ERROR;
+   s = strm->state;
+   if (s == NULL) return BZ_PARAM_ERROR;
+   if (s->strm != strm) return BZ_PARAM_ERROR;
+
+#ifndef BZ_NO_THREADS
+   if (s->pool != NULL) {
+      if (s->state == BZ_X_IDLE) return BZ_SEQUENCE_ERROR;
+      return decompress_mt ( strm );
+   }
+#endif
+
+   while (True) {
+      if (s->state == BZ_X_IDLE) return BZ_SEQUENCE_ERROR;
+      if (s->state == BZ_X_OUTPUT) {
+         unRLE_obuf_to_output ( s );
+         if (s->nblock_used == s->save_nblock+1 && s->state_out_len == 0) {
+            BZ_FINALISE_CRC ( s->calculatedBlockCRC );
             if (s->verbosity >= 3) 
                VPrintf2 ( " {0x%x, 0x%x}", s->storedBlockCRC, 
                           s->calculatedBlockCRC );
@@ -859,6 +2168,9 @@ int BZ_API(BZ2_bzDecompressEnd)  ( bz_stream *strm )
    if (s == NULL) return BZ_PARAM_ERROR;
    if (s->strm != strm) return BZ_PARAM_ERROR;
 
+#ifndef BZ_NO_THREADS
+   if (s->pool != NULL) end_dpool ( strm );
+#endif
    if (s->tt   != NULL) BZFREE(s->tt);
    if (s->ll16 != NULL) BZFREE(s->ll16);
    if (s->ll4  != NULL) BZFREE(s->ll4);
@@ -881,6 +2193,37 @@ int BZ_API(BZ2_bzDecompressEnd)  ( bz_stream *strm )
    if (bzf != NULL) bzf->lastErr = eee;   \
 }
 
+/*--
+   A block index lets BZ2_bzSeek start decoding at the block
+   which holds a given uncompressed offset, instead of at the
+   start of the file.  BZ2_bzIndexBuild writes it to a separate
+   file: the four bytes "BZX0", then for each block the bit
+   offset of its header in the compressed file (8 bytes), the
+   uncompressed offset of its first byte (8 bytes), the combined
+   CRC of the blocks before it in its stream (4 bytes) and the
+   block size of its stream (1 byte), all big-endian.  A final
+   entry with block size 0 gives the end of the data.  Carrying
+   the combined CRC keeps the end-of-stream check working on
+   streams which are entered part way through.
+--*/
+#ifdef _WIN32
+typedef unsigned __int64   BzOff;
+#else
+typedef unsigned long long BzOff;
+#endif
+
+#define BZ_IX_MAGIC "BZX0"
+#define BZ_IX_ENTRY 21
+
+typedef
+   struct {
+      BzOff  bitPos;
+      BzOff  outPos;
+      UInt32 combinedCRC;
+      Int32  blockSize100k;
+   }
+   BZ_IXENT;
+
 typedef 
    struct {
       FILE*     handle;
@@ -890,6 +2233,10 @@ typedef
       bz_stream strm;
       Int32     lastErr;
       Bool      initialisedOk;
+      BZ_IXENT* ix;
+      Int32     nIx;
+      BzOff     pos;
+      Bool      atEnd;
    }
    bzFile;
 
@@ -911,6 +2258,20 @@ BZFILE* BZ_API(BZ2_bzWriteOpen)
                       int   blockSize100k, 
                       int   verbosity,
                       int   workFactor )
+{
+   return BZ2_bzWriteOpenMT ( bzerror, f, blockSize100k, 
+                              verbosity, workFactor, 1 );
+}
+
+
+/*---------------------------------------------------*/
+BZFILE* BZ_API(BZ2_bzWriteOpenMT) 
+                    ( int*  bzerror,      
+                      FILE* f, 
+                      int   blockSize100k, 
+                      int   verbosity,
+                      int   workFactor,
+                      int   nThreads )
 {
    Int32   ret;
    bzFile* bzf = NULL;
@@ -919,8 +2280,10 @@ BZFILE* BZ_API(BZ2_bzWriteOpen)
 
    if (f == NULL ||
        (blockSize100k < 1 || blockSize100k > 9) ||
-       (workFactor < 0 || workFactor > 250) ||
-       (verbosity < 0 || verbosity > 4))
+       (workFactor < 0 ||
+        (workFactor > 250 && workFactor != BZ_WORK_SUFFIX)) ||
+       (verbosity < 0 || verbosity > 4) ||
+       (nThreads < 1 || nThreads > BZ_MAX_THREADS))
       { BZ_SETERR(BZ_PARAM_ERROR); return NULL; };
 
    if (ferror(f))
@@ -938,10 +2301,11 @@ BZFILE* BZ_API(BZ2_bzWriteOpen)
    bzf->strm.bzalloc  = NULL;
    bzf->strm.bzfree   = NULL;
    bzf->strm.opaque   = NULL;
+   bzf->ix            = NULL;
 
    if (workFactor == 0) workFactor = 30;
-   ret = BZ2_bzCompressInit ( &(bzf->strm), blockSize100k, 
-                              verbosity, workFactor );
+   ret = BZ2_bzCompressInitMT ( &(bzf->strm), blockSize100k, 
+                                verbosity, workFactor, nThreads );
    if (ret != BZ_OK)
       { BZ_SETERR(ret); free(bzf); return NULL; };
 
@@ -1083,6 +2447,21 @@ BZFILE* BZ_API(BZ2_bzReadOpen)
                      int   small,
                      void* unused,
                      int   nUnused )
+{
+   return BZ2_bzReadOpenMT ( bzerror, f, verbosity, small, 
+                             unused, nUnused, 1 );
+}
+
+
+/*---------------------------------------------------*/
+BZFILE* BZ_API(BZ2_bzReadOpenMT) 
+                   ( int*  bzerror, 
+                     FILE* f, 
+                     int   verbosity,
+                     int   small,
+                     void* unused,
+                     int   nUnused,
+                     int   nThreads )
 {
    bzFile* bzf = NULL;
    int     ret;
@@ -1093,7 +2472,8 @@ BZFILE* BZ_API(BZ2_bzReadOpen)
        (small != 0 && small != 1) ||
        (verbosity < 0 || verbosity > 4) ||
        (unused == NULL && nUnused != 0) ||
-       (unused != NULL && (nUnused < 0 || nUnused > BZ_MAX_UNUSED)))
+       (unused != NULL && (nUnused < 0 || nUnused > BZ_MAX_UNUSED)) ||
+       (nThreads < 1 || nThreads > BZ_MAX_THREADS))
       { BZ_SETERR(BZ_PARAM_ERROR); return NULL; };
 
    if (ferror(f))
@@ -1112,6 +2492,10 @@ BZFILE* BZ_API(BZ2_bzReadOpen)
    bzf->strm.bzalloc  = NULL;
    bzf->strm.bzfree   = NULL;
    bzf->strm.opaque   = NULL;
+   bzf->ix            = NULL;
+   bzf->nIx           = 0;
+   bzf->pos           = 0;
+   bzf->atEnd         = False;
    
    while (nUnused > 0) {
       bzf->buf[bzf->bufN] = *((UChar*)(unused)); bzf->bufN++;
@@ -1119,7 +2503,8 @@ BZFILE* BZ_API(BZ2_bzReadOpen)
       nUnused--;
    }
 
-   ret = BZ2_bzDecompressInit ( &(bzf->strm), verbosity, small );
+   ret = BZ2_bzDecompressInitMT ( &(bzf->strm), verbosity, small, 
+                                  nThreads );
    if (ret != BZ_OK)
       { BZ_SETERR(ret); free(bzf); return NULL; };
 
@@ -1145,10 +2530,90 @@ void BZ_API(BZ2_bzReadClose) ( int *bzerror, BZFILE *b )
 
    if (bzf->initialisedOk)
       (void)BZ2_bzDecompressEnd ( &(bzf->strm) );
+   if (bzf->ix != NULL) free ( bzf->ix );
    free ( bzf );
 }
 
 
+/*---------------------------------------------------*/
+static
+Int32 ix_find ( bzFile* bzf, BzOff outPos )
+{
+   /*-- the last entry whose block starts at or before outPos --*/
+   Int32 lo = 0, hi = bzf->nIx - 1, mid;
+
+   while (lo < hi) {
+      mid = (lo + hi + 1) >> 1;
+      if (bzf->ix[mid].outPos <= outPos) lo = mid; else hi = mid - 1;
+   }
+   return lo;
+}
+
+
+/*---------------------------------------------------*/
+static
+Int32 ix_enter ( bzFile* bzf, Int32 k )
+{
+   BZ_IXENT*  e    = &bzf->ix[k];
+   bz_stream* strm = &(bzf->strm);
+   DState*    s    = strm->state;
+   Int32      n    = 100000 * e->blockSize100k;
+   BzOff      at   = e->bitPos >> 3;
+#ifdef _WIN32
+   fpos_t     fp   = (fpos_t)at;
+
+   if (fsetpos ( bzf->handle, &fp ) != 0) return BZ_IO_ERROR;
+#else
+   if (fseeko ( bzf->handle, (off_t)at, SEEK_SET ) != 0)
+      return BZ_IO_ERROR;
+#endif
+   bzf->bufN = fread ( bzf->buf, sizeof(UChar),
+                       BZ_MAX_UNUSED, bzf->handle );
+   if (ferror(bzf->handle)) return BZ_IO_ERROR;
+   if (bzf->bufN == 0) return BZ_UNEXPECTED_EOF;
+   strm->avail_in = bzf->bufN;
+   strm->next_in  = bzf->buf;
+
+   if ((s->tt == NULL && s->ll16 == NULL) ||
+       s->blockSize100k != e->blockSize100k) {
+      if (s->tt   != NULL) BZFREE(s->tt);
+      if (s->ll16 != NULL) BZFREE(s->ll16);
+      if (s->ll4  != NULL) BZFREE(s->ll4);
+      s->tt   = NULL;
+      s->ll16 = NULL;
+      s->ll4  = NULL;
+      if (s->smallDecompress) {
+         s->ll16 = BZALLOC( n * sizeof(UInt16) );
+         s->ll4  = BZALLOC( ((1 + n) >> 1) * sizeof(UChar) );
+         if (s->ll16 == NULL || s->ll4 == NULL) return BZ_MEM_ERROR;
+      } else {
+         s->tt   = BZALLOC( n * sizeof(Int32) );
+         if (s->tt == NULL) return BZ_MEM_ERROR;
+      }
+      s->blockSize100k = e->blockSize100k;
+   }
+
+   BZ2_decompressBlockAt ( s, (Int32)(e->bitPos & 7) );
+   s->calculatedCombinedCRC = e->combinedCRC;
+   return BZ_OK;
+}
+
+
+/*---------------------------------------------------*/
+static
+Int32 ix_next_stream ( bzFile* bzf, Int32 nOut )
+{
+   /*-- a stream has ended nOut bytes into this read;
+        carry on with the next one, if there is one --*/
+   BzOff  outPos = bzf->pos + nOut;
+   Int32  k      = ix_find ( bzf, outPos );
+
+   if (bzf->ix[k].outPos != outPos) return BZ_DATA_ERROR;
+   if (k == bzf->nIx - 1) { bzf->atEnd = True; return BZ_STREAM_END; }
+   return ix_enter ( bzf, k );
+}
+
+
 /*---------------------------------------------------*/
 int BZ_API(BZ2_bzRead) 
            ( int*    bzerror, 
@@ -1170,6 +2635,9 @@ int BZ_API(BZ2_bzRead)
    if (len == 0)
       { BZ_SETERR(BZ_OK); return 0; };
 
+   if (bzf->atEnd)
+      { BZ_SETERR(BZ_STREAM_END); return 0; };
+
    bzf->strm.avail_out = len;
    bzf->strm.next_out = buf;
 
@@ -1197,11 +2665,18 @@ int BZ_API(BZ2_bzRead)
           bzf->strm.avail_in == 0 && bzf->strm.avail_out > 0)
          { BZ_SETERR(BZ_UNEXPECTED_EOF); return 0; };
 
+      if (ret == BZ_STREAM_END && bzf->ix != NULL) {
+         ret = ix_next_stream ( bzf, len - bzf->strm.avail_out );
+         if (ret != BZ_OK && ret != BZ_STREAM_END)
+            { BZ_SETERR(ret); return 0; };
+      }
+
       if (ret == BZ_STREAM_END)
          { BZ_SETERR(BZ_STREAM_END);
+           bzf->pos += len - bzf->strm.avail_out;
            return len - bzf->strm.avail_out; };
       if (bzf->strm.avail_out == 0)
-         { BZ_SETERR(BZ_OK); return len; };
+         { BZ_SETERR(BZ_OK); bzf->pos += len; return len; };
       
    }
 
@@ -1228,6 +2703,236 @@ void BZ_API(BZ2_bzReadGetUnused)
    *nUnused = bzf->strm.avail_in;
    *unused = bzf->strm.next_in;
 }
+
+
+/*---------------------------------------------------*/
+static
+Bool ix_write ( FILE* idx, BzOff bitPos, BzOff outPos,
+                UInt32 combinedCRC, Int32 blockSize100k )
+{
+   UChar rec[BZ_IX_ENTRY];
+   Int32 i;
+
+   for (i = 0; i < 8; i++) {
+      rec[i]     = (UChar)(bitPos >> (56 - 8 * i));
+      rec[8 + i] = (UChar)(outPos >> (56 - 8 * i));
+   }
+   for (i = 0; i < 4; i++)
+      rec[16 + i] = (UChar)(combinedCRC >> (24 - 8 * i));
+   rec[20] = (UChar)blockSize100k;
+   return (Bool)(fwrite ( rec, 1, BZ_IX_ENTRY, idx ) == BZ_IX_ENTRY);
+}
+
+
+/*---------------------------------------------------*/
+int BZ_API(BZ2_bzIndexBuild) ( FILE* f, FILE* idx )
+{
+   bz_stream strm;
+   DState*   s;
+   UChar     ibuf[BZ_MAX_UNUSED];
+   UChar     obuf[BZ_MAX_UNUSED];
+   BzOff     ibufPos = 0, outPos = 0, bitPos = 0;
+   Int32     n = 0, r, ret = BZ_OK;
+   Bool      first = True;
+
+   if (f == NULL || idx == NULL) return BZ_PARAM_ERROR;
+   if (fwrite ( BZ_IX_MAGIC, 1, 4, idx ) != 4) return BZ_IO_ERROR;
+
+   /*-- Decode each stream in turn, driving BZ2_decompress
+        directly so as to see every block start, and note the
+        file position of each block header as we come to it. --*/
+   strm.next_in  = (char*)ibuf;
+   strm.avail_in = 0;
+   while (True) {
+      if (strm.avail_in == 0) {
+         ibufPos += n;
+         n = fread ( ibuf, 1, BZ_MAX_UNUSED, f );
+         if (ferror(f)) return BZ_IO_ERROR;
+         strm.next_in  = (char*)ibuf;
+         strm.avail_in = n;
+         if (n == 0) break;
+      }
+
+      strm.bzalloc = NULL;
+      strm.bzfree  = NULL;
+      strm.opaque  = NULL;
+      ret = BZ2_bzDecompressInit ( &strm, 0, 0 );
+      if (ret != BZ_OK) return ret;
+      s = strm.state;
+
+      while (True) {
+         if (s->state == BZ_X_MAGIC_1 || s->state == BZ_X_BLKHDR_1)
+            bitPos = (ibufPos + ((UChar*)strm.next_in - ibuf)) * 8
+                     - s->bsLive + (s->state == BZ_X_MAGIC_1 ? 32 : 0);
+         r = BZ2_decompress ( s );
+         if (r == BZ_STREAM_END) {
+            if (s->calculatedCombinedCRC != s->storedCombinedCRC)
+               r = BZ_DATA_ERROR;
+            break;
+         }
+         if (r != BZ_OK) break;
+
+         if (s->state == BZ_X_OUTPUT) {
+            if (!ix_write ( idx, bitPos, outPos,
+                            s->calculatedCombinedCRC,
+                            s->blockSize100k ))
+               { r = BZ_IO_ERROR; break; }
+            do {
+               strm.next_out  = (char*)obuf;
+               strm.avail_out = BZ_MAX_UNUSED;
+               unRLE_obuf_to_output ( s );
+               outPos += BZ_MAX_UNUSED - strm.avail_out;
+               if (strm.avail_out == BZ_MAX_UNUSED) break;
+            } while (s->nblock_used != s->save_nblock+1 ||
+                     s->state_out_len != 0);
+            BZ_FINALISE_CRC ( s->calculatedBlockCRC );
+            if (s->calculatedBlockCRC != s->storedBlockCRC)
+               { r = BZ_DATA_ERROR; break; }
+            s->calculatedCombinedCRC
+               = (s->calculatedCombinedCRC << 1) |
+                    (s->calculatedCombinedCRC >> 31);
+            s->calculatedCombinedCRC ^= s->calculatedBlockCRC;
+            s->state = BZ_X_BLKHDR_1;
+            continue;
+         }
+
+         if (strm.avail_in == 0) {
+            ibufPos += n;
+            n = fread ( ibuf, 1, BZ_MAX_UNUSED, f );
+            if (ferror(f)) { r = BZ_IO_ERROR; break; }
+            if (n == 0) { r = BZ_UNEXPECTED_EOF; break; }
+            strm.next_in  = (char*)ibuf;
+            strm.avail_in = n;
+         }
+      }
+      BZ2_bzDecompressEnd ( &strm );
+
+      /*-- like bzip2, ignore trailing garbage after a stream --*/
+      if (r == BZ_DATA_ERROR_MAGIC && !first) break;
+      if (r != BZ_STREAM_END) return r;
+      first = False;
+      bitPos = (ibufPos + ((UChar*)strm.next_in - ibuf)) * 8;
+   }
+
+   if (first) return BZ_DATA_ERROR_MAGIC;
+   if (!ix_write ( idx, bitPos, outPos, 0, 0 )) return BZ_IO_ERROR;
+   if (fflush ( idx ) != 0) return BZ_IO_ERROR;
+   return BZ_OK;
+}
+
+
+/*---------------------------------------------------*/
+BZFILE* BZ_API(BZ2_bzSeekOpen)
+                   ( int*  bzerror,
+                     FILE* f,
+                     FILE* idx,
+                     int   verbosity,
+                     int   small )
+{
+   bzFile*   bzf = NULL;
+   BZ_IXENT* ix  = NULL;
+   BZ_IXENT* e;
+   UChar     rec[BZ_IX_ENTRY];
+   Int32     i, nIx = 0, cap = 0, ret = BZ_OK;
+
+   BZ_SETERR(BZ_OK);
+
+   if (f == NULL || idx == NULL ||
+       (small != 0 && small != 1) ||
+       (verbosity < 0 || verbosity > 4))
+      { BZ_SETERR(BZ_PARAM_ERROR); return NULL; };
+
+   if (fread ( rec, 1, 4, idx ) != 4 ||
+       memcmp ( rec, BZ_IX_MAGIC, 4 ) != 0)
+      { BZ_SETERR(ferror(idx) ? BZ_IO_ERROR : BZ_DATA_ERROR_MAGIC);
+        return NULL; };
+
+   /*-- Read entries up to the end marker, checking that they
+        are in order, since ix_find relies on it. --*/
+   while (True) {
+      if (fread ( rec, 1, BZ_IX_ENTRY, idx ) != BZ_IX_ENTRY)
+         { ret = ferror(idx) ? BZ_IO_ERROR : BZ_UNEXPECTED_EOF; break; };
+      if (nIx == cap) {
+         cap = cap == 0 ? 64 : 2 * cap;
+         e = realloc ( ix, cap * sizeof(BZ_IXENT) );
+         if (e == NULL) { ret = BZ_MEM_ERROR; break; };
+         ix = e;
+      }
+      e = &ix[nIx];
+      e->bitPos = e->outPos = 0;
+      e->combinedCRC = 0;
+      for (i = 0; i < 8; i++) {
+         e->bitPos = (e->bitPos << 8) | rec[i];
+         e->outPos = (e->outPos << 8) | rec[8 + i];
+      }
+      for (i = 0; i < 4; i++)
+         e->combinedCRC = (e->combinedCRC << 8) | rec[16 + i];
+      e->blockSize100k = rec[20];
+      if (e->blockSize100k > 9 ||
+          (nIx == 0 && e->outPos != 0) ||
+          (nIx > 0 && (e->outPos <= ix[nIx-1].outPos ||
+                       e->bitPos <= ix[nIx-1].bitPos)))
+         { ret = BZ_DATA_ERROR; break; };
+      nIx++;
+      if (e->blockSize100k == 0) break;
+   }
+   if (ret != BZ_OK)
+      { if (ix != NULL) free ( ix ); BZ_SETERR(ret); return NULL; };
+
+   bzf = BZ2_bzReadOpen ( bzerror, f, verbosity, small, NULL, 0 );
+   if (bzf == NULL) { free ( ix ); return NULL; };
+   bzf->ix  = ix;
+   bzf->nIx = nIx;
+
+   BZ2_bzSeek ( bzerror, bzf, 0, 0 );
+   if (bzf->lastErr != BZ_OK)
+      { ret = bzf->lastErr; BZ2_bzReadClose ( NULL, bzf );
+        if (bzerror != NULL) *bzerror = ret;
+        return NULL; };
+   return bzf;
+}
+
+
+/*---------------------------------------------------*/
+void BZ_API(BZ2_bzSeek)
+            ( int*         bzerror,
+              BZFILE*      b,
+              unsigned int offset_lo32,
+              unsigned int offset_hi32 )
+{
+   bzFile* bzf = (bzFile*)b;
+   BzOff   target = ((BzOff)offset_hi32 << 32) | offset_lo32;
+   Char    junk[BZ_MAX_UNUSED];
+   Int32   k, ret;
+
+   BZ_SETERR(BZ_OK);
+   if (bzf == NULL || bzf->ix == NULL)
+      { BZ_SETERR(BZ_PARAM_ERROR); return; };
+   if (bzf->writing)
+      { BZ_SETERR(BZ_SEQUENCE_ERROR); return; };
+
+   k = ix_find ( bzf, target );
+   if (k == bzf->nIx - 1) {
+      bzf->atEnd = True;
+      bzf->pos   = bzf->ix[k].outPos;
+      return;
+   }
+
+   ret = ix_enter ( bzf, k );
+   if (ret != BZ_OK) { BZ_SETERR(ret); return; };
+   bzf->atEnd = False;
+   bzf->pos   = bzf->ix[k].outPos;
+
+   /*-- decode and drop the part of the block before target --*/
+   while (bzf->pos < target) {
+      k = target - bzf->pos < BZ_MAX_UNUSED
+             ? (Int32)(target - bzf->pos) : BZ_MAX_UNUSED;
+      BZ2_bzRead ( bzerror, b, junk, k );
+      if (bzf->lastErr == BZ_STREAM_END)
+         { BZ_SETERR(BZ_DATA_ERROR); return; };
+      if (bzf->lastErr != BZ_OK) return;
+   }
+}
 #endif
 
 
@@ -1252,7 +2957,8 @@ int BZ_API(BZ2_bzBuffToBuffCompress)
        source == NULL ||
        blockSize100k < 1 || blockSize100k > 9 ||
        verbosity < 0 || verbosity > 4 ||
-       workFactor < 0 || workFactor > 250) 
+       workFactor < 0 ||
+       (workFactor > 250 && workFactor != BZ_WORK_SUFFIX)) 
       return BZ_PARAM_ERROR;
 
    if (workFactor == 0) workFactor = 30;
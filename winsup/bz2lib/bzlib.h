@@ -85,6 +85,11 @@ extern "C" {
 #define BZ_OUTBUFF_FULL      (-8)
 #define BZ_CONFIG_ERROR      (-9)
 
+#define BZ_MAX_THREADS       64
+
+/*-- workFactor value selecting the suffix-array block sorter --*/
+#define BZ_WORK_SUFFIX       251
+
 typedef 
    struct {
       char *next_in;
@@ -140,6 +145,14 @@ BZ_EXTERN int BZ_API(BZ2_bzCompressInit) (
       int        workFactor 
    );
 
+BZ_EXTERN int BZ_API(BZ2_bzCompressInitMT) ( 
+      bz_stream* strm, 
+      int        blockSize100k, 
+      int        verbosity, 
+      int        workFactor,
+      int        nThreads
+   );
+
 BZ_EXTERN int BZ_API(BZ2_bzCompress) ( 
       bz_stream* strm, 
       int action 
@@ -155,6 +168,13 @@ BZ_EXTERN int BZ_API(BZ2_bzDecompressInit) (
       int       small
    );
 
+BZ_EXTERN int BZ_API(BZ2_bzDecompressInitMT) ( 
+      bz_stream *strm, 
+      int       verbosity, 
+      int       small,
+      int       nThreads
+   );
+
 BZ_EXTERN int BZ_API(BZ2_bzDecompress) ( 
       bz_stream* strm 
    );
@@ -181,6 +201,16 @@ BZ_EXTERN BZFILE* BZ_API(BZ2_bzReadOpen) (
       int   nUnused 
    );
 
+BZ_EXTERN BZFILE* BZ_API(BZ2_bzReadOpenMT) ( 
+      int*  bzerror,   
+      FILE* f, 
+      int   verbosity, 
+      int   small,
+      void* unused,    
+      int   nUnused,
+      int   nThreads
+   );
+
 BZ_EXTERN void BZ_API(BZ2_bzReadClose) ( 
       int*    bzerror, 
       BZFILE* b 
@@ -200,6 +230,26 @@ BZ_EXTERN int BZ_API(BZ2_bzRead) (
       int     len 
    );
 
+BZ_EXTERN int BZ_API(BZ2_bzIndexBuild) (
+      FILE* f,
+      FILE* idx
+   );
+
+BZ_EXTERN BZFILE* BZ_API(BZ2_bzSeekOpen) (
+      int*  bzerror,
+      FILE* f,
+      FILE* idx,
+      int   verbosity,
+      int   small
+   );
+
+BZ_EXTERN void BZ_API(BZ2_bzSeek) (
+      int*         bzerror,
+      BZFILE*      b,
+      unsigned int offset_lo32,
+      unsigned int offset_hi32
+   );
+
 BZ_EXTERN BZFILE* BZ_API(BZ2_bzWriteOpen) ( 
       int*  bzerror,      
       FILE* f, 
@@ -208,6 +258,15 @@ BZ_EXTERN BZFILE* BZ_API(BZ2_bzWriteOpen) (
       int   workFactor 
    );
 
+BZ_EXTERN BZFILE* BZ_API(BZ2_bzWriteOpenMT) ( 
+      int*  bzerror,      
+      FILE* f, 
+      int   blockSize100k, 
+      int   verbosity, 
+      int   workFactor,
+      int   nThreads
+   );
+
 BZ_EXTERN void BZ_API(BZ2_bzWrite) ( 
       int*    bzerror, 
       BZFILE* b, 
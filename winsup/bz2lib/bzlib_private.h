@@ -151,6 +151,9 @@ extern void bz_internal_error ( int errcode );
 
 #define BZ_MAX_SELECTORS (2 + (900000 / BZ_G_SIZE))
 
+/*-- Codes this long or shorter decode in one table probe. --*/
+#define BZ_LOOKUP_BITS 10
+
 
 
 /*-- Stuff for randomising repetitive blocks. --*/
@@ -180,6 +183,13 @@ extern Int32 BZ2_rNums[512];
 /*-- Stuff for doing CRCs. --*/
 
 extern UInt32 BZ2_crc32Table[256];
+extern UInt32 BZ2_crc32Slice[8][256];
+
+extern UInt32 
+BZ2_crc32Update ( UInt32, UChar*, Int32 );
+
+extern UInt32 
+BZ2_crc32Combine ( UInt32, UInt32, UInt32 );
 
 #define BZ_INITIALISE_CRC(crcVar)              \
 {                                              \
@@ -215,6 +225,9 @@ extern UInt32 BZ2_crc32Table[256];
 #define BZ_N_SHELL 18
 #define BZ_N_OVERSHOOT (BZ_N_RADIX + BZ_N_QSORT + BZ_N_SHELL + 2)
 
+/*-- UInt32s of workspace for the suffix-array sorter --*/
+#define BZ_SA_WORK(nn) ((nn) + ((nn) >> 4) + 320)
+
 
 
 
@@ -247,6 +260,7 @@ typedef
 
       /* for deciding when to use the fallback sorting algorithm */
       Int32    workFactor;
+      UInt32*  sawork;
 
       /* run-length-encoding of the input */
       UInt32   state_in_ch;
@@ -289,6 +303,9 @@ typedef
       /* second dimension: only 3 needed; 4 makes index calculations faster */
       UInt32   len_pack[BZ_MAX_ALPHA_SIZE][4];
 
+      /* worker threads and their blocks; NULL when serial */
+      struct bz_pool* pool;
+
    }
    EState;
 
@@ -305,6 +322,18 @@ BZ2_compressBlock ( EState*, Bool );
 extern void 
 BZ2_bsInitWrite ( EState* );
 
+extern void 
+BZ2_compressBlockMT ( EState* );
+
+extern void 
+BZ2_spliceBlockMT ( EState*, EState* );
+
+extern void 
+BZ2_compressHeaderMT ( EState*, UChar* );
+
+extern void 
+BZ2_compressTrailerMT ( EState*, UChar* );
+
 extern void 
 BZ2_hbAssignCodes ( Int32*, UChar*, Int32, Int32, Int32 );
 
@@ -434,6 +463,7 @@ typedef
       Int32    base   [BZ_N_GROUPS][BZ_MAX_ALPHA_SIZE];
       Int32    perm   [BZ_N_GROUPS][BZ_MAX_ALPHA_SIZE];
       Int32    minLens[BZ_N_GROUPS];
+      UInt16   lookup [BZ_N_GROUPS][1 << BZ_LOOKUP_BITS];
 
       /* save area for scalars in the main decompress code */
       Int32    save_i;
@@ -461,6 +491,9 @@ typedef
       Int32*   save_gBase;
       Int32*   save_gPerm;
 
+      /* worker threads and their blocks; NULL when serial */
+      struct bz_dpool* pool;
+
    }
    DState;
 
@@ -508,10 +541,17 @@ BZ2_indexIntoF ( Int32, Int32* );
 extern Int32 
 BZ2_decompress ( DState* );
 
+extern void 
+BZ2_decompressBlockAt ( DState*, Int32 );
+
 extern void 
 BZ2_hbCreateDecodeTables ( Int32*, Int32*, Int32*, UChar*,
                            Int32,  Int32, Int32 );
 
+extern void 
+BZ2_hbCreateLookupTable ( UInt16*, Int32*, Int32*, Int32*,
+                          Int32 );
+
 
 #endif
 
@@ -640,6 +640,59 @@ void sendMTFValues ( EState* s )
 }
 
 
+/*---------------------------------------------------*/
+static
+void writeStreamHeader ( EState* s )
+{
+   bsPutUChar ( s, 'B' );
+   bsPutUChar ( s, 'Z' );
+   bsPutUChar ( s, 'h' );
+   bsPutUChar ( s, (UChar)('0' + s->blockSize100k) );
+}
+
+
+/*---------------------------------------------------*/
+static
+void writeBlock ( EState* s )
+{
+   bsPutUChar ( s, 0x31 ); bsPutUChar ( s, 0x41 );
+   bsPutUChar ( s, 0x59 ); bsPutUChar ( s, 0x26 );
+   bsPutUChar ( s, 0x53 ); bsPutUChar ( s, 0x59 );
+
+   /*-- Now the block's CRC, so it is in a known place. --*/
+   bsPutUInt32 ( s, s->blockCRC );
+
+   /*-- 
+      Now a single bit indicating (non-)randomisation. 
+      As of version 0.9.5, we use a better sorting algorithm
+      which makes randomisation unnecessary.  So always set
+      the randomised bit to 'no'.  Of course, the decoder
+      still needs to be able to handle randomised blocks
+      so as to maintain backwards compatibility with
+      older versions of bzip2.
+   --*/
+   bsW(s,1,0);
+
+   bsW ( s, 24, s->origPtr );
+   generateMTFValues ( s );
+   sendMTFValues ( s );
+}
+
+
+/*---------------------------------------------------*/
+static
+void writeStreamTrailer ( EState* s )
+{
+   bsPutUChar ( s, 0x17 ); bsPutUChar ( s, 0x72 );
+   bsPutUChar ( s, 0x45 ); bsPutUChar ( s, 0x38 );
+   bsPutUChar ( s, 0x50 ); bsPutUChar ( s, 0x90 );
+   bsPutUInt32 ( s, s->combinedCRC );
+   if (s->verbosity >= 2)
+      VPrintf1( "    final combined CRC = 0x%x\n   ", s->combinedCRC );
+   bsFinishWrite ( s );
+}
+
+
 /*---------------------------------------------------*/
 void BZ2_compressBlock ( EState* s, Bool is_last_block )
 {
@@ -663,49 +716,111 @@ void BZ2_compressBlock ( EState* s, Bool is_last_block )
    /*-- If this is the first block, create the stream header. --*/
    if (s->blockNo == 1) {
       BZ2_bsInitWrite ( s );
-      bsPutUChar ( s, 'B' );
-      bsPutUChar ( s, 'Z' );
-      bsPutUChar ( s, 'h' );
-      bsPutUChar ( s, (UChar)('0' + s->blockSize100k) );
+      writeStreamHeader ( s );
    }
 
-   if (s->nblock > 0) {
+   if (s->nblock > 0) writeBlock ( s );
 
-      bsPutUChar ( s, 0x31 ); bsPutUChar ( s, 0x41 );
-      bsPutUChar ( s, 0x59 ); bsPutUChar ( s, 0x26 );
-      bsPutUChar ( s, 0x53 ); bsPutUChar ( s, 0x59 );
-
-      /*-- Now the block's CRC, so it is in a known place. --*/
-      bsPutUInt32 ( s, s->blockCRC );
-
-      /*-- 
-         Now a single bit indicating (non-)randomisation. 
-         As of version 0.9.5, we use a better sorting algorithm
-         which makes randomisation unnecessary.  So always set
-         the randomised bit to 'no'.  Of course, the decoder
-         still needs to be able to handle randomised blocks
-         so as to maintain backwards compatibility with
-         older versions of bzip2.
-      --*/
-      bsW(s,1,0);
+   /*-- If this is the last block, add the stream trailer. --*/
+   if (is_last_block) writeStreamTrailer ( s );
+}
 
-      bsW ( s, 24, s->origPtr );
-      generateMTFValues ( s );
-      sendMTFValues ( s );
-   }
 
+/*---------------------------------------------------*/
+/*--- Compressing blocks on worker threads        ---*/
+/*---------------------------------------------------*/
 
-   /*-- If this is the last block, add the stream trailer. --*/
-   if (is_last_block) {
+/*--
+   In parallel mode each block is coded by a worker into
+   its own EState, starting at bit 0 of its own zbits, by
+   BZ2_compressBlockMT.  The EState belonging to the stream
+   then takes the finished blocks in order and splices each
+   one onto the bits left over from the previous one with
+   BZ2_spliceBlockMT.  The result is bit-for-bit the stream
+   that BZ2_compressBlock would have made.
+--*/
 
-      bsPutUChar ( s, 0x17 ); bsPutUChar ( s, 0x72 );
-      bsPutUChar ( s, 0x45 ); bsPutUChar ( s, 0x38 );
-      bsPutUChar ( s, 0x50 ); bsPutUChar ( s, 0x90 );
-      bsPutUInt32 ( s, s->combinedCRC );
-      if (s->verbosity >= 2)
-         VPrintf1( "    final combined CRC = 0x%x\n   ", s->combinedCRC );
-      bsFinishWrite ( s );
+/*---------------------------------------------------*/
+void BZ2_compressBlockMT ( EState* s )
+{
+   BZ_FINALISE_CRC ( s->blockCRC );
+   BZ2_blockSort ( s );
+
+   s->zbits = (UChar*) (&((UChar*)s->arr2)[s->nblock]);
+   s->numZ  = 0;
+   BZ2_bsInitWrite ( s );
+   writeBlock ( s );
+
+   /*-- Leave at most 7 bits for the splice. --*/
+   bsNEEDW ( 0 );
+}
+
+
+/*---------------------------------------------------*/
+void BZ2_spliceBlockMT ( EState* s, EState* b )
+{
+   UChar* z    = b->zbits;
+   Int32  nz   = b->numZ;
+   UInt32 buff = s->bsBuff;
+   Int32  live = s->bsLive;
+   Int32  i;
+
+   s->combinedCRC = (s->combinedCRC << 1) | (s->combinedCRC >> 31);
+   s->combinedCRC ^= b->blockCRC;
+
+   if (s->verbosity >= 2)
+      VPrintf4( "    block %d: crc = 0x%8x, "
+                "combined CRC = 0x%8x, size = %d\n",
+                b->blockNo, b->blockCRC, s->combinedCRC, b->nblock );
+
+   /*-- 
+      Shift b's bytes right by the live bits, in place.  The
+      byte written never lies beyond the one just read.
+   --*/
+   if (live > 0) {
+      for (i = 0; i < nz; i++) {
+         buff |= ((UInt32)z[i]) << (24 - live);
+         z[i] = (UChar)(buff >> 24);
+         buff <<= 8;
+      }
+   }
+
+   buff |= b->bsBuff >> live;
+   live += b->bsLive;
+   if (live >= 8) {
+      z[nz] = (UChar)(buff >> 24);
+      nz++;
+      buff <<= 8;
+      live -= 8;
    }
+
+   s->bsBuff        = buff;
+   s->bsLive        = live;
+   s->zbits         = z;
+   s->numZ          = nz;
+   s->state_out_pos = 0;
+}
+
+
+/*---------------------------------------------------*/
+void BZ2_compressHeaderMT ( EState* s, UChar* buf )
+{
+   s->zbits         = buf;
+   s->numZ          = 0;
+   s->state_out_pos = 0;
+   BZ2_bsInitWrite ( s );
+   writeStreamHeader ( s );
+   bsNEEDW ( 0 );
+}
+
+
+/*---------------------------------------------------*/
+void BZ2_compressTrailerMT ( EState* s, UChar* buf )
+{
+   s->zbits         = buf;
+   s->numZ          = 0;
+   s->state_out_pos = 0;
+   writeStreamTrailer ( s );
 }
 
 
@@ -0,0 +1,102 @@
+
+/* Check and time the block CRC: one byte at a time through
+   BZ2_crc32Table, as bzip2 did up to now, against the eight
+   bytes at a time BZ2_crc32Update.  Also checks that
+   BZ2_crc32Combine joins the CRCs of split buffers correctly.
+   Build with `make crcbench' and run with no arguments.
+   On x86 with gcc it reports bytes per cycle, elsewhere
+   megabytes per second.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "bzlib_private.h"
+
+#define N_BUF   1000000
+#define N_PASS  64
+
+UChar buf[N_BUF];
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+static unsigned long long cycles ( void )
+{
+   unsigned int lo, hi;
+   __asm__ __volatile__ ( "rdtsc" : "=a" (lo), "=d" (hi) );
+   return ((unsigned long long)hi << 32) | lo;
+}
+#define HAVE_CYCLES
+#endif
+
+static UInt32 crcBytewise ( UChar* p, Int32 n )
+{
+   UInt32 crc;
+   BZ_INITIALISE_CRC ( crc );
+   while (n-- > 0) { BZ_UPDATE_CRC ( crc, *p ); p++; }
+   BZ_FINALISE_CRC ( crc );
+   return crc;
+}
+
+static UInt32 crcSliced ( UChar* p, Int32 n )
+{
+   UInt32 crc;
+   BZ_INITIALISE_CRC ( crc );
+   crc = BZ2_crc32Update ( crc, p, n );
+   BZ_FINALISE_CRC ( crc );
+   return crc;
+}
+
+static void bench ( char* name, UInt32 (*fn)(UChar*, Int32) )
+{
+   clock_t  t0;
+   double   secs;
+   UInt32   sum = 0;
+   Int32    i;
+#ifdef HAVE_CYCLES
+   unsigned long long c0 = cycles();
+#endif
+
+   t0 = clock();
+   for (i = 0; i < N_PASS; i++) sum += fn ( buf, N_BUF - (i & 7) );
+   secs = (double)(clock() - t0) / CLOCKS_PER_SEC;
+#ifdef HAVE_CYCLES
+   printf ( "%-10s %8.3f bytes/cycle", name,
+            (double)N_PASS * N_BUF / (double)(cycles() - c0) );
+#else
+   printf ( "%-10s", name );
+#endif
+   printf ( " %8.1f MB/s  (%08x)\n",
+            secs > 0 ? N_PASS * (N_BUF / 1000000.0) / secs : 0.0, sum );
+}
+
+int main ( int argc, char** argv )
+{
+   Int32  i, n, off, cut, bad = 0;
+   UInt32 whole, a, b;
+
+   srand ( 1 );
+   for (i = 0; i < N_BUF; i++) buf[i] = (UChar)rand();
+
+   for (i = 0; i < 20000; i++) {
+      n     = rand() % 300;
+      off   = rand() % 8;
+      cut   = n > 0 ? rand() % (n + 1) : 0;
+      whole = crcBytewise ( buf + off, n );
+      if (crcSliced ( buf + off, n ) != whole) bad++;
+      a = crcSliced ( buf + off, cut );
+      b = crcSliced ( buf + off + cut, n - cut );
+      if (BZ2_crc32Combine ( a, b, n - cut ) != whole) bad++;
+   }
+   whole = crcBytewise ( buf, N_BUF );
+   if (BZ2_crc32Combine ( crcSliced ( buf, 123457 ),
+                          crcSliced ( buf + 123457, N_BUF - 123457 ),
+                          N_BUF - 123457 ) != whole) bad++;
+   if (bad) {
+      printf ( "crcbench: %d mismatches\n", bad );
+      return 1;
+   }
+
+   bench ( "bytewise", crcBytewise );
+   bench ( "slice-8",  crcSliced );
+   return 0;
+}
@@ -111,6 +111,13 @@ void makeMaps_d ( DState* s )
    GET_BITS(lll,uuu,1)
 
 /*---------------------------------------------------*/
+/*--
+   Tops bsBuff up from whatever input there is, then
+   tries the group's lookup table; codes it can't
+   resolve go bit by bit, which is also the only
+   way out for want of input, so the BZ_X_MTF_*
+   states resume exactly as before.
+--*/
 #define GET_MTF_VAL(label1,label2,lval)           \
 {                                                 \
    if (groupPos == 0) {                           \
@@ -125,6 +132,29 @@ void makeMaps_d ( DState* s )
       gBase = &(s->base[gSel][0]);                \
    }                                              \
    groupPos--;                                    \
+   while (s->bsLive <= 24 &&                      \
+          s->strm->avail_in > 0) {                \
+      s->bsBuff                                   \
+         = (s->bsBuff << 8) |                     \
+           ((UInt32)                              \
+              (*((UChar*)(s->strm->next_in))));   \
+      s->bsLive += 8;                             \
+      s->strm->next_in++;                         \
+      s->strm->avail_in--;                        \
+      s->strm->total_in_lo32++;                   \
+      if (s->strm->total_in_lo32 == 0)            \
+         s->strm->total_in_hi32++;                \
+   }                                              \
+   zn = 0;                                        \
+   if (s->bsLive >= BZ_LOOKUP_BITS)               \
+      zn = s->lookup[gSel]                        \
+              [(s->bsBuff >>                      \
+                (s->bsLive - BZ_LOOKUP_BITS))     \
+               & ((1 << BZ_LOOKUP_BITS) - 1)];    \
+   if (zn != 0) {                                 \
+      s->bsLive -= zn >> 9;                       \
+      lval = zn & 0x1ff;                          \
+   } else {                                       \
    zn = gMinlen;                                  \
    GET_BITS(label1, zvec, zn);                    \
    while (1) {                                    \
@@ -139,6 +169,60 @@ void makeMaps_d ( DState* s )
        || zvec - gBase[zn] >= BZ_MAX_ALPHA_SIZE)  \
       RETURN(BZ_DATA_ERROR);                      \
    lval = gPerm[zvec - gBase[zn]];                \
+   }                                              \
+}
+
+
+/*---------------------------------------------------*/
+static
+void initSaveArea ( DState* s )
+{
+   s->save_i           = 0;
+   s->save_j           = 0;
+   s->save_t           = 0;
+   s->save_alphaSize   = 0;
+   s->save_nGroups     = 0;
+   s->save_nSelectors  = 0;
+   s->save_EOB         = 0;
+   s->save_groupNo     = 0;
+   s->save_groupPos    = 0;
+   s->save_nextSym     = 0;
+   s->save_nblockMAX   = 0;
+   s->save_nblock      = 0;
+   s->save_es          = 0;
+   s->save_N           = 0;
+   s->save_curr        = 0;
+   s->save_zt          = 0;
+   s->save_zn          = 0;
+   s->save_zvec        = 0;
+   s->save_zj          = 0;
+   s->save_gSel        = 0;
+   s->save_gMinlen     = 0;
+   s->save_gLimit      = NULL;
+   s->save_gBase       = NULL;
+   s->save_gPerm       = NULL;
+}
+
+
+/*---------------------------------------------------*/
+/*--
+   Make s decode a single block whose header starts
+   skip bits into the next byte of s->strm's input,
+   without having seen the stream header.  The caller
+   sets blockSize100k and allocates tt or ll16/ll4.
+--*/
+void BZ2_decompressBlockAt ( DState* s, Int32 skip )
+{
+   bz_stream* strm = s->strm;
+
+   initSaveArea ( s );
+   s->state  = BZ_X_BLKHDR_1;
+   s->bsBuff = (UInt32)(*((UChar*)(strm->next_in)));
+   s->bsLive = 8 - skip;
+   strm->next_in++;
+   strm->avail_in--;
+   strm->total_in_lo32++;
+   if (strm->total_in_lo32 == 0) strm->total_in_hi32++;
 }
 
 
@@ -176,33 +260,7 @@ Int32 BZ2_decompress ( DState* s )
    Int32* gBase;
    Int32* gPerm;
 
-   if (s->state == BZ_X_MAGIC_1) {
-      /*initialise the save area*/
-      s->save_i           = 0;
-      s->save_j           = 0;
-      s->save_t           = 0;
-      s->save_alphaSize   = 0;
-      s->save_nGroups     = 0;
-      s->save_nSelectors  = 0;
-      s->save_EOB         = 0;
-      s->save_groupNo     = 0;
-      s->save_groupPos    = 0;
-      s->save_nextSym     = 0;
-      s->save_nblockMAX   = 0;
-      s->save_nblock      = 0;
-      s->save_es          = 0;
-      s->save_N           = 0;
-      s->save_curr        = 0;
-      s->save_zt          = 0;
-      s->save_zn          = 0;
-      s->save_zvec        = 0;
-      s->save_zj          = 0;
-      s->save_gSel        = 0;
-      s->save_gMinlen     = 0;
-      s->save_gLimit      = NULL;
-      s->save_gBase       = NULL;
-      s->save_gPerm       = NULL;
-   }
+   if (s->state == BZ_X_MAGIC_1) initSaveArea ( s );
 
    /*restore from the save area*/
    i           = s->save_i;
@@ -383,6 +441,13 @@ Int32 BZ2_decompress ( DState* s )
             &(s->len[t][0]),
             minLen, maxLen, alphaSize
          );
+         BZ2_hbCreateLookupTable (
+            &(s->lookup[t][0]),
+            &(s->limit[t][0]), 
+            &(s->base[t][0]), 
+            &(s->perm[t][0]),
+            minLen
+         );
          s->minLens[t] = minLen;
       }
 
@@ -432,20 +497,15 @@ Int32 BZ2_decompress ( DState* s )
             uc = s->seqToUnseq[ s->mtfa[s->mtfbase[0]] ];
             s->unzftab[uc] += es;
 
-            if (s->smallDecompress)
-               while (es > 0) {
-                  if (nblock >= nblockMAX) RETURN(BZ_DATA_ERROR);
-                  s->ll16[nblock] = (UInt16)uc;
-                  nblock++;
-                  es--;
-               }
-            else
-               while (es > 0) {
-                  if (nblock >= nblockMAX) RETURN(BZ_DATA_ERROR);
-                  s->tt[nblock] = (UInt32)uc;
-                  nblock++;
-                  es--;
-               };
+            if (es > 0 && es > nblockMAX - nblock)
+               RETURN(BZ_DATA_ERROR);
+            if (s->smallDecompress) {
+               UInt16* ll16 = s->ll16;
+               while (es > 0) { ll16[nblock++] = (UInt16)uc; es--; }
+            } else {
+               UInt32* tt = s->tt;
+               while (es > 0) { tt[nblock++] = (UInt32)uc; es--; }
+            }
 
             continue;
 
@@ -570,11 +630,19 @@ Int32 BZ2_decompress ( DState* s )
 
       } else {
 
-         /*-- compute the T^(-1) vector --*/
-         for (i = 0; i < nblock; i++) {
-            uc = (UChar)(s->tt[i] & 0xff);
-            s->tt[s->cftab[uc]] |= (i << 8);
-            s->cftab[uc]++;
+         /*-- compute the T^(-1) vector.  tt[i] keeps its byte
+              in the low 8 bits, so each step of the output
+              walk is a single load.  Work from local copies,
+              which the stores to tt can't be aliasing. --*/
+         {
+            UInt32* tt = s->tt;
+            Int32   cc[256];
+            for (i = 0; i < 256; i++) cc[i] = s->cftab[i];
+            for (i = 0; i < nblock; i++) {
+               uc = (UChar)(tt[i] & 0xff);
+               tt[cc[uc]] |= (i << 8);
+               cc[uc]++;
+            }
          }
 
          s->tPos = s->tt[s->origPtr] >> 8;
@@ -223,6 +223,40 @@ void BZ2_hbCreateDecodeTables ( Int32 *limit,
 }
 
 
+/*---------------------------------------------------*/
+/*--
+   For every BZ_LOOKUP_BITS-bit window of the input,
+   the symbol and code length that decoding it with
+   limit/base/perm would give, as (length << 9) | symbol,
+   or 0 if that takes more bits or finds a bad code.
+   Worked out by the same steps as the bit-at-a-time
+   decoder, so even corrupt tables decode the same.
+--*/
+void BZ2_hbCreateLookupTable ( UInt16 *lookup,
+                               Int32 *limit,
+                               Int32 *base,
+                               Int32 *perm,
+                               Int32 minLen )
+{
+   Int32 w, n, zvec, sym;
+
+   for (w = 0; w < (1 << BZ_LOOKUP_BITS); w++) {
+      lookup[w] = 0;
+      for (n = minLen; n <= BZ_LOOKUP_BITS; n++) {
+         zvec = w >> (BZ_LOOKUP_BITS - n);
+         if (zvec > limit[n]) continue;
+         if (zvec - base[n] >= 0 &&
+             zvec - base[n] < BZ_MAX_ALPHA_SIZE) {
+            sym = perm[zvec - base[n]];
+            if (sym >= 0 && sym < 512)
+               lookup[w] = (UInt16)((n << 9) | sym);
+         }
+         break;
+      }
+   }
+}
+
+
 /*-------------------------------------------------------------*/
 /*--- end                                         huffman.c ---*/
 /*-------------------------------------------------------------*/
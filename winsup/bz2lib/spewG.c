@@ -7,6 +7,8 @@
    time.  Note: *don't* bother with --exponential when compressing 
    Real Files; it'll just waste a lot of CPU time :-)
    (but is otherwise harmless).
+   An argument gives the number of megabytes instead; `make bench'
+   uses a small one as its highly repetitive sample.
 */
 
 #define _FILE_OFFSET_BITS 64
@@ -22,10 +24,11 @@ char buf[N_BUF];
 
 int main ( int argc, char** argv )
 {
-   int ii, kk, p;
+   int ii, kk, p, mb;
+   mb = argc > 1 ? atoi ( argv[1] ) : MEGABYTES;
    srandom(1);
    setbuffer ( stdout, buf, N_BUF );
-   for (kk = 0; kk < MEGABYTES * 515; kk+=3) {
+   for (kk = 0; kk < mb * 515; kk+=3) {
       p = 25+random()%50;
       for (ii = 0; ii < p; ii++)
          printf ( "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa" );
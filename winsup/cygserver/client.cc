@@ -22,6 +22,8 @@ details. */
 #include <unistd.h>
 
 #include "cygerrno.h"
+#include "cygserver_msg.h"
+#include "cygserver_sem.h"
 #include "cygserver_shm.h"
 #include "safe_memory.h"
 
@@ -288,6 +290,12 @@ client_request::handle_request (transport_layer_base *const conn,
     case CYGSERVER_REQUEST_SHM:
       req = safe_new0 (client_request_shm);
       break;
+    case CYGSERVER_REQUEST_MSG:
+      req = safe_new0 (client_request_msg);
+      break;
+    case CYGSERVER_REQUEST_SEM:
+      req = safe_new0 (client_request_sem);
+      break;
     default:
       syscall_printf ("unknown request code %d received: request ignored",
 		      header.request_code);
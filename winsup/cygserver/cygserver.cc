@@ -22,6 +22,7 @@ details. */
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/cygwin.h>
 
 #include "cygerrno.h"
 #include "cygwin_version.h"
@@ -523,6 +524,26 @@ handle_signal (const int signum)
   shutdown_server = true;
 }
 
+/*
+ * loadavg_sampler ()
+ *
+ * The DLL samples the load averages when they are read and the last
+ * sample is stale, which is only as good as the reading is regular.
+ * Sample them on a timer instead, every LOADAVG_INTERVAL (in the DLL's
+ * loadavg.h) seconds.
+ */
+
+static DWORD WINAPI
+loadavg_sampler (LPVOID)
+{
+  while (!shutdown_server)
+    {
+      cygwin_internal (CW_SAMPLE_LOADAVG);
+      Sleep (5 * 1000);
+    }
+  return 0;
+}
+
 /*
  * print_usage ()
  */
@@ -743,6 +764,15 @@ main (const int argc, char *argv[])
   request_queue.start ();
   printf (".");
 
+  DWORD tid;
+  HANDLE sampler = CreateThread (NULL, 0, loadavg_sampler, NULL, 0, &tid);
+  if (sampler)
+    CloseHandle (sampler);
+  else
+    debug_printf ("failed to start load average sampler, error = %lu",
+		  GetLastError ());
+  printf (".");
+
   printf ("complete\n");
 
   /* TODO: wait on multiple objects - the thread handle for each
@@ -15,6 +15,7 @@ details. */
 
 #include <assert.h>
 #include <limits.h>		/* For OPEN_MAX. */
+#include <string.h>
 
 /*
  * The sysv ipc id's (msgid, semid, shmid) are integers arranged such
@@ -81,4 +82,124 @@ ipc_ext2int (const int extid, const ipc_subsys_t subsys)
     return ((extid & (IPCMNI - 1)) - OPEN_MAX) / IPC_SUBSYS_COUNT;
 }
 
+/*
+ * The msg and sem subsystems keep the state of each queue and set in
+ * a file mapping that cygserver shares with every attached process,
+ * so that operations which don't have to block are performed without
+ * a round trip to the server.  The mapping is guarded by a spin lock
+ * which holds the winpid of its owner, so that cygserver can release
+ * it on behalf of a process that died while holding it.
+ */
+
+inline void
+ipc_lock_shared (volatile LONG & lock)
+{
+  const LONG winpid = GetCurrentProcessId ();
+
+  for (int spins = 0;
+       InterlockedCompareExchange ((LONG *) &lock, winpid, 0);
+       spins++)
+    Sleep (spins < 64 ? 0 : 1);
+}
+
+inline void
+ipc_unlock_shared (volatile LONG & lock)
+{
+  InterlockedExchange ((LONG *) &lock, 0);
+}
+
+inline void
+ipc_break_shared (volatile LONG & lock, const DWORD winpid)
+{
+  InterlockedCompareExchange ((LONG *) &lock, 0, winpid);
+}
+
+/*
+ * Processes blocked on a queue or set enter themselves in the
+ * object's wait list and sleep on a per-thread named event.  Whoever
+ * changes the state of the object sets the events of the waiters
+ * concerned, and removes them from the list, while holding the lock;
+ * the waiters then recheck the state.  The `what' field is subsystem
+ * specific.
+ */
+
+enum
+  {
+    IPC_WAITERS = 64		// Wait list entries per queue or set.
+  };
+
+struct ipc_waiter_t
+{
+  DWORD winpid;			// 0 if the entry is unused.
+  DWORD tid;
+  int what;
+};
+
+inline char *
+ipc_wait_name (char *const buf, const DWORD winpid, const DWORD tid)
+{
+  static const char prefix[] = "cygwin.ipc.wait.";
+  static const char digits[] = "0123456789abcdef";
+
+  char *cp = buf;
+  if (wincap.has_terminal_services ())
+    {
+      strcpy (cp, "Global\\");
+      cp += 7;
+    }
+  strcpy (cp, prefix);
+  cp += sizeof (prefix) - 1;
+  for (int shift = 28; shift >= 0; shift -= 4)
+    *cp++ = digits[(winpid >> shift) & 0xf];
+  *cp++ = '.';
+  for (int shift = 28; shift >= 0; shift -= 4)
+    *cp++ = digits[(tid >> shift) & 0xf];
+  *cp = '\0';
+
+  return buf;
+}
+
+inline void
+ipc_wake (ipc_waiter_t & waiter)
+{
+  char name[48];
+  const HANDLE evt =
+    OpenEvent (EVENT_MODIFY_STATE, FALSE,
+	       ipc_wait_name (name, waiter.winpid, waiter.tid));
+
+  if (evt)
+    {
+      SetEvent (evt);
+      CloseHandle (evt);
+    }
+  waiter.winpid = 0;
+}
+
+inline void
+ipc_wake_all (ipc_waiter_t *const waiters)
+{
+  for (int i = 0; i < IPC_WAITERS; i++)
+    if (waiters[i].winpid)
+      ipc_wake (waiters[i]);
+}
+
+/* Drop the entries of a process that has exited. */
+inline void
+ipc_forget_waiters (ipc_waiter_t *const waiters, const DWORD winpid)
+{
+  for (int i = 0; i < IPC_WAITERS; i++)
+    if (waiters[i].winpid == winpid)
+      waiters[i].winpid = 0;
+}
+
+#ifdef __INSIDE_CYGWIN__
+/* Called and returns with the lock held.  Returns 0 when woken up
+ * (which doesn't imply the caller may proceed) or an errno value.  If
+ * the wait list is full, *polling is incremented while the caller
+ * polls instead.
+ */
+extern int ipc_wait (volatile LONG & lock, ipc_waiter_t *waiters, int what,
+		     LONG *polling = NULL);
+#endif
+
 #endif /* __CYGSERVER_IPC_H__ */
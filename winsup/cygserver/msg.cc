@@ -1,6 +1,6 @@
 /* msg.cc: Single unix specification IPC interface for Cygwin.
 
-   Copyright 2002 Red Hat, Inc.
+   Copyright 2002, 2003 Red Hat, Inc.
 
    Written by Conrad Scott <conrad.scott@dsl.pipex.com>.
 
@@ -10,38 +10,748 @@ This software is a copyrighted work licensed under the terms of the
 Cygwin license.  Please consult the file "CYGWIN_LICENSE" for
 details. */
 
-#include "winsup.h"
+#include "woutsup.h"
 
-#include <sys/types.h>
-#include <cygwin/msg.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
 
+#include "cygserver_ipc.h"
+#include "cygserver_msg.h"
+#include "security.h"
 
-#include "cygerrno.h"
+#include "cygwin/cygserver.h"
+#include "cygwin/cygserver_process.h"
+#include "cygwin/cygserver_transport.h"
 
-extern "C" int
-msgctl (int msqid, int cmd, struct msqid_ds *buf)
+/*---------------------------------------------------------------------------*
+ * class server_msgmgr
+ *
+ * A singleton class.
+ *
+ * The messages live in a file mapping per queue which is also mapped
+ * by each attached process.  The server only creates and deletes
+ * queues, hands out the mapping to attaching processes and cleans up
+ * after processes which exit while holding the queue's lock or while
+ * waiting on the queue.
+ *---------------------------------------------------------------------------*/
+
+#define msgmgr (server_msgmgr::instance ())
+
+class server_msgmgr
+{
+private:
+  class queue_t
+  {
+  public:
+    const int _intid;
+    const int _msqid;
+    struct msqid_ds _ds;
+    msgq_shared_t *const _shared;
+
+    queue_t *_next;
+
+    queue_t (key_t key, int intid, HANDLE hFileMap, msgq_shared_t *);
+    ~queue_t ();
+
+    int attach (class process *, HANDLE & hFileMap);
+    void detach (class process *);
+
+  private:
+    static long _sequence;
+
+    const HANDLE _hFileMap;
+  };
+
+  class cleanup_t : public cleanup_routine
+  {
+  public:
+    cleanup_t (const queue_t *const queueptr)
+      : cleanup_routine (reinterpret_cast<void *> (queueptr->_msqid))
+    {
+      assert (key ());
+    }
+
+    int msqid () const { return reinterpret_cast<int> (key ()); }
+
+    virtual void cleanup (class process *const client)
+    {
+      msgmgr.msgdt (msqid (), client);
+    }
+  };
+
+public:
+  static server_msgmgr & instance ();
+
+  int msgattach (HANDLE & hFileMap, int msqid, class process *);
+  int msgctl (int & out_msqid, struct msqid_ds & out_ds,
+	      struct msginfo & out_msginfo, struct msg_info & out_msg_info,
+	      const int msqid, int cmd, const struct msqid_ds &,
+	      class process *);
+  void msgdt (int msqid, class process *);
+  int msgget (int & out_msqid, key_t, int msgflg, uid_t, gid_t,
+	      class process *);
+
+private:
+  static server_msgmgr *_instance;
+  static pthread_once_t _instance_once;
+
+  static void initialise_instance ();
+
+  CRITICAL_SECTION _queues_lock;
+  queue_t *_queues_head;	// A list sorted by int_id.
+
+  int _msg_ids;			// Number of queues (for ipcs(8)).
+  int _intid_max;		// Highest intid yet allocated (for ipcs(8)).
+
+  server_msgmgr ();
+  ~server_msgmgr ();
+
+  // Undefined (as this class is a singleton):
+  server_msgmgr (const server_msgmgr &);
+  server_msgmgr & operator= (const server_msgmgr &);
+
+  queue_t *find_by_key (key_t);
+  queue_t *find (int intid, queue_t **previous = NULL);
+
+  int new_queue (key_t, int msgflg, uid_t, gid_t);
+
+  queue_t *new_queue (key_t, HANDLE, msgq_shared_t *);
+  void delete_queue (queue_t *);
+};
+
+/* static */ long server_msgmgr::queue_t::_sequence = 0;
+
+/* static */ server_msgmgr *server_msgmgr::_instance = NULL;
+/* static */ pthread_once_t server_msgmgr::_instance_once = PTHREAD_ONCE_INIT;
+
+/*---------------------------------------------------------------------------*
+ * server_msgmgr::queue_t::queue_t ()
+ *---------------------------------------------------------------------------*/
+
+server_msgmgr::queue_t::queue_t (const key_t key,
+				 const int intid,
+				 const HANDLE hFileMap,
+				 msgq_shared_t *const shared)
+  : _intid (intid),
+    _msqid (ipc_int2ext (intid, IPC_MSGOP, _sequence)),
+    _shared (shared),
+    _next (NULL),
+    _hFileMap (hFileMap)
+{
+  assert (0 <= _intid && _intid < MSGMNI);
+
+  memset (&_ds, '\0', sizeof (_ds));
+  _ds.msg_perm.key = key;
+}
+
+/*---------------------------------------------------------------------------*
+ * server_msgmgr::queue_t::~queue_t ()
+ *---------------------------------------------------------------------------*/
+
+server_msgmgr::queue_t::~queue_t ()
+{
+  if (!UnmapViewOfFile (_shared))
+    syscall_printf ("failed to unmap view [msqid = %d]: %E", _msqid);
+
+  if (!CloseHandle (_hFileMap))
+    syscall_printf ("failed to close file map [handle = 0x%x]: %E", _hFileMap);
+}
+
+/*---------------------------------------------------------------------------*
+ * server_msgmgr::queue_t::attach ()
+ *---------------------------------------------------------------------------*/
+
+int
+server_msgmgr::queue_t::attach (class process *const client,
+				HANDLE & hFileMap)
+{
+  assert (client);
+
+  if (!DuplicateHandle (GetCurrentProcess (),
+			_hFileMap,
+			client->handle (),
+			&hFileMap,
+			0,
+			FALSE, // bInheritHandle
+			DUPLICATE_SAME_ACCESS))
+    {
+      syscall_printf (("failed to duplicate handle for client "
+		       "[key = 0x%016llx, msqid = %d, handle = 0x%x]: %E"),
+		      _ds.msg_perm.key, _msqid, _hFileMap);
+
+      return -EACCES;	// FIXME: Case analysis?
+    }
+
+  // A process attaching more than once (after a fork, the child
+  // attaches itself) simply gets more than one cleanup routine.
+
+  cleanup_t *const cleanup = safe_new (cleanup_t, this);
+
+  const bool result = client->add (cleanup);
+
+  assert (result);
+
+  return 0;
+}
+
+/*---------------------------------------------------------------------------*
+ * server_msgmgr::queue_t::detach ()
+ *
+ * Called once the client has exited.
+ *---------------------------------------------------------------------------*/
+
+void
+server_msgmgr::queue_t::detach (class process *const client)
+{
+  ipc_break_shared (_shared->lock, client->winpid ());
+  ipc_lock_shared (_shared->lock);
+  ipc_forget_waiters (_shared->waiters, client->winpid ());
+  ipc_unlock_shared (_shared->lock);
+}
+
+/*---------------------------------------------------------------------------*
+ * server_msgmgr::instance ()
+ *---------------------------------------------------------------------------*/
+
+/* static */ server_msgmgr &
+server_msgmgr::instance ()
+{
+  pthread_once (&_instance_once, &initialise_instance);
+
+  assert (_instance);
+
+  return *_instance;
+}
+
+/*---------------------------------------------------------------------------*
+ * server_msgmgr::msgattach ()
+ *---------------------------------------------------------------------------*/
+
+int
+server_msgmgr::msgattach (HANDLE & hFileMap,
+			  const int msqid, class process *const client)
+{
+  syscall_printf ("msgattach (msqid = %d) for %d(%lu)",
+		  msqid, client->cygpid (), client->winpid ());
+
+  int result = 0;
+  EnterCriticalSection (&_queues_lock);
+
+  queue_t *const queueptr = find (ipc_ext2int (msqid, IPC_MSGOP));
+
+  if (!queueptr)
+    result = -EINVAL;
+  else
+    result = queueptr->attach (client, hFileMap);
+
+  LeaveCriticalSection (&_queues_lock);
+
+  if (result < 0)
+    syscall_printf ("-1 [%d] = msgattach (msqid = %d) for %d(%lu)",
+		    -result, msqid, client->cygpid (), client->winpid ());
+  else
+    syscall_printf ("0x%x = msgattach (msqid = %d) for %d(%lu)",
+		    hFileMap, msqid, client->cygpid (), client->winpid ());
+
+  return result;
+}
+
+/*---------------------------------------------------------------------------*
+ * server_msgmgr::msgctl ()
+ *---------------------------------------------------------------------------*/
+
+int
+server_msgmgr::msgctl (int & out_msqid,
+		       struct msqid_ds & out_ds,
+		       struct msginfo & out_msginfo,
+		       struct msg_info & out_msg_info,
+		       const int msqid, const int cmd,
+		       const struct msqid_ds & ds,
+		       class process *const client)
+{
+  syscall_printf ("msgctl (msqid = %d, cmd = 0x%x) for %d(%lu)",
+		  msqid, cmd, client->cygpid (), client->winpid ());
+
+  int result = 0;
+  EnterCriticalSection (&_queues_lock);
+
+  switch (cmd)
+    {
+    case IPC_STAT:
+    case MSG_STAT:		// Uses intids rather than msqids.
+    case IPC_SET:
+    case IPC_RMID:
+      {
+	int intid;
+
+	if (cmd == MSG_STAT)
+	  intid = msqid;
+	else
+	  intid = ipc_ext2int (msqid, IPC_MSGOP);
+
+	queue_t *const queueptr = find (intid);
+
+	if (!queueptr)
+	  result = -EINVAL;
+	else
+	  {
+	    msgq_shared_t *const shared = queueptr->_shared;
+
+	    switch (cmd)
+	      {
+	      case IPC_STAT:
+	      case MSG_STAT:	// ipcs(8) i'face.
+		out_ds = queueptr->_ds;
+		ipc_lock_shared (shared->lock);
+		out_ds.msg_cbytes = shared->cbytes;
+		out_ds.msg_qnum = shared->qnum;
+		out_ds.msg_qbytes = shared->qbytes;
+		out_ds.msg_lspid = shared->lspid;
+		out_ds.msg_lrpid = shared->lrpid;
+		out_ds.msg_stime = shared->stime;
+		out_ds.msg_rtime = shared->rtime;
+		ipc_unlock_shared (shared->lock);
+		if (cmd == MSG_STAT)
+		  out_msqid = queueptr->_msqid;
+		break;
+
+	      case IPC_SET:
+		if (ds.msg_qbytes <= 0 || ds.msg_qbytes > MSGMNB)
+		  {
+		    result = -EINVAL;
+		    break;
+		  }
+		queueptr->_ds.msg_perm.uid = ds.msg_perm.uid;
+		queueptr->_ds.msg_perm.gid = ds.msg_perm.gid;
+		queueptr->_ds.msg_perm.mode = ds.msg_perm.mode & 0777;
+		queueptr->_ds.msg_ctime = time (NULL); // FIXME: sub-second times.
+		ipc_lock_shared (shared->lock);
+		shared->qbytes = ds.msg_qbytes;
+		ipc_wake_all (shared->waiters);
+		ipc_unlock_shared (shared->lock);
+		break;
+
+	      case IPC_RMID:
+		ipc_lock_shared (shared->lock);
+		shared->deleted = 1;
+		ipc_wake_all (shared->waiters);
+		ipc_unlock_shared (shared->lock);
+		delete_queue (queueptr);
+		break;
+	      }
+	  }
+      }
+      break;
+
+    case IPC_INFO:
+      out_msginfo.msgpool = MSGPOOL;
+      out_msginfo.msgmax = MSGMAX;
+      out_msginfo.msgmnb = MSGMNB;
+      out_msginfo.msgmni = MSGMNI;
+      out_msginfo.msgtql = MSGTQL;
+      break;
+
+    case MSG_INFO:		// ipcs(8) i'face.
+      out_msqid = _intid_max;
+      out_msg_info.msg_ids = _msg_ids;
+      out_msg_info.msg_num = 0;
+      out_msg_info.msg_tot = 0;
+      for (queue_t *queueptr = _queues_head;
+	   queueptr;
+	   queueptr = queueptr->_next)
+	{
+	  ipc_lock_shared (queueptr->_shared->lock);
+	  out_msg_info.msg_num += queueptr->_shared->qnum;
+	  out_msg_info.msg_tot += queueptr->_shared->cbytes;
+	  ipc_unlock_shared (queueptr->_shared->lock);
+	}
+      break;
+
+    default:
+      result = -EINVAL;
+      break;
+    }
+
+  LeaveCriticalSection (&_queues_lock);
+
+  if (result < 0)
+    syscall_printf (("-1 [%d] = "
+		     "msgctl (msqid = %d, cmd = 0x%x) for %d(%lu)"),
+		    -result,
+		    msqid, cmd, client->cygpid (), client->winpid ());
+  else
+    syscall_printf (("%d = "
+		     "msgctl (msqid = %d, cmd = 0x%x) for %d(%lu)"),
+		    ((cmd == MSG_STAT || cmd == MSG_INFO)
+		     ? out_msqid
+		     : result),
+		    msqid, cmd, client->cygpid (), client->winpid ());
+
+  return result;
+}
+
+/*---------------------------------------------------------------------------*
+ * server_msgmgr::msgdt ()
+ *
+ * Only called from the process cleanup routine.  The queue may
+ * already have been removed, in which case there is nothing left to
+ * do.
+ *---------------------------------------------------------------------------*/
+
+void
+server_msgmgr::msgdt (const int msqid, class process *const client)
+{
+  syscall_printf ("msgdt (msqid = %d) for %d(%lu)",
+		  msqid, client->cygpid (), client->winpid ());
+
+  EnterCriticalSection (&_queues_lock);
+
+  queue_t *const queueptr = find (ipc_ext2int (msqid, IPC_MSGOP));
+
+  if (queueptr && queueptr->_msqid == msqid)
+    queueptr->detach (client);
+
+  LeaveCriticalSection (&_queues_lock);
+}
+
+/*---------------------------------------------------------------------------*
+ * server_msgmgr::msgget ()
+ *---------------------------------------------------------------------------*/
+
+int
+server_msgmgr::msgget (int & out_msqid,
+		       const key_t key, const int msgflg,
+		       const uid_t uid, const gid_t gid,
+		       class process *const client)
+{
+  syscall_printf ("msgget (key = 0x%016llx, msgflg = 0%o) for %d(%lu)",
+		  key, msgflg, client->cygpid (), client->winpid ());
+
+  int result = 0;
+  EnterCriticalSection (&_queues_lock);
+
+  if (key == IPC_PRIVATE)
+    result = new_queue (key, msgflg, uid, gid);
+  else
+    {
+      queue_t *const queueptr = find_by_key (key);
+
+      if (!queueptr)
+	if (msgflg & IPC_CREAT)
+	  result = new_queue (key, msgflg, uid, gid);
+	else
+	  result = -ENOENT;
+      else if ((msgflg & IPC_CREAT) && (msgflg & IPC_EXCL))
+	result = -EEXIST;
+      else if ((msgflg & ~(queueptr->_ds.msg_perm.mode)) & 0777)
+	result = -EACCES;
+      else
+	result = queueptr->_msqid;
+    }
+
+  LeaveCriticalSection (&_queues_lock);
+
+  if (result >= 0)
+    {
+      out_msqid = result;
+      result = 0;
+    }
+
+  if (result < 0)
+    syscall_printf (("-1 [%d] = "
+		     "msgget (key = 0x%016llx, msgflg = 0%o) for %d(%lu)"),
+		    -result,
+		    key, msgflg, client->cygpid (), client->winpid ());
+  else
+    syscall_printf (("%d = "
+		     "msgget (key = 0x%016llx, msgflg = 0%o) for %d(%lu)"),
+		    out_msqid,
+		    key, msgflg, client->cygpid (), client->winpid ());
+
+  return result;
+}
+
+/*---------------------------------------------------------------------------*
+ * server_msgmgr::initialise_instance ()
+ *---------------------------------------------------------------------------*/
+
+/* static */ void
+server_msgmgr::initialise_instance ()
+{
+  assert (!_instance);
+
+  _instance = safe_new0 (server_msgmgr);
+
+  assert (_instance);
+}
+
+/*---------------------------------------------------------------------------*
+ * server_msgmgr::server_msgmgr ()
+ *---------------------------------------------------------------------------*/
+
+server_msgmgr::server_msgmgr ()
+  : _queues_head (NULL),
+    _msg_ids (0),
+    _intid_max (0)
+{
+  InitializeCriticalSection (&_queues_lock);
+}
+
+/*---------------------------------------------------------------------------*
+ * server_msgmgr::~server_msgmgr ()
+ *---------------------------------------------------------------------------*/
+
+server_msgmgr::~server_msgmgr ()
+{
+  DeleteCriticalSection (&_queues_lock);
+}
+
+/*---------------------------------------------------------------------------*
+ * server_msgmgr::find_by_key ()
+ *---------------------------------------------------------------------------*/
+
+server_msgmgr::queue_t *
+server_msgmgr::find_by_key (const key_t key)
+{
+  for (queue_t *queueptr = _queues_head; queueptr; queueptr = queueptr->_next)
+    if (queueptr->_ds.msg_perm.key == key)
+      return queueptr;
+
+  return NULL;
+}
+
+/*---------------------------------------------------------------------------*
+ * server_msgmgr::find ()
+ *---------------------------------------------------------------------------*/
+
+server_msgmgr::queue_t *
+server_msgmgr::find (const int intid, queue_t **previous)
+{
+  if (previous)
+    *previous = NULL;
+
+  for (queue_t *queueptr = _queues_head; queueptr; queueptr = queueptr->_next)
+    if (queueptr->_intid == intid)
+      return queueptr;
+    else if (queueptr->_intid > intid) // The list is sorted by intid.
+      return NULL;
+    else if (previous)
+      *previous = queueptr;
+
+  return NULL;
+}
+
+/*---------------------------------------------------------------------------*
+ * server_msgmgr::new_queue ()
+ *---------------------------------------------------------------------------*/
+
+int
+server_msgmgr::new_queue (const key_t key,
+			  const int msgflg,
+			  const uid_t uid,
+			  const gid_t gid)
 {
-  set_errno (ENOSYS);
-  return -1;
+  const HANDLE hFileMap = CreateFileMapping (INVALID_HANDLE_VALUE,
+					     NULL, PAGE_READWRITE,
+					     0, sizeof (msgq_shared_t),
+					     NULL);
+
+  if (!hFileMap)
+    {
+      syscall_printf ("failed to create file mapping: %E");
+      return -ENOMEM;		// FIXME
+    }
+
+  msgq_shared_t *const shared = (msgq_shared_t *)
+    MapViewOfFile (hFileMap, FILE_MAP_WRITE, 0, 0, 0);
+
+  if (!shared)
+    {
+      syscall_printf ("failed to map view: %E");
+      (void) CloseHandle (hFileMap);
+      return -ENOMEM;		// FIXME
+    }
+
+  // The mapping is zero-filled, so the queue starts out empty.
+  shared->qbytes = MSGMNB;
+
+  queue_t *const queueptr = new_queue (key, hFileMap, shared);
+
+  if (!queueptr)
+    {
+      (void) UnmapViewOfFile (shared);
+      (void) CloseHandle (hFileMap);
+      return -ENOSPC;
+    }
+
+  queueptr->_ds.msg_perm.cuid = queueptr->_ds.msg_perm.uid = uid;
+  queueptr->_ds.msg_perm.cgid = queueptr->_ds.msg_perm.gid = gid;
+  queueptr->_ds.msg_perm.mode = msgflg & 0777;
+  queueptr->_ds.msg_ctime = time (NULL); // FIXME: sub-second times.
+
+  return queueptr->_msqid;
+}
+
+/*---------------------------------------------------------------------------*
+ * server_msgmgr::new_queue ()
+ *
+ * Allocate a new queue for the given key and file map with the lowest
+ * available intid and insert into the queue list.
+ *---------------------------------------------------------------------------*/
+
+server_msgmgr::queue_t *
+server_msgmgr::new_queue (const key_t key, const HANDLE hFileMap,
+			  msgq_shared_t *const shared)
+{
+  int intid = 0;		// Next expected intid value.
+  queue_t *previous = NULL;	// Insert pointer.
+
+  // Find first unallocated intid.
+  for (queue_t *queueptr = _queues_head;
+       queueptr && queueptr->_intid == intid;
+       queueptr = queueptr->_next, intid++)
+    {
+      previous = queueptr;
+    }
+
+  if (intid >= MSGMNI)
+    return NULL;
+
+  queue_t *const queueptr =
+    safe_new (queue_t, key, intid, hFileMap, shared);
+
+  assert (queueptr);
+
+  if (previous)
+    {
+      queueptr->_next = previous->_next;
+      previous->_next = queueptr;
+    }
+  else
+    {
+      queueptr->_next = _queues_head;
+      _queues_head = queueptr;
+    }
+
+  _msg_ids += 1;
+  if (intid > _intid_max)
+    _intid_max = intid;
+
+  return queueptr;
 }
 
-extern "C" int
-msgget (key_t key, int msgflg)
+/*---------------------------------------------------------------------------*
+ * server_msgmgr::delete_queue ()
+ *
+ * The mapping stays alive for as long as attached processes still
+ * have handles to it; they see the `deleted' flag and fail with EIDRM.
+ *---------------------------------------------------------------------------*/
+
+void
+server_msgmgr::delete_queue (queue_t *const queueptr)
 {
-  set_errno (ENOSYS);
-  return -1;
+  assert (queueptr);
+
+  queue_t *previous = NULL;
+
+  const queue_t *const tmp = find (queueptr->_intid, &previous);
+
+  assert (tmp == queueptr);
+  assert (previous ? previous->_next == queueptr : _queues_head == queueptr);
+
+  if (previous)
+    previous->_next = queueptr->_next;
+  else
+    _queues_head = queueptr->_next;
+
+  assert (_msg_ids > 0);
+  _msg_ids -= 1;
+
+  safe_delete (queueptr);
 }
 
-extern "C" ssize_t
-msgrcv (int msqid, void *msgp, size_t msgsz, long msgtyp, int msgflg)
+/*---------------------------------------------------------------------------*
+ * client_request_msg::client_request_msg ()
+ *---------------------------------------------------------------------------*/
+
+client_request_msg::client_request_msg ()
+  : client_request (CYGSERVER_REQUEST_MSG,
+		    &_parameters, sizeof (_parameters))
 {
-  set_errno (ENOSYS);
-  return -1;
+  // verbose: syscall_printf ("created");
 }
 
-extern "C" int
-msgsnd (int msqid, const void *msgp, size_t msgsz, int msgflg)
+/*---------------------------------------------------------------------------*
+ * client_request_msg::serve ()
+ *---------------------------------------------------------------------------*/
+
+void
+client_request_msg::serve (transport_layer_base *const conn,
+			   process_cache *const cache)
 {
-  set_errno (ENOSYS);
-  return -1;
+  assert (conn);
+
+  assert (!error_code ());
+
+  if (msglen () != sizeof (_parameters.in))
+    {
+      syscall_printf ("bad request body length: expecting %lu bytes, got %lu",
+		      sizeof (_parameters), msglen ());
+      error_code (EINVAL);
+      msglen (0);
+      return;
+    }
+
+  // FIXME: Get a return code out of this and don't continue on error.
+  conn->impersonate_client ();
+
+  class process *const client = cache->process (_parameters.in.cygpid,
+						_parameters.in.winpid);
+
+  if (!client)
+    {
+      error_code (EAGAIN);
+      msglen (0);
+      return;
+    }
+
+  int result = -EINVAL;
+
+  switch (_parameters.in.msgop)
+    {
+    case MSGOP_msgget:
+      result = msgmgr.msgget (_parameters.out.msqid,
+			      _parameters.in.key, _parameters.in.msgflg,
+			      _parameters.in.uid, _parameters.in.gid,
+			      client);
+      break;
+
+    case MSGOP_msgattach:
+      result = msgmgr.msgattach (_parameters.out.hFileMap,
+				 _parameters.in.msqid, client);
+      break;
+
+    case MSGOP_msgctl:
+      result = msgmgr.msgctl (_parameters.out.msqid,
+			      _parameters.out.ds, _parameters.out.msginfo,
+			      _parameters.out.msg_info,
+			      _parameters.in.msqid, _parameters.in.cmd,
+			      _parameters.in.ds,
+			      client);
+      break;
+    }
+
+  client->release ();
+  conn->revert_to_self ();
+
+  if (result < 0)
+    {
+      error_code (-result);
+      msglen (0);
+    }
+  else
+    msglen (sizeof (_parameters.out));
 }
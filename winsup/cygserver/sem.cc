@@ -1,6 +1,6 @@
 /* sem.cc: Single unix specification IPC interface for Cygwin.
 
-   Copyright 2002 Red Hat, Inc.
+   Copyright 2002, 2003 Red Hat, Inc.
 
    Written by Conrad Scott <conrad.scott@dsl.pipex.com>.
 
@@ -10,31 +10,994 @@ This software is a copyrighted work licensed under the terms of the
 Cygwin license.  Please consult the file "CYGWIN_LICENSE" for
 details. */
 
-#include "winsup.h"
+#include "woutsup.h"
 
-#include <sys/types.h>
-#include <cygwin/sem.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
 
+#include "cygserver_ipc.h"
+#include "cygserver_sem.h"
+#include "security.h"
 
-#include "cygerrno.h"
+#include "cygwin/cygserver.h"
+#include "cygwin/cygserver_process.h"
+#include "cygwin/cygserver_transport.h"
 
-extern "C" int
-semctl (int semid, int semnum, int cmd, ...)
+/*---------------------------------------------------------------------------*
+ * class server_semmgr
+ *
+ * A singleton class.
+ *
+ * The semaphore values live in a file mapping per set which is also
+ * mapped by each attached process.  The server only creates and
+ * deletes sets, hands out the mapping to attaching processes, hands
+ * out the undo table and a slot in it to processes using SEM_UNDO and
+ * applies a process's semadj values when it exits.
+ *---------------------------------------------------------------------------*/
+
+#define semmgr (server_semmgr::instance ())
+
+class server_semmgr
+{
+private:
+  class semset_t
+  {
+  public:
+    const int _intid;
+    const int _semid;
+    struct semid_ds _ds;
+    semset_shared_t *const _shared;
+
+    semset_t *_next;
+
+    semset_t (key_t key, int intid, HANDLE hFileMap, semset_shared_t *);
+    ~semset_t ();
+
+    int attach (class process *, HANDLE & hFileMap);
+    int undo (class process *, HANDLE & hFileMap, int & slot, LONG & seq);
+    void detach (class process *);
+
+  private:
+    static long _sequence;
+
+    const HANDLE _hFileMap;
+    HANDLE _hUndoMap;		// NULL until somebody uses SEM_UNDO.
+    void *_undo;
+
+    bool grow_undo ();
+  };
+
+  class cleanup_t : public cleanup_routine
+  {
+  public:
+    cleanup_t (const semset_t *const setptr)
+      : cleanup_routine (reinterpret_cast<void *> (setptr->_semid))
+    {
+      assert (key ());
+    }
+
+    int semid () const { return reinterpret_cast<int> (key ()); }
+
+    virtual void cleanup (class process *const client)
+    {
+      semmgr.semdt (semid (), client);
+    }
+  };
+
+public:
+  static server_semmgr & instance ();
+
+  int semattach (HANDLE & hFileMap, int semid, class process *);
+  int semundo (HANDLE & hFileMap, int & slot, LONG & seq, int semid,
+	       class process *);
+  int semctl (int & out_semid, struct semid_ds & out_ds,
+	      struct seminfo & out_seminfo, struct sem_info & out_sem_info,
+	      const int semid, int cmd, const struct semid_ds &,
+	      class process *);
+  void semdt (int semid, class process *);
+  int semget (int & out_semid, key_t, int nsems, int semflg, uid_t, gid_t,
+	      class process *);
+
+private:
+  static server_semmgr *_instance;
+  static pthread_once_t _instance_once;
+
+  static void initialise_instance ();
+
+  CRITICAL_SECTION _semsets_lock;
+  semset_t *_semsets_head;	// A list sorted by int_id.
+
+  int _sem_ids;			// Number of sem sets (for ipcs(8)).
+  int _sem_num;			// Total number of semaphores (for ipcs(8)).
+  int _intid_max;		// Highest intid yet allocated (for ipcs(8)).
+
+  server_semmgr ();
+  ~server_semmgr ();
+
+  // Undefined (as this class is a singleton):
+  server_semmgr (const server_semmgr &);
+  server_semmgr & operator= (const server_semmgr &);
+
+  semset_t *find_by_key (key_t);
+  semset_t *find (int intid, semset_t **previous = NULL);
+
+  int new_semset (key_t, int nsems, int semflg, pid_t, uid_t, gid_t);
+
+  semset_t *new_semset (key_t, int nsems, HANDLE, semset_shared_t *);
+  void delete_semset (semset_t *);
+};
+
+/* static */ long server_semmgr::semset_t::_sequence = 0;
+
+/* static */ server_semmgr *server_semmgr::_instance = NULL;
+/* static */ pthread_once_t server_semmgr::_instance_once = PTHREAD_ONCE_INIT;
+
+/*---------------------------------------------------------------------------*
+ * server_semmgr::semset_t::semset_t ()
+ *---------------------------------------------------------------------------*/
+
+server_semmgr::semset_t::semset_t (const key_t key,
+				   const int intid,
+				   const HANDLE hFileMap,
+				   semset_shared_t *const shared)
+  : _intid (intid),
+    _semid (ipc_int2ext (intid, IPC_SEMOP, _sequence)),
+    _shared (shared),
+    _next (NULL),
+    _hFileMap (hFileMap),
+    _hUndoMap (NULL),
+    _undo (NULL)
+{
+  assert (0 <= _intid && _intid < SEMMNI);
+
+  memset (&_ds, '\0', sizeof (_ds));
+  _ds.sem_perm.key = key;
+  _ds.sem_nsems = shared->nsems;
+}
+
+/*---------------------------------------------------------------------------*
+ * server_semmgr::semset_t::~semset_t ()
+ *---------------------------------------------------------------------------*/
+
+server_semmgr::semset_t::~semset_t ()
 {
-  set_errno (ENOSYS);
-  return -1;
+  if (!UnmapViewOfFile (_shared))
+    syscall_printf ("failed to unmap view [semid = %d]: %E", _semid);
+
+  if (!CloseHandle (_hFileMap))
+    syscall_printf ("failed to close file map [handle = 0x%x]: %E", _hFileMap);
+
+  if (_undo)
+    {
+      (void) UnmapViewOfFile (_undo);
+      (void) CloseHandle (_hUndoMap);
+    }
 }
 
-extern "C" int
-semget (key_t key, int nsems, int semflg)
+/*---------------------------------------------------------------------------*
+ * server_semmgr::semset_t::attach ()
+ *
+ * Give the client a handle to the set's mapping.  Every attached
+ * process is cleaned up after, so that its wait list entries are
+ * dropped and the set's lock is broken if it dies holding it.
+ *---------------------------------------------------------------------------*/
+
+int
+server_semmgr::semset_t::attach (class process *const client,
+				 HANDLE & hFileMap)
 {
-  set_errno (ENOSYS);
-  return -1;
+  assert (client);
+
+  if (!DuplicateHandle (GetCurrentProcess (),
+			_hFileMap,
+			client->handle (),
+			&hFileMap,
+			0,
+			FALSE, // bInheritHandle
+			DUPLICATE_SAME_ACCESS))
+    {
+      syscall_printf (("failed to duplicate handle for client "
+		       "[key = 0x%016llx, semid = %d, handle = 0x%x]: %E"),
+		      _ds.sem_perm.key, _semid, _hFileMap);
+
+      return -EACCES;	// FIXME: Case analysis?
+    }
+
+  // A process attaching more than once simply gets more than one
+  // cleanup routine, as with msg queues.
+
+  cleanup_t *const cleanup = safe_new (cleanup_t, this);
+
+  // FIXME: ::add should only fail if the process object is already
+  // cleaning up; but it can't be doing that since this thread has it
+  // locked.
+
+  const bool result = client->add (cleanup);
+
+  assert (result);
+
+  return 0;
 }
 
-extern "C" int
-semop (int semid, struct sembuf *sops, size_t nsops)
+/*---------------------------------------------------------------------------*
+ * server_semmgr::semset_t::undo ()
+ *
+ * Give the client a handle to the undo table and a slot for its
+ * semadj values, which it keeps until it exits.  The table grows when
+ * all its slots are taken.  The client must have attached already.
+ *---------------------------------------------------------------------------*/
+
+int
+server_semmgr::semset_t::undo (class process *const client,
+			       HANDLE & hFileMap, int & slot, LONG & seq)
 {
-  set_errno (ENOSYS);
-  return -1;
+  assert (client);
+
+  int unused = -1;
+
+  slot = -1;
+
+  ipc_lock_shared (_shared->lock);
+
+  for (int n = 0; _undo && n < _shared->undo_slots; n++)
+    {
+      semset_slot_t *const slotptr = _shared->slot (_undo, n);
+
+      if (slotptr->winpid == client->winpid ())
+	{
+	  slot = n;
+	  break;
+	}
+      else if (!slotptr->winpid && unused < 0)
+	unused = n;
+    }
+
+  if (slot < 0 && unused < 0)
+    {
+      unused = _shared->undo_slots;
+      if (!grow_undo ())
+	unused = -1;
+    }
+
+  if (slot < 0 && unused >= 0)
+    {
+      semset_slot_t *const slotptr = _shared->slot (_undo, unused);
+
+      slotptr->winpid = client->winpid ();
+      slotptr->cygpid = client->cygpid ();
+      memset (slotptr->semadj, '\0', _shared->nsems * sizeof (semset_adj_t));
+
+      slot = unused;
+    }
+
+  seq = _shared->undo_seq;
+
+  ipc_unlock_shared (_shared->lock);
+
+  if (slot < 0)
+    return -ENOSPC;
+
+  // The slot stays allocated if this fails; it is freed when the
+  // client exits.
+  if (!DuplicateHandle (GetCurrentProcess (),
+			_hUndoMap,
+			client->handle (),
+			&hFileMap,
+			0,
+			FALSE, // bInheritHandle
+			DUPLICATE_SAME_ACCESS))
+    {
+      syscall_printf (("failed to duplicate undo table handle for client "
+		       "[key = 0x%016llx, semid = %d, handle = 0x%x]: %E"),
+		      _ds.sem_perm.key, _semid, _hUndoMap);
+
+      return -EACCES;	// FIXME: Case analysis?
+    }
+
+  return 0;
+}
+
+/*---------------------------------------------------------------------------*
+ * server_semmgr::semset_t::grow_undo ()
+ *
+ * Replace the undo table with one twice as large, or create the first
+ * one.  Called with the set's lock held.  Attached clients notice the
+ * new `undo_seq' and ask for the new table before they next touch
+ * their semadj values, the old one stays mapped for as long as they
+ * still have it.
+ *---------------------------------------------------------------------------*/
+
+bool
+server_semmgr::semset_t::grow_undo ()
+{
+  const int nslots = _undo ? 2 * _shared->undo_slots : SEMUNDO_SLOTS;
+
+  if (nslots > SEMMNU)
+    return false;
+
+  const size_t size = nslots * semset_shared_t::slot_size (_shared->nsems);
+
+  const HANDLE hUndoMap = CreateFileMapping (INVALID_HANDLE_VALUE,
+					     NULL, PAGE_READWRITE,
+					     0, size, NULL);
+
+  if (!hUndoMap)
+    {
+      syscall_printf ("failed to create undo table [semid = %d]: %E",
+		      _semid);
+      return false;
+    }
+
+  void *const undo = MapViewOfFile (hUndoMap, FILE_MAP_WRITE, 0, 0, 0);
+
+  if (!undo)
+    {
+      syscall_printf ("failed to map undo table [semid = %d]: %E", _semid);
+      (void) CloseHandle (hUndoMap);
+      return false;
+    }
+
+  // The new slots are zero-filled, i.e. unused.
+  if (_undo)
+    {
+      memcpy (undo, _undo,
+	      _shared->undo_slots
+	      * semset_shared_t::slot_size (_shared->nsems));
+      (void) UnmapViewOfFile (_undo);
+      (void) CloseHandle (_hUndoMap);
+    }
+
+  _hUndoMap = hUndoMap;
+  _undo = undo;
+  _shared->undo_slots = nslots;
+  _shared->undo_seq += 1;
+
+  syscall_printf ("undo table of semid %d grown to %d slots", _semid, nslots);
+
+  return true;
+}
+
+/*---------------------------------------------------------------------------*
+ * server_semmgr::semset_t::detach ()
+ *
+ * Called once the client has exited: apply its semadj values, free
+ * its undo slot if it had one and drop any wait list entries it left
+ * behind.  If it died
+ * while holding the set's lock, the lock is released first.
+ *---------------------------------------------------------------------------*/
+
+void
+server_semmgr::semset_t::detach (class process *const client)
+{
+  ipc_break_shared (_shared->lock, client->winpid ());
+  ipc_lock_shared (_shared->lock);
+
+  ipc_forget_waiters (_shared->waiters, client->winpid ());
+
+  for (int n = 0; _undo && n < _shared->undo_slots; n++)
+    {
+      semset_slot_t *const slotptr = _shared->slot (_undo, n);
+
+      if (slotptr->winpid != client->winpid ())
+	continue;
+
+      bool changed = false;
+
+      for (int i = 0; i < _shared->nsems; i++)
+	if (slotptr->semadj[i].value
+	    && slotptr->semadj[i].gen == _shared->sem ()[i].adjgen)
+	  {
+	    semset_sem_t *const semptr = _shared->sem () + i;
+	    int semval = semptr->semval + slotptr->semadj[i].value;
+
+	    if (semval < 0)
+	      semval = 0;
+	    else if (semval > SEMVMX)
+	      semval = SEMVMX;
+
+	    semptr->semval = semval;
+	    semptr->sempid = client->cygpid ();
+	    changed = true;
+	  }
+
+      slotptr->winpid = 0;
+
+      if (changed)
+	ipc_wake_all (_shared->waiters);
+      break;
+    }
+
+  ipc_unlock_shared (_shared->lock);
+}
+
+/*---------------------------------------------------------------------------*
+ * server_semmgr::instance ()
+ *---------------------------------------------------------------------------*/
+
+/* static */ server_semmgr &
+server_semmgr::instance ()
+{
+  pthread_once (&_instance_once, &initialise_instance);
+
+  assert (_instance);
+
+  return *_instance;
+}
+
+/*---------------------------------------------------------------------------*
+ * server_semmgr::semattach ()
+ *---------------------------------------------------------------------------*/
+
+int
+server_semmgr::semattach (HANDLE & hFileMap,
+			  const int semid, class process *const client)
+{
+  syscall_printf ("semattach (semid = %d) for %d(%lu)",
+		  semid, client->cygpid (), client->winpid ());
+
+  int result = 0;
+  EnterCriticalSection (&_semsets_lock);
+
+  semset_t *const setptr = find (ipc_ext2int (semid, IPC_SEMOP));
+
+  if (!setptr)
+    result = -EINVAL;
+  else
+    result = setptr->attach (client, hFileMap);
+
+  LeaveCriticalSection (&_semsets_lock);
+
+  if (result < 0)
+    syscall_printf ("-1 [%d] = semattach (semid = %d) for %d(%lu)",
+		    -result, semid, client->cygpid (), client->winpid ());
+  else
+    syscall_printf ("0x%x = semattach (semid = %d) for %d(%lu)",
+		    hFileMap, semid, client->cygpid (), client->winpid ());
+
+  return result;
+}
+
+/*---------------------------------------------------------------------------*
+ * server_semmgr::semundo ()
+ *---------------------------------------------------------------------------*/
+
+int
+server_semmgr::semundo (HANDLE & hFileMap, int & slot, LONG & seq,
+			const int semid, class process *const client)
+{
+  syscall_printf ("semundo (semid = %d) for %d(%lu)",
+		  semid, client->cygpid (), client->winpid ());
+
+  int result = 0;
+  EnterCriticalSection (&_semsets_lock);
+
+  semset_t *const setptr = find (ipc_ext2int (semid, IPC_SEMOP));
+
+  if (!setptr || setptr->_semid != semid)
+    result = -EIDRM;
+  else
+    result = setptr->undo (client, hFileMap, slot, seq);
+
+  LeaveCriticalSection (&_semsets_lock);
+
+  if (result < 0)
+    syscall_printf ("-1 [%d] = semundo (semid = %d) for %d(%lu)",
+		    -result, semid, client->cygpid (), client->winpid ());
+  else
+    syscall_printf ("0x%x = semundo (semid = %d) for %d(%lu), slot %d",
+		    hFileMap, semid, client->cygpid (), client->winpid (),
+		    slot);
+
+  return result;
+}
+
+/*---------------------------------------------------------------------------*
+ * server_semmgr::semctl ()
+ *
+ * Only the commands dealing with the set as a whole arrive here; the
+ * commands reading and setting semaphore values are handled by the
+ * client in the set's mapping.
+ *---------------------------------------------------------------------------*/
+
+int
+server_semmgr::semctl (int & out_semid,
+		       struct semid_ds & out_ds,
+		       struct seminfo & out_seminfo,
+		       struct sem_info & out_sem_info,
+		       const int semid, const int cmd,
+		       const struct semid_ds & ds,
+		       class process *const client)
+{
+  syscall_printf ("semctl (semid = %d, cmd = 0x%x) for %d(%lu)",
+		  semid, cmd, client->cygpid (), client->winpid ());
+
+  int result = 0;
+  EnterCriticalSection (&_semsets_lock);
+
+  switch (cmd)
+    {
+    case IPC_STAT:
+    case SEM_STAT:		// Uses intids rather than semids.
+    case IPC_SET:
+    case IPC_RMID:
+      {
+	int intid;
+
+	if (cmd == SEM_STAT)
+	  intid = semid;
+	else
+	  intid = ipc_ext2int (semid, IPC_SEMOP);
+
+	semset_t *const setptr = find (intid);
+
+	if (!setptr)
+	  result = -EINVAL;
+	else
+	  switch (cmd)
+	    {
+	    case IPC_STAT:
+	    case SEM_STAT:	// ipcs(8) i'face.
+	      out_ds = setptr->_ds;
+	      ipc_lock_shared (setptr->_shared->lock);
+	      out_ds.sem_otime = setptr->_shared->otime;
+	      if (setptr->_shared->ctime > out_ds.sem_ctime)
+		out_ds.sem_ctime = setptr->_shared->ctime;
+	      ipc_unlock_shared (setptr->_shared->lock);
+	      if (cmd == SEM_STAT)
+		out_semid = setptr->_semid;
+	      break;
+
+	    case IPC_SET:
+	      setptr->_ds.sem_perm.uid = ds.sem_perm.uid;
+	      setptr->_ds.sem_perm.gid = ds.sem_perm.gid;
+	      setptr->_ds.sem_perm.mode = ds.sem_perm.mode & 0777;
+	      setptr->_ds.sem_ctime = time (NULL); // FIXME: sub-second times.
+	      break;
+
+	    case IPC_RMID:
+	      ipc_lock_shared (setptr->_shared->lock);
+	      setptr->_shared->deleted = 1;
+	      ipc_wake_all (setptr->_shared->waiters);
+	      ipc_unlock_shared (setptr->_shared->lock);
+	      delete_semset (setptr);
+	      break;
+	    }
+      }
+      break;
+
+    case IPC_INFO:
+      out_seminfo.semmni = SEMMNI;
+      out_seminfo.semmns = SEMMNS;
+      out_seminfo.semmsl = SEMMSL;
+      out_seminfo.semopm = SEMOPM;
+      out_seminfo.semmnu = SEMMNU;
+      out_seminfo.semume = SEMUME;
+      out_seminfo.semvmx = SEMVMX;
+      out_seminfo.semaem = SEMAEM;
+      break;
+
+    case SEM_INFO:		// ipcs(8) i'face.
+      out_semid = _intid_max;
+      out_sem_info.sem_ids = _sem_ids;
+      out_sem_info.sem_num = _sem_num;
+      break;
+
+    default:
+      result = -EINVAL;
+      break;
+    }
+
+  LeaveCriticalSection (&_semsets_lock);
+
+  if (result < 0)
+    syscall_printf (("-1 [%d] = "
+		     "semctl (semid = %d, cmd = 0x%x) for %d(%lu)"),
+		    -result,
+		    semid, cmd, client->cygpid (), client->winpid ());
+  else
+    syscall_printf (("%d = "
+		     "semctl (semid = %d, cmd = 0x%x) for %d(%lu)"),
+		    ((cmd == SEM_STAT || cmd == SEM_INFO)
+		     ? out_semid
+		     : result),
+		    semid, cmd, client->cygpid (), client->winpid ());
+
+  return result;
+}
+
+/*---------------------------------------------------------------------------*
+ * server_semmgr::semdt ()
+ *
+ * Only called from the process cleanup routine.  The set may already
+ * have been removed, in which case there is nothing left to do.
+ *---------------------------------------------------------------------------*/
+
+void
+server_semmgr::semdt (const int semid, class process *const client)
+{
+  syscall_printf ("semdt (semid = %d) for %d(%lu)",
+		  semid, client->cygpid (), client->winpid ());
+
+  EnterCriticalSection (&_semsets_lock);
+
+  semset_t *const setptr = find (ipc_ext2int (semid, IPC_SEMOP));
+
+  if (setptr && setptr->_semid == semid)
+    setptr->detach (client);
+
+  LeaveCriticalSection (&_semsets_lock);
+}
+
+/*---------------------------------------------------------------------------*
+ * server_semmgr::semget ()
+ *---------------------------------------------------------------------------*/
+
+int
+server_semmgr::semget (int & out_semid,
+		       const key_t key, const int nsems, const int semflg,
+		       const uid_t uid, const gid_t gid,
+		       class process *const client)
+{
+  syscall_printf (("semget (key = 0x%016llx, nsems = %d, semflg = 0%o) "
+		   "for %d(%lu)"),
+		  key, nsems, semflg,
+		  client->cygpid (), client->winpid ());
+
+  int result = 0;
+  EnterCriticalSection (&_semsets_lock);
+
+  if (key == IPC_PRIVATE)
+    result = new_semset (key, nsems, semflg,
+			 client->cygpid (), uid, gid);
+  else
+    {
+      semset_t *const setptr = find_by_key (key);
+
+      if (!setptr)
+	if (semflg & IPC_CREAT)
+	  result = new_semset (key, nsems, semflg,
+			       client->cygpid (), uid, gid);
+	else
+	  result = -ENOENT;
+      else if ((semflg & IPC_CREAT) && (semflg & IPC_EXCL))
+	result = -EEXIST;
+      else if ((semflg & ~(setptr->_ds.sem_perm.mode)) & 0777)
+	result = -EACCES;
+      else if (nsems < 0 || nsems > setptr->_ds.sem_nsems)
+	result = -EINVAL;
+      else
+	result = setptr->_semid;
+    }
+
+  LeaveCriticalSection (&_semsets_lock);
+
+  if (result >= 0)
+    {
+      out_semid = result;
+      result = 0;
+    }
+
+  if (result < 0)
+    syscall_printf (("-1 [%d] = "
+		     "semget (key = 0x%016llx, nsems = %d, semflg = 0%o) "
+		     "for %d(%lu)"),
+		    -result,
+		    key, nsems, semflg,
+		    client->cygpid (), client->winpid ());
+  else
+    syscall_printf (("%d = "
+		     "semget (key = 0x%016llx, nsems = %d, semflg = 0%o) "
+		     "for %d(%lu)"),
+		    out_semid,
+		    key, nsems, semflg,
+		    client->cygpid (), client->winpid ());
+
+  return result;
+}
+
+/*---------------------------------------------------------------------------*
+ * server_semmgr::initialise_instance ()
+ *---------------------------------------------------------------------------*/
+
+/* static */ void
+server_semmgr::initialise_instance ()
+{
+  assert (!_instance);
+
+  _instance = safe_new0 (server_semmgr);
+
+  assert (_instance);
+}
+
+/*---------------------------------------------------------------------------*
+ * server_semmgr::server_semmgr ()
+ *---------------------------------------------------------------------------*/
+
+server_semmgr::server_semmgr ()
+  : _semsets_head (NULL),
+    _sem_ids (0),
+    _sem_num (0),
+    _intid_max (0)
+{
+  InitializeCriticalSection (&_semsets_lock);
+}
+
+/*---------------------------------------------------------------------------*
+ * server_semmgr::~server_semmgr ()
+ *---------------------------------------------------------------------------*/
+
+server_semmgr::~server_semmgr ()
+{
+  DeleteCriticalSection (&_semsets_lock);
+}
+
+/*---------------------------------------------------------------------------*
+ * server_semmgr::find_by_key ()
+ *---------------------------------------------------------------------------*/
+
+server_semmgr::semset_t *
+server_semmgr::find_by_key (const key_t key)
+{
+  for (semset_t *setptr = _semsets_head; setptr; setptr = setptr->_next)
+    if (setptr->_ds.sem_perm.key == key)
+      return setptr;
+
+  return NULL;
+}
+
+/*---------------------------------------------------------------------------*
+ * server_semmgr::find ()
+ *---------------------------------------------------------------------------*/
+
+server_semmgr::semset_t *
+server_semmgr::find (const int intid, semset_t **previous)
+{
+  if (previous)
+    *previous = NULL;
+
+  for (semset_t *setptr = _semsets_head; setptr; setptr = setptr->_next)
+    if (setptr->_intid == intid)
+      return setptr;
+    else if (setptr->_intid > intid) // The list is sorted by intid.
+      return NULL;
+    else if (previous)
+      *previous = setptr;
+
+  return NULL;
+}
+
+/*---------------------------------------------------------------------------*
+ * server_semmgr::new_semset ()
+ *---------------------------------------------------------------------------*/
+
+int
+server_semmgr::new_semset (const key_t key,
+			   const int nsems,
+			   const int semflg,
+			   const pid_t cygpid,
+			   const uid_t uid,
+			   const gid_t gid)
+{
+  if (nsems <= 0 || nsems > SEMMSL)
+    return -EINVAL;
+
+  const HANDLE hFileMap = CreateFileMapping (INVALID_HANDLE_VALUE,
+					     NULL, PAGE_READWRITE,
+					     0, semset_shared_t::size (nsems),
+					     NULL);
+
+  if (!hFileMap)
+    {
+      syscall_printf ("failed to create file mapping [nsems = %d]: %E",
+		      nsems);
+      return -ENOMEM;		// FIXME
+    }
+
+  semset_shared_t *const shared = (semset_shared_t *)
+    MapViewOfFile (hFileMap, FILE_MAP_WRITE, 0, 0, 0);
+
+  if (!shared)
+    {
+      syscall_printf ("failed to map view [nsems = %d]: %E", nsems);
+      (void) CloseHandle (hFileMap);
+      return -ENOMEM;		// FIXME
+    }
+
+  // The mapping is zero-filled, so all values start out at 0 and there is
+  // no undo table yet.
+  shared->nsems = nsems;
+
+  semset_t *const setptr = new_semset (key, nsems, hFileMap, shared);
+
+  if (!setptr)
+    {
+      (void) UnmapViewOfFile (shared);
+      (void) CloseHandle (hFileMap);
+      return -ENOSPC;
+    }
+
+  setptr->_ds.sem_perm.cuid = setptr->_ds.sem_perm.uid = uid;
+  setptr->_ds.sem_perm.cgid = setptr->_ds.sem_perm.gid = gid;
+  setptr->_ds.sem_perm.mode = semflg & 0777;
+  setptr->_ds.sem_ctime = time (NULL); // FIXME: sub-second times.
+
+  return setptr->_semid;
+}
+
+/*---------------------------------------------------------------------------*
+ * server_semmgr::new_semset ()
+ *
+ * Allocate a new set for the given key and file map with the lowest
+ * available intid and insert into the set list.
+ *---------------------------------------------------------------------------*/
+
+server_semmgr::semset_t *
+server_semmgr::new_semset (const key_t key, const int nsems,
+			   const HANDLE hFileMap,
+			   semset_shared_t *const shared)
+{
+  if (_sem_num + nsems > SEMMNS)
+    return NULL;
+
+  int intid = 0;		// Next expected intid value.
+  semset_t *previous = NULL;	// Insert pointer.
+
+  // Find first unallocated intid.
+  for (semset_t *setptr = _semsets_head;
+       setptr && setptr->_intid == intid;
+       setptr = setptr->_next, intid++)
+    {
+      previous = setptr;
+    }
+
+  if (intid >= SEMMNI)
+    return NULL;
+
+  semset_t *const setptr =
+    safe_new (semset_t, key, intid, hFileMap, shared);
+
+  assert (setptr);
+
+  if (previous)
+    {
+      setptr->_next = previous->_next;
+      previous->_next = setptr;
+    }
+  else
+    {
+      setptr->_next = _semsets_head;
+      _semsets_head = setptr;
+    }
+
+  _sem_ids += 1;
+  _sem_num += nsems;
+  if (intid > _intid_max)
+    _intid_max = intid;
+
+  return setptr;
+}
+
+/*---------------------------------------------------------------------------*
+ * server_semmgr::delete_semset ()
+ *
+ * The mapping stays alive for as long as attached processes still
+ * have handles to it; they see the `deleted' flag and fail with EIDRM.
+ *---------------------------------------------------------------------------*/
+
+void
+server_semmgr::delete_semset (semset_t *const setptr)
+{
+  assert (setptr);
+
+  semset_t *previous = NULL;
+
+  const semset_t *const tmp = find (setptr->_intid, &previous);
+
+  assert (tmp == setptr);
+  assert (previous ? previous->_next == setptr : _semsets_head == setptr);
+
+  if (previous)
+    previous->_next = setptr->_next;
+  else
+    _semsets_head = setptr->_next;
+
+  assert (_sem_ids > 0);
+  _sem_ids -= 1;
+  _sem_num -= setptr->_ds.sem_nsems;
+
+  safe_delete (setptr);
+}
+
+/*---------------------------------------------------------------------------*
+ * client_request_sem::client_request_sem ()
+ *---------------------------------------------------------------------------*/
+
+client_request_sem::client_request_sem ()
+  : client_request (CYGSERVER_REQUEST_SEM,
+		    &_parameters, sizeof (_parameters))
+{
+  // verbose: syscall_printf ("created");
+}
+
+/*---------------------------------------------------------------------------*
+ * client_request_sem::serve ()
+ *---------------------------------------------------------------------------*/
+
+void
+client_request_sem::serve (transport_layer_base *const conn,
+			   process_cache *const cache)
+{
+  assert (conn);
+
+  assert (!error_code ());
+
+  if (msglen () != sizeof (_parameters.in))
+    {
+      syscall_printf ("bad request body length: expecting %lu bytes, got %lu",
+		      sizeof (_parameters), msglen ());
+      error_code (EINVAL);
+      msglen (0);
+      return;
+    }
+
+  // FIXME: Get a return code out of this and don't continue on error.
+  conn->impersonate_client ();
+
+  class process *const client = cache->process (_parameters.in.cygpid,
+						_parameters.in.winpid);
+
+  if (!client)
+    {
+      error_code (EAGAIN);
+      msglen (0);
+      return;
+    }
+
+  int result = -EINVAL;
+
+  switch (_parameters.in.semop)
+    {
+    case SEMOP_semget:
+      result = semmgr.semget (_parameters.out.semid,
+			      _parameters.in.key, _parameters.in.nsems,
+			      _parameters.in.semflg,
+			      _parameters.in.uid, _parameters.in.gid,
+			      client);
+      break;
+
+    case SEMOP_semattach:
+      result = semmgr.semattach (_parameters.out.attach.hFileMap,
+				 _parameters.in.semid, client);
+      break;
+
+    case SEMOP_semundo:
+      result = semmgr.semundo (_parameters.out.attach.hFileMap,
+			       _parameters.out.attach.slot,
+			       _parameters.out.attach.undo_seq,
+			       _parameters.in.semid, client);
+      break;
+
+    case SEMOP_semctl:
+      result = semmgr.semctl (_parameters.out.semid,
+			      _parameters.out.ds, _parameters.out.seminfo,
+			      _parameters.out.sem_info,
+			      _parameters.in.semid, _parameters.in.cmd,
+			      _parameters.in.ds,
+			      client);
+      break;
+    }
+
+  client->release ();
+  conn->revert_to_self ();
+
+  if (result < 0)
+    {
+      error_code (-result);
+      msglen (0);
+    }
+  else
+    msglen (sizeof (_parameters.out));
 }
@@ -0,0 +1,234 @@
+/* af_local.h: Shared memory transport for AF_LOCAL sockets
+
+   Copyright 2003 Red Hat, Inc.
+
+This file is part of Cygwin.
+
+This software is a copyrighted work licensed under the terms of the
+Cygwin license.  Please consult the file "CYGWIN_LICENSE" for
+details. */
+
+#ifndef __AF_LOCAL_H__
+#define __AF_LOCAL_H__
+
+/* Connection setup of AF_LOCAL stream sockets still uses a loopback TCP
+   connection and the secret event handshake.  Once both sides have
+   verified each other, the data is exchanged through a pair of ring
+   buffers in a named shared memory area instead of going through the
+   TCP stack.  Side 0 is the accepting end, side 1 the connecting end.
+   Side N writes to ring[N] and reads from ring[!N]. */
+
+#define AF_LOCAL_RING_SIZE	65536	/* Must be a power of 2 */
+#define AF_LOCAL_MAX_FDS	8	/* descriptors per sendmsg */
+#define AF_LOCAL_MAX_RIGHTS	16	/* sendmsg's with descriptors in flight */
+
+struct af_local_fd
+{
+  HANDLE h;		/* Handle value in sender's process */
+  DWORD access;
+  int flags;
+  char name[MAX_PATH];
+};
+
+/* Descriptors passed with msg_accrights.  They are attached to the stream
+   offset at which the data of the same sendmsg starts.  Socket descriptors
+   can't be passed, sendmsg fails with EOPNOTSUPP for them. */
+struct af_local_rights
+{
+  DWORD offset;
+  DWORD winpid;		/* Sender's Windows pid */
+  int nfds;
+  af_local_fd fd[AF_LOCAL_MAX_FDS];
+};
+
+struct af_local_ring
+{
+  LONG lock;				/* Windows pid of the holder, or 0 */
+  volatile DWORD head;			/* Advanced by writer only */
+  volatile DWORD tail;			/* Advanced by reader only */
+  volatile LONG closed;			/* Writer has shut down */
+  volatile LONG rclosed;		/* Reader has gone away */
+  volatile DWORD rights_head;
+  volatile DWORD rights_tail;
+  af_local_rights rights[AF_LOCAL_MAX_RIGHTS];
+  char data[AF_LOCAL_RING_SIZE];
+};
+
+struct af_local_shared
+{
+  volatile LONG attached[2];		/* Side has attached, never reset */
+  volatile LONG refs[2];		/* Open descriptors per side */
+  af_local_ring ring[2];
+};
+
+class af_local_conn
+{
+  HANDLE map;
+  af_local_shared *shared;
+  int side;
+  /* data_evt[N] is raised when data is written into ring[!N] or ring[!N]
+     is shut down, space_evt[N] when ring[N] is drained or its reader goes
+     away, i.e. side N waits on them.  select_evt[N] is raised along with
+     either, so that select can wait for reading and writing at once.  All
+     are manual reset events which are reset before testing the ring
+     state. */
+  HANDLE data_evt[2];
+  HANDLE space_evt[2];
+  HANDLE select_evt[2];
+
+  af_local_ring *rd () { return shared->ring + !side; }
+  af_local_ring *wr () { return shared->ring + side; }
+  void wake_reader ()
+  {
+    SetEvent (data_evt[!side]);
+    SetEvent (select_evt[!side]);
+  }
+  void wake_writer ()
+  {
+    SetEvent (space_evt[!side]);
+    SetEvent (select_evt[!side]);
+  }
+
+public:
+  af_local_conn () : map (NULL), shared (NULL) {}
+  bool attached () const { return shared != NULL; }
+
+  /* The methods are implemented in fhandler_socket.cc */
+  bool attach (int nside, unsigned short server_port,
+	       unsigned short client_port, int *secret,
+	       LPSECURITY_ATTRIBUTES sa);
+  bool peer_attached ();
+  bool remap ();
+  void add_ref ();
+  void release_ref ();
+  bool dup (af_local_conn *child);
+  void detach ();
+  void close ();
+
+  int send (const struct msghdr *msg, bool nonblocking);
+  int recv (struct msghdr *msg, int flags, bool nonblocking);
+  void shutdown_write ();
+
+  bool readable ();
+  bool writable ();
+  int bytes_available ();
+  HANDLE select_event () const { return select_evt[side]; }
+
+  /* Accessors for fork_fixup and set_inheritance. */
+  static const int nhandles = 7;
+  HANDLE& handle (int n)
+  {
+    return n == 0 ? map : n < 3 ? data_evt[n - 1]
+			: n < 5 ? space_evt[n - 3] : select_evt[n - 5];
+  }
+};
+
+/* Datagram sockets need no connection setup.  Each one owns an inbox, a single
+   ring in a named shared memory area, which any sender can open.  Bound
+   sockets name it after the port and secret in their socket file, so that
+   senders find it through the path, others after their wake events.  Each
+   datagram is stored as an af_local_dgram_hdr followed by the data, padded
+   to a multiple of 4 bytes.  A sender finding the inbox full registers as a
+   waiter, and the receiver raises the waiters' space events once it has
+   made room.  closed is unused, rclosed is set when the owner goes away. */
+
+#define AF_LOCAL_MAX_WAITERS	16
+
+struct af_local_dgram_hdr
+{
+  DWORD len;
+  char from[UNIX_PATH_LEN];		/* Sender's bound path, or empty */
+};
+
+struct af_local_inbox
+{
+  volatile LONG refs;			/* Open descriptors of the owner */
+  DWORD owner[2];			/* Names the owner's events */
+  DWORD nwaiters;			/* The waiters are protected by */
+  DWORD waiter[AF_LOCAL_MAX_WAITERS][2]; /* ring.lock */
+  af_local_ring ring;
+};
+
+struct af_local_peer
+{
+  HANDLE map;
+  af_local_inbox *box;
+  HANDLE data_evt;			/* The owner's events */
+  HANDLE select_evt;
+  unsigned short port;			/* Name of the inbox */
+  int secret[4];
+};
+
+class af_local_dgram
+{
+  DWORD id[2];
+  /* Our own inbox and its name. */
+  HANDLE map;
+  af_local_inbox *box;
+  unsigned short port;
+  int secret[4];
+  /* data_evt is raised when a datagram arrives in our inbox, space_evt when
+     an inbox we wait for got drained or its owner went away.  select_evt
+     is raised along with either.  The events are named after id. */
+  HANDLE data_evt;
+  HANDLE space_evt;
+  HANDLE select_evt;
+  af_local_peer peer;			/* Set by connect */
+  af_local_peer last;			/* Cache for sendto, not inherited */
+
+  bool open_peer (af_local_peer &p, unsigned short nport, int *nsecret,
+		  LPSECURITY_ATTRIBUTES sa);
+  void close_inbox ();
+
+public:
+  af_local_dgram () : map (NULL), box (NULL) {}
+
+  /* The methods are implemented in fhandler_socket.cc */
+  bool create (unsigned short nport, int *nsecret, LPSECURITY_ATTRIBUTES sa);
+  bool bind (unsigned short nport, int *nsecret, LPSECURITY_ATTRIBUTES sa);
+  bool connect (unsigned short nport, int *nsecret, LPSECURITY_ATTRIBUTES sa);
+  bool connect (af_local_dgram *other, LPSECURITY_ATTRIBUTES sa);
+  af_local_peer *connected_peer () { return peer.box ? &peer : NULL; }
+  af_local_peer *find_peer (unsigned short nport, int *nsecret);
+  bool remap ();
+  void forget_last ();
+  void add_ref ();
+  void release_ref ();
+  bool dup (af_local_dgram *child);
+  void detach ();
+  void close ();
+
+  int send (const struct msghdr *msg, af_local_peer *p, const char *from,
+	    bool nonblocking);
+  int recv (struct msghdr *msg, int flags, bool nonblocking);
+
+  bool readable ();
+  bool writable ();
+  int bytes_available ();
+  HANDLE select_event () const { return select_evt; }
+
+  /* Accessors for fork_fixup and set_inheritance.  Unused ones are NULL. */
+  static const int nhandles = 7;
+  HANDLE& handle (int n)
+  {
+    switch (n)
+      {
+      case 0:
+	return map;
+      case 1:
+	return data_evt;
+      case 2:
+	return space_evt;
+      case 3:
+	return select_evt;
+      case 4:
+	return peer.map;
+      case 5:
+	return peer.data_evt;
+      default:
+	return peer.select_evt;
+      }
+  }
+};
+
+#endif /* __AF_LOCAL_H__ */
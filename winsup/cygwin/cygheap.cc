@@ -201,7 +201,7 @@ cygheap_init ()
       init_cheap ();
       (void) _csbrk (sizeof (*cygheap));
     }
-  if (!cygheap->fdtab)
+  if (!cygheap->fdtab.size)
     cygheap->fdtab.init ();
 }
 
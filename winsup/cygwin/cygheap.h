@@ -281,7 +281,7 @@ class cygheap_fdmanip
   }
   operator int &() {return fd;}
   operator fhandler_base* &() {return *fh;}
-  void operator = (fhandler_base *fh) {*this->fh = fh;}
+  void operator = (fhandler_base *fh) {cygheap->fdtab.set (fd, fh);}
   fhandler_base *operator -> () const {return *fh;}
   bool isopen () const
   {
@@ -306,7 +306,7 @@ class cygheap_fdnew : public cygheap_fdmanip
     if (fd >= 0)
       {
 	locked = lockit;
-	fh = cygheap->fdtab + fd;
+	fh = cygheap->fdtab.slot (fd);
       }
     else
       {
@@ -316,7 +316,7 @@ class cygheap_fdnew : public cygheap_fdmanip
 	locked = false;
       }
   }
-  void operator = (fhandler_base *fh) {*this->fh = fh;}
+  void operator = (fhandler_base *fh) {cygheap->fdtab.set (fd, fh);}
 };
 
 class cygheap_fdget : public cygheap_fdmanip
@@ -327,7 +327,7 @@ class cygheap_fdget : public cygheap_fdmanip
     if (lockit)
       SetResourceLock (LOCK_FD_LIST, READ_LOCK, "cygheap_fdget");
     if (fd >= 0 && fd < (int) cygheap->fdtab.size
-	&& *(fh = cygheap->fdtab + fd) != NULL)
+	&& *(fh = cygheap->fdtab.slot (fd)) != NULL)
       {
 	this->fd = fd;
 	locked = lockit;
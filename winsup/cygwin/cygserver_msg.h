@@ -0,0 +1,196 @@
+/* cygserver_msg.h: Single unix specification IPC interface for Cygwin.
+
+   Copyright 2003 Red Hat, Inc.
+
+This file is part of Cygwin.
+
+This software is a copyrighted work licensed under the terms of the
+Cygwin license.  Please consult the file "CYGWIN_LICENSE" for
+details. */
+
+#ifndef __CYGSERVER_MSG_H__
+#define __CYGSERVER_MSG_H__
+
+#include <sys/types.h>
+#include <cygwin/msg.h>
+
+#include <assert.h>
+#include <limits.h>
+
+#include "cygserver_ipc.h"
+
+#include "cygwin/cygserver.h"
+
+/*---------------------------------------------------------------------------*
+ * Values for the msginfo entries.
+ *
+ * Nb. MSGSEG is the maximum number of messages on any one queue.
+ *---------------------------------------------------------------------------*/
+
+enum
+  {
+    MSGMAX = 8192,
+    MSGMNB = 16384,
+    MSGMNI = 128,		// Must be <= IPCMNI.
+    MSGSEG = 1024,
+    MSGTQL = MSGMNI * MSGSEG,
+    MSGPOOL = MSGMNI * MSGMNB
+  };
+
+/*---------------------------------------------------------------------------*
+ * struct msgq_shared_t
+ *
+ * The mapping shared by cygserver and the processes attached to a
+ * queue.  The messages are kept in `arena' in the order they were
+ * sent, each one as a msgq_msg_t header followed by the message text
+ * padded to a multiple of four bytes; msgrcv (2) closes the gap it
+ * leaves behind.  The `what' field of a wait list entry is one of
+ * MSG_WAITSEND or MSG_WAITRECV.  Everything is protected by `lock'.
+ *---------------------------------------------------------------------------*/
+
+enum
+  {
+    MSG_WAITSEND,
+    MSG_WAITRECV
+  };
+
+struct msgq_msg_t
+{
+  long mtype;
+  size_t msize;
+
+  static size_t size (const size_t msize)
+  {
+    return sizeof (msgq_msg_t) + ((msize + 3) & ~3);
+  }
+
+  char *text () { return (char *) (this + 1); }
+  msgq_msg_t *next () { return (msgq_msg_t *) ((char *) this + size (msize)); }
+};
+
+enum
+  {
+    MSGQ_ARENA = MSGMNB + MSGSEG * (sizeof (msgq_msg_t) + 3)
+  };
+
+struct msgq_shared_t
+{
+  volatile LONG lock;
+  LONG deleted;			// Set by IPC_RMID.
+  msglen_t cbytes;
+  msgqnum_t qnum;
+  msglen_t qbytes;
+  pid_t lspid;
+  pid_t lrpid;
+  time_t stime;
+  time_t rtime;
+  size_t used;			// Bytes of arena in use.
+  ipc_waiter_t waiters[IPC_WAITERS];
+  char arena[MSGQ_ARENA];
+
+  msgq_msg_t *first () { return (msgq_msg_t *) arena; }
+  msgq_msg_t *end () { return (msgq_msg_t *) (arena + used); }
+};
+
+/*---------------------------------------------------------------------------*
+ * class client_request_msg
+ *
+ * Only msgget (2), msgctl (2) and attaching to a queue go through
+ * cygserver.  msgsnd (2) and msgrcv (2) work directly on the queue's
+ * mapping.
+ *---------------------------------------------------------------------------*/
+
+#ifndef __INSIDE_CYGWIN__
+class transport_layer_base;
+class process_cache;
+#endif
+
+class client_request_msg : public client_request
+{
+  friend class client_request;
+
+public:
+  enum msgop_t
+    {
+      MSGOP_msgattach,
+      MSGOP_msgctl,
+      MSGOP_msgget
+    };
+
+#ifdef __INSIDE_CYGWIN__
+  client_request_msg (int msqid); // attach
+  client_request_msg (int msqid, int cmd, const struct msqid_ds *); // msgctl
+  client_request_msg (key_t, int msgflg); // msgget
+#endif
+
+  // Accessors for out parameters.
+
+  int msqid () const
+  {
+    assert (!error_code ());
+    return _parameters.out.msqid;
+  }
+
+  HANDLE hFileMap () const
+  {
+    assert (!error_code ());
+    return _parameters.out.hFileMap;
+  }
+
+  const struct msqid_ds & ds () const
+  {
+    assert (!error_code ());
+    return _parameters.out.ds;
+  }
+
+  const struct msginfo & msginfo () const
+  {
+    assert (!error_code ());
+    return _parameters.out.msginfo;
+  }
+
+  const struct msg_info & msg_info () const
+  {
+    assert (!error_code ());
+    return _parameters.out.msg_info;
+  }
+
+private:
+  union
+  {
+    struct
+    {
+      msgop_t msgop;
+      key_t key;
+      int msgflg;
+      int msqid;
+      int cmd;
+      pid_t cygpid;
+      DWORD winpid;
+      __uid32_t uid;
+      __gid32_t gid;
+      struct msqid_ds ds;
+    } in;
+
+    struct {
+      int msqid;
+      union
+      {
+	HANDLE hFileMap;
+	struct msqid_ds ds;
+	struct msginfo msginfo;
+	struct msg_info msg_info;
+      };
+    } out;
+  } _parameters;
+
+#ifndef __INSIDE_CYGWIN__
+  client_request_msg ();
+#endif
+
+#ifndef __INSIDE_CYGWIN__
+  virtual void serve (transport_layer_base *, process_cache *);
+#endif
+};
+
+#endif /* __CYGSERVER_MSG_H__ */
@@ -0,0 +1,244 @@
+/* cygserver_sem.h: Single unix specification IPC interface for Cygwin.
+
+   Copyright 2003 Red Hat, Inc.
+
+This file is part of Cygwin.
+
+This software is a copyrighted work licensed under the terms of the
+Cygwin license.  Please consult the file "CYGWIN_LICENSE" for
+details. */
+
+#ifndef __CYGSERVER_SEM_H__
+#define __CYGSERVER_SEM_H__
+
+#include <sys/types.h>
+#include <cygwin/sem.h>
+
+#include <assert.h>
+#include <limits.h>
+
+#include "cygserver_ipc.h"
+
+#include "cygwin/cygserver.h"
+
+/*---------------------------------------------------------------------------*
+ * Values for the seminfo entries.
+ *
+ * Nb. SEMMNU is the number of processes using SEM_UNDO that may have
+ * semadj values in any one set.  The undo table starts out with
+ * SEMUNDO_SLOTS slots and doubles in size when it is full.
+ *---------------------------------------------------------------------------*/
+
+enum
+  {
+    SEMMNI = 128,		// Must be <= IPCMNI.
+    SEMMSL = 250,
+    SEMMNS = SEMMNI * SEMMSL,
+    SEMOPM = 32,
+    SEMMNU = 32768,
+    SEMUME = SEMMSL,
+    SEMVMX = 32767,
+    SEMAEM = SEMVMX,
+    SEMUNDO_SLOTS = 16
+  };
+
+/*---------------------------------------------------------------------------*
+ * struct semset_shared_t
+ *
+ * The mapping shared by cygserver and the processes attached to a
+ * set.  The header is followed by the semaphores.  The `what' field of
+ * a wait list entry is the semaphore number, with SEM_WAITZERO or'ed in
+ * if the waiter waits for the value to become zero.  Waiters which
+ * found the wait list full and poll instead count themselves in the
+ * semaphore's npoll or zpoll.  Everything is protected by `lock'.
+ *
+ * The semadj values live in a second mapping, the undo table, which
+ * only processes calling semop (2) with SEM_UNDO map.  It holds
+ * `undo_slots' slots of slot_size () bytes each.  cygserver replaces
+ * it with a larger one when it runs out of slots, and bumps `undo_seq'
+ * so that the processes map the new table.  A semadj value only counts
+ * if its `gen' matches the semaphore's `adjgen', which SETVAL and
+ * SETALL bump to clear the semadj values of all processes at once.
+ *---------------------------------------------------------------------------*/
+
+enum
+  {
+    SEM_WAITZERO = 0x10000
+  };
+
+struct semset_sem_t
+{
+  unsigned short semval;
+  pid_t sempid;
+  DWORD adjgen;
+  LONG npoll;
+  LONG zpoll;
+};
+
+struct semset_adj_t
+{
+  DWORD gen;
+  short value;
+};
+
+struct semset_slot_t
+{
+  DWORD winpid;			// 0 if the slot is unused.
+  pid_t cygpid;
+  semset_adj_t semadj[1];	// [nsems]
+};
+
+struct semset_shared_t
+{
+  volatile LONG lock;
+  LONG deleted;			// Set by IPC_RMID.
+  int nsems;
+  time_t otime;
+  time_t ctime;
+  LONG undo_seq;
+  int undo_slots;
+  ipc_waiter_t waiters[IPC_WAITERS];
+
+  semset_sem_t *sem ()
+  {
+    return (semset_sem_t *) (this + 1);
+  }
+
+  static size_t size (const int nsems)
+  {
+    return sizeof (semset_shared_t) + nsems * sizeof (semset_sem_t);
+  }
+
+  static size_t slot_size (const int nsems)
+  {
+    return sizeof (semset_slot_t) + (nsems - 1) * sizeof (semset_adj_t);
+  }
+
+  semset_slot_t *slot (void *const undo, const int n)
+  {
+    assert (0 <= n && n < undo_slots);
+    return (semset_slot_t *) ((char *) undo + n * slot_size (nsems));
+  }
+};
+
+/*---------------------------------------------------------------------------*
+ * class client_request_sem
+ *
+ * Only semget (2), the lifecycle commands of semctl (2), attaching to
+ * a set and getting an undo slot go through cygserver.  semop (2) and
+ * the value commands of semctl (2) work directly on the set's mapping.
+ *---------------------------------------------------------------------------*/
+
+#ifndef __INSIDE_CYGWIN__
+class transport_layer_base;
+class process_cache;
+#endif
+
+class client_request_sem : public client_request
+{
+  friend class client_request;
+
+public:
+  enum semop_t
+    {
+      SEMOP_semattach,
+      SEMOP_semctl,
+      SEMOP_semget,
+      SEMOP_semundo
+    };
+
+#ifdef __INSIDE_CYGWIN__
+  client_request_sem (semop_t, int semid); // attach, undo
+  client_request_sem (int semid, int cmd, const struct semid_ds *); // semctl
+  client_request_sem (key_t, int nsems, int semflg); // semget
+#endif
+
+  // Accessors for out parameters.
+
+  int semid () const
+  {
+    assert (!error_code ());
+    return _parameters.out.semid;
+  }
+
+  HANDLE hFileMap () const
+  {
+    assert (!error_code ());
+    return _parameters.out.attach.hFileMap;
+  }
+
+  int slot () const
+  {
+    assert (!error_code ());
+    return _parameters.out.attach.slot;
+  }
+
+  LONG undo_seq () const
+  {
+    assert (!error_code ());
+    return _parameters.out.attach.undo_seq;
+  }
+
+  const struct semid_ds & ds () const
+  {
+    assert (!error_code ());
+    return _parameters.out.ds;
+  }
+
+  const struct seminfo & seminfo () const
+  {
+    assert (!error_code ());
+    return _parameters.out.seminfo;
+  }
+
+  const struct sem_info & sem_info () const
+  {
+    assert (!error_code ());
+    return _parameters.out.sem_info;
+  }
+
+private:
+  union
+  {
+    struct
+    {
+      semop_t semop;
+      key_t key;
+      int nsems;
+      int semflg;
+      int semid;
+      int cmd;
+      pid_t cygpid;
+      DWORD winpid;
+      __uid32_t uid;
+      __gid32_t gid;
+      struct semid_ds ds;
+    } in;
+
+    struct {
+      int semid;
+      union
+      {
+	struct
+	{
+	  HANDLE hFileMap;	// The set's mapping, or its undo table.
+	  int slot;		// Our slot in the undo table.
+	  LONG undo_seq;
+	} attach;
+	struct semid_ds ds;
+	struct seminfo seminfo;
+	struct sem_info sem_info;
+      };
+    } out;
+  } _parameters;
+
+#ifndef __INSIDE_CYGWIN__
+  client_request_sem ();
+#endif
+
+#ifndef __INSIDE_CYGWIN__
+  virtual void serve (transport_layer_base *, process_cache *);
+#endif
+};
+
+#endif /* __CYGSERVER_SEM_H__ */
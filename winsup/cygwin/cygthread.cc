@@ -18,11 +18,26 @@ details. */
 
 #undef CloseHandle
 
-static cygthread NO_COPY threads[18];
+static cygthread NO_COPY threads[64];
 #define NTHREADS (sizeof (threads) / sizeof (threads[0]))
 
+/* A pool thread which has been idle for IDLE_TIMEOUT ms exits unless
+   no more than IDLE_KEEP pool threads are idle.  Its slot stays on the
+   free list and gets a new thread when it is used again. */
+#define IDLE_TIMEOUT 30000
+#define IDLE_KEEP 4
+
 DWORD NO_COPY cygthread::main_thread_id;
 bool NO_COPY cygthread::exiting;
+cygthread_stats NO_COPY cygthread::stats;
+
+/* Head of the list of free slots.  The low 16 bits hold the index of
+   the first free slot plus one, the high 16 bits a counter which is
+   bumped on every change so that a stale compare-exchange fails. */
+LONG NO_COPY cygthread::free_head;
+
+#define FREE_INDEX(x) ((x) & 0xffff)
+#define FREE_NEXT(x, i) ((LONG) ((((DWORD) (x) & ~0xffff) + 0x10000) | (i)))
 
 /* Initial stub called by cygthread constructor. Performs initial
    per-thread initialization and loops waiting for new thread functions
@@ -75,14 +90,13 @@ cygthread::stub (VOID *arg)
 	  info->__name = NULL;
 	  SetEvent (info->ev);
 	}
-      switch (WaitForSingleObject (info->thread_sync, INFINITE))
-	{
-	case WAIT_OBJECT_0:
-	  continue;
-	default:
-	  api_fatal ("WFSO failed, %E");
-	  break;
-	}
+      DWORD res;
+      while ((res = WaitForSingleObject (info->thread_sync, IDLE_TIMEOUT))
+	     == WAIT_TIMEOUT)
+	if (info->retire ())
+	  ExitThread (0);
+      if (res != WAIT_OBJECT_0)
+	api_fatal ("WFSO failed, %E");
     }
 }
 
@@ -116,7 +130,7 @@ cygthread::is ()
 {
   DWORD tid = GetCurrentThreadId ();
 
-  for (DWORD i = 0; i < NTHREADS; i++)
+  for (LONG i = 0; i < stats.slots; i++)
     if (threads[i].id == tid)
       return 1;
 
@@ -129,24 +143,97 @@ cygthread::freerange ()
   cygthread *self = (cygthread *) calloc (1, sizeof (*self));
   self->is_freerange = true;
   self->ev = self->h;
+  InterlockedIncrement (&stats.freerange);
   return self;
 }
 
+/* Take the first slot off the free list. */
+cygthread *
+cygthread::pop_free ()
+{
+  LONG head, next;
+  do
+    {
+      head = free_head;
+      if (!FREE_INDEX (head))
+	return NULL;
+      next = FREE_NEXT (head, threads[FREE_INDEX (head) - 1].next_free);
+    }
+  while (InterlockedCompareExchange (&free_head, next, head) != head);
+  return threads + FREE_INDEX (head) - 1;
+}
+
+/* Put this slot on the free list. */
+void
+cygthread::push_free ()
+{
+  LONG head;
+  do
+    {
+      head = free_head;
+      next_free = FREE_INDEX (head);
+    }
+  while (InterlockedCompareExchange (&free_head,
+				     FREE_NEXT (head, this - threads + 1), head)
+	 != head);
+}
+
+/* Mark a pool slot as available again. */
+void
+cygthread::release ()
+{
+  if (h)
+    InterlockedIncrement (&stats.idle);
+  InterlockedDecrement (&stats.active);
+  (void) InterlockedExchange (&inuse, 0); /* No longer in use */
+  push_free ();
+}
+
+/* Called by an idle pool thread after waiting IDLE_TIMEOUT ms for
+   work.  Returns true if the thread should exit.  The slot is claimed
+   while it is cleaned up, so operator new can't hand it out with a
+   half dead thread. */
+bool
+cygthread::retire ()
+{
+  if (exiting || stats.idle <= IDLE_KEEP
+      || InterlockedCompareExchange (&inuse, 1, 0))
+    return false;
+  InterlockedDecrement (&stats.idle);
+  InterlockedIncrement (&stats.reaped);
+  thread_printf ("idle thread %p exiting", id);
+  CloseHandle (h);
+  h = NULL;
+  id = 0;
+  stack_ptr = NULL;
+  (void) InterlockedExchange (&inuse, 0);
+  return true;
+}
+
 void * cygthread::operator
 new (size_t)
 {
   cygthread *info;
+  LONG n;
 
-  /* Search the threads array for an empty slot to use */
-  for (info = threads; info < threads + NTHREADS; info++)
-    if (!InterlockedExchange (&info->inuse, 1))
+  /* Reuse a free slot if there is one.  A slot whose thread is just
+     retiring is briefly marked in use; wait for that to finish. */
+  if ((info = pop_free ()))
+    {
+      while (InterlockedCompareExchange (&info->inuse, 1, 0))
+	low_priority_sleep (0);
+      if (info->h)
+	InterlockedDecrement (&stats.idle);
+      goto found;
+    }
+
+  /* Otherwise grow the pool by one slot. */
+  while ((n = stats.slots) < (LONG) NTHREADS)
+    if (InterlockedCompareExchange (&stats.slots, n + 1, n) == n)
       {
-	/* available */
-#ifdef DEBUGGING
-	if (info->__name)
-	  api_fatal ("name not NULL? id %p, i %d", info->id, info - threads);
-#endif
-	goto out;
+	info = threads + n;
+	(void) InterlockedExchange (&info->inuse, 1);
+	goto found;
       }
 
 #ifdef DEBUGGING
@@ -156,8 +243,14 @@ new (size_t)
 #endif
 
   info = freerange ();	/* exhausted thread pool */
+  return info;
 
-out:
+found:
+#ifdef DEBUGGING
+  if (info->__name)
+    api_fatal ("name not NULL? id %p, i %d", info->id, info - threads);
+#endif
+  InterlockedIncrement (&stats.active);
   return info;
 }
 
@@ -180,6 +273,8 @@ cygthread::cygthread (LPTHREAD_START_ROUTINE start, LPVOID param,
 			this, 0, &id);
       if (!h)
 	api_fatal ("thread handle not set - %p<%p>, %E", h, id);
+      if (!is_freerange)
+	InterlockedIncrement (&stats.created);
       thread_printf ("created thread %p", h);
     }
 }
@@ -196,7 +291,7 @@ cygthread::name (DWORD tid)
   if (tid == main_thread_id)
     return "main";
 
-  for (DWORD i = 0; i < NTHREADS; i++)
+  for (LONG i = 0; i < stats.slots; i++)
     if (threads[i].id == tid)
       {
 	res = threads[i].__name ?: "exiting thread";
@@ -264,7 +359,7 @@ cygthread::terminate_thread ()
       h = NULL;
       __name = NULL;
       stack_ptr = NULL;
-      (void) InterlockedExchange (&inuse, 0); /* No longer in use */
+      release ();
     }
 }
 
@@ -320,7 +415,7 @@ cygthread::detach (HANDLE sigwait)
 	{
 	  ResetEvent (*this);
 	  /* Mark the thread as available by setting inuse to zero */
-	  (void) InterlockedExchange (&inuse, 0);
+	  release ();
 	}
     }
   return signalled;
@@ -1,14 +1,27 @@
 /* cygthread.h
 
-   Copyright 1998, 1999, 2000, 2001, 2002 Red Hat, Inc.
+   Copyright 1998, 1999, 2000, 2001, 2002, 2003 Red Hat, Inc.
 
 This software is a copyrighted work licensed under the terms of the
 Cygwin license.  Please consult the file "CYGWIN_LICENSE" for
 details. */
 
+/* Counters describing the state of the thread pool, reported in
+   /proc/<pid>/cygthreads. */
+struct cygthread_stats
+{
+  LONG active;		/* Slots handed out and not yet detached */
+  LONG idle;		/* Pool threads waiting for work */
+  LONG slots;		/* Slots used so far */
+  LONG created;		/* Pool threads created */
+  LONG reaped;		/* Idle pool threads which exited */
+  LONG freerange;	/* Threads created because the pool was exhausted */
+};
+
 class cygthread
 {
   LONG inuse;
+  LONG next_free;
   DWORD id;
   HANDLE h;
   HANDLE ev;
@@ -19,11 +32,17 @@ class cygthread
   VOID *arg;
   bool is_freerange;
   static bool exiting;
+  static LONG free_head;
   static DWORD WINAPI stub (VOID *);
   static DWORD WINAPI simplestub (VOID *);
+  static cygthread *pop_free ();
+  void push_free ();
+  void release ();
+  bool retire ();
   void terminate_thread ();
  public:
   static DWORD main_thread_id;
+  static cygthread_stats stats;
   static const char * name (DWORD = 0);
   cygthread (LPTHREAD_START_ROUTINE, LPVOID, const char *);
   cygthread () {};
@@ -675,7 +675,9 @@ dll_crt0_1 ()
 #ifdef DEBUGGING
   {
   extern void fork_init ();
+  extern "C" void small_printf_check ();
   fork_init ();
+  small_printf_check ();
   }
 #endif
 
@@ -56,42 +56,123 @@ set_std_handle (int fd)
     SetStdHandle (std_consts[fd], cygheap->fdtab[fd]->get_output_handle ());
 }
 
+/* Allocate a table with room for nfds fds, which must be a multiple of
+   NOFILE_INCR. */
+fdtop *
+dtable::alloc_table (size_t nfds)
+{
+  fdtop *t = (fdtop *) ccalloc (HEAP_ARGV, 1, sizeof (fdtop));
+  if (!t)
+    return NULL;
+  for (size_t c = 0; c < nfds / NOFILE_INCR; c++)
+    if (!(t->chunk[c] = (fdchunk *) ccalloc (HEAP_ARGV, 1, sizeof (fdchunk))))
+      {
+	free_table (t);
+	return NULL;
+      }
+  return t;
+}
+
+void
+dtable::free_table (fdtop *t)
+{
+  for (int c = 0; c < NOFILE_CHUNKS && t->chunk[c]; c++)
+    cfree (t->chunk[c]);
+  cfree (t);
+}
+
 int
 dtable::extend (int howmuch)
 {
   int new_size = size + howmuch;
-  fhandler_base **newfds;
 
   if (howmuch <= 0)
     return 0;
 
-  if (new_size > (100 * NOFILE_INCR))
+  if (new_size > NOFILE_MAX)
     {
       set_errno (EMFILE);
       return 0;
     }
 
-  /* Try to allocate more space for fd table. We can't call realloc ()
-     here to preserve old table if memory allocation fails */
-
-  if (!(newfds = (fhandler_base **) ccalloc (HEAP_ARGV, new_size, sizeof newfds[0])))
+  if (!fds && !(fds = alloc_table (0)))
     {
       debug_printf ("calloc failed");
       set_errno (ENOMEM);
       return 0;
     }
-  if (fds)
+
+  /* Add whole chunks.  The existing ones stay where they are, so
+     concurrent lookups see either the old or the new size but never
+     a stale pointer.  The table held during vfork grows in step. */
+  while ((int) size < new_size)
     {
-      cfree (fds);
-      memcpy (newfds, fds, size * sizeof (fds[0]));
+      int c = size / NOFILE_INCR;
+      fdchunk *ch = (fdchunk *) ccalloc (HEAP_ARGV, 1, sizeof (fdchunk));
+      fdchunk *ch_on_hold = NULL;
+      if (!ch || (fds_on_hold && fds_on_hold != fds
+		  && !(ch_on_hold = (fdchunk *) ccalloc (HEAP_ARGV, 1,
+							 sizeof (fdchunk)))))
+	{
+	  if (ch)
+	    cfree (ch);
+	  debug_printf ("calloc failed");
+	  set_errno (ENOMEM);
+	  return 0;
+	}
+      fds->chunk[c] = ch;
+      if (ch_on_hold)
+	fds_on_hold->chunk[c] = ch_on_hold;
+      InterlockedExchange ((long *) &size, size + NOFILE_INCR);
     }
 
-  size = new_size;
-  fds = newfds;
   debug_printf ("size %d, fds %p", size, fds);
   return 1;
 }
 
+/* Store fh in the slot for fd and keep the free slot bitmaps in sync. */
+static void
+table_set (fdtop *t, int fd, fhandler_base *fh)
+{
+  int c = fd / NOFILE_INCR;
+  int i = fd % NOFILE_INCR;
+  fdchunk *ch = t->chunk[c];
+  DWORD bit = 1UL << (i % 32);
+
+  ch->fds[i] = fh;
+  if (!fh)
+    {
+      ch->used[i / 32] &= ~bit;
+      t->full[c / 32] &= ~(1UL << (c % 32));
+    }
+  else if ((ch->used[i / 32] |= bit) == ~0UL)
+    {
+      for (i = 0; i < NOFILE_INCR / 32; i++)
+	if (ch->used[i] != ~0UL)
+	  return;
+      t->full[c / 32] |= 1UL << (c % 32);
+    }
+}
+
+void
+dtable::set (int fd, fhandler_base *fh)
+{
+  table_set (fds, fd, fh);
+}
+
+/* Set the limit for newly allocated fds, i.e. RLIMIT_NOFILE. */
+int
+dtable::setlimit (int newlimit)
+{
+  if (newlimit < 0 || newlimit > NOFILE_MAX)
+    {
+      set_errno (EINVAL);
+      return -1;
+    }
+  limit = newlimit;
+  return 0;
+}
+
 void
 dtable::get_debugger_info ()
 {
@@ -163,34 +244,111 @@ dtable::stdio_init ()
     set_console_ctty ();
 }
 
+/* Return the lowest bit in map between from and to which is set if
+   `set', clear otherwise, or -1. */
+static int
+find_bit (const DWORD *map, int from, int to, bool set)
+{
+  for (int i = from; i < to; i = (i | 31) + 1)
+    {
+      DWORD w = (set ? map[i / 32] : ~map[i / 32]) & (~0UL << (i % 32));
+      if (w)
+	return (i & ~31) + low_zeros (w);
+    }
+  return -1;
+}
+
 int
 dtable::find_unused_handle (int start)
 {
   AssertResourceOwner (LOCK_FD_LIST, READ_LOCK);
-  do
+  int fd = start;
+  while (fd < limit)
     {
-      for (size_t i = start; i < size; i++)
-	/* See if open -- no need for overhead of not_open */
-	if (fds[i] == NULL)
-	  return i;
+      if ((size_t) fd >= size && !extend (fd + 1 - size))
+	return -1;
+
+      /* First look in fd's own chunk, then skip to the next chunk which
+	 isn't full.  Chunks not allocated yet are never marked full. */
+      int c = fd / NOFILE_INCR;
+      int i = find_bit (fds->chunk[c]->used, fd % NOFILE_INCR, NOFILE_INCR,
+			false);
+      if (i >= 0)
+	{
+	  fd = c * NOFILE_INCR + i;
+	  break;
+	}
+      if ((c = find_bit (fds->full, c + 1, NOFILE_CHUNKS, false)) < 0)
+	return -1;
+      fd = c * NOFILE_INCR;
+    }
+  return fd < limit ? fd : -1;
+}
+
+/* Return the lowest open fd not below fd, or -1.  Used to walk the
+   open fds only instead of the whole table. */
+int
+dtable::next_open (int fd)
+{
+  for (int c = fd / NOFILE_INCR; (size_t) fd < size; c++, fd = c * NOFILE_INCR)
+    {
+      int i = find_bit (fds->chunk[c]->used, fd % NOFILE_INCR, NOFILE_INCR,
+			true);
+      if (i >= 0)
+	return c * NOFILE_INCR + i;
     }
-  while (extend (NOFILE_INCR));
   return -1;
 }
 
+/* Some fds (currently only sockets which can't simply be inherited)
+   need extra effort in the parent, which requires starting the child
+   suspended. */
+bool
+dtable::need_fixup_before ()
+{
+  for (int i = next_open (0); i >= 0; i = next_open (i + 1))
+    if ((*this)[i]->need_fixup_before ())
+      return true;
+  return false;
+}
+
+/* Describe the open fds for /proc/<pid>/fd: for each, its number and
+   the name of its fhandler separated by a space, ending in a NUL.
+   Returns a malloc'd buffer, setting n to its length. */
+char *
+dtable::fd_names (size_t &n)
+{
+  char *buf = NULL;
+  size_t len = 0;
+
+  n = 0;
+  SetResourceLock (LOCK_FD_LIST, READ_LOCK, "fd_names");
+  for (int i = next_open (0); i >= 0; i = next_open (i + 1))
+    {
+      const char *name = (*this)[i]->get_name ();
+      if (!name)
+	name = "";
+      size_t need = n + 12 + strlen (name) + 1;
+      if (need > len)
+	{
+	  char *newbuf = (char *) realloc (buf, len = 2 * need);
+	  if (!newbuf)
+	    break;
+	  buf = newbuf;
+	}
+      n += __small_sprintf (buf + n, "%d %s", i, name) + 1;
+    }
+  ReleaseResourceLock (LOCK_FD_LIST, READ_LOCK, "fd_names");
+  return buf;
+}
+
 void
 dtable::release (int fd)
 {
   if (!not_open (fd))
     {
-      switch (fds[fd]->get_device ())
-	{
-	case FH_SOCKET:
-	  dec_need_fixup_before ();
-	  break;
-	}
-      delete fds[fd];
-      fds[fd] = NULL;
+      delete (*this)[fd];
+      set (fd, NULL);
     }
 }
 
@@ -262,7 +420,7 @@ dtable::init_std_file_from_handle (int fd, HANDLE handle)
     }
 
   if (!name)
-    fds[fd] = NULL;
+    set (fd, NULL);
   else
     {
       path_conv pc;
@@ -352,8 +510,7 @@ dtable::build_fhandler (int fd, DWORD dev, char *unix_name,
 	fh = cnew (fhandler_pipe) (dev);
 	break;
       case FH_SOCKET:
-	if ((fh = cnew (fhandler_socket) (unit)))
-	  inc_need_fixup_before ();
+	fh = cnew (fhandler_socket) (unit);
 	break;
       case FH_DISK:
 	fh = cnew (fhandler_disk_file) ();
@@ -415,7 +572,9 @@ dtable::build_fhandler (int fd, DWORD dev, char *unix_name,
 	return NULL;
     }
   debug_printf ("fd %d, fh %p", fd, fh);
-  return fd >= 0 ? (fds[fd] = fh) : fh;
+  if (fd >= 0)
+    set (fd, fh);
+  return fh;
 }
 
 fhandler_base *
@@ -454,7 +613,7 @@ dtable::dup2 (int oldfd, int newfd)
       goto done;
     }
 
-  if (newfd < 0)
+  if (newfd < 0 || newfd >= limit)
     {
       syscall_printf ("new fd out of bounds: %d", newfd);
       set_errno (EBADF);
@@ -467,14 +626,14 @@ dtable::dup2 (int oldfd, int newfd)
       goto done;
     }
 
-  if ((newfh = dup_worker (fds[oldfd])) == NULL)
+  if ((newfh = dup_worker ((*this)[oldfd])) == NULL)
     {
       res = -1;
       goto done;
     }
 
   debug_printf ("newfh->io_handle %p, oldfh->io_handle %p",
-		newfh->get_io_handle (), fds[oldfd]->get_io_handle ());
+		newfh->get_io_handle (), (*this)[oldfd]->get_io_handle ());
 
   if (!not_open (newfd))
     close (newfd);
@@ -487,7 +646,7 @@ dtable::dup2 (int oldfd, int newfd)
       goto done;
     }
 
-  fds[newfd] = newfh;
+  set (newfd, newfh);
 
   if ((res = newfd) <= 2)
     set_std_handle (res);
@@ -508,7 +667,7 @@ dtable::select_read (int fd, select_record *s)
       set_errno (EBADF);
       return NULL;
     }
-  fhandler_base *fh = fds[fd];
+  fhandler_base *fh = (*this)[fd];
   s = fh->select_read (s);
   s->fd = fd;
   s->fh = fh;
@@ -525,7 +684,7 @@ dtable::select_write (int fd, select_record *s)
       set_errno (EBADF);
       return NULL;
     }
-  fhandler_base *fh = fds[fd];
+  fhandler_base *fh = (*this)[fd];
   s = fh->select_write (s);
   s->fd = fd;
   s->fh = fh;
@@ -542,7 +701,7 @@ dtable::select_except (int fd, select_record *s)
       set_errno (EBADF);
       return NULL;
     }
-  fhandler_base *fh = fds[fd];
+  fhandler_base *fh = (*this)[fd];
   s = fh->select_except (s);
   s->fd = fd;
   s->fh = fh;
@@ -551,19 +710,27 @@ dtable::select_except (int fd, select_record *s)
   return s;
 }
 
-/* Function to walk the fd table after an exec and perform
-   per-fhandler type fixups. */
+/* Functions to walk the fd table before and after a fork or an exec
+   and perform per-fhandler type fixups.  They visit the open fds only.
+   Handles which are inherited keep their values in the child and need
+   no work at all, so only close-on-exec handles and the few types
+   needing special treatment are touched. */
 void
 dtable::fixup_before_fork (DWORD target_proc_id)
 {
   SetResourceLock (LOCK_FD_LIST, WRITE_LOCK | READ_LOCK, "fixup_before_fork");
+  int start = strace.microseconds ();
+  int nfixed = 0;
   fhandler_base *fh;
-  for (size_t i = 0; i < size; i++)
-    if ((fh = fds[i]) != NULL)
+  for (int i = next_open (0); i >= 0; i = next_open (i + 1))
+    if ((fh = (*this)[i])->need_fixup_before ())
       {
 	debug_printf ("fd %d (%s)", i, fh->get_name ());
 	fh->fixup_before_fork_exec (target_proc_id);
+	nfixed++;
       }
+  syscall_printf ("%d fds fixed up, %d us", nfixed,
+		  strace.microseconds () - start);
   ReleaseResourceLock (LOCK_FD_LIST, WRITE_LOCK | READ_LOCK, "fixup_before_fork");
 }
 
@@ -572,8 +739,8 @@ dtable::fixup_before_exec (DWORD target_proc_id)
 {
   SetResourceLock (LOCK_FD_LIST, WRITE_LOCK | READ_LOCK, "fixup_before_exec");
   fhandler_base *fh;
-  for (size_t i = 0; i < size; i++)
-    if ((fh = fds[i]) != NULL && !fh->get_close_on_exec ())
+  for (int i = next_open (0); i >= 0; i = next_open (i + 1))
+    if (!(fh = (*this)[i])->get_close_on_exec () && fh->need_fixup_before ())
       {
 	debug_printf ("fd %d (%s)", i, fh->get_name ());
 	fh->fixup_before_fork_exec (target_proc_id);
@@ -581,13 +748,29 @@ dtable::fixup_before_exec (DWORD target_proc_id)
   ReleaseResourceLock (LOCK_FD_LIST, WRITE_LOCK | READ_LOCK, "fixup_before_exec");
 }
 
+/* The child which fixup_before_fork or fixup_before_exec prepared for
+   never got going, so let go of whatever was taken on its behalf. */
+void
+dtable::fixup_before_failed (bool execing)
+{
+  SetResourceLock (LOCK_FD_LIST, WRITE_LOCK | READ_LOCK, "fixup_before_failed");
+  fhandler_base *fh;
+  for (int i = next_open (0); i >= 0; i = next_open (i + 1))
+    {
+      fh = (*this)[i];
+      if ((!execing || !fh->get_close_on_exec ()) && fh->need_fixup_before ())
+	fh->fixup_before_failed ();
+    }
+  ReleaseResourceLock (LOCK_FD_LIST, WRITE_LOCK | READ_LOCK, "fixup_before_failed");
+}
+
 void
 dtable::set_file_pointers_for_exec ()
 {
   SetResourceLock (LOCK_FD_LIST, WRITE_LOCK | READ_LOCK, "set_file_pointers_for_exec");
   fhandler_base *fh;
-  for (size_t i = 0; i < size; i++)
-    if ((fh = fds[i]) != NULL && fh->get_flags () & O_APPEND)
+  for (int i = next_open (0); i >= 0; i = next_open (i + 1))
+    if ((fh = (*this)[i])->get_flags () & O_APPEND)
       SetFilePointer (fh->get_handle (), 0, 0, FILE_END);
   ReleaseResourceLock (LOCK_FD_LIST, WRITE_LOCK | READ_LOCK, "fixup_before_exec");
 }
@@ -595,51 +778,71 @@ dtable::set_file_pointers_for_exec ()
 void
 dtable::fixup_after_exec (HANDLE parent)
 {
+  int start = strace.microseconds ();
+  int nfds = 0;
   first_fd_for_open = 0;
   fhandler_base *fh;
-  for (size_t i = 0; i < size; i++)
-    if ((fh = fds[i]) != NULL)
-      {
-	fh->clear_readahead ();
-	if (fh->get_close_on_exec ())
-	  release (i);
-	else
-	  {
-	    fh->fixup_after_exec (parent);
-	    if (i == 0)
-	      SetStdHandle (std_consts[i], fh->get_io_handle ());
-	    else if (i <= 2)
-	      SetStdHandle (std_consts[i], fh->get_output_handle ());
-	  }
-      }
+  for (int i = next_open (0); i >= 0; i = next_open (i + 1))
+    {
+      fh = (*this)[i];
+      fh->clear_readahead ();
+      if (fh->get_close_on_exec ())
+	release (i);
+      else
+	{
+	  fh->fixup_after_exec (parent);
+	  if (i == 0)
+	    SetStdHandle (std_consts[i], fh->get_io_handle ());
+	  else if (i <= 2)
+	    SetStdHandle (std_consts[i], fh->get_output_handle ());
+	  nfds++;
+	}
+    }
+  syscall_printf ("%d fds kept, %d us", nfds, strace.microseconds () - start);
 }
 
+/* Close-on-exec handles are not inheritable, so the child duplicates
+   each of them from the parent.  There is no call to duplicate more
+   than one handle at a time, and making them inheritable for the
+   duration of the fork would leak them into whatever another thread
+   spawns meanwhile. */
 void
 dtable::fixup_after_fork (HANDLE parent)
 {
+  int start = strace.microseconds ();
+  int nfds = 0, nfixed = 0;
   fhandler_base *fh;
-  for (size_t i = 0; i < size; i++)
-    if ((fh = fds[i]) != NULL)
-      {
-	if (fh->get_close_on_exec () || fh->get_need_fork_fixup ())
-	  {
-	    debug_printf ("fd %d (%s)", i, fh->get_name ());
-	    fh->fixup_after_fork (parent);
-	  }
-	if (i == 0)
-	  SetStdHandle (std_consts[i], fh->get_io_handle ());
-	else if (i <= 2)
-	  SetStdHandle (std_consts[i], fh->get_output_handle ());
-      }
+  for (int i = next_open (0); i >= 0; i = next_open (i + 1), nfds++)
+    {
+      fh = (*this)[i];
+      if (fh->get_close_on_exec () || fh->get_need_fork_fixup ())
+	{
+	  debug_printf ("fd %d (%s)", i, fh->get_name ());
+	  fh->fixup_after_fork (parent);
+	  nfixed++;
+	}
+      if (i == 0)
+	SetStdHandle (std_consts[i], fh->get_io_handle ());
+      else if (i <= 2)
+	SetStdHandle (std_consts[i], fh->get_output_handle ());
+    }
+  syscall_printf ("%d fds, %d fixed up, %d us", nfds, nfixed,
+		  strace.microseconds () - start);
 }
 
 int
 dtable::vfork_child_dup ()
 {
-  fhandler_base **newtable;
+  fdtop *newtable;
   SetResourceLock (LOCK_FD_LIST, WRITE_LOCK | READ_LOCK, "dup");
-  newtable = (fhandler_base **) ccalloc (HEAP_ARGV, size, sizeof (fds[0]));
+  if (!(newtable = alloc_table (size)))
+    {
+      ReleaseResourceLock (LOCK_FD_LIST, WRITE_LOCK | READ_LOCK, "dup");
+      set_errno (ENOMEM);
+      return 0;
+    }
   int res = 1;
+  fhandler_base *fh;
 
   /* Remove impersonation */
   cygheap->user.deimpersonate ();
@@ -647,8 +850,11 @@ dtable::vfork_child_dup ()
   for (size_t i = 0; i < size; i++)
     if (not_open (i))
       continue;
-    else if ((newtable[i] = dup_worker (fds[i])) != NULL)
-      newtable[i]->set_close_on_exec (fds[i]->get_close_on_exec ());
+    else if ((fh = dup_worker ((*this)[i])) != NULL)
+      {
+	table_set (newtable, i, fh);
+	fh->set_close_on_exec ((*this)[i]->get_close_on_exec ());
+      }
     else
       {
 	res = 0;
@@ -673,10 +879,10 @@ dtable::vfork_parent_restore ()
   SetResourceLock (LOCK_FD_LIST, WRITE_LOCK | READ_LOCK, "restore");
 
   close_all_files ();
-  fhandler_base **deleteme = fds;
+  fdtop *deleteme = fds;
   fds = fds_on_hold;
   fds_on_hold = NULL;
-  cfree (deleteme);
+  free_table (deleteme);
 
   ReleaseResourceLock (LOCK_FD_LIST, WRITE_LOCK | READ_LOCK, "restore");
   return;
@@ -688,7 +894,7 @@ dtable::vfork_child_fixup ()
   if (!fds_on_hold)
     return;
   debug_printf ("here");
-  fhandler_base **saveme = fds;
+  fdtop *saveme = fds;
   fds = fds_on_hold;
 
   fhandler_base *fh;
@@ -706,7 +912,7 @@ dtable::vfork_child_fixup ()
       }
 
   fds = saveme;
-  cfree (fds_on_hold);
+  free_table (fds_on_hold);
   fds_on_hold = NULL;
 
   return;
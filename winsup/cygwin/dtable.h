@@ -8,30 +8,50 @@ This software is a copyrighted work licensed under the terms of the
 Cygwin license.  Please consult the file "CYGWIN_LICENSE" for
 details. */
 
-/* Initial and increment values for cygwin's fd table */
-#define NOFILE_INCR    32
+/* Initial and increment values for cygwin's fd table.  The table is
+   allocated in chunks of NOFILE_INCR fds which never move once they
+   exist, so an fd can be looked up without locking the table. */
+#define NOFILE_INCR    128
+#define NOFILE_CHUNKS  512
+#define NOFILE_MAX     (NOFILE_INCR * NOFILE_CHUNKS)
+
+/* Default for RLIMIT_NOFILE. */
+#define NOFILE_LIMIT   3200
 
 #include "thread.h"
 
+/* A bit is set in `used' for each fd in use, and in `full' for each
+   chunk with all fds in use. */
+struct fdchunk
+{
+  DWORD used[NOFILE_INCR / 32];
+  fhandler_base *fds[NOFILE_INCR];
+};
+
+struct fdtop
+{
+  DWORD full[NOFILE_CHUNKS / 32];
+  fdchunk *chunk[NOFILE_CHUNKS];
+};
+
 class suffix_info;
 class dtable
 {
-  fhandler_base **fds;
-  fhandler_base **fds_on_hold;
+  fdtop *fds;
+  fdtop *fds_on_hold;
   int first_fd_for_open;
-  int cnt_need_fixup_before;
+  fdtop *alloc_table (size_t nfds);
+  void free_table (fdtop *);
 public:
   size_t size;
+  int limit;
 
-  dtable () : first_fd_for_open(3), cnt_need_fixup_before(0) {}
-  void init () {first_fd_for_open = 3;}
+  dtable () : first_fd_for_open(3) {}
+  void init () {first_fd_for_open = 3; limit = NOFILE_LIMIT;}
 
-  void dec_need_fixup_before ()
-    { if (cnt_need_fixup_before > 0) --cnt_need_fixup_before; }
-  void inc_need_fixup_before ()
-    { cnt_need_fixup_before++; }
-  BOOL need_fixup_before ()
-    { return cnt_need_fixup_before > 0; }
+  int next_open (int fd);
+  bool need_fixup_before ();
+  char *fd_names (size_t &n);
 
   int vfork_child_dup ();
   void vfork_parent_restore ();
@@ -40,6 +60,7 @@ public:
   int extend (int howmuch);
   void fixup_before_exec (DWORD win_proc_id);
   void fixup_before_fork (DWORD win_proc_id);
+  void fixup_before_failed (bool execing);
   void fixup_after_fork (HANDLE);
   fhandler_base *build_fhandler (int fd, DWORD dev, const char *unix_name,
 				 const char *win32_name = NULL, int unit = -1);
@@ -49,14 +70,10 @@ public:
 					   path_conv& pc,
 					   unsigned opts = PC_SYM_FOLLOW,
 					   suffix_info *si = NULL);
+  /* No lock needed, size never shrinks and chunks never move. */
   inline int not_open (int fd)
   {
-    SetResourceLock (LOCK_FD_LIST, READ_LOCK, "not_open");
-
-    int res = fd < 0 || fd >= (int) size || fds[fd] == NULL;
-
-    ReleaseResourceLock (LOCK_FD_LIST, READ_LOCK, "not open");
-    return res;
+    return fd < 0 || fd >= (int) size || (*this)[fd] == NULL;
   }
   int find_unused_handle (int start);
   int find_unused_handle () { return find_unused_handle (first_fd_for_open);}
@@ -64,11 +81,14 @@ public:
   void init_std_file_from_handle (int fd, HANDLE handle);
   int dup2 (int oldfd, int newfd);
   void fixup_after_exec (HANDLE);
-  inline fhandler_base *operator [](int fd) const { return fds[fd]; }
+  inline fhandler_base **slot (int fd) const
+    { return fds->chunk[fd / NOFILE_INCR]->fds + fd % NOFILE_INCR; }
+  inline fhandler_base *operator [](int fd) const { return *slot (fd); }
+  void set (int fd, fhandler_base *fh);
+  int setlimit (int newlimit);
   select_record *select_read (int fd, select_record *s);
   select_record *select_write (int fd, select_record *s);
   select_record *select_except (int fd, select_record *s);
-  operator fhandler_base **() {return fds;}
   void stdio_init ();
   void get_debugger_info ();
   void set_file_pointers_for_exec ();
@@ -159,6 +159,8 @@ posify (char **here, const char *value)
  *	Explicitly removes '=' in argument name.
  */
 
+unsigned long env_generation;
+
 static char * __stdcall
 my_findenv (const char *name, int *offset)
 {
@@ -229,6 +231,7 @@ _addenv (const char *name, const char *value, int overwrite)
       if (issetenv && strlen (p) >= valuelen)
 	{
 	  strcpy (p, value);
+	  env_generation++;
 	  return 0;
 	}
     }
@@ -281,6 +284,8 @@ _addenv (const char *name, const char *value, int overwrite)
       strcpy (envhere + namelen + 1, value);
     }
 
+  env_generation++;
+
   /* Update cygwin's cache, if appropriate */
   win_env *spenv;
   if ((spenv = getwinenv (envhere)))
@@ -342,10 +347,13 @@ unsetenv (const char *name)
   int offset;
 
   while (my_findenv (name, &offset))	/* if set multiple times */
-    /* Move up the rest of the array */
-    for (e = cur_environ () + offset; ; e++)
-      if (!(*e = *(e + 1)))
-	break;
+    {
+      /* Move up the rest of the array */
+      for (e = cur_environ () + offset; ; e++)
+	if (!(*e = *(e + 1)))
+	  break;
+      env_generation++;
+    }
 }
 
 /* Turn environment variable part of a=b string into uppercase. */
@@ -999,6 +1007,7 @@ cur_environ ()
     {
       __cygwin_environ = *main_environ;
       update_envptrs ();
+      env_generation++;
     }
 
   return __cygwin_environ;
@@ -40,6 +40,8 @@ char * __stdcall getwinenveq (const char *name, size_t len, int)
 
 void __stdcall update_envptrs ();
 extern char **__cygwin_environ, ***main_environ;
+/* Bumped on every change to the environment, see cur_environ. */
+extern unsigned long env_generation;
 extern "C" char __stdcall **cur_environ ();
 char ** __stdcall build_env (const char * const *envp, char *&envblock,
 			     int &envc, bool need_envblock)
@@ -260,6 +260,8 @@ cygwin_internal (cygwin_getinfo_types t, ...)
 	  char *filename = va_arg (arg, char *);
 	  return check_ntsec (filename);
 	}
+      case CW_SAMPLE_LOADAVG:
+	return loadavg_sample ();
       default:
 	return (DWORD) -1;
     }
@@ -246,7 +246,9 @@ class fhandler_base
 
   virtual void set_close_on_exec (int val);
 
+  virtual bool need_fixup_before () { return false; }
   virtual void fixup_before_fork_exec (DWORD) {}
+  virtual void fixup_before_failed () {}
   virtual void fixup_after_fork (HANDLE);
   virtual void fixup_after_exec (HANDLE) {}
 
@@ -391,9 +393,12 @@ class fhandler_socket: public fhandler_base
   int connect_secret [4];
   HANDLE secret_event;
   struct _WSAPROTOCOL_INFOA *prot_info_ptr;
+  class af_local_conn *lconn;	/* Shared memory transport, AF_LOCAL only */
+  class af_local_dgram *ldgram;	/* The same for datagram sockets */
   char *sun_path;
   int had_connect_or_listen;
   int unit;
+  bool ifs_handle;		/* Socket is a plain inheritable handle */
 
  public:
   fhandler_socket (int unit);
@@ -401,6 +406,14 @@ class fhandler_socket: public fhandler_base
   int get_socket () { return (int) get_handle(); }
   fhandler_socket * is_socket () { return this; }
   int get_unit () { return unit; }
+  af_local_conn *get_local_conn () { return lconn; }
+  af_local_dgram *get_local_dgram () { return ldgram; }
+  struct af_local_peer *local_dgram_peer (const struct sockaddr *to,
+					  int tolen);
+  void pair_local_dgram (fhandler_socket *fh);
+  bool is_ifs_handle () const { return ifs_handle; }
+  void set_ifs_handle (bool val) { ifs_handle = val; }
+  int dup_local_conn (fhandler_socket *child);
 
   bool saw_shutdown_read () const {return FHISSETF (SHUTRD);}
   bool saw_shutdown_write () const {return FHISSETF (SHUTWR);}
@@ -440,7 +453,9 @@ class fhandler_socket: public fhandler_base
   int dup (fhandler_base *child);
 
   void set_close_on_exec (int val);
+  bool need_fixup_before () { return !ifs_handle || lconn || ldgram; }
   virtual void fixup_before_fork_exec (DWORD);
+  void fixup_before_failed ();
   void fixup_after_fork (HANDLE);
   void fixup_after_exec (HANDLE);
 
@@ -869,7 +884,8 @@ class fhandler_tty_common: public fhandler_termios
   fhandler_tty_common (DWORD dev, int unit = 0)
     : fhandler_termios (dev, unit), output_done_event (NULL),
     ioctl_request_event (NULL), ioctl_done_event (NULL), output_mutex (NULL),
-    input_mutex (NULL), input_available_event (NULL), inuse (NULL), ttynum (unit)
+    input_mutex (NULL), input_available_event (NULL),
+    output_available_event (NULL), inuse (NULL), ttynum (unit)
   {
     // nothing to do
   }
@@ -881,6 +897,8 @@ class fhandler_tty_common: public fhandler_termios
 				// Ioctl() status in tty::ioctl_retval.
   HANDLE output_mutex, input_mutex;
   HANDLE input_available_event;
+  HANDLE output_available_event; // Raised by slave when data has been
+				// written to the master's input pipe.
   HANDLE inuse;			// used to indicate that a tty is in use
   int ttynum;			// Master tty num.
 
@@ -928,6 +946,8 @@ class fhandler_tty_slave: public fhandler_tty_common
 class fhandler_pty_master: public fhandler_tty_common
 {
   int pktmode;			// non-zero if pty in a packet mode.
+  bool unsignalled_output;	// output seen without output_available_event
+  int event_reads;		// reads woken by the event while polling
  public:
   int need_nl;			// Next read should start with \n
 
@@ -28,6 +28,7 @@ details. */
 #include "ntdll.h"
 #include <winioctl.h>
 #include "cpuid.h"
+#include "shared_info.h"
 
 #define _COMPILING_NEWLIB
 #include <dirent.h>
@@ -41,6 +42,7 @@ static const int PROC_VERSION  = 6;     // /proc/version
 static const int PROC_UPTIME   = 7;     // /proc/uptime
 static const int PROC_CPUINFO  = 8;     // /proc/cpuinfo
 static const int PROC_PARTITIONS = 9;   // /proc/partitions
+static const int PROC_PRESSURE = 10;    // /proc/pressure
 
 /* names of objects in /proc */
 static const char *proc_listing[] = {
@@ -54,6 +56,7 @@ static const char *proc_listing[] = {
   "uptime",
   "cpuinfo",
   "partitions",
+  "pressure",
   NULL
 };
 
@@ -73,6 +76,7 @@ static const DWORD proc_fhandlers[PROC_LINK_COUNT] = {
   FH_PROC,
   FH_PROC,
   FH_PROC,
+  FH_PROC,
 };
 
 /* name of the /proc filesystem */
@@ -84,6 +88,8 @@ static _off64_t format_proc_stat (char *destbuf, size_t maxsize);
 static _off64_t format_proc_uptime (char *destbuf, size_t maxsize);
 static _off64_t format_proc_cpuinfo (char *destbuf, size_t maxsize);
 static _off64_t format_proc_partitions (char *destbuf, size_t maxsize);
+static _off64_t format_proc_loadavg (char *destbuf, size_t maxsize);
+static _off64_t format_proc_pressure (char *destbuf, size_t maxsize);
 
 /* Auxillary function that returns the fhandler associated with the given path
    this is where it would be nice to have pattern matching in C - polymorphism
@@ -354,14 +360,8 @@ fhandler_proc::fill_filebuf ()
       }
     case PROC_LOADAVG:
       {
-	/*
-	 * not really supported - Windows doesn't keep track of these values
-	 * Windows 95/98/me does have the KERNEL/CPUUsage performance counter
-	 * which is similar.
-	 */
-	filebuf = (char *) realloc (filebuf, bufalloc = 16);
-	filesize = __small_sprintf (filebuf, "%u.%02u %u.%02u %u.%02u\n",
-				    0, 0, 0, 0, 0, 0);
+	filebuf = (char *) realloc (filebuf, bufalloc = 64);
+	filesize = format_proc_loadavg (filebuf, bufalloc);
 	break;
       }
     case PROC_MEMINFO:
@@ -382,6 +382,12 @@ fhandler_proc::fill_filebuf ()
 	filesize = format_proc_partitions (filebuf, bufalloc);
 	break;
       }
+    case PROC_PRESSURE:
+      {
+	filebuf = (char *) realloc (filebuf, bufalloc = 256);
+	filesize = format_proc_pressure (filebuf, bufalloc);
+	break;
+      }
     }
     return true;
 }
@@ -486,25 +492,37 @@ format_proc_stat (char *destbuf, size_t maxsize)
       interrupt_count = 0;
       if (ret == STATUS_SUCCESS)
 	{
-	  unsigned long long user_time = 0ULL, kernel_time = 0ULL, idle_time = 0ULL;
+	  /* Kernel time includes the idle time and the time spent
+	     servicing interrupts and DPCs, which are given as Linux's
+	     irq and softirq. */
+	  unsigned long long t[sbi.NumberProcessors + 1][5];
+	  memset (t[0], 0, sizeof t[0]);
 	  for (int i = 0; i < sbi.NumberProcessors; i++)
 	    {
-	      kernel_time += (spt[i].KernelTime.QuadPart - spt[i].IdleTime.QuadPart) * HZ / 10000000ULL;
-	      user_time += spt[i].UserTime.QuadPart * HZ / 10000000ULL;
-	      idle_time += spt[i].IdleTime.QuadPart * HZ / 10000000ULL;
+	      unsigned long long *c = t[i + 1];
+	      c[0] = spt[i].UserTime.QuadPart;
+	      c[2] = spt[i].IdleTime.QuadPart;
+	      c[3] = spt[i].InterruptTime.QuadPart;
+	      c[4] = spt[i].DpcTime.QuadPart;
+	      unsigned long long other = c[2] + c[3] + c[4];
+	      c[1] = spt[i].KernelTime.QuadPart > (LONGLONG) other
+		     ? spt[i].KernelTime.QuadPart - other : 0;
+	      for (int j = 0; j < 5; j++)
+		t[0][j] += c[j];
+	      interrupt_count += spt[i].InterruptCount;
 	    }
-
-	  eobuf += __small_sprintf (eobuf, "cpu %U %U %U %U\n",
-				    user_time, 0ULL, kernel_time, idle_time);
-	  user_time = 0ULL, kernel_time = 0ULL, idle_time = 0ULL;
-	  for (int i = 0; i < sbi.NumberProcessors; i++)
+	  for (int i = 0; i <= sbi.NumberProcessors; i++)
 	    {
-	      interrupt_count += spt[i].InterruptCount;
-	      kernel_time = (spt[i].KernelTime.QuadPart - spt[i].IdleTime.QuadPart) * HZ / 10000000ULL;
-	      user_time = spt[i].UserTime.QuadPart * HZ / 10000000ULL;
-	      idle_time = spt[i].IdleTime.QuadPart * HZ / 10000000ULL;
-	      eobuf += __small_sprintf (eobuf, "cpu%d %U %U %U %U\n", i,
-					user_time, 0ULL, kernel_time, idle_time);
+	      unsigned long long *c = t[i];
+	      for (int j = 0; j < 5; j++)
+		c[j] = c[j] * HZ / 10000000ULL;
+	      if (i)
+		eobuf += __small_sprintf (eobuf, "cpu%d", i - 1);
+	      else
+		eobuf += __small_sprintf (eobuf, "cpu ");
+	      eobuf += __small_sprintf (eobuf, " %U %U %U %U %U %U %U\n",
+					c[0], 0ULL, c[1], c[2], 0ULL,
+					c[3], c[4]);
 	    }
 
 	  ret = NtQuerySystemInformation (SystemPerformanceInformation,
@@ -544,19 +562,56 @@ format_proc_stat (char *destbuf, size_t maxsize)
    * counters is by no means worth it.
    *   }
    */
+  loadavg_sample ();
   eobuf += __small_sprintf (eobuf, "page %u %u\n"
 				   "swap %u %u\n"
 				   "intr %u\n"
 				   "ctxt %u\n"
-				   "btime %u\n",
+				   "btime %u\n"
+				   "procs_running %u\n"
+				   "procs_blocked %u\n",
 				   pages_in, pages_out,
 				   swap_in, swap_out,
 				   interrupt_count,
 				   context_switches,
-				   boot_time);
+				   boot_time,
+				   cygwin_shared->loadavg.running,
+				   cygwin_shared->loadavg.blocked);
   return eobuf - destbuf;
 }
 
+/* A percentage or load to two places, as whole and hundredths. */
+#define CENTS(x) (unsigned) ((x) * 100 + 0.5) / 100, \
+		 (unsigned) ((x) * 100 + 0.5) % 100
+
+static _off64_t
+format_proc_loadavg (char *destbuf, size_t maxsize)
+{
+  loadavginfo &la = cygwin_shared->loadavg;
+  loadavg_sample ();
+  return __small_sprintf (destbuf, "%u.%02u %u.%02u %u.%02u %u/%u\n",
+			  CENTS (la.load[0]), CENTS (la.load[1]),
+			  CENTS (la.load[2]), la.running, la.threads);
+}
+
+/* Like the files in Linux's /proc/pressure, with a line for time in
+   which some thread waited for a CPU and one for time in which some
+   thread waited on paging.  See loadavg.cc. */
+static _off64_t
+format_proc_pressure (char *destbuf, size_t maxsize)
+{
+  loadavginfo &la = cygwin_shared->loadavg;
+  loadavg_sample ();
+  return __small_sprintf (destbuf, "cpu some avg10=%u.%02u avg60=%u.%02u "
+				   "avg300=%u.%02u total=%U\n"
+				   "memory some avg10=%u.%02u avg60=%u.%02u "
+				   "avg300=%u.%02u total=%U\n",
+			  CENTS (la.cpu_some[0]), CENTS (la.cpu_some[1]),
+			  CENTS (la.cpu_some[2]), la.cpu_total,
+			  CENTS (la.mem_some[0]), CENTS (la.mem_some[1]),
+			  CENTS (la.mem_some[2]), la.mem_total);
+}
+
 #define read_value(x,y) \
       do {\
 	dwCount = BUFSIZE; \
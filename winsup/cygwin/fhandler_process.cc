@@ -22,6 +22,9 @@ details. */
 #include "dtable.h"
 #include "cygheap.h"
 #include "ntdll.h"
+#include "cygthread.h"
+#include "syscall_stats.h"
+#include <psapi.h>
 #include <sys/param.h>
 #include <assert.h>
 #include <sys/sysmacros.h>
@@ -42,6 +45,10 @@ static const int PROCESS_CTTY = 11;
 static const int PROCESS_STAT = 12;
 static const int PROCESS_STATM = 13;
 static const int PROCESS_CMDLINE = 14;
+static const int PROCESS_CYGTHREADS = 15;
+static const int PROCESS_SYSCALLS = 16;
+static const int PROCESS_MAPS = 17;
+static const int PROCESS_FD = 18;
 
 static const char * const process_listing[] =
 {
@@ -60,6 +67,10 @@ static const char * const process_listing[] =
   "stat",
   "statm",
   "cmdline",
+  "cygthreads",
+  "syscalls",
+  "maps",
+  "fd",
   NULL
 };
 
@@ -69,6 +80,11 @@ static const int PROCESS_LINK_COUNT =
 static _off64_t format_process_stat (_pinfo *p, char *destbuf, size_t maxsize);
 static _off64_t format_process_status (_pinfo *p, char *destbuf, size_t maxsize);
 static _off64_t format_process_statm (_pinfo *p, char *destbuf, size_t maxsize);
+static _off64_t format_process_cygthreads (_pinfo *p, char *destbuf, size_t maxsize);
+static _off64_t format_process_syscalls (_pinfo *p, char *destbuf, size_t maxsize);
+static char *format_process_maps (_pinfo *p, size_t &n);
+static const char *find_fd (const char *list, size_t n, int fd);
+static int get_fd_number (const char *s);
 static int get_process_state (DWORD dwProcessId);
 static bool get_mem_values (DWORD dwProcessId, unsigned long *vmsize,
 			    unsigned long *vmrss, unsigned long *vmtext,
@@ -89,6 +105,21 @@ fhandler_process::exists ()
   if (*path == 0)
     return 2;
 
+  if (pathmatch (path + 1, "fd"))
+    return 1;
+  if (path_prefix_p ("fd", path + 1, 2))
+    {
+      int fd = get_fd_number (path + 4);
+      pinfo p (atoi (get_name () + proc_len + 1));
+      size_t n;
+      char *list;
+      if (fd < 0 || !p || !(list = p->fds (n)))
+	return 0;
+      bool found = find_fd (list, n, fd);
+      free (list);
+      return found ? -1 : 0;
+    }
+
   for (int i = 0; process_listing[i]; i++)
     if (pathmatch (path + 1, process_listing[i]))
       return -1;
@@ -146,6 +177,41 @@ fhandler_process::fstat (struct __stat64 *buf, path_conv *pc)
 struct dirent *
 fhandler_process::readdir (DIR * dir)
 {
+  const char *path = get_name () + proc_len + 1;
+  pid = atoi (path);
+  while (*path != 0 && !isdirsep (*path))
+    path++;
+
+  if (*path != 0)
+    {
+      /* /proc/<pid>/fd.  The fd list is fetched afresh each time the
+	 directory is read from the start. */
+      if (dir->__d_position == 0 || !filebuf)
+	{
+	  pinfo p (pid);
+	  size_t n = 0;
+	  if (filebuf)
+	    free (filebuf);
+	  filebuf = p ? p->fds (n) : NULL;
+	  filesize = filebuf ? n : 0;
+	}
+      if (dir->__d_position < 2)
+	strcpy (dir->__d_dirent->d_name, dir->__d_position ? ".." : ".");
+      else
+	{
+	  char *s = filebuf;
+	  for (int i = 2; i < dir->__d_position && s < filebuf + filesize; i++)
+	    s = strchr (s, '\0') + 1;
+	  if (!s || s >= filebuf + filesize)
+	    return NULL;
+	  __small_sprintf (dir->__d_dirent->d_name, "%d", atoi (s));
+	}
+      dir->__d_position++;
+      syscall_printf ("%p = readdir (%p) (%s)", &dir->__d_dirent, dir,
+		      dir->__d_dirent->d_name);
+      return dir->__d_dirent;
+    }
+
   if (dir->__d_position >= PROCESS_LINK_COUNT)
     return NULL;
   strcpy (dir->__d_dirent->d_name, process_listing[dir->__d_position++]);
@@ -171,7 +237,7 @@ fhandler_process::open (path_conv *pc, int flags, mode_t mode)
   while (*path != 0 && !isdirsep (*path))
     path++;
 
-  if (*path == 0)
+  if (*path == 0 || pathmatch (path + 1, "fd"))
     {
       if ((flags & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL))
 	{
@@ -356,6 +422,47 @@ fhandler_process::fill_filebuf ()
 	filesize = format_process_statm (*p, filebuf, bufalloc);
 	break;
       }
+    case PROCESS_CYGTHREADS:
+      {
+	filebuf = (char *) realloc (filebuf, bufalloc = 2048);
+	filesize = format_process_cygthreads (*p, filebuf, bufalloc);
+	break;
+      }
+    case PROCESS_SYSCALLS:
+      {
+	filebuf = (char *) realloc (filebuf, bufalloc = 4096);
+	filesize = format_process_syscalls (*p, filebuf, bufalloc);
+	break;
+      }
+    case PROCESS_MAPS:
+      {
+	if (filebuf)
+	  free (filebuf);
+	size_t fs;
+	filebuf = format_process_maps (*p, fs);
+	filesize = fs;
+	if (!filebuf)
+	  return false;
+	break;
+      }
+    case PROCESS_FD:
+      {
+	size_t n;
+	char *list = p->fds (n);
+	int fd = get_fd_number (strrchr (get_name (), '/') + 1);
+	const char *name = list ? find_fd (list, n, fd) : NULL;
+	if (!name)
+	  {
+	    if (list)
+	      free (list);
+	    set_errno (ENOENT);
+	    return false;
+	  }
+	filebuf = (char *) realloc (filebuf, bufalloc = strlen (name) + 2);
+	filesize = __small_sprintf (filebuf, "%s\n", name);
+	free (list);
+	break;
+      }
     }
 
   return true;
@@ -591,6 +698,214 @@ format_process_status (_pinfo *p, char *destbuf, size_t maxsize)
 			  );
 }
 
+static _off64_t
+format_process_cygthreads (_pinfo *p, char *destbuf, size_t maxsize)
+{
+  cygthread_stats stats;
+  if (!p->threadstats (stats))
+    return 0;
+  return __small_sprintf (destbuf, "Active:    %d\n"
+				   "Idle:      %d\n"
+				   "Slots:     %d\n"
+				   "Created:   %d\n"
+				   "Reaped:    %d\n"
+				   "Freerange: %d\n",
+			  stats.active, stats.idle, stats.slots,
+			  stats.created, stats.reaped, stats.freerange);
+}
+
+/* One line per entry point: its name, the number of calls, their total
+   time in microseconds, and a histogram of their times in which the
+   first count is of calls under 1us and each after that of calls under
+   twice as long as the one before. */
+static _off64_t
+format_process_syscalls (_pinfo *p, char *destbuf, size_t maxsize)
+{
+  syscall_stats stats;
+  if (!p->syscallstats (stats))
+    return 0;
+  char *s = destbuf;
+  s += __small_sprintf (s, "# name calls usecs <1us <2us <4us ...\n");
+  for (int i = 0; i < SC_NSTATS; i++)
+    {
+      s += __small_sprintf (s, "%s %u %U", syscall_stat_names[i],
+			    stats.sc[i].calls, stats.sc[i].usecs);
+      for (int b = 0; b < SC_HIST; b++)
+	s += __small_sprintf (s, " %u", stats.sc[i].hist[b]);
+      *s++ = '\n';
+    }
+  return s - destbuf;
+}
+
+/* Return the fd number at s, or -1 if s isn't one. */
+static int
+get_fd_number (const char *s)
+{
+  char *end;
+  long fd = strtol (s, &end, 10);
+  return end == s || *end || fd < 0 ? -1 : fd;
+}
+
+/* Look fd up in a list from _pinfo::fds, returning its name. */
+static const char *
+find_fd (const char *list, size_t n, int fd)
+{
+  for (const char *s = list; s < list + n; s = strchr (s, '\0') + 1)
+    if (atoi (s) == fd)
+      return strchr (s, ' ') + 1;
+  return NULL;
+}
+
+struct maps_area
+{
+  DWORD addr;
+  DWORD end;
+  _off64_t offset;
+  char *name;
+};
+
+/* Split a list from _pinfo::mmaps into its areas, in place. */
+static maps_area *
+parse_mmaps (char *list, size_t n, int &nareas)
+{
+  maps_area *areas = NULL;
+  int alloc = 0;
+
+  nareas = 0;
+  for (char *s = list, *eol; s < list + n; s = eol + 1)
+    {
+      if (!(eol = (char *) memchr (s, '\n', list + n - s)))
+	break;
+      *eol = '\0';
+      if (nareas == alloc)
+	{
+	  maps_area *newareas = (maps_area *) realloc (areas,
+				  (alloc = alloc ? 2 * alloc : 16) * sizeof *areas);
+	  if (!newareas)
+	    break;
+	  areas = newareas;
+	}
+      maps_area &a = areas[nareas++];
+      a.addr = strtoul (s, &s, 16);
+      a.end = a.addr + strtoul (s, &s, 16);
+      while (*s == ' ')
+	s++;
+      if (*s)
+	s++;		/* The access, which the region shows anyway. */
+      a.offset = strtoull (s, &s, 16);
+      a.name = *s == ' ' ? s + 1 : s;
+    }
+  return areas;
+}
+
+/* rwx and shared or private, from a region's protection and type. */
+static void
+get_region_perms (MEMORY_BASIC_INFORMATION &m, char *perms)
+{
+  DWORD prot = m.State == MEM_COMMIT ? m.Protect & 0xff : 0;
+  perms[0] = prot & (PAGE_READONLY | PAGE_READWRITE | PAGE_WRITECOPY
+		     | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE
+		     | PAGE_EXECUTE_WRITECOPY) ? 'r' : '-';
+  perms[1] = prot & (PAGE_READWRITE | PAGE_WRITECOPY | PAGE_EXECUTE_READWRITE
+		     | PAGE_EXECUTE_WRITECOPY) ? 'w' : '-';
+  perms[2] = prot & (PAGE_EXECUTE | PAGE_EXECUTE_READ
+		     | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY)
+	     ? 'x' : '-';
+  perms[3] = m.Type == MEM_MAPPED
+	     && !(prot & (PAGE_WRITECOPY | PAGE_EXECUTE_WRITECOPY)) ? 's' : 'p';
+  perms[4] = '\0';
+}
+
+/* One line per region of the address space which is in use, in the
+   format of Linux's maps.  Regions are as VirtualQueryEx reports them.
+   Those within an mmap are given its file and offset, and those of a
+   loaded DLL or the executable its file and offset from its load
+   address.  The process is only queried, never stopped.  Returns a
+   malloc'd buffer, setting n to its length. */
+static char *
+format_process_maps (_pinfo *p, size_t &n)
+{
+  HANDLE proc = OpenProcess (PROCESS_QUERY_INFORMATION | PROCESS_VM_READ,
+			     FALSE, p->dwProcessId);
+  if (!proc)
+    {
+      __seterrno ();
+      return NULL;
+    }
+
+  size_t mlen;
+  int nareas = 0, ai = 0;
+  char *mlist = p->mmaps (mlen);
+  maps_area *areas = mlist ? parse_mmaps (mlist, mlen, nareas) : NULL;
+
+  char *buf = NULL;
+  size_t len = 0;
+  MEMORY_BASIC_INFORMATION m;
+  PVOID image_base = NULL;
+  char win32_name[MAX_PATH], image_name[MAX_PATH];
+  char perms[5];
+
+  n = 0;
+  image_name[0] = '\0';
+  for (DWORD addr = 0;
+       VirtualQueryEx (proc, (PVOID) addr, &m, sizeof m);
+       addr = (DWORD) m.BaseAddress + m.RegionSize)
+    {
+      DWORD base = (DWORD) m.BaseAddress;
+      if (base + m.RegionSize <= addr)
+	break;
+      if (m.State == MEM_FREE)
+	continue;
+
+      const char *name = "";
+      _off64_t offset = 0;
+      if (m.Type == MEM_IMAGE)
+	{
+	  if (m.AllocationBase != image_base)
+	    {
+	      image_base = m.AllocationBase;
+	      image_name[0] = '\0';
+	      if (GetModuleFileNameExA (proc, (HMODULE) image_base,
+					win32_name, MAX_PATH))
+		mount_table->conv_to_posix_path (win32_name, image_name, 1);
+	    }
+	  name = image_name;
+	  offset = base - (DWORD) image_base;
+	}
+      else if (m.Type == MEM_MAPPED)
+	{
+	  while (ai < nareas && areas[ai].end <= base)
+	    ai++;
+	  if (ai < nareas && areas[ai].addr <= base)
+	    {
+	      name = areas[ai].name;
+	      offset = areas[ai].offset + base - areas[ai].addr;
+	    }
+	}
+
+      size_t need = n + 64 + strlen (name);
+      if (need > len)
+	{
+	  char *newbuf = (char *) realloc (buf, len = 2 * need);
+	  if (!newbuf)
+	    break;
+	  buf = newbuf;
+	}
+      get_region_perms (m, perms);
+      n += __small_sprintf (buf + n, "%08x-%08x %s %08X 00:00 0 %s\n",
+			    base, base + m.RegionSize, perms, offset, name);
+    }
+
+  CloseHandle (proc);
+  if (areas)
+    free (areas);
+  if (mlist)
+    free (mlist);
+  if (!buf)
+    buf = strdup ("");
+  return buf;
+}
+
 static _off64_t
 format_process_statm (_pinfo *p, char *destbuf, size_t maxsize)
 {
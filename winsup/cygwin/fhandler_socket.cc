@@ -31,6 +31,7 @@
 #include "cygheap.h"
 #include "sigproc.h"
 #include "wsock_event.h"
+#include "af_local.h"
 #include "cygthread.h"
 #include "select.h"
 #include <unistd.h>
@@ -124,7 +125,9 @@ get_inet_addr (const struct sockaddr *in, int inlen,
 /* fhandler_socket */
 
 fhandler_socket::fhandler_socket (int nunit)
-  : fhandler_base (FH_SOCKET), sun_path (NULL), unit (nunit)
+  : fhandler_base (FH_SOCKET), lconn (NULL), ldgram (NULL), sun_path (NULL),
+    unit (nunit),
+    ifs_handle (false)
 {
   set_need_fork_fixup ();
   prot_info_ptr = (LPWSAPROTOCOL_INFOA) cmalloc (HEAP_BUF,
@@ -135,6 +138,10 @@ fhandler_socket::~fhandler_socket ()
 {
   if (prot_info_ptr)
     cfree (prot_info_ptr);
+  if (lconn)
+    cfree (lconn);
+  if (ldgram)
+    cfree (ldgram);
   if (sun_path)
     cfree (sun_path);
 }
@@ -246,10 +253,1187 @@ fhandler_socket::check_peer_secret_event (struct sockaddr_in* peer, int* secret)
     return 0;
 }
 
+/**********************************************************************/
+/* af_local_conn: shared memory transport for connected AF_LOCAL stream
+   sockets.  See af_local.h. */
+
+static void
+af_local_name (char *buf, const char *what, unsigned short server_port,
+	       unsigned short client_port, int *secret_ptr)
+{
+  __small_sprintf (buf, "%scygwin.local_socket.%s.%d.%d.%08x-%08x-%08x-%08x",
+		   wincap.has_terminal_services () ? "Global\\" : "",
+		   what, server_port, client_port,
+		   secret_ptr [0], secret_ptr [1],
+		   secret_ptr [2], secret_ptr [3]);
+}
+
+/* The ring lock holds the Windows pid of its holder, so that it can be
+   taken over should the holder die with it held.  Nothing which could
+   fault is done under the lock: the user's buffers are checked before
+   taking it. */
+static bool
+af_local_holder_alive (DWORD winpid)
+{
+  HANDLE h = OpenProcess (SYNCHRONIZE, FALSE, winpid);
+  if (!h)
+    return GetLastError () != ERROR_INVALID_PARAMETER;
+  bool alive = WaitForSingleObject (h, 0) == WAIT_TIMEOUT;
+  CloseHandle (h);
+  return alive;
+}
+
+static void
+af_local_lock (af_local_ring *r)
+{
+  const LONG winpid = GetCurrentProcessId ();
+  LONG holder;
+
+  for (int spins = 0;
+       (holder = InterlockedCompareExchange (&r->lock, winpid, 0));
+       spins++)
+    if (spins % 64 == 63 && holder != winpid
+	&& !af_local_holder_alive (holder))
+      {
+	debug_printf ("breaking lock held by dead process %d", holder);
+	InterlockedCompareExchange (&r->lock, 0, holder);
+      }
+    else
+      low_priority_sleep (spins < 64 ? 0 : 1);
+}
+
+static inline void
+af_local_unlock (af_local_ring *r)
+{
+  InterlockedExchange (&r->lock, 0);
+}
+
+bool
+af_local_conn::attach (int nside, unsigned short server_port,
+		       unsigned short client_port, int *secret,
+		       LPSECURITY_ATTRIBUTES sa)
+{
+  static const char *evt_names[] =
+    { "data0", "data1", "space0", "space1", "select0", "select1" };
+  char name[MAX_PATH];
+
+  side = nside;
+  data_evt[0] = data_evt[1] = space_evt[0] = space_evt[1] = NULL;
+  select_evt[0] = select_evt[1] = NULL;
+
+  /* Whichever side comes first creates the area, the other one opens it.
+     The pagefile backed section is zero filled by the system. */
+  af_local_name (name, "ring", server_port, client_port, secret);
+  if (!(map = CreateFileMapping (INVALID_HANDLE_VALUE, sa, PAGE_READWRITE, 0,
+				 sizeof (af_local_shared), name)))
+    {
+      debug_printf ("CreateFileMapping (%s), %E", name);
+      return false;
+    }
+  for (int i = 0; i < 6; i++)
+    {
+      af_local_name (name, evt_names[i], server_port, client_port, secret);
+      HANDLE &h = handle (i + 1);
+      if (!(h = CreateEvent (sa, TRUE, FALSE, name)))
+	{
+	  debug_printf ("CreateEvent (%s), %E", name);
+	  detach ();
+	  return false;
+	}
+    }
+  if (!remap ())
+    {
+      detach ();
+      return false;
+    }
+  add_ref ();
+  InterlockedExchange ((LONG *) &shared->attached[side], 1);
+  debug_printf ("attached side %d, server port %d, client port %d", side,
+		ntohs (server_port), ntohs (client_port));
+  return true;
+}
+
+/* Only valid after the secret event handshake.  Each side attaches before
+   it signals its secret event, so if the peer didn't attach by then, it
+   failed to do so and will fall back to TCP.  We must do the same. */
+bool
+af_local_conn::peer_attached ()
+{
+  return shared->attached[!side];
+}
+
+bool
+af_local_conn::remap ()
+{
+  shared = (af_local_shared *) MapViewOfFile (map, FILE_MAP_WRITE, 0, 0, 0);
+  if (!shared)
+    debug_printf ("MapViewOfFile, %E");
+  return shared != NULL;
+}
+
+void
+af_local_conn::add_ref ()
+{
+  InterlockedIncrement ((LONG *) &shared->refs[side]);
+}
+
+bool
+af_local_conn::dup (af_local_conn *child)
+{
+  *child = *this;
+  child->shared = NULL;
+  for (int i = 0; i < nhandles; i++)
+    if (!DuplicateHandle (hMainProc, handle (i), hMainProc,
+			  &child->handle (i), 0, TRUE, DUPLICATE_SAME_ACCESS))
+      {
+	__seterrno ();
+	while (--i >= 0)
+	  CloseHandle (child->handle (i));
+	return false;
+      }
+  if (!child->remap ())
+    {
+      __seterrno ();
+      child->detach ();
+      return false;
+    }
+  child->add_ref ();
+  return true;
+}
+
+void
+af_local_conn::detach ()
+{
+  if (shared)
+    UnmapViewOfFile (shared);
+  shared = NULL;
+  for (int i = 0; i < nhandles; i++)
+    if (handle (i))
+      {
+	CloseHandle (handle (i));
+	handle (i) = NULL;
+      }
+}
+
+/* Only the last descriptor referencing this side shuts down the
+   connection.  Other processes may still use it after a fork. */
+void
+af_local_conn::release_ref ()
+{
+  if (!InterlockedDecrement ((LONG *) &shared->refs[side]))
+    {
+      shutdown_write ();
+      InterlockedExchange ((LONG *) &rd ()->rclosed, 1);
+      wake_writer ();
+    }
+}
+
+void
+af_local_conn::close ()
+{
+  release_ref ();
+  detach ();
+}
+
+void
+af_local_conn::shutdown_write ()
+{
+  InterlockedExchange ((LONG *) &wr ()->closed, 1);
+  wake_reader ();
+}
+
+bool
+af_local_conn::readable ()
+{
+  af_local_ring *r = rd ();
+  return r->head != r->tail || r->closed;
+}
+
+int
+af_local_conn::bytes_available ()
+{
+  af_local_ring *r = rd ();
+  return r->head - r->tail;
+}
+
+bool
+af_local_conn::writable ()
+{
+  af_local_ring *r = wr ();
+  return r->head - r->tail < AF_LOCAL_RING_SIZE || r->rclosed;
+}
+
+/* Wait for evt, which the caller reset before testing the ring state. */
+static int
+af_local_wait (HANDLE evt, bool nonblocking, DWORD timeout = INFINITE)
+{
+  if (nonblocking)
+    {
+      set_errno (EAGAIN);
+      return -1;
+    }
+  HANDLE w4[2] = { evt, signal_arrived };
+  switch (WaitForMultipleObjects (2, w4, FALSE, timeout))
+    {
+    case WAIT_OBJECT_0:
+    case WAIT_TIMEOUT:
+      return 0;
+    case WAIT_OBJECT_0 + 1:
+      set_errno (EINTR);
+      return -1;
+    default:
+      __seterrno ();
+      return -1;
+    }
+}
+
+/* Collect the descriptors in msg_accrights into rt.  The handles are
+   duplicated into our own process and transferred to the receiver by
+   af_local_recv_rights using DUPLICATE_CLOSE_SOURCE, so they stay valid even
+   if the sender closes its descriptors or exits before the data is read.
+   Socket descriptors are refused with EOPNOTSUPP: their handles belong to
+   winsock and would have to go through WSADuplicateSocket for the receiving
+   process, which isn't known yet at this point. */
+static int
+af_local_get_rights (af_local_rights *rt, const struct msghdr *msg)
+{
+  int nfds = msg->msg_accrightslen / sizeof (int);
+  const int *fds = (const int *) msg->msg_accrights;
+
+  if (nfds > AF_LOCAL_MAX_FDS)
+    {
+      set_errno (EINVAL);
+      return -1;
+    }
+
+  rt->winpid = GetCurrentProcessId ();
+  for (rt->nfds = 0; rt->nfds < nfds; rt->nfds++)
+    {
+      af_local_fd *lfd = rt->fd + rt->nfds;
+      cygheap_fdget cfd (fds[rt->nfds]);
+
+      if (cfd < 0)
+	goto err;
+      if (cfd->is_socket ())
+	{
+	  set_errno (EOPNOTSUPP);
+	  goto err;
+	}
+      if (!DuplicateHandle (hMainProc, cfd->get_handle (), hMainProc,
+			    &lfd->h, 0, FALSE, DUPLICATE_SAME_ACCESS))
+	{
+	  __seterrno ();
+	  goto err;
+	}
+      lfd->access = cfd->get_access ();
+      lfd->flags = cfd->get_flags ();
+      strncpy (lfd->name, cfd->get_name (), MAX_PATH - 1);
+      lfd->name[MAX_PATH - 1] = '\0';
+    }
+  return 0;
+
+err:
+  while (rt->nfds-- > 0)
+    CloseHandle (rt->fd[rt->nfds].h);
+  return -1;
+}
+
+/* Close the handles collected by af_local_get_rights if they couldn't be
+   queued. */
+static void
+af_local_free_rights (af_local_rights *rt)
+{
+  while (rt->nfds-- > 0)
+    CloseHandle (rt->fd[rt->nfds].h);
+}
+
+/* Attach rt to the data written next into r.  Must be called with r locked,
+   right before the first byte of the same sendmsg is put into the ring. */
+static int
+af_local_queue_rights (af_local_ring *r, const af_local_rights *rt)
+{
+  if (r->rights_head - r->rights_tail >= AF_LOCAL_MAX_RIGHTS)
+    {
+      set_errno (ENOBUFS);
+      return -1;
+    }
+  af_local_rights *q = r->rights + r->rights_head % AF_LOCAL_MAX_RIGHTS;
+  memcpy (q, rt, sizeof *q);
+  q->offset = r->head;
+  r->rights_head++;
+  return 0;
+}
+
+static void
+af_local_recv_rights (af_local_rights *rt, struct msghdr *msg)
+{
+  int *fds = (int *) msg->msg_accrights;
+  int maxfds = fds ? msg->msg_accrightslen / sizeof (int) : 0;
+  int nfds = 0;
+
+  HANDLE sender = OpenProcess (PROCESS_DUP_HANDLE, FALSE, rt->winpid);
+  if (!sender)
+    debug_printf ("OpenProcess (%d), %E", rt->winpid);
+  for (int i = 0; sender && i < rt->nfds; i++)
+    {
+      af_local_fd *lfd = rt->fd + i;
+      HANDLE nh;
+
+      /* Descriptors which don't fit are discarded, as on other systems. */
+      if (nfds >= maxfds)
+	{
+	  DuplicateHandle (sender, lfd->h, NULL, NULL, 0, FALSE,
+			   DUPLICATE_CLOSE_SOURCE);
+	  continue;
+	}
+      if (!DuplicateHandle (sender, lfd->h, hMainProc, &nh, 0, TRUE,
+			    DUPLICATE_SAME_ACCESS | DUPLICATE_CLOSE_SOURCE))
+	{
+	  debug_printf ("DuplicateHandle (%p), %E", lfd->h);
+	  continue;
+	}
+      cygheap_fdnew fd;
+      if (fd < 0)
+	{
+	  CloseHandle (nh);
+	  continue;
+	}
+      path_conv pc;
+      fhandler_base *fh = cygheap->fdtab.build_fhandler_from_name (fd,
+								   lfd->name,
+								   nh, pc);
+      if (!fh)
+	{
+	  CloseHandle (nh);
+	  continue;
+	}
+      fh->init (nh, lfd->access, lfd->flags & (O_BINARY | O_TEXT)
+				 ?: pc.binmode ());
+      fds[nfds++] = fd;
+      debug_printf ("received %s as fd %d", lfd->name, (int) fd);
+    }
+  if (sender)
+    CloseHandle (sender);
+  if (fds)
+    msg->msg_accrightslen = nfds * sizeof (int);
+}
+
+int
+af_local_conn::send (const struct msghdr *msg, bool nonblocking)
+{
+  af_local_ring *r = wr ();
+  const struct iovec *iov = msg->msg_iov;
+  const struct iovec *iovend = iov + msg->msg_iovlen;
+  size_t off = 0;
+  bool rights = msg->msg_accrights && msg->msg_accrightslen;
+  int res = 0;
+
+  /* The buffers are checked up front, so as not to fault with the ring
+     locked. */
+  ssize_t len = check_iovec_for_write (iov, msg->msg_iovlen);
+  if (len < 0
+      || (rights && __check_invalid_read_ptr_errno (msg->msg_accrights,
+						    msg->msg_accrightslen)))
+    return -1;
+  /* Descriptors must come with at least one byte of data. */
+  if (rights && !len)
+    {
+      set_errno (EINVAL);
+      return -1;
+    }
+
+  /* The descriptors are only attached to the stream once our first byte
+     goes into the ring.  Another writer may fill the ring while we wait for
+     space, and its data must not carry our descriptors. */
+  af_local_rights rt;
+  if (rights && af_local_get_rights (&rt, msg))
+    return -1;
+
+  af_local_lock (r);
+  while (iov < iovend)
+    {
+      if (r->rclosed)
+	{
+	  set_errno (EPIPE);
+	  res = -1;
+	  break;
+	}
+
+      DWORD avail = AF_LOCAL_RING_SIZE - (r->head - r->tail);
+      if (!avail)
+	{
+	  /* Return a partial count rather than blocking if something was
+	     written already and we're not allowed to block. */
+	  if (res && nonblocking)
+	    break;
+	  ResetEvent (space_evt[side]);
+	  if (r->head - r->tail < AF_LOCAL_RING_SIZE || r->rclosed)
+	    continue;
+	  af_local_unlock (r);
+	  int wres = af_local_wait (space_evt[side], nonblocking);
+	  af_local_lock (r);
+	  if (wres)
+	    {
+	      if (!res)
+		res = -1;
+	      break;
+	    }
+	  continue;
+	}
+
+      if (rights && !res && af_local_queue_rights (r, &rt))
+	{
+	  res = -1;
+	  break;
+	}
+      DWORD pos = r->head & (AF_LOCAL_RING_SIZE - 1);
+      size_t n = min (iov->iov_len - off, avail);
+      n = min (n, AF_LOCAL_RING_SIZE - pos);
+      memcpy (r->data + pos, (char *) iov->iov_base + off, n);
+      InterlockedExchangeAdd ((LONG *) &r->head, n);
+      res += n;
+      wake_reader ();
+      if ((off += n) >= iov->iov_len)
+	{
+	  iov++;
+	  off = 0;
+	}
+    }
+
+  af_local_unlock (r);
+  /* Nothing was sent, so the descriptors were never queued. */
+  if (rights && res <= 0)
+    af_local_free_rights (&rt);
+  return res;
+}
+
+int
+af_local_conn::recv (struct msghdr *msg, int flags, bool nonblocking)
+{
+  af_local_ring *r = rd ();
+  const struct iovec *iov = msg->msg_iov;
+  DWORD avail;
+  int res = 0;
+
+  ssize_t slen = check_iovec_for_read (iov, msg->msg_iovlen);
+  if (slen < 0
+      || (msg->msg_accrights
+	  && __check_null_invalid_struct_errno (msg->msg_accrights,
+						msg->msg_accrightslen)))
+    return -1;
+  size_t len = slen;
+  msg->msg_namelen = 0;
+
+  af_local_lock (r);
+  for (;;)
+    {
+      ResetEvent (data_evt[side]);
+      if ((avail = r->head - r->tail) || r->closed || !len)
+	break;
+      af_local_unlock (r);
+      int wres = af_local_wait (data_evt[side], nonblocking);
+      af_local_lock (r);
+      if (wres)
+	{
+	  af_local_unlock (r);
+	  return -1;
+	}
+    }
+
+  /* Don't read across the start of data which has descriptors attached,
+     so that the descriptors are returned together with their data. */
+  bool got_rights = false;
+  for (DWORD rtail = r->rights_tail; rtail != r->rights_head; rtail++)
+    {
+      af_local_rights *rt = r->rights + rtail % AF_LOCAL_MAX_RIGHTS;
+      DWORD dist = rt->offset - r->tail;
+      if (dist)
+	{
+	  if (dist < avail)
+	    avail = dist;
+	  break;
+	}
+      if (!(flags & MSG_PEEK))
+	{
+	  af_local_recv_rights (rt, msg);
+	  r->rights_tail++;
+	  got_rights = true;
+	}
+    }
+  /* Peeking doesn't return the descriptors, they're only transferred once
+     the data is really read. */
+  if (!got_rights && msg->msg_accrights)
+    msg->msg_accrightslen = 0;
+
+  len = min (len, avail);
+  for (DWORD tail = r->tail; len; iov++)
+    {
+      size_t ilen = min (iov->iov_len, len);
+      size_t done = 0;
+      while (done < ilen)
+	{
+	  DWORD pos = tail & (AF_LOCAL_RING_SIZE - 1);
+	  size_t n = min (ilen - done, AF_LOCAL_RING_SIZE - pos);
+	  memcpy ((char *) iov->iov_base + done, r->data + pos, n);
+	  tail += n;
+	  done += n;
+	}
+      res += ilen;
+      len -= ilen;
+      if (!len && !(flags & MSG_PEEK))
+	{
+	  InterlockedExchange ((LONG *) &r->tail, tail);
+	  wake_writer ();
+	}
+    }
+  af_local_unlock (r);
+  return res;
+}
+
+/* Create the shared memory transport for a new AF_LOCAL stream connection
+   on sock.  side is 0 for the accepting, 1 for the connecting end. */
+static af_local_conn *
+af_local_attach (int side, int sock, unsigned short peer_port, int *secret,
+		 LPSECURITY_ATTRIBUTES sa)
+{
+  struct sockaddr_in sin;
+  int len = sizeof sin;
+
+  if (::getsockname (sock, (struct sockaddr *) &sin, &len))
+    {
+      debug_printf ("error getting local socket name (%d)", WSAGetLastError ());
+      return NULL;
+    }
+
+  af_local_conn *lc = (af_local_conn *) ccalloc (HEAP_BUF, 1, sizeof *lc);
+  if (!lc)
+    return NULL;
+  new (lc) af_local_conn;
+  if (!lc->attach (side, side ? peer_port : sin.sin_port,
+		   side ? sin.sin_port : peer_port, secret, sa))
+    {
+      cfree (lc);
+      return NULL;
+    }
+  return lc;
+}
+
+static void
+af_local_release (af_local_conn *&lc, bool closing)
+{
+  if (lc)
+    {
+      if (closing)
+	lc->close ();
+      else
+	lc->detach ();
+      cfree (lc);
+      lc = NULL;
+    }
+}
+
+/* af_local_dgram: shared memory transport for AF_LOCAL datagram sockets.
+   See af_local.h. */
+
+static DWORD af_local_dgram_count;
+
+static void
+af_local_event_name (char *buf, const char *what, DWORD *id)
+{
+  int idsecret[4] = { (int) id[0], (int) id[1], 0, 0 };
+  af_local_name (buf, what, 0, 0, idsecret);
+}
+
+static inline DWORD
+af_local_dgram_size (DWORD len)
+{
+  return (sizeof (af_local_dgram_hdr) + len + 3) & ~3;
+}
+
+static void
+af_local_ring_put (af_local_ring *r, DWORD pos, const void *src, size_t n)
+{
+  while (n)
+    {
+      DWORD off = pos & (AF_LOCAL_RING_SIZE - 1);
+      size_t chunk = min (n, AF_LOCAL_RING_SIZE - off);
+      memcpy (r->data + off, src, chunk);
+      src = (const char *) src + chunk;
+      pos += chunk;
+      n -= chunk;
+    }
+}
+
+static void
+af_local_ring_get (af_local_ring *r, DWORD pos, void *dst, size_t n)
+{
+  while (n)
+    {
+      DWORD off = pos & (AF_LOCAL_RING_SIZE - 1);
+      size_t chunk = min (n, AF_LOCAL_RING_SIZE - off);
+      memcpy (dst, r->data + off, chunk);
+      dst = (char *) dst + chunk;
+      pos += chunk;
+      n -= chunk;
+    }
+}
+
+/* Called with the ring locked.  Returns false if there's no room left in
+   the list, in which case the caller has to poll. */
+static bool
+af_local_add_waiter (af_local_inbox *box, DWORD *id)
+{
+  for (DWORD i = 0; i < box->nwaiters; i++)
+    if (box->waiter[i][0] == id[0] && box->waiter[i][1] == id[1])
+      return true;
+  if (box->nwaiters >= AF_LOCAL_MAX_WAITERS)
+    return false;
+  box->waiter[box->nwaiters][0] = id[0];
+  box->waiter[box->nwaiters][1] = id[1];
+  box->nwaiters++;
+  return true;
+}
+
+/* Called with the ring unlocked, on a copy of the waiters taken while it
+   was locked. */
+static void
+af_local_wake_waiters (DWORD waiter[][2], DWORD nwaiters)
+{
+  static const char *evt_names[] = { "dgram_space", "dgram_select" };
+  char name[MAX_PATH];
+
+  for (DWORD i = 0; i < nwaiters; i++)
+    for (int j = 0; j < 2; j++)
+      {
+	af_local_event_name (name, evt_names[j], waiter[i]);
+	HANDLE h = OpenEvent (EVENT_MODIFY_STATE, FALSE, name);
+	if (h)
+	  {
+	    SetEvent (h);
+	    CloseHandle (h);
+	  }
+      }
+}
+
+bool
+af_local_dgram::create (unsigned short nport, int *nsecret,
+			LPSECURITY_ATTRIBUTES sa)
+{
+  static const char *evt_names[] =
+    { "dgram_data", "dgram_space", "dgram_select" };
+  char name[MAX_PATH];
+
+  memset (this, 0, sizeof *this);
+  id[0] = GetCurrentProcessId ();
+  id[1] = InterlockedIncrement ((LONG *) &af_local_dgram_count);
+  for (int i = 0; i < 3; i++)
+    {
+      af_local_event_name (name, evt_names[i], id);
+      HANDLE &h = handle (i + 1);
+      if (!(h = CreateEvent (sa, TRUE, FALSE, name)))
+	{
+	  debug_printf ("CreateEvent (%s), %E", name);
+	  detach ();
+	  return false;
+	}
+    }
+  if (!bind (nport, nsecret, sa))
+    {
+      detach ();
+      return false;
+    }
+  return true;
+}
+
+/* Create a new inbox.  Unbound sockets name theirs after their events,
+   so nobody but a socketpair peer can find it. */
+bool
+af_local_dgram::bind (unsigned short nport, int *nsecret,
+		      LPSECURITY_ATTRIBUTES sa)
+{
+  char name[MAX_PATH];
+  int idsecret[4] = { (int) id[0], (int) id[1], 0, 0 };
+
+  if (!nsecret)
+    nsecret = idsecret;
+  af_local_name (name, "dgram", nport, 0, nsecret);
+  HANDLE nmap = CreateFileMapping (INVALID_HANDLE_VALUE, sa, PAGE_READWRITE,
+				   0, sizeof (af_local_inbox), name);
+  if (!nmap)
+    {
+      debug_printf ("CreateFileMapping (%s), %E", name);
+      return false;
+    }
+  af_local_inbox *nbox = (af_local_inbox *)
+			 MapViewOfFile (nmap, FILE_MAP_WRITE, 0, 0, 0);
+  if (!nbox)
+    {
+      debug_printf ("MapViewOfFile, %E");
+      CloseHandle (nmap);
+      return false;
+    }
+  close_inbox ();
+  map = nmap;
+  box = nbox;
+  port = nport;
+  memcpy (secret, nsecret, sizeof secret);
+  box->owner[0] = id[0];
+  box->owner[1] = id[1];
+  add_ref ();
+  debug_printf ("inbox %s", name);
+  return true;
+}
+
+bool
+af_local_dgram::open_peer (af_local_peer &p, unsigned short nport,
+			   int *nsecret, LPSECURITY_ATTRIBUTES sa)
+{
+  char name[MAX_PATH];
+
+  memset (&p, 0, sizeof p);
+  af_local_name (name, "dgram", nport, 0, nsecret);
+  if (!(p.map = OpenFileMapping (FILE_MAP_WRITE, sa->bInheritHandle, name)))
+    {
+      debug_printf ("OpenFileMapping (%s), %E", name);
+      return false;
+    }
+  if (!(p.box = (af_local_inbox *)
+		MapViewOfFile (p.map, FILE_MAP_WRITE, 0, 0, 0)))
+    goto err;
+  af_local_event_name (name, "dgram_data", p.box->owner);
+  if (!(p.data_evt = OpenEvent (EVENT_MODIFY_STATE, sa->bInheritHandle, name)))
+    goto err;
+  af_local_event_name (name, "dgram_select", p.box->owner);
+  if (!(p.select_evt = OpenEvent (EVENT_MODIFY_STATE, sa->bInheritHandle,
+				  name)))
+    goto err;
+  p.port = nport;
+  memcpy (p.secret, nsecret, sizeof p.secret);
+  return true;
+
+err:
+  debug_printf ("can't open peer, %E");
+  if (p.data_evt)
+    CloseHandle (p.data_evt);
+  if (p.box)
+    UnmapViewOfFile (p.box);
+  CloseHandle (p.map);
+  memset (&p, 0, sizeof p);
+  return false;
+}
+
+static void
+af_local_close_peer (af_local_peer &p)
+{
+  if (p.box)
+    UnmapViewOfFile (p.box);
+  if (p.map)
+    CloseHandle (p.map);
+  if (p.data_evt)
+    CloseHandle (p.data_evt);
+  if (p.select_evt)
+    CloseHandle (p.select_evt);
+  memset (&p, 0, sizeof p);
+}
+
+bool
+af_local_dgram::connect (unsigned short nport, int *nsecret,
+			 LPSECURITY_ATTRIBUTES sa)
+{
+  af_local_close_peer (peer);
+  return open_peer (peer, nport, nsecret, sa);
+}
+
+bool
+af_local_dgram::connect (af_local_dgram *other, LPSECURITY_ATTRIBUTES sa)
+{
+  return connect (other->port, other->secret, sa);
+}
+
+/* Find the inbox bound to nport and nsecret, using the connected peer or
+   the one we sent to last if possible. */
+af_local_peer *
+af_local_dgram::find_peer (unsigned short nport, int *nsecret)
+{
+  if (peer.box && peer.port == nport
+      && !memcmp (peer.secret, nsecret, sizeof peer.secret))
+    return &peer;
+  if (last.box && last.port == nport
+      && !memcmp (last.secret, nsecret, sizeof last.secret))
+    return &last;
+  af_local_close_peer (last);
+  return open_peer (last, nport, nsecret, &sec_all_nih) ? &last : NULL;
+}
+
+bool
+af_local_dgram::remap ()
+{
+  box = (af_local_inbox *) MapViewOfFile (map, FILE_MAP_WRITE, 0, 0, 0);
+  if (peer.map)
+    peer.box = (af_local_inbox *) MapViewOfFile (peer.map, FILE_MAP_WRITE,
+						 0, 0, 0);
+  if (!box || (peer.map && !peer.box))
+    debug_printf ("MapViewOfFile, %E");
+  return box && (!peer.map || peer.box);
+}
+
+/* The handles of last aren't inherited, so they are invalid in a forked
+   or exec'ed child. */
+void
+af_local_dgram::forget_last ()
+{
+  memset (&last, 0, sizeof last);
+}
+
+void
+af_local_dgram::add_ref ()
+{
+  InterlockedIncrement ((LONG *) &box->refs);
+}
+
+/* Only the last descriptor referencing the inbox closes it.  Blocked
+   senders are woken, so that they notice. */
+void
+af_local_dgram::release_ref ()
+{
+  if (InterlockedDecrement ((LONG *) &box->refs))
+    return;
+
+  af_local_ring *r = &box->ring;
+  DWORD waiter[AF_LOCAL_MAX_WAITERS][2];
+  struct msghdr none = { NULL, 0, NULL, 0, NULL, 0 };
+
+  af_local_lock (r);
+  InterlockedExchange ((LONG *) &r->rclosed, 1);
+  DWORD nwaiters = box->nwaiters;
+  memcpy (waiter, box->waiter, nwaiters * sizeof *waiter);
+  box->nwaiters = 0;
+  /* Nobody is going to receive the descriptors still queued. */
+  while (r->rights_tail != r->rights_head)
+    {
+      af_local_rights *rt = r->rights + r->rights_tail++ % AF_LOCAL_MAX_RIGHTS;
+      af_local_recv_rights (rt, &none);
+    }
+  af_local_unlock (r);
+  af_local_wake_waiters (waiter, nwaiters);
+}
+
+void
+af_local_dgram::close_inbox ()
+{
+  if (box)
+    {
+      release_ref ();
+      UnmapViewOfFile (box);
+    }
+  if (map)
+    CloseHandle (map);
+  box = NULL;
+  map = NULL;
+}
+
+bool
+af_local_dgram::dup (af_local_dgram *child)
+{
+  *child = *this;
+  child->box = NULL;
+  memset (&child->last, 0, sizeof child->last);
+  child->peer.box = NULL;
+  for (int i = 0; i < nhandles; i++)
+    if (handle (i)
+	&& !DuplicateHandle (hMainProc, handle (i), hMainProc,
+			     &child->handle (i), 0, TRUE,
+			     DUPLICATE_SAME_ACCESS))
+      {
+	__seterrno ();
+	while (--i >= 0)
+	  if (handle (i))
+	    CloseHandle (child->handle (i));
+	return false;
+      }
+  if (!child->remap ())
+    {
+      __seterrno ();
+      child->detach ();
+      return false;
+    }
+  child->add_ref ();
+  return true;
+}
+
+void
+af_local_dgram::detach ()
+{
+  if (box)
+    UnmapViewOfFile (box);
+  box = NULL;
+  if (peer.box)
+    UnmapViewOfFile (peer.box);
+  peer.box = NULL;
+  af_local_close_peer (last);
+  for (int i = 0; i < nhandles; i++)
+    if (handle (i))
+      {
+	CloseHandle (handle (i));
+	handle (i) = NULL;
+      }
+}
+
+void
+af_local_dgram::close ()
+{
+  release_ref ();
+  detach ();
+}
+
+bool
+af_local_dgram::readable ()
+{
+  af_local_ring *r = &box->ring;
+  return r->head != r->tail;
+}
+
+int
+af_local_dgram::bytes_available ()
+{
+  af_local_ring *r = &box->ring;
+  DWORD len = 0;
+
+  af_local_lock (r);
+  if (r->head != r->tail)
+    af_local_ring_get (r, r->tail, &len, sizeof len);
+  af_local_unlock (r);
+  return len;
+}
+
+/* Unconnected sockets are always writable.  Otherwise we register as a
+   waiter with the peer's inbox when it's full, so that select is woken when
+   it's drained.  If we can't register, we claim to be writable rather than
+   risk not being woken at all. */
+bool
+af_local_dgram::writable ()
+{
+  if (!peer.box)
+    return true;
+
+  af_local_ring *r = &peer.box->ring;
+  af_local_lock (r);
+  bool res = r->rclosed
+	     || (AF_LOCAL_RING_SIZE - (r->head - r->tail)
+		 >= af_local_dgram_size (1))
+	     || !af_local_add_waiter (peer.box, id);
+  af_local_unlock (r);
+  return res;
+}
+
+/* Datagrams are never split.  One which doesn't fit into an empty inbox
+   can't be sent at all. */
+int
+af_local_dgram::send (const struct msghdr *msg, af_local_peer *p,
+		      const char *from, bool nonblocking)
+{
+  af_local_ring *r = &p->box->ring;
+  bool rights = msg->msg_accrights && msg->msg_accrightslen;
+  af_local_dgram_hdr hdr;
+
+  ssize_t len = check_iovec_for_write (msg->msg_iov, msg->msg_iovlen);
+  if (len < 0
+      || (rights && __check_invalid_read_ptr_errno (msg->msg_accrights,
+						    msg->msg_accrightslen)))
+    return -1;
+  DWORD need = af_local_dgram_size (len);
+  if ((size_t) len > AF_LOCAL_RING_SIZE || need > AF_LOCAL_RING_SIZE)
+    {
+      set_errno (EMSGSIZE);
+      return -1;
+    }
+  hdr.len = len;
+  memset (hdr.from, 0, sizeof hdr.from);
+  if (from)
+    strncpy (hdr.from, from, sizeof hdr.from - 1);
+  af_local_rights rt;
+  if (rights && af_local_get_rights (&rt, msg))
+    return -1;
+
+  af_local_lock (r);
+  for (;;)
+    {
+      if (r->rclosed)
+	{
+	  af_local_unlock (r);
+	  if (rights)
+	    af_local_free_rights (&rt);
+	  if (p == &last)
+	    af_local_close_peer (last);
+	  set_errno (ECONNREFUSED);
+	  return -1;
+	}
+      if (AF_LOCAL_RING_SIZE - (r->head - r->tail) >= need)
+	break;
+      ResetEvent (space_evt);
+      bool registered = af_local_add_waiter (p->box, id);
+      af_local_unlock (r);
+      int wres = af_local_wait (space_evt, nonblocking,
+				registered ? INFINITE : 1);
+      af_local_lock (r);
+      if (wres)
+	{
+	  af_local_unlock (r);
+	  if (rights)
+	    af_local_free_rights (&rt);
+	  return -1;
+	}
+    }
+
+  if (rights && af_local_queue_rights (r, &rt))
+    {
+      af_local_unlock (r);
+      af_local_free_rights (&rt);
+      return -1;
+    }
+  DWORD pos = r->head;
+  af_local_ring_put (r, pos, &hdr, sizeof hdr);
+  pos += sizeof hdr;
+  for (int i = 0; i < msg->msg_iovlen; i++)
+    {
+      af_local_ring_put (r, pos, msg->msg_iov[i].iov_base,
+			 msg->msg_iov[i].iov_len);
+      pos += msg->msg_iov[i].iov_len;
+    }
+  InterlockedExchangeAdd ((LONG *) &r->head, need);
+  af_local_unlock (r);
+  SetEvent (p->data_evt);
+  SetEvent (p->select_evt);
+  return len;
+}
+
+/* Like recvfrom on other systems, the rest of a datagram which doesn't fit
+   into the buffers is discarded. */
+int
+af_local_dgram::recv (struct msghdr *msg, int flags, bool nonblocking)
+{
+  af_local_ring *r = &box->ring;
+  const struct iovec *iov = msg->msg_iov;
+  DWORD waiter[AF_LOCAL_MAX_WAITERS][2];
+  DWORD nwaiters = 0;
+  af_local_dgram_hdr hdr;
+
+  ssize_t slen = check_iovec_for_read (iov, msg->msg_iovlen);
+  if (slen < 0
+      || (msg->msg_accrights
+	  && __check_null_invalid_struct_errno (msg->msg_accrights,
+						msg->msg_accrightslen))
+      || (msg->msg_name
+	  && __check_null_invalid_struct_errno (msg->msg_name,
+						msg->msg_namelen)))
+    return -1;
+
+  af_local_lock (r);
+  for (;;)
+    {
+      ResetEvent (data_evt);
+      if (r->head != r->tail)
+	break;
+      af_local_unlock (r);
+      int wres = af_local_wait (data_evt, nonblocking);
+      af_local_lock (r);
+      if (wres)
+	{
+	  af_local_unlock (r);
+	  return -1;
+	}
+    }
+
+  DWORD tail = r->tail;
+  af_local_ring_get (r, tail, &hdr, sizeof hdr);
+  hdr.from[sizeof hdr.from - 1] = '\0';
+
+  af_local_rights *rt = r->rights + r->rights_tail % AF_LOCAL_MAX_RIGHTS;
+  if (r->rights_tail != r->rights_head && rt->offset == tail)
+    {
+      if (!(flags & MSG_PEEK))
+	{
+	  af_local_recv_rights (rt, msg);
+	  r->rights_tail++;
+	}
+      else if (msg->msg_accrights)
+	msg->msg_accrightslen = 0;
+    }
+  else if (msg->msg_accrights)
+    msg->msg_accrightslen = 0;
+
+  size_t len = min ((size_t) slen, hdr.len);
+  int res = len;
+  DWORD pos = tail + sizeof hdr;
+  for (; len; iov++)
+    {
+      size_t n = min (iov->iov_len, len);
+      af_local_ring_get (r, pos, iov->iov_base, n);
+      pos += n;
+      len -= n;
+    }
+
+  if (!(flags & MSG_PEEK))
+    {
+      InterlockedExchange ((LONG *) &r->tail,
+			   tail + af_local_dgram_size (hdr.len));
+      nwaiters = box->nwaiters;
+      memcpy (waiter, box->waiter, nwaiters * sizeof *waiter);
+      box->nwaiters = 0;
+    }
+  af_local_unlock (r);
+  af_local_wake_waiters (waiter, nwaiters);
+
+  if (msg->msg_name)
+    {
+      struct sockaddr_un un_addr;
+      un_addr.sun_family = AF_LOCAL;
+      strcpy (un_addr.sun_path, hdr.from);
+      int un_len = sizeof un_addr.sun_family + strlen (hdr.from) + 1;
+      memcpy (msg->msg_name, &un_addr, min (msg->msg_namelen, un_len));
+      msg->msg_namelen = un_len;
+    }
+  else
+    msg->msg_namelen = 0;
+  return res;
+}
+
+static af_local_dgram *
+af_local_dgram_create (unsigned short port, int *secret,
+		       LPSECURITY_ATTRIBUTES sa)
+{
+  af_local_dgram *ld = (af_local_dgram *) ccalloc (HEAP_BUF, 1, sizeof *ld);
+  if (!ld)
+    return NULL;
+  new (ld) af_local_dgram;
+  if (!ld->create (port, secret, sa))
+    {
+      cfree (ld);
+      return NULL;
+    }
+  return ld;
+}
+
+static void
+af_local_release (af_local_dgram *&ld, bool closing)
+{
+  if (ld)
+    {
+      if (closing)
+	ld->close ();
+      else
+	ld->detach ();
+      cfree (ld);
+      ld = NULL;
+    }
+}
+
 void
 fhandler_socket::fixup_before_fork_exec (DWORD win_proc_id)
 {
-  if (!winsock2_active)
+  if (ifs_handle)
+    debug_printf ("IFS socket %p, nothing to duplicate", get_socket ());
+  else if (!winsock2_active)
     {
       fhandler_base::fixup_before_fork_exec (win_proc_id);
       debug_printf ("Without Winsock 2.0");
@@ -263,6 +1447,21 @@ fhandler_socket::fixup_before_fork_exec (DWORD win_proc_id)
 		    get_socket (), win_proc_id, prot_info_ptr);
       set_winsock_errno ();
     }
+  /* The reference is taken on behalf of the child here, since the parent
+     may close its descriptor before the child got a chance to start. */
+  if (lconn)
+    lconn->add_ref ();
+  if (ldgram)
+    ldgram->add_ref ();
+}
+
+void
+fhandler_socket::fixup_before_failed ()
+{
+  if (lconn)
+    lconn->release_ref ();
+  if (ldgram)
+    ldgram->release_ref ();
 }
 
 extern "C" void __stdcall load_wsock32 ();
@@ -271,32 +1470,66 @@ fhandler_socket::fixup_after_fork (HANDLE parent)
 {
   SOCKET new_sock;
 
-  debug_printf ("WSASocket begin, dwServiceFlags1=%d",
-		prot_info_ptr->dwServiceFlags1);
-
-  if ((new_sock = WSASocketA (FROM_PROTOCOL_INFO,
-				   FROM_PROTOCOL_INFO,
-				   FROM_PROTOCOL_INFO,
-				   prot_info_ptr, 0, 0)) == INVALID_SOCKET)
-    {
-      debug_printf ("WSASocket error");
-      set_io_handle ((HANDLE)INVALID_SOCKET);
-      set_winsock_errno ();
-    }
-  else if (!new_sock && !winsock2_active)
+  if (ifs_handle)
     {
-      load_wsock32 ();
+      /* Inherited with the same value, or duplicated from the parent
+	 if it's close-on-exec, just like any other handle. */
       fhandler_base::fixup_after_fork (parent);
-      debug_printf ("Without Winsock 2.0");
+      debug_printf ("IFS socket %p", get_io_handle ());
     }
   else
     {
-      debug_printf ("WSASocket went fine new_sock %p, old_sock %p", new_sock, get_io_handle ());
-      set_io_handle ((HANDLE) new_sock);
+      debug_printf ("WSASocket begin, dwServiceFlags1=%d",
+		    prot_info_ptr->dwServiceFlags1);
+
+      if ((new_sock = WSASocketA (FROM_PROTOCOL_INFO,
+				  FROM_PROTOCOL_INFO,
+				  FROM_PROTOCOL_INFO,
+				  prot_info_ptr, 0, 0)) == INVALID_SOCKET)
+	{
+	  debug_printf ("WSASocket error");
+	  set_io_handle ((HANDLE)INVALID_SOCKET);
+	  set_winsock_errno ();
+	}
+      else if (!new_sock && !winsock2_active)
+	{
+	  load_wsock32 ();
+	  fhandler_base::fixup_after_fork (parent);
+	  debug_printf ("Without Winsock 2.0");
+	}
+      else
+	{
+	  debug_printf ("WSASocket went fine new_sock %p, old_sock %p", new_sock, get_io_handle ());
+	  set_io_handle ((HANDLE) new_sock);
+	}
     }
 
   if (secret_event)
     fork_fixup (parent, secret_event, "secret_event");
+
+  if (lconn)
+    {
+      for (int i = 0; i < af_local_conn::nhandles; i++)
+	fork_fixup (parent, lconn->handle (i), "af_local_conn");
+      if (!lconn->remap ())
+	{
+	  system_printf ("can't map AF_LOCAL transport, %E");
+	  af_local_release (lconn, false);
+	}
+    }
+
+  if (ldgram)
+    {
+      for (int i = 0; i < af_local_dgram::nhandles; i++)
+	if (ldgram->handle (i))
+	  fork_fixup (parent, ldgram->handle (i), "af_local_dgram");
+      ldgram->forget_last ();
+      if (!ldgram->remap ())
+	{
+	  system_printf ("can't map AF_LOCAL transport, %E");
+	  af_local_release (ldgram, false);
+	}
+    }
 }
 
 void
@@ -316,13 +1549,17 @@ fhandler_socket::dup (fhandler_base *child)
 {
   debug_printf ("here");
   fhandler_socket *fhs = (fhandler_socket *) child;
+  /* The copy still points to our transports.  dup_local_conn gives it
+     its own ones. */
+  fhs->lconn = NULL;
+  fhs->ldgram = NULL;
   fhs->addr_family = addr_family;
   if (get_addr_family () == AF_LOCAL)
     fhs->set_sun_path (get_sun_path ());
   fhs->set_socket_type (get_socket_type ());
   fhs->set_connect_state (get_connect_state ());
 
-  if (winsock2_active)
+  if (winsock2_active && !ifs_handle)
     {
       /* Since WSADuplicateSocket() fails on NT systems when the process
 	 is currently impersonating a non-privileged account, we revert
@@ -339,7 +1576,7 @@ fhandler_socket::dup (fhandler_base *child)
 	{
 	  fhs->fixup_after_fork (hMainProc);
 	  if (fhs->get_io_handle() != (HANDLE) INVALID_SOCKET)
-	    return 0;
+	    return dup_local_conn (fhs);
 	}
       debug_printf ("WSADuplicateSocket failed, trying DuplicateHandle");
     }
@@ -350,16 +1587,89 @@ fhandler_socket::dup (fhandler_base *child)
 
   HANDLE nh;
   if (!DuplicateHandle (hMainProc, get_io_handle (), hMainProc, &nh, 0,
-			!winsock2_active, DUPLICATE_SAME_ACCESS))
+			!winsock2_active || ifs_handle, DUPLICATE_SAME_ACCESS))
     {
       system_printf ("!DuplicateHandle(%x) failed, %E", get_io_handle ());
       __seterrno ();
       return -1;
     }
   fhs->set_io_handle (nh);
+  return dup_local_conn (fhs);
+}
+
+int
+fhandler_socket::dup_local_conn (fhandler_socket *fhs)
+{
+  if (lconn)
+    {
+      af_local_conn *lc = (af_local_conn *) ccalloc (HEAP_BUF, 1, sizeof *lc);
+      if (!lc || !lconn->dup (lc))
+	{
+	  if (lc)
+	    cfree (lc);
+	  else
+	    set_errno (ENOMEM);
+	  closesocket (fhs->get_socket ());
+	  return -1;
+	}
+      fhs->lconn = lc;
+    }
+  if (ldgram)
+    {
+      af_local_dgram *ld = (af_local_dgram *) ccalloc (HEAP_BUF, 1,
+						       sizeof *ld);
+      if (!ld || !ldgram->dup (ld))
+	{
+	  if (ld)
+	    cfree (ld);
+	  else
+	    set_errno (ENOMEM);
+	  closesocket (fhs->get_socket ());
+	  return -1;
+	}
+      fhs->ldgram = ld;
+    }
   return 0;
 }
 
+/* Datagrams to AF_LOCAL sockets go straight into their inbox.  NULL means
+   to use winsock, either because there's no AF_LOCAL destination or because
+   it has no inbox. */
+af_local_peer *
+fhandler_socket::local_dgram_peer (const struct sockaddr *to, int tolen)
+{
+  struct sockaddr_in sin;
+  int secret[4];
+
+  if (get_addr_family () != AF_LOCAL || get_socket_type () != SOCK_DGRAM)
+    return NULL;
+  if (!to)
+    return ldgram ? ldgram->connected_peer () : NULL;
+  if (to->sa_family != AF_LOCAL
+      || !get_inet_addr (to, tolen, &sin, &tolen, secret))
+    return NULL;
+  if (!ldgram
+      && !(ldgram = af_local_dgram_create (0, NULL, get_inheritance (true))))
+    return NULL;
+  return ldgram->find_peer (sin.sin_port, secret);
+}
+
+/* Connect the inboxes of two socketpair ends.  If anything fails, both
+   ends keep using UDP. */
+void
+fhandler_socket::pair_local_dgram (fhandler_socket *fh)
+{
+  if ((ldgram = af_local_dgram_create (0, NULL, get_inheritance (true)))
+      && (fh->ldgram = af_local_dgram_create (0, NULL,
+					      fh->get_inheritance (true)))
+      && ldgram->connect (fh->ldgram, get_inheritance (true))
+      && fh->ldgram->connect (ldgram, fh->get_inheritance (true)))
+    return;
+  debug_printf ("can't create inboxes, using UDP");
+  af_local_release (ldgram, true);
+  af_local_release (fh->ldgram, true);
+}
+
 int __stdcall
 fhandler_socket::fstat (struct __stat64 *buf, path_conv *pc)
 {
@@ -480,6 +1790,22 @@ fhandler_socket::bind (const struct sockaddr *name, int namelen)
 	  CloseHandle (fh);
 	  set_sun_path (un_addr->sun_path);
 	  res = 0;
+	  /* Senders look for an inbox named after the socket file's contents,
+	     and fall back to UDP if there is none.  So we must not keep one
+	     under any other name. */
+	  if (get_socket_type () == SOCK_DGRAM)
+	    {
+	      unsigned short port = htons (sin.sin_port);
+	      LPSECURITY_ATTRIBUTES sa = get_inheritance (true);
+	      if (ldgram ? !ldgram->bind (port, connect_secret, sa)
+			 : !(ldgram = af_local_dgram_create (port,
+							    connect_secret,
+							    sa)))
+		{
+		  debug_printf ("can't create inbox, using UDP");
+		  af_local_release (ldgram, true);
+		}
+	    }
 	}
 #undef un_addr
     }
@@ -526,6 +1852,11 @@ fhandler_socket::connect (const struct sockaddr *name, int namelen)
     }
   if (get_addr_family () == AF_LOCAL && get_socket_type () == SOCK_STREAM)
     {
+      /* The transport must be attached before our secret event is
+	 signalled, see af_local_conn::peer_attached. */
+      if (!res)
+	lconn = af_local_attach (1, get_socket (), sin.sin_port, secret,
+				 get_inheritance (true));
       if (!res || in_progress)
 	{
 	  if (!create_secret_event (secret))
@@ -547,12 +1878,33 @@ fhandler_socket::connect (const struct sockaddr *name, int namelen)
 
       if (secret_check_failed)
 	{
+	  af_local_release (lconn, false);
 	  close_secret_event ();
 	  if (res)
 	    closesocket (res);
 	  set_errno (ECONNREFUSED);
 	  res = -1;
 	}
+      else if (lconn && !lconn->peer_attached ())
+	{
+	  debug_printf ("peer didn't attach, using TCP");
+	  af_local_release (lconn, false);
+	}
+    }
+
+  else if (get_addr_family () == AF_LOCAL && get_socket_type () == SOCK_DGRAM
+	   && name->sa_family == AF_LOCAL && !res)
+    {
+      bool created = !ldgram;
+      if (created)
+	ldgram = af_local_dgram_create (0, NULL, get_inheritance (true));
+      if (ldgram
+	  && !ldgram->connect (sin.sin_port, secret, get_inheritance (true)))
+	{
+	  debug_printf ("peer has no inbox, using UDP");
+	  if (created)
+	    af_local_release (ldgram, true);
+	}
     }
 
   err = WSAGetLastError ();
@@ -605,8 +1957,12 @@ fhandler_socket::accept (struct sockaddr *peer, int *len)
   if ((SOCKET) res == INVALID_SOCKET && WSAGetLastError () == WSAEWOULDBLOCK)
     in_progress = TRUE;
 
+  af_local_conn *lc = NULL;
   if (get_addr_family () == AF_LOCAL && get_socket_type () == SOCK_STREAM)
     {
+      if ((SOCKET) res != INVALID_SOCKET)
+	lc = af_local_attach (0, res, ((struct sockaddr_in *) peer)->sin_port,
+			      connect_secret, &sec_all);
       if ((SOCKET) res != INVALID_SOCKET || in_progress)
 	{
 	  if (!create_secret_event ())
@@ -627,12 +1983,18 @@ fhandler_socket::accept (struct sockaddr *peer, int *len)
 
       if (secret_check_failed)
 	{
+	  af_local_release (lc, false);
 	  close_secret_event ();
 	  if ((SOCKET) res != INVALID_SOCKET)
 	    closesocket (res);
 	  set_errno (ECONNABORTED);
 	  return -1;
 	}
+      if (lc && !lc->peer_attached ())
+	{
+	  debug_printf ("peer didn't attach, using TCP");
+	  af_local_release (lc, false);
+	}
     }
 
   if ((SOCKET) res == INVALID_SOCKET)
@@ -650,10 +2012,12 @@ fhandler_socket::accept (struct sockaddr *peer, int *len)
 	  res_fh->set_addr_family (get_addr_family ());
 	  res_fh->set_socket_type (get_socket_type ());
 	  res_fh->set_connect_state (CONNECTED);
+	  res_fh->lconn = lc;
 	  res = res_fd;
 	}
       else
 	{
+	  af_local_release (lc, true);
 	  closesocket (res);
 	  res = -1;
 	}
@@ -731,6 +2095,24 @@ fhandler_socket::recvfrom (void *ptr, size_t len, int flags,
   int res;
   DWORD ret;
 
+  if (lconn)
+    {
+      struct iovec iov = { ptr, len };
+      struct msghdr msg = { NULL, 0, &iov, 1, NULL, 0 };
+      if (fromlen)
+	*fromlen = 0;
+      return lconn->recv (&msg, flags, is_nonblocking ());
+    }
+  if (ldgram)
+    {
+      struct iovec iov = { ptr, len };
+      struct msghdr msg = { from, fromlen ? *fromlen : 0, &iov, 1, NULL, 0 };
+      res = ldgram->recv (&msg, flags, is_nonblocking ());
+      if (res >= 0 && fromlen)
+	*fromlen = msg.msg_namelen;
+      return res;
+    }
+
   flags &= MSG_WINMASK;
   if (!winsock2_active)
     ret = res = ::recvfrom (get_socket (),
@@ -775,15 +2157,12 @@ fhandler_socket::recvfrom (void *ptr, size_t len, int flags,
 int
 fhandler_socket::recvmsg (struct msghdr *msg, int flags, ssize_t tot)
 {
-  if (get_addr_family () == AF_LOCAL)
-    {
-      /* On AF_LOCAL sockets the (fixed-size) name of the shared memory
-	 area used for descriptor passing is transmitted first.
-	 If this string is empty, no descriptors are passed and we can
-	 go ahead recv'ing the normal data blocks.  Otherwise start
-	 special handling for descriptor passing. */
-      /*TODO*/
-    }
+  /* Connected AF_LOCAL stream sockets use the shared memory transport,
+     which also handles descriptor passing. */
+  if (lconn)
+    return lconn->recv (msg, flags, is_nonblocking ());
+  if (ldgram)
+    return ldgram->recv (msg, flags, is_nonblocking ());
 
   struct iovec *const iov = msg->msg_iov;
   const int iovcnt = msg->msg_iovlen;
@@ -915,6 +2294,21 @@ fhandler_socket::sendto (const void *ptr, size_t len, int flags,
 {
   sockaddr_in sin;
 
+  if (lconn)
+    {
+      struct iovec iov = { (void *) ptr, len };
+      struct msghdr msg = { NULL, 0, &iov, 1, NULL, 0 };
+      return sendmsg (&msg, flags, len);
+    }
+
+  af_local_peer *lpeer = local_dgram_peer (to, tolen);
+  if (lpeer)
+    {
+      struct iovec iov = { (void *) ptr, len };
+      struct msghdr msg = { NULL, 0, &iov, 1, NULL, 0 };
+      return ldgram->send (&msg, lpeer, get_sun_path (), is_nonblocking ());
+    }
+
   if (to && !get_inet_addr (to, tolen, &sin, &tolen))
     return -1;
 
@@ -974,15 +2368,21 @@ fhandler_socket::sendto (const void *ptr, size_t len, int flags,
 int
 fhandler_socket::sendmsg (const struct msghdr *msg, int flags, ssize_t tot)
 {
-  if (get_addr_family () == AF_LOCAL)
+  /* Connected AF_LOCAL stream sockets use the shared memory transport,
+     which also handles descriptor passing. */
+  if (lconn)
     {
-      /* For AF_LOCAL/AF_UNIX sockets, if descriptors are given, start
-	 the special handling for descriptor passing.  Otherwise just
-	 transmit an empty string to tell the receiver that no
-	 descriptor passing is done. */
-      /*TODO*/
+      int res = lconn->send (msg, is_nonblocking ());
+      if (res == -1 && get_errno () == EPIPE && !(flags & MSG_NOSIGNAL))
+	raise (SIGPIPE);
+      return res;
     }
 
+  af_local_peer *lpeer = local_dgram_peer ((struct sockaddr *) msg->msg_name,
+					   msg->msg_namelen);
+  if (lpeer)
+    return ldgram->send (msg, lpeer, get_sun_path (), is_nonblocking ());
+
   struct iovec *const iov = msg->msg_iov;
   const int iovcnt = msg->msg_iovlen;
 
@@ -1087,6 +2487,9 @@ fhandler_socket::sendmsg (const struct msghdr *msg, int flags, ssize_t tot)
 int
 fhandler_socket::shutdown (int how)
 {
+  if (lconn && how != SHUT_RD)
+    lconn->shutdown_write ();
+
   int res = ::shutdown (get_socket (), how);
 
   if (res)
@@ -1140,6 +2543,8 @@ fhandler_socket::close ()
     }
 
   close_secret_event ();
+  af_local_release (lconn, true);
+  af_local_release (ldgram, true);
 
   debug_printf ("%d = fhandler_socket::close()", res);
   return res;
@@ -1248,6 +2653,23 @@ fhandler_socket::ioctl (unsigned int cmd, void *p)
 	  }
 	break;
       }
+    case FIONREAD:
+      if (lconn)
+	{
+	  *(int *) p = lconn->bytes_available ();
+	  res = 0;
+	  break;
+	}
+      if (ldgram)
+	{
+	  *(int *) p = ldgram->bytes_available ();
+	  res = 0;
+	  break;
+	}
+      res = ioctlsocket (get_socket (), cmd, (unsigned long *) p);
+      if (res == SOCKET_ERROR)
+	set_winsock_errno ();
+      break;
     case FIOASYNC:
       res = WSAAsyncSelect (get_socket (), gethwnd (), WM_ASYNCIO,
 	      *(int *) p ? ASYNC_MASK : 0);
@@ -1315,6 +2737,16 @@ fhandler_socket::set_close_on_exec (int val)
 {
   if (!winsock2_active) /* < Winsock 2.0 */
     set_inheritance (get_handle (), val);
+  else if (ifs_handle)
+    SetHandleInformation (get_handle (), HANDLE_FLAG_INHERIT,
+			  val ? 0 : HANDLE_FLAG_INHERIT);
+  if (lconn)
+    for (int i = 0; i < af_local_conn::nhandles; i++)
+      set_inheritance (lconn->handle (i), val);
+  if (ldgram)
+    for (int i = 0; i < af_local_dgram::nhandles; i++)
+      if (ldgram->handle (i))
+	set_inheritance (ldgram->handle (i), val);
   set_close_on_exec_flag (val);
   debug_printf ("set close_on_exec for %s to %d", get_name (), val);
 }
@@ -234,6 +234,10 @@ fhandler_pty_master::hit_eof ()
 
 /* Process tty output requests */
 
+#define PTY_POLL_MS	10	/* poll interval for unsignalled writers */
+#define PTY_IDLE_MS	500	/* wait between EOF checks when idle */
+#define PTY_EVENT_READS	8	/* event-woken reads to stop polling again */
+
 int
 fhandler_pty_master::process_slave_output (char *buf, size_t len, int pktmode_on)
 {
@@ -279,15 +283,44 @@ fhandler_pty_master::process_slave_output (char *buf, size_t len, int pktmode_on
       n = 0; // get_readahead_into_buffer (outbuf, len);
       if (!n)
 	{
-	  /* Doing a busy wait like this is quite inefficient, but nothing
-	     else seems to work completely.  Windows should provide some sort
-	     of overlapped I/O for pipes, or something, but it doesn't.  */
+	  /* Anonymous pipes can't do overlapped I/O, so wait for the slave
+	     to raise output_available_event after each WriteFile instead.
+	     The event is reset before peeking so that a write which happens
+	     between the peek and the wait is not lost.  Non-cygwin processes,
+	     and slaves which couldn't open the event, write to the pipe
+	     without raising it.  If we find data after a timed out wait, fall
+	     back to polling every PTY_POLL_MS.  Once PTY_EVENT_READS reads in
+	     a row have been woken up by the event, the writers raise it
+	     again, so go back to waiting for it.  */
+	  DWORD wait_ms = unsignalled_output ? PTY_POLL_MS : PTY_IDLE_MS;
+	  bool timed_out = false;
+	  bool woken = false;
 	  while (1)
 	    {
+	      if (output_available_event)
+		ResetEvent (output_available_event);
 	      if (!PeekNamedPipe (handle, NULL, 0, NULL, &n, NULL))
 		goto err;
 	      if (n > 0)
-		break;
+		{
+		  if (!unsignalled_output)
+		    {
+		      if (timed_out)
+			{
+			  termios_printf ("output without event, polling");
+			  unsignalled_output = true;
+			  event_reads = 0;
+			}
+		    }
+		  else if (timed_out)
+		    event_reads = 0;
+		  else if (woken && ++event_reads >= PTY_EVENT_READS)
+		    {
+		      termios_printf ("output events are back, waiting");
+		      unsignalled_output = false;
+		    }
+		  break;
+		}
 	      if (hit_eof ())
 		goto out;
 	      if (n == 0 && is_nonblocking ())
@@ -297,7 +330,15 @@ fhandler_pty_master::process_slave_output (char *buf, size_t len, int pktmode_on
 		  break;
 		}
 
-	      Sleep (10);
+	      if (!output_available_event)
+		Sleep (PTY_POLL_MS);
+	      else
+		{
+		  DWORD res = WaitForSingleObject (output_available_event,
+						   wait_ms);
+		  timed_out = res == WAIT_TIMEOUT;
+		  woken = res == WAIT_OBJECT_0;
+		}
 	    }
 
 	  if (ReadFile (handle, outbuf, rlen, &n, NULL) == FALSE)
@@ -481,8 +522,12 @@ fhandler_tty_slave::open (path_conv *, int flags, mode_t)
       return 0;
     }
 
-  /* The ioctl events may or may not exist.  See output_done_event,
-     above.  */
+  /* The master falls back to polling if the output available event
+     doesn't exist.  The ioctl events may or may not exist either.  See
+     output_done_event, above.  */
+  __small_sprintf (buf, OUTPUT_AVAILABLE_EVENT, ttynum);
+  if (!(output_available_event = OpenEvent (EVENT_ALL_ACCESS, TRUE, buf)))
+    termios_printf ("open output event failed, %E");
   __small_sprintf (buf, IOCTL_REQUEST_EVENT, ttynum);
   ioctl_request_event = OpenEvent (EVENT_ALL_ACCESS, TRUE, buf);
   __small_sprintf (buf, IOCTL_DONE_EVENT, ttynum);
@@ -667,6 +712,9 @@ fhandler_tty_slave::write (const void *ptr, size_t len)
 	  break;
 	}
 
+      if (output_available_event)
+	SetEvent (output_available_event);
+
       if (output_done_event != NULL)
 	{
 	  DWORD rc;
@@ -902,6 +950,15 @@ fhandler_tty_common::dup (fhandler_base *child)
       errind = 4;
       goto err;
     }
+  if (output_available_event == NULL)
+    fts->output_available_event = NULL;
+  else if (!DuplicateHandle (hMainProc, output_available_event, hMainProc,
+			     &fts->output_available_event, 0, 1,
+			     DUPLICATE_SAME_ACCESS))
+    {
+      errind = 10;
+      goto err;
+    }
   if (!DuplicateHandle (hMainProc, output_mutex, hMainProc,
 			&fts->output_mutex, 0, 1,
 			DUPLICATE_SAME_ACCESS))
@@ -1047,7 +1104,8 @@ out:
  fhandler_pty_master
 */
 fhandler_pty_master::fhandler_pty_master (DWORD devtype, int unit)
-  : fhandler_tty_common (devtype, unit)
+  : fhandler_tty_common (devtype, unit), unsignalled_output (false),
+    event_reads (0)
 {
 }
 
@@ -1092,6 +1150,15 @@ fhandler_tty_common::close ()
 
   if (!ForceCloseHandle (input_available_event))
     termios_printf ("CloseHandle (input_available_event<%p>), %E", input_available_event);
+
+  /* Wake up a master waiting for output so that it notices EOF now
+     rather than on its next idle timeout. */
+  if (output_available_event)
+    {
+      SetEvent (output_available_event);
+      if (!CloseHandle (output_available_event))
+	termios_printf ("CloseHandle (output_available_event<%p>), %E", output_available_event);
+    }
   if (!ForceCloseHandle1 (get_handle (), from_pty))
     termios_printf ("CloseHandle (get_handle ()<%p>), %E", get_handle ());
   if (!ForceCloseHandle1 (get_output_handle (), to_pty))
@@ -1238,6 +1305,8 @@ fhandler_tty_common::set_close_on_exec (int val)
   set_inheritance (output_mutex, val);
   set_inheritance (input_mutex, val);
   set_inheritance (input_available_event, val);
+  if (output_available_event)
+    set_inheritance (output_available_event, val);
   set_inheritance (output_handle, val);
 }
 
@@ -1265,6 +1334,8 @@ fhandler_tty_common::fixup_after_fork (HANDLE parent)
     fork_fixup (parent, input_mutex, "input_mutex");
   if (input_available_event)
     fork_fixup (parent, input_available_event, "input_available_event");
+  if (output_available_event)
+    fork_fixup (parent, output_available_event, "output_available_event");
   fork_fixup (parent, inuse, "inuse");
 }
 
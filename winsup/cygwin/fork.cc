@@ -30,6 +30,7 @@ details. */
 #include "shared_info.h"
 #include "cygmalloc.h"
 #include "cygthread.h"
+#include "syscall_stats.h"
 
 #ifdef DEBUGGING
 static int npid;
@@ -378,7 +379,8 @@ fork_parent (HANDLE& hParent, dll *&first_dll,
      parent after CreateProcess and before copying the datastructures
      to the child. So we have to start the child in suspend state,
      unfortunately, to avoid a race condition. */
-  if (cygheap->fdtab.need_fixup_before ())
+  bool fixup_before = cygheap->fdtab.need_fixup_before ();
+  if (fixup_before)
     c_flags |= CREATE_SUSPENDED;
 
   /* Create an inheritable handle to pass to the child process.  This will
@@ -458,7 +460,8 @@ fork_parent (HANDLE& hParent, dll *&first_dll,
 		  myself->progname, myself->progname, c_flags, &si, &pi);
   __malloc_lock ();
   void *newheap;
-  newheap = cygheap_setup_for_child (&ch, cygheap->fdtab.need_fixup_before ());
+  int start = strace.microseconds ();
+  newheap = cygheap_setup_for_child (&ch, fixup_before);
   rc = CreateProcess (myself->progname, /* image to run */
 		      myself->progname, /* what we send in arg0 */
 		      sec_attribs,
@@ -486,7 +489,7 @@ fork_parent (HANDLE& hParent, dll *&first_dll,
 
   /* Fixup the parent datastructure if needed and resume the child's
      main thread. */
-  if (!cygheap->fdtab.need_fixup_before ())
+  if (!fixup_before)
     cygheap_setup_for_child_cleanup (newheap, &ch, 0);
   else
     {
@@ -494,6 +497,8 @@ fork_parent (HANDLE& hParent, dll *&first_dll,
       cygheap_setup_for_child_cleanup (newheap, &ch, 1);
       ResumeThread (pi.hThread);
     }
+  syscall_printf ("child %u created, fixup before %d, %d us",
+		  pi.dwProcessId, fixup_before, strace.microseconds () - start);
 
 #ifdef DEBUGGING
   pinfo forked ((ch.cygpid != 1 ? ch.cygpid : cygwin_pid (pi.dwProcessId)), 1);
@@ -604,6 +609,8 @@ fork_parent (HANDLE& hParent, dll *&first_dll,
 
 /* Common cleanup code for failure cases */
  cleanup:
+  if (fixup_before)
+    cygheap->fdtab.fixup_before_failed (false);
   /* Remember to de-allocate the fd table. */
   if (pi.hProcess)
     ForceCloseHandle1 (pi.hProcess, childhProc);
@@ -619,6 +626,7 @@ fork_parent (HANDLE& hParent, dll *&first_dll,
 extern "C" int
 fork ()
 {
+  syscall_timer timer (SC_FORK);
   struct
   {
     HANDLE hParent;
@@ -652,7 +660,12 @@ fork ()
   int res = setjmp (ch.jmp);
 
   if (res)
-    res = fork_child (grouped.hParent, grouped.first_dll, grouped.load_dlls);
+    {
+      /* The child has a copy of the parent's timer; only the parent
+	 gets to record the fork. */
+      timer.cancel ();
+      res = fork_child (grouped.hParent, grouped.first_dll, grouped.load_dlls);
+    }
   else
     res = fork_parent (grouped.hParent, grouped.first_dll, grouped.load_dlls, esp, ch);
 
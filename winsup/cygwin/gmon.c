@@ -42,6 +42,7 @@ static char rcsid[] = "$OpenBSD: gmon.c,v 1.8 1997/07/23 21:11:27 kstailey Exp $
 #include <sys/param.h>
 #include <sys/types.h>
 #include <gmon.h>
+#include <pthread.h>
 
 #include <profil.h>
 #include <windows.h>
@@ -52,6 +53,7 @@ static char rcsid[] = "$OpenBSD: gmon.c,v 1.8 1997/07/23 21:11:27 kstailey Exp $
 struct gmonparam _gmonparam = { GMON_PROF_OFF };
 
 static int	s_scale;
+static pid_t	s_pid;		/* of the process that called monstartup */
 /* see profil(2) where this is describe (incorrectly) */
 #define		SCALE_1_TO_1	0x10000L
 
@@ -69,6 +71,106 @@ fake_sbrk(int size)
       return (void *) -1;
 }
 
+static void
+gmon_lock(p)
+	struct gmonparam *p;
+{
+	/* Sleep(0) only yields to threads of our own priority */
+	while (InterlockedExchange(&p->lock, 1))
+		Sleep(1);
+}
+
+static void
+gmon_unlock(p)
+	struct gmonparam *p;
+{
+	InterlockedExchange(&p->lock, 0);
+}
+
+/*
+ * Give the calling thread a gmonbuf: that of a thread which has
+ * exited if there is one, else a new one.  Also have profil sample
+ * the thread from now on.
+ */
+struct gmonbuf *
+_gmon_newbuf()
+{
+	struct gmonparam *p = &_gmonparam;
+	struct gmonbuf *b;
+	HANDLE thr;
+
+	if (!DuplicateHandle(GetCurrentProcess(), GetCurrentThread(),
+	    GetCurrentProcess(), &thr, 0, FALSE, DUPLICATE_SAME_ACCESS))
+		return NULL;
+	gmon_lock(p);
+	for (b = p->bufs; b; b = b->next)
+		if (b->thread == NULL ||
+		    WaitForSingleObject(b->thread, 0) == WAIT_OBJECT_0)
+			break;
+	if (b == NULL && (b = calloc(1, sizeof(*b))) != NULL) {
+		b->next = p->bufs;
+		p->bufs = b;
+	} else if (b != NULL && b->thread != NULL)
+		CloseHandle(b->thread);
+	if (b != NULL) {
+		b->thread = thr;
+		b->state = GMON_PROF_ON;
+		TlsSetValue(p->tlsindex, b);
+	}
+	gmon_unlock(p);
+	if (b == NULL) {
+		CloseHandle(thr);
+		return NULL;
+	}
+	profil_thread();
+	return b;
+}
+
+/*
+ * Merge B into the shared tables and empty it.  The caller must own B,
+ * ie. have set its state to GMON_PROF_BUSY.  Once the tos have run
+ * out, profiling stops and B's arcs are thrown away.
+ */
+void
+_gmon_flushbuf(b)
+	struct gmonbuf *b;
+{
+	struct gmonparam *p = &_gmonparam;
+	struct rawarc *a;
+
+	gmon_lock(p);
+	for (a = b->arcs; a < b->arcs + GMONBUF_ARCS; a++) {
+		if (a->raw_selfpc == 0)
+			continue;
+		if (p->state != GMON_PROF_ERROR &&
+		    _gmon_arc(p, a->raw_frompc, a->raw_selfpc,
+		    a->raw_count) < 0)
+			p->state = GMON_PROF_ERROR;
+		a->raw_selfpc = 0;
+	}
+	b->narcs = 0;
+	gmon_unlock(p);
+}
+
+/*
+ * In a forked child, neither the parent's thread handles nor its TLS
+ * slot are valid.  Keep the counts, but let every gmonbuf be taken
+ * over afresh, and write the results to a file of the child's own.
+ */
+static void
+gmon_child()
+{
+	struct gmonparam *p = &_gmonparam;
+	struct gmonbuf *b;
+
+	p->lock = 0;
+	p->tlsindex = TlsAlloc();
+	for (b = p->bufs; b; b = b->next) {
+		b->thread = NULL;
+		b->state = GMON_PROF_ON;
+	}
+}
+
 void
 monstartup(lowpc, highpc)
 	u_long lowpc;
@@ -113,6 +215,16 @@ monstartup(lowpc, highpc)
 	//minbrk = fake_sbrk(0);
 	p->tos[0].link = 0;
 
+	p->tlsindex = TlsAlloc();
+	if (p->tlsindex == (u_long)-1) {
+		ERR("monstartup: no TLS slot\n");
+		return;
+	}
+	p->bufs = NULL;
+	p->lock = 0;
+	s_pid = getpid();
+	pthread_atfork(NULL, NULL, gmon_child);
+
 	o = p->highpc - p->lowpc;
 	if (p->kcountsize < o) {
 #ifndef notdef
@@ -147,16 +259,32 @@ _mcleanup()
 	struct rawarc rawarc;
 	struct gmonparam *p = &_gmonparam;
 	struct gmonhdr gmonhdr, *hdr;
+	struct gmonbuf *b;
 	char *proffile;
+	int tries;
+	int overflow;
 #ifdef DEBUG
 	int log, len;
 	char dbuf[200];
 #endif
 
-	if (p->state == GMON_PROF_ERROR)
-		ERR("_mcleanup: tos overflow\n");
+	/*
+	 * merge every thread's arcs.  one still in mcount gets a moment
+	 * to leave it; one that was killed there is merged anyway.
+	 */
+	for (b = p->bufs; b; b = b->next) {
+		for (tries = 0; tries < 10; tries++) {
+			if (InterlockedExchange(&b->state, GMON_PROF_BUSY)
+			    == GMON_PROF_ON)
+				break;
+			Sleep(1);
+		}
+		_gmon_flushbuf(b);
+	}
+
+	overflow = p->state == GMON_PROF_ERROR;
 
-	hz = PROF_HZ;
+	hz = profil_hz();
 	moncontrol(0);
 
 #ifdef nope
@@ -206,7 +334,20 @@ _mcleanup()
 	}
 #else
 	{
-	  char gmon_out[] = "gmon.out";
+	  /*
+	   * as glibc, write to $GMON_OUT_PREFIX.<pid> if that's set.
+	   * otherwise, a forked child writes to gmon.<pid>.out, so as
+	   * not to overwrite its parent's gmon.out.
+	   */
+	  char gmon_out[MAXPATHLEN];
+	  char *prefix = getenv("GMON_OUT_PREFIX");
+
+	  if (prefix != NULL && *prefix != '\0')
+		snprintf(gmon_out, sizeof gmon_out, "%s.%d", prefix, getpid());
+	  else if (getpid() != s_pid)
+		sprintf(gmon_out, "gmon.%d.out", getpid());
+	  else
+		sprintf(gmon_out, "gmon.out");
 	  proffile = gmon_out;
 	}
 #endif
@@ -257,6 +398,8 @@ _mcleanup()
 		}
 	}
 	close(fd);
+	if (overflow)
+		ERR("_mcleanup: tos overflow, the call graph is incomplete\n");
 }
 
 /*
@@ -122,6 +122,23 @@ struct rawarc {
 	long	raw_count;
 };
 
+/*
+ * Each thread counts arcs in a small hash table of its own, so that
+ * threads neither contend for the shared tables nor corrupt them.
+ * It is merged into the shared tables when it fills up, and at exit.
+ * A thread that starts after another has exited takes over its
+ * table as it is.
+ */
+#define	GMONBUF_ARCS	1024		/* a power of 2 */
+
+struct gmonbuf {
+	struct gmonbuf	*next;		/* on _gmonparam.bufs */
+	void		*thread;	/* handle of the owning thread */
+	long		state;		/* GMON_PROF_ON or GMON_PROF_BUSY */
+	long		narcs;
+	struct rawarc	arcs[GMONBUF_ARCS];
+};
+
 /*
  * general rounding functions.
  */
@@ -144,9 +161,16 @@ struct gmonparam {
 	u_long		highpc;
 	u_long		textsize;
 	u_long		hashfraction;
+	u_long		tlsindex;	/* the calling thread's gmonbuf */
+	struct gmonbuf	*bufs;		/* everybody's */
+	long		lock;		/* guards froms, tos and bufs */
 };
 extern struct gmonparam _gmonparam;
 
+int _gmon_arc __P((struct gmonparam *, u_long, u_long, long));
+struct gmonbuf *_gmon_newbuf __P((void));
+void _gmon_flushbuf __P((struct gmonbuf *));
+
 /*
  * Possible states of profiling.
  */
@@ -13,6 +13,26 @@ details. */
 
 #include <mmsystem.h>
 
+/* Converts counter ticks to another unit by a 32.32 fixed point
+   multiplication, so that no 64 bit division is needed per call. */
+class hires_scale
+{
+  ULONGLONG mult_int;
+  DWORD mult_frac;
+ public:
+  void init (LONGLONG from_hz, LONGLONG to_hz)
+  {
+    mult_int = to_hz / from_hz;
+    mult_frac = (DWORD) ((double) (to_hz % from_hz) * 4294967296.
+			 / (double) from_hz);
+  }
+  ULONGLONG scale (ULONGLONG ticks) const
+  {
+    return ticks * mult_int + (ticks >> 32) * mult_frac
+	   + (((ULONGLONG) (DWORD) ticks * mult_frac) >> 32);
+  }
+};
+
 class hires_base
 {
  protected:
@@ -27,12 +47,24 @@ class hires_us : hires_base
 {
   LARGE_INTEGER primed_ft;
   LARGE_INTEGER primed_pc;
-  double freq;
+  hires_scale freq;
   void prime ();
  public:
   LONGLONG usecs (bool justdelta);
 };
 
+/* Monotonic nanosecond clock for CLOCK_MONOTONIC. */
+class hires_ns : hires_base
+{
+  LARGE_INTEGER primed_pc;
+  hires_scale freq;
+  LONGLONG res;
+  void prime ();
+ public:
+  LONGLONG nsecs ();
+  LONGLONG resolution ();
+};
+
 class hires_ms : hires_base
 {
   DWORD initime_ms;
@@ -49,6 +49,8 @@ protected:
     CYGSERVER_REQUEST_SHUTDOWN,
     CYGSERVER_REQUEST_ATTACH_TTY,
     CYGSERVER_REQUEST_SHM,
+    CYGSERVER_REQUEST_MSG,
+    CYGSERVER_REQUEST_SEM,
     CYGSERVER_REQUEST_LAST
   } request_code_t;
 
@@ -21,7 +21,7 @@ extern "C"
 
 /* Semaphore operation flags:
  */
-#define SEM_UNDO		/* Set up adjust on exit entry. */
+#define SEM_UNDO   0x1000	/* Set up adjust on exit entry. */
 
 /* Command definitions for the semctl () function:
  */
@@ -0,0 +1,44 @@
+/* time.h
+
+   Copyright 2003 Red Hat Inc.
+
+This file is part of Cygwin.
+
+This software is a copyrighted work licensed under the terms of the
+Cygwin license.  Please consult the file "CYGWIN_LICENSE" for
+details. */
+
+#ifndef _CYGWIN_TIME_H
+#define _CYGWIN_TIME_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#ifndef __clockid_t_defined
+#define __clockid_t_defined
+typedef unsigned long clockid_t;
+#endif /*__clockid_t_defined*/
+
+#ifndef CLOCK_REALTIME
+#define CLOCK_REALTIME			((clockid_t) 1)
+#define CLOCK_PROCESS_CPUTIME_ID	((clockid_t) 2)
+#define CLOCK_THREAD_CPUTIME_ID		((clockid_t) 3)
+#define CLOCK_MONOTONIC			((clockid_t) 4)
+#endif
+
+#ifndef TIMER_ABSTIME
+#define TIMER_ABSTIME	4
+#endif
+
+int clock_gettime (clockid_t, struct timespec *);
+int clock_getres (clockid_t, struct timespec *);
+int clock_nanosleep (clockid_t, int, const struct timespec *,
+		     struct timespec *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*_CYGWIN_TIME_H*/
@@ -210,12 +210,15 @@ details. */
        88: Export _getreent
        89: Export __mempcpy
        90: Export _fopen64
+       91: Export clock_getres clock_gettime clock_nanosleep
+       92: Export msgctl msgget msgrcv msgsnd semctl semget semop
+       93: Export cygwin_conv_path_array
      */
 
      /* Note that we forgot to bump the api for ualarm, strtoll, strtoull */
 
 #define CYGWIN_VERSION_API_MAJOR 0
-#define CYGWIN_VERSION_API_MINOR 90
+#define CYGWIN_VERSION_API_MINOR 93
 
      /* There is also a compatibity version number associated with the
 	shared memory regions.  It is incremented when incompatible
@@ -136,9 +136,9 @@ details. */
 #define CHILD_MAX 63
 
 /* # of open files per process. Actually it can be more since Cygwin
-   grows the dtable as necessary. We define a reasonable limit here
-   which is returned by getdtablesize(), sysconf(_SC_OPEN_MAX) and
-   getrlimit(RLIMIT_NOFILE). */
+   grows the dtable as necessary up to the limit which is set by
+   setrlimit(RLIMIT_NOFILE) and returned by getdtablesize(),
+   sysconf(_SC_OPEN_MAX) and getrlimit(RLIMIT_NOFILE). */
 #undef OPEN_MAX
 #define OPEN_MAX 256
 
@@ -41,6 +41,16 @@ extern int cygwin_conv_to_full_posix_path (const char *, char *);
 extern int cygwin_posix_path_list_p (const char *);
 extern void cygwin_split_path (const char *, char *, char *);
 
+/* What cygwin_conv_path_array converts to. */
+#define CCP_POSIX	0x0	/* POSIX paths, as cygwin_conv_to_posix_path */
+#define CCP_WIN32	0x1	/* Win32 paths, as cygwin_conv_to_win32_path */
+#define CCP_ABSOLUTE	0x2	/* absolute ones, as the _full_ versions */
+
+/* Converts each path like the functions above would, only converting
+   a path which occurs more than once just once. */
+extern int cygwin_conv_path_array (unsigned, int, const char *const *,
+				   char **);
+
 struct __cygwin_perfile
 {
   const char *name;
@@ -72,7 +82,8 @@ typedef enum
     CW_CYGWIN_PID_TO_WINPID,
     CW_EXTRACT_DOMAIN_AND_USER,
     CW_CMDLINE,
-    CW_CHECK_NTSEC
+    CW_CHECK_NTSEC,
+    CW_SAMPLE_LOADAVG
   } cygwin_getinfo_types;
 
 #define CW_NEXTPID	0x80000000	/* or with pid to get next one */
@@ -31,12 +31,59 @@ details. */
 
 #include <stdarg.h>
 
+#define _STRACE_RING_NAME	"cygwin.strace.ring.%x"	/* Windows pid */
+#define _STRACE_RING_MAGIC	0x67725963
+#define _STRACE_RING_MAXARGS	16
+#define _STRACE_RING_STRLEN	160
+
+/* Binary trace event.  The format string and the function name are
+   recorded as pointers into the traced process and are only read and
+   formatted by strace.exe.  String arguments and the thread name are
+   copied into str since they may not outlive the call.  For a %s
+   argument args holds the offset into str, or -1 for a NULL pointer.
+   64 bit arguments take two slots, low word first. */
+struct _strace_ring_event
+{
+  volatile long seq;		/* Slot index + 1 once the event is complete */
+  unsigned category;
+  unsigned long usecs;
+  unsigned long pid;
+  unsigned long err;		/* Win32 error for %E */
+  const char *func;
+  const char *fmt;
+  unsigned short execing;
+  unsigned short nargs;
+  unsigned long args[_STRACE_RING_MAXARGS];
+  char str[_STRACE_RING_STRLEN];	/* Thread name, then %s arguments */
+};
+
+/* Shared memory ring created by strace.exe for each traced process.
+   Any thread of the traced process reserves a slot by advancing head;
+   strace.exe advances tail after it has consumed an event.  When the
+   ring is full the event is dropped and counted instead of blocking
+   the traced process. */
+struct _strace_ring
+{
+  unsigned long magic;
+  unsigned long nslots;		/* Power of 2 */
+  unsigned long mask;		/* Categories strace.exe wants to see */
+  volatile long head;
+  volatile long tail;
+  volatile long dropped;
+  char progname[260];
+  struct _strace_ring_event ev[1];
+};
+
 #ifdef __cplusplus
 
 class strace
 {
+  struct _strace_ring *ring;
   int vsprntf (char *buf, const char *func, const char *infmt, va_list ap);
   void write (unsigned category, const char *buf, int count);
+  void activate ();
+  void ring_record (unsigned category, const char *func, const char *fmt,
+		    va_list ap, unsigned long err);
 public:
   int microseconds ();
   int version;
@@ -57,6 +104,10 @@ extern strace strace;
 #define _STRACE_INTERFACE_ACTIVATE_ADDR  -1
 #define _STRACE_INTERFACE_ACTIVATE_ADDR1 -2
 
+/* Written to strace.active by strace.exe when it has created a ring
+   buffer for the process instead of reading OutputDebugString output. */
+#define _STRACE_INTERFACE_RING 2
+
 /* Bitmasks of tracing messages to print.  */
 
 #define _STRACE_ALL	 0x00001 // so behaviour of strace=1 is unchanged
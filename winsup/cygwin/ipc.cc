@@ -14,6 +14,10 @@
 #include "winsup.h"
 #include <cygwin/ipc.h>
 #include <sys/stat.h>
+#include "cygerrno.h"
+#include "security.h"
+#include "sigproc.h"
+#include "cygserver_ipc.h"
 
 /* Notes: we return a valid key even if id's low order 8 bits are 0. */
 extern "C" key_t
@@ -90,3 +94,64 @@ ftok (const char *path, int id)
   tmp |= (id & 0x00ff);
   return tmp;
 }
+
+#ifdef USE_SERVER
+/* Wait for the state of a msg queue or sem set to change.  The caller
+   holds the object's lock, which is released while waiting.  If the
+   wait list is full, fall back to polling, counted in *polling so that
+   the caller's object can still report its waiters. */
+int
+ipc_wait (volatile LONG &lock, ipc_waiter_t *waiters, int what,
+	  LONG *polling)
+{
+  const DWORD winpid = GetCurrentProcessId ();
+  const DWORD tid = GetCurrentThreadId ();
+  ipc_waiter_t *waiter = NULL;
+  HANDLE evt = NULL;
+  char name[48];
+
+  for (int i = 0; i < IPC_WAITERS; i++)
+    if (!waiters[i].winpid)
+      {
+	waiter = waiters + i;
+	break;
+      }
+  if (waiter
+      && (evt = CreateEvent (&sec_all_nih, FALSE, FALSE,
+			     ipc_wait_name (name, winpid, tid))))
+    {
+      waiter->winpid = winpid;
+      waiter->tid = tid;
+      waiter->what = what;
+    }
+  else if (polling)
+    ++*polling;
+  ipc_unlock_shared (lock);
+
+  HANDLE w4[2] = { signal_arrived, evt };
+  DWORD res = WaitForMultipleObjects (evt ? 2 : 1, w4, FALSE,
+				      evt ? INFINITE : 10);
+
+  ipc_lock_shared (lock);
+  if (evt)
+    {
+      /* Still in the list if we weren't woken up. */
+      if (waiter->winpid == winpid && waiter->tid == tid)
+	waiter->winpid = 0;
+      CloseHandle (evt);
+    }
+  else if (polling)
+    --*polling;
+
+  switch (res)
+    {
+    case WAIT_OBJECT_0:
+      return EINTR;
+    case WAIT_OBJECT_0 + 1:
+    case WAIT_TIMEOUT:
+      return 0;
+    default:
+      return geterrno_from_win_error (GetLastError (), EINVAL);
+    }
+}
+#endif /* USE_SERVER */
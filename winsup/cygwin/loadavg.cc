@@ -0,0 +1,191 @@
+/* loadavg.cc: load averages and stall times, sampled system wide
+
+   Copyright 2003 Red Hat, Inc.
+
+This file is part of Cygwin.
+
+This software is a copyrighted work licensed under the terms of the
+Cygwin license.  Please consult the file "CYGWIN_LICENSE" for
+details. */
+
+#include "winsup.h"
+#include <stdlib.h>
+#include <math.h>
+#include <ntdef.h>
+#include "security.h"
+#include "fhandler.h"
+#include "path.h"
+#include "shared_info.h"
+#include "ntdll.h"
+
+/* Windows keeps no load average, so one is made the way Linux makes
+   its own: every LOADAVG_INTERVAL seconds the threads running or ready
+   to run are counted, along with those waiting for the pager, and the
+   count folded into exponentially decaying averages.  There is no
+   process to do this on a timer, so it is done by whoever next wants
+   the averages once the last sample is LOADAVG_INTERVAL old.  The time
+   since the last sample counts as though the latest count held for all
+   of it, so the averages are only as good as the sampling is regular;
+   cygserver samples on a timer to keep them so. */
+
+static const double load_secs[3] = {60, 300, 900};
+static const double stall_secs[3] = {10, 60, 300};
+
+/* Threads held up by paging, which Linux would count as in disk wait. */
+static bool
+paging_wait (KWAIT_REASON r)
+{
+  switch (r)
+    {
+    case FreePage:
+    case PageIn:
+    case PoolAllocation:
+    case WrFreePage:
+    case WrPageIn:
+    case WrPoolAllocation:
+    case WrVirtualMemory:
+    case WrPageOut:
+      return true;
+    default:
+      return false;
+    }
+}
+
+/* Count the threads in the system, those ready to run or running, and
+   those waiting on paging.  Returns false if they can't be had. */
+static bool
+count_threads (DWORD &threads, DWORD &running, DWORD &ready, DWORD &blocked)
+{
+  NTSTATUS ret;
+  ULONG n = 0x4000;
+  PULONG p = new ULONG[n];
+  while (STATUS_INFO_LENGTH_MISMATCH ==
+	 (ret = NtQuerySystemInformation (SystemProcessesAndThreadsInformation,
+					 (PVOID) p,
+					 n * sizeof *p, NULL)))
+    delete [] p, p = new ULONG[n *= 2];
+  if (ret != STATUS_SUCCESS)
+    {
+      debug_printf ("NtQuerySystemInformation: ret = %d, "
+		    "Dos(ret) = %d",
+		    ret, RtlNtStatusToDosError (ret));
+      delete [] p;
+      return false;
+    }
+
+  threads = running = ready = blocked = 0;
+  for (SYSTEM_PROCESSES *sp = (SYSTEM_PROCESSES *) p; ;
+       sp = (SYSTEM_PROCESSES *) ((char *) sp + sp->NextEntryDelta))
+    {
+      /* The idle process has a thread "running" on every idle CPU. */
+      if (sp->ProcessId)
+	{
+	  SYSTEM_THREADS *st;
+	  /* See get_process_state in fhandler_process.cc. */
+	  if (wincap.has_process_io_counters ())
+	    st = &sp->Threads[0];
+	  else
+	    st = (SYSTEM_THREADS *) ((char *) sp + 136);
+	  threads += sp->ThreadCount;
+	  for (unsigned i = 0; i < sp->ThreadCount; i++, st++)
+	    switch (st->State)
+	      {
+	      case StateReady:
+	      case StateStandby:
+		ready++;
+		/* fall through */
+	      case StateRunning:
+		running++;
+		break;
+	      case StateWait:
+		if (paging_wait (st->WaitReason))
+		  blocked++;
+		break;
+	      default:
+		break;
+	      }
+	}
+      if (!sp->NextEntryDelta)
+	break;
+    }
+  delete [] p;
+
+  /* Not counting the thread doing the counting. */
+  if (running)
+    running--;
+  return true;
+}
+
+static bool
+process_alive (DWORD winpid)
+{
+  HANDLE h = OpenProcess (SYNCHRONIZE, FALSE, winpid);
+  if (!h)
+    return GetLastError () != ERROR_INVALID_PARAMETER;
+  bool alive = WaitForSingleObject (h, 0) == WAIT_TIMEOUT;
+  CloseHandle (h);
+  return alive;
+}
+
+/* Take a sample if the last is LOADAVG_INTERVAL old and nobody else is
+   taking one.  Returns true if a sample was taken. */
+bool __stdcall
+loadavg_sample ()
+{
+  loadavginfo &la = cygwin_shared->loadavg;
+  const LONG winpid = GetCurrentProcessId ();
+  LONGLONG now;
+  DWORD threads, running, ready, blocked;
+
+  if (!wincap.is_winnt ())
+    return false;
+  GetSystemTimeAsFileTime ((FILETIME *) &now);
+  if (la.last && now - la.last < LOADAVG_INTERVAL * 10000000LL)
+    return false;
+  /* A sample takes a moment, so the sampler may only have died with the
+     lock held if the last sample is long overdue.  Take over then. */
+  LONG holder = InterlockedCompareExchange (&la.lock, winpid, 0);
+  if (holder)
+    {
+      if (now - la.last < 4 * LOADAVG_INTERVAL * 10000000LL
+	  || holder == winpid || process_alive (holder)
+	  || InterlockedCompareExchange (&la.lock, winpid, holder) != holder)
+	return false;
+      debug_printf ("taking over from dead sampler %d", holder);
+    }
+
+  bool res = false;
+  if (now - la.last >= LOADAVG_INTERVAL * 10000000LL
+      && count_threads (threads, running, ready, blocked))
+    {
+      /* A first sample has no history, and so sets the averages. */
+      double secs = la.last ? (now - la.last) / 1e7 : 1e9;
+      for (int i = 0; i < 3; i++)
+	{
+	  double e = exp (-secs / load_secs[i]);
+	  la.load[i] = la.load[i] * e + (running + blocked) * (1 - e);
+	  e = exp (-secs / stall_secs[i]);
+	  la.cpu_some[i] = la.cpu_some[i] * e + (ready ? 100 : 0) * (1 - e);
+	  la.mem_some[i] = la.mem_some[i] * e + (blocked ? 100 : 0) * (1 - e);
+	}
+      /* Not crediting more than a couple of intervals to one sample,
+	 which would be guesswork. */
+      if (la.last)
+	{
+	  unsigned long long usecs = (now - la.last) / 10;
+	  if (usecs > 2 * LOADAVG_INTERVAL * 1000000ULL)
+	    usecs = 2 * LOADAVG_INTERVAL * 1000000ULL;
+	  if (ready)
+	    la.cpu_total += usecs;
+	  if (blocked)
+	    la.mem_total += usecs;
+	}
+      la.threads = threads;
+      la.running = running;
+      la.blocked = blocked;
+      la.last = now;
+      res = true;
+    }
+  InterlockedExchange (&la.lock, 0);
+  return res;
+}
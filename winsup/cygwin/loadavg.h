@@ -0,0 +1,32 @@
+/* loadavg.h: load averages and stall times, sampled system wide
+
+   Copyright 2003 Red Hat, Inc.
+
+This file is part of Cygwin.
+
+This software is a copyrighted work licensed under the terms of the
+Cygwin license.  Please consult the file "CYGWIN_LICENSE" for
+details. */
+
+/* Seconds between samples, as on Linux. */
+#define LOADAVG_INTERVAL 5
+
+/* Kept in the shared memory region, so that every process sees the same
+   averages however seldom it samples them itself.  The percentages are
+   of time during which at least one thread was ready to run but had no
+   CPU, or was waiting for a page to be read or written. */
+struct loadavginfo
+{
+  LONGLONG last;		/* time of the last sample, as a FILETIME */
+  double load[3];		/* over 1, 5 and 15 minutes */
+  double cpu_some[3];		/* % over 10, 60 and 300 seconds */
+  double mem_some[3];		/* ditto */
+  unsigned long long cpu_total;	/* usecs of such waiting, ever */
+  unsigned long long mem_total;	/* ditto */
+  LONG lock;			/* Windows pid of the sampler, or 0 */
+  DWORD running;		/* threads running or ready at the last sample */
+  DWORD blocked;		/* threads waiting on paging at the last sample */
+  DWORD threads;		/* all threads at the last sample */
+};
+
+bool __stdcall loadavg_sample ();
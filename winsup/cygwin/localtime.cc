@@ -6,6 +6,7 @@
 
 #include "winsup.h"
 #include "cygerrno.h"
+#include "environ.h"
 #include <windows.h>
 #define lint
 
@@ -607,6 +608,7 @@ static struct state	gmtmem;
 
 static char		lcl_TZname[TZ_STRLEN_MAX + 1];
 static int		lcl_is_set;
+static unsigned long	lcl_env_generation;	/* env_generation at last tzset */
 static int		gmt_is_set;
 
 #define tzname _tzname
@@ -1463,8 +1465,8 @@ tzsetwall P((void))
 	settzname();
 }
 
-extern "C" void
-tzset P((void))
+static void
+tzset_env P((void))
 {
 	const char *	name = getenv("TZ");
 
@@ -1504,6 +1506,20 @@ tzset P((void))
 	settzname();
 }
 
+/*
+** TZ can only have changed if the environment has changed since the
+** last call, so skip the getenv and compare most of the time.
+*/
+extern "C" void
+tzset P((void))
+{
+	cur_environ();
+	if (lcl_is_set != 0 && lcl_env_generation == env_generation)
+		return;
+	tzset_env();
+	lcl_env_generation = env_generation;
+}
+
 /*
 ** The easy way to behave "as if no library function calls" localtime
 ** is to not call it--so we drop its guts into "localsub", which can be
@@ -1539,10 +1555,18 @@ localsub (const time_t * const	timep,
 				break;
 			}
 	} else {
-		for (i = 1; i < sp->timecnt; ++i)
-			if (t < sp->ats[i])
-				break;
-		i = sp->types[i - 1];
+		register int	lo = 1;
+		register int	hi = sp->timecnt;
+
+		/* Find the first transition after t. */
+		while (lo < hi) {
+			register int	mid = (lo + hi) >> 1;
+
+			if (t < sp->ats[mid])
+				hi = mid;
+			else	lo = mid + 1;
+		}
+		i = sp->types[lo - 1];
 	}
 	ttisp = &sp->ttis[i];
 	/*
@@ -1712,6 +1736,25 @@ timesub(const time_t *timep, const long offset, const struct state *sp,
 	** representation.  This uses "... ??:59:60" et seq.
 	*/
 	tmp->tm_sec = (int) (rem % SECSPERMIN) + hit;
+	/*
+	** Consecutive calls usually fall on the same day, so remember the
+	** date part of the last result per thread.
+	*/
+	struct _winsup_t *	w = _reent_winsup();
+	if (w != NULL && w->_tm_day_valid && w->_tm_day == days) {
+		tmp->tm_year = w->_tm_date.tm_year;
+		tmp->tm_yday = w->_tm_date.tm_yday;
+		tmp->tm_mon = w->_tm_date.tm_mon;
+		tmp->tm_mday = w->_tm_date.tm_mday;
+		tmp->tm_wday = w->_tm_date.tm_wday;
+		tmp->tm_isdst = 0;
+#ifdef TM_GMTOFF
+		tmp->TM_GMTOFF = offset;
+#endif /* defined TM_GMTOFF */
+		return;
+	}
+	if (w != NULL)
+		w->_tm_day = days;
 	tmp->tm_wday = (int) ((EPOCH_WDAY + days) % DAYSPERWEEK);
 	if (tmp->tm_wday < 0)
 		tmp->tm_wday += DAYSPERWEEK;
@@ -1738,6 +1781,10 @@ timesub(const time_t *timep, const long offset, const struct state *sp,
 #ifdef TM_GMTOFF
 	tmp->TM_GMTOFF = offset;
 #endif /* defined TM_GMTOFF */
+	if (w != NULL) {
+		w->_tm_date = *tmp;
+		w->_tm_day_valid = TRUE;
+	}
 }
 
 extern "C" char *
@@ -38,39 +38,27 @@ static char rcsid[] = "$OpenBSD: mcount.c,v 1.6 1997/07/23 21:11:27 kstailey Exp
 #include <sys/param.h>
 #include <sys/types.h>
 #include <gmon.h>
+#include <windows.h>
 
 /*
- * mcount is called on entry to each function compiled with the profiling
- * switch set.  _mcount(), which is declared in a machine-dependent way
- * with _MCOUNT_DECL, does the actual work and is either inlined into a
- * C routine or called by an assembly stub.  In any case, this magic is
- * taken care of by the MCOUNT definition in <machine/profile.h>.
- *
- * _mcount updates data structures that represent traversals of the
- * program's call graph edges.  frompc and selfpc are the return
- * address and function address that represents the given call graph edge.
+ * Count COUNT traversals of the call graph edge from FROMPC to SELFPC
+ * in the shared tables.  Called with p->lock held, or while only one
+ * thread is running.  Returns -1 if there is no room for it.
  *
  * Note: the original BSD code used the same variable (frompcindex) for
  * both frompcindex and frompc.  Any reasonable, modern compiler will
  * perform this optimization.
  */
-//_MCOUNT_DECL __P((u_long frompc, u_long selfpc));
-_MCOUNT_DECL(frompc, selfpc)	/* _mcount; may be static, inline, etc */
+int
+_gmon_arc(p, frompc, selfpc, count)
+	register struct gmonparam *p;
 	register u_long frompc, selfpc;
+	long count;
 {
 	register u_short *frompcindex;
 	register struct tostruct *top, *prevtop;
-	register struct gmonparam *p;
 	register long toindex;
 
-	p = &_gmonparam;
-	/*
-	 * check that we are profiling
-	 * and that we aren't recursively invoked.
-	 */
-	if (p->state != GMON_PROF_ON)
-		return;
-	p->state = GMON_PROF_BUSY;
 	/*
 	 * check that frompcindex is a reasonable pc value.
 	 * for example:	signal catchers get called from the stack,
@@ -78,7 +66,7 @@ _MCOUNT_DECL(frompc, selfpc)	/* _mcount; may be static, inline, etc */
 	 */
 	frompc -= p->lowpc;
 	if (frompc > p->textsize)
-		goto done;
+		return 0;
 
 #if (HASHFRACTION & (HASHFRACTION - 1)) == 0
 	if (p->hashfraction == HASHFRACTION)
@@ -96,22 +84,22 @@ _MCOUNT_DECL(frompc, selfpc)	/* _mcount; may be static, inline, etc */
 		toindex = ++p->tos[0].link;
 		if (toindex >= p->tolimit)
 			/* halt further profiling */
-			goto overflow;
+			return -1;
 
 		*frompcindex = toindex;
 		top = &p->tos[toindex];
 		top->selfpc = selfpc;
-		top->count = 1;
+		top->count = count;
 		top->link = 0;
-		goto done;
+		return 0;
 	}
 	top = &p->tos[toindex];
 	if (top->selfpc == selfpc) {
 		/*
 		 * arc at front of chain; usual case.
 		 */
-		top->count++;
-		goto done;
+		top->count += count;
+		return 0;
 	}
 	/*
 	 * have to go looking down chain for it.
@@ -119,7 +107,7 @@ _MCOUNT_DECL(frompc, selfpc)	/* _mcount; may be static, inline, etc */
 	 * prevtop points to previous top.
 	 * we know it is not at the head of the chain.
 	 */
-	for (; /* goto done */; ) {
+	for (; /* return */; ) {
 		if (top->link == 0) {
 			/*
 			 * top is end of the chain and none of the chain
@@ -129,14 +117,14 @@ _MCOUNT_DECL(frompc, selfpc)	/* _mcount; may be static, inline, etc */
 			 */
 			toindex = ++p->tos[0].link;
 			if (toindex >= p->tolimit)
-				goto overflow;
+				return -1;
 
 			top = &p->tos[toindex];
 			top->selfpc = selfpc;
-			top->count = 1;
+			top->count = count;
 			top->link = *frompcindex;
 			*frompcindex = toindex;
-			goto done;
+			return 0;
 		}
 		/*
 		 * otherwise, check the next arc on the chain.
@@ -149,20 +137,82 @@ _MCOUNT_DECL(frompc, selfpc)	/* _mcount; may be static, inline, etc */
 			 * increment its count
 			 * move it to the head of the chain.
 			 */
-			top->count++;
+			top->count += count;
 			toindex = prevtop->link;
 			prevtop->link = top->link;
 			top->link = *frompcindex;
 			*frompcindex = toindex;
+			return 0;
+		}
+	}
+}
+
+#define	GMONBUF_HASH(frompc, selfpc) \
+	((((frompc) >> 2) ^ ((selfpc) >> 4)) & (GMONBUF_ARCS - 1))
+
+/*
+ * mcount is called on entry to each function compiled with the profiling
+ * switch set.  _mcount(), which is declared in a machine-dependent way
+ * with _MCOUNT_DECL, does the actual work and is either inlined into a
+ * C routine or called by an assembly stub.  In any case, this magic is
+ * taken care of by the MCOUNT definition in <machine/profile.h>.
+ *
+ * _mcount updates data structures that represent traversals of the
+ * program's call graph edges.  frompc and selfpc are the return
+ * address and function address that represents the given call graph edge.
+ * It counts them in the calling thread's gmonbuf, which only that
+ * thread writes to until it is merged.
+ */
+//_MCOUNT_DECL __P((u_long frompc, u_long selfpc));
+_MCOUNT_DECL(frompc, selfpc)	/* _mcount; may be static, inline, etc */
+	register u_long frompc, selfpc;
+{
+	register struct gmonparam *p;
+	register struct gmonbuf *b;
+	register struct rawarc *a;
+	register u_long h;
+
+	p = &_gmonparam;
+	/*
+	 * check that we are profiling
+	 * and that we aren't recursively invoked.
+	 */
+	if (p->state != GMON_PROF_ON)
+		return;
+	b = (struct gmonbuf *)TlsGetValue(p->tlsindex);
+	if (b == NULL && (b = _gmon_newbuf()) == NULL)
+		return;
+	if (InterlockedExchange(&b->state, GMON_PROF_BUSY) != GMON_PROF_ON)
+		return;
+	if (frompc - p->lowpc > p->textsize)
+		goto done;
+
+	h = GMONBUF_HASH(frompc, selfpc);
+	for (;;) {
+		a = &b->arcs[h];
+		if (a->raw_selfpc == selfpc && a->raw_frompc == frompc) {
+			a->raw_count++;
 			goto done;
 		}
+		if (a->raw_selfpc == 0)
+			break;
+		h = (h + 1) & (GMONBUF_ARCS - 1);
+	}
+	/*
+	 * first time this thread has traversed this arc since the
+	 * buffer was last merged.  keep the buffer no more than 3/4
+	 * full, so that probe sequences stay short.
+	 */
+	if (b->narcs >= GMONBUF_ARCS / 4 * 3) {
+		_gmon_flushbuf(b);
+		a = &b->arcs[GMONBUF_HASH(frompc, selfpc)];
 	}
+	a->raw_frompc = frompc;
+	a->raw_selfpc = selfpc;
+	a->raw_count = 1;
+	b->narcs++;
 done:
-	p->state = GMON_PROF_ON;
-	return;
-overflow:
-	p->state = GMON_PROF_ERROR;
-	return;
+	b->state = GMON_PROF_ON;
 }
 
 /*
@@ -27,10 +27,10 @@ details. */
 #define PGBITS		(sizeof (DWORD)*8)
 #define MAPSIZE(pages)	howmany ((pages), PGBITS)
 
-#define MAP_SET(n)	(map_map_[(n)/PGBITS] |= (1L << ((n) % PGBITS)))
-#define MAP_CLR(n)	(map_map_[(n)/PGBITS] &= ~(1L << ((n) % PGBITS)))
 #define MAP_ISSET(n)	(map_map_[(n)/PGBITS] & (1L << ((n) % PGBITS)))
 
+class list;
+
 /*
  * Simple class used to keep a record of all current
  * mmap areas in a process. Needed so that
@@ -48,6 +48,9 @@ class mmap_record
     DWORD size_to_map_;
     caddr_t base_address_;
     DWORD *map_map_;
+    DWORD free_pages_;
+    list *owner_;
+    int index_;
 
   public:
     mmap_record (int fd, HANDLE h, DWORD ac, _off64_t o, DWORD s, caddr_t b) :
@@ -58,7 +61,10 @@ class mmap_record
        offset_ (o),
        size_to_map_ (s),
        base_address_ (b),
-       map_map_ (NULL)
+       map_map_ (NULL),
+       free_pages_ (0),
+       owner_ (NULL),
+       index_ (-1)
       {
 	if (fd >= 0 && !cygheap->fdtab.not_open (fd))
 	  devtype_ = cygheap->fdtab[fd]->get_device ();
@@ -74,10 +80,18 @@ class mmap_record
     DWORD get_offset () const { return offset_; }
     DWORD get_size () const { return size_to_map_; }
     caddr_t get_address () const { return base_address_; }
+    caddr_t get_end () const
+      { return base_address_ + PAGE_CNT (size_to_map_) * getpagesize (); }
     DWORD *get_map () const { return map_map_; }
+    DWORD get_free () const { return free_pages_; }
+    list *get_owner () const { return owner_; }
+    int get_index () const { return index_; }
+    void set_owner (list *l, int i) { owner_ = l; index_ = i; }
     void alloc_map (_off64_t off, DWORD len);
     void free_map () { if (map_map_) cfree (map_map_); }
 
+    void set_map (DWORD off, DWORD len, BOOL set);
+    void note_free ();
     DWORD find_empty (DWORD pages);
     _off64_t map_map (_off64_t off, DWORD len);
     BOOL unmap_map (caddr_t addr, DWORD len);
@@ -88,24 +102,76 @@ class mmap_record
     void free_fh (fhandler_base *fh);
 };
 
+static inline DWORD
+bit_count (DWORD w)
+{
+  DWORD n = 0;
+  for (; w; w &= w - 1)
+    n++;
+  return n;
+}
+
+/* Set or clear `len' bits of the page bitmap starting at page `off',
+   a word at a time, and keep count of the free pages. */
+void
+mmap_record::set_map (DWORD off, DWORD len, BOOL set)
+{
+  while (len > 0)
+    {
+      DWORD bit = off % PGBITS;
+      DWORD cnt = PGBITS - bit < len ? PGBITS - bit : len;
+      DWORD mask = (cnt == PGBITS ? ~0UL : (1UL << cnt) - 1) << bit;
+      DWORD *word = map_map_ + off / PGBITS;
+      if (set)
+	{
+	  free_pages_ -= bit_count (mask & ~*word);
+	  *word |= mask;
+	}
+      else
+	{
+	  free_pages_ += bit_count (mask & *word);
+	  *word &= ~mask;
+	}
+      off += cnt;
+      len -= cnt;
+    }
+  note_free ();
+}
+
+/* Find the first run of `pages' free pages.  Whole words of used or
+   free pages are skipped at once, partial words by counting the low
+   zero (free) or one (used) bits. */
 DWORD
 mmap_record::find_empty (DWORD pages)
 {
   DWORD mapped_pages = PAGE_CNT (size_to_map_);
-  DWORD start;
+  DWORD start = 0, run = 0;
 
   if (pages > mapped_pages)
     return (DWORD)-1;
-  for (start = 0; start <= mapped_pages - pages; ++start)
-    if (!MAP_ISSET (start))
-      {
-	DWORD cnt;
-	for (cnt = 0; cnt < pages; ++cnt)
-	  if (MAP_ISSET (start + cnt))
-	    break;
-	if (cnt >= pages)
-	  return start;
-      }
+  for (DWORD n = 0; n < mapped_pages; )
+    {
+      DWORD bit = n % PGBITS;
+      DWORD word = map_map_[n / PGBITS] >> bit;
+      DWORD cnt;
+
+      if (word & 1)
+	{
+	  /* Skip the used pages. */
+	  cnt = ~word ? low_zeros (~word) : PGBITS - bit;
+	  run = 0;
+	}
+      else
+	{
+	  cnt = word ? low_zeros (word) : PGBITS - bit;
+	  if (!run)
+	    start = n;
+	  run += cnt;
+	  if (run >= pages)
+	    return start + pages <= mapped_pages ? start : (DWORD)-1;
+	}
+      n += cnt;
+    }
   return (DWORD)-1;
 }
 
@@ -115,6 +181,8 @@ mmap_record::alloc_map (_off64_t off, DWORD len)
   /* Allocate one bit per page */
   map_map_ = (DWORD *) ccalloc (HEAP_MMAP, MAPSIZE (PAGE_CNT (size_to_map_)),
 			        sizeof (DWORD));
+  free_pages_ = PAGE_CNT (size_to_map_);
+  note_free ();
   if (wincap.virtual_protect_works_on_shared_pages ())
     {
       DWORD old_prot;
@@ -130,10 +198,7 @@ mmap_record::alloc_map (_off64_t off, DWORD len)
 			      PAGE_NOACCESS, &old_prot))
 	syscall_printf ("VirtualProtect(%x,%D) failed: %E",
 			base_address_ + off + len, size_to_map_ - len - off);
-      off /= getpagesize ();
-      len /= getpagesize ();
-      while (len-- > 0)
-	MAP_SET (off + len);
+      set_map (off / getpagesize (), len / getpagesize (), TRUE);
     }
 }
 
@@ -171,8 +236,7 @@ mmap_record::map_map (_off64_t off, DWORD len)
       return (_off64_t)-1;
     }
 
-  while (len-- > 0)
-    MAP_SET (off + len);
+  set_map (off, len, TRUE);
   return off * getpagesize ();
 }
 
@@ -188,8 +252,7 @@ mmap_record::unmap_map (caddr_t addr, DWORD len)
 			  len * getpagesize (), PAGE_NOACCESS, &old_prot))
     syscall_printf ("-1 = unmap_map (): %E");
 
-  for (; len-- > 0; ++off)
-    MAP_CLR (off);
+  set_map (off, len, FALSE);
   /* Return TRUE if all pages are free'd which may result in unmapping
      the whole chunk. */
   for (len = MAPSIZE (PAGE_CNT (size_to_map_)); len > 0; )
@@ -258,33 +321,49 @@ mmap_record::free_fh (fhandler_base *fh)
     cfree (fh);
 }
 
+/* `free_recs' has a bit set for each record with free pages, so that
+   finding room for an anonymous mapping in the chunk of an earlier one
+   skips the records which are full. */
 class list {
 public:
-  mmap_record *recs;
+  mmap_record **recs;
+  DWORD *free_recs;
   int nrecs, maxrecs;
   int fd;
   DWORD hash;
+  list *next;			/* Next list in the same hash bucket. */
   list ();
   ~list ();
   mmap_record *add_record (mmap_record r, _off64_t off, DWORD len);
-  void erase (int i);
-  void erase ();
+  void erase (mmap_record *rec);
+  void set_free (int i, BOOL has_free);
   mmap_record *match (_off64_t off, DWORD len);
-  long match (caddr_t addr, DWORD len, caddr_t &m_addr, DWORD &m_len,
-	      long start);
 };
 
+void
+mmap_record::note_free ()
+{
+  if (owner_)
+    owner_->set_free (index_, free_pages_ != 0);
+}
+
 list::list ()
-: nrecs (0), maxrecs (10), fd (0), hash (0)
+: nrecs (0), maxrecs (PGBITS), fd (0), hash (0), next (NULL)
 {
-  recs = (mmap_record *) cmalloc (HEAP_MMAP, 10 * sizeof (mmap_record));
+  recs = (mmap_record **) cmalloc (HEAP_MMAP,
+				   PGBITS * sizeof (mmap_record *));
+  free_recs = (DWORD *) ccalloc (HEAP_MMAP, 1, sizeof (DWORD));
 }
 
 list::~list ()
 {
-  for (mmap_record *rec = recs; nrecs-- > 0; ++rec)
-    rec->free_map ();
+  for (mmap_record **rec = recs; nrecs-- > 0; ++rec)
+    {
+      (*rec)->free_map ();
+      cfree (*rec);
+    }
   cfree (recs);
+  cfree (free_recs);
 }
 
 mmap_record *
@@ -292,12 +371,38 @@ list::add_record (mmap_record r, _off64_t off, DWORD len)
 {
   if (nrecs == maxrecs)
     {
-      maxrecs += 5;
-      recs = (mmap_record *) crealloc (recs, maxrecs * sizeof (mmap_record));
+      mmap_record **new_recs;
+      DWORD *new_free;
+      new_recs = (mmap_record **) crealloc (recs, (maxrecs + PGBITS)
+						  * sizeof (mmap_record *));
+      if (!new_recs)
+	return NULL;
+      recs = new_recs;
+      new_free = (DWORD *) crealloc (free_recs, MAPSIZE (maxrecs + PGBITS)
+						* sizeof (DWORD));
+      if (!new_free)
+	return NULL;
+      free_recs = new_free;
+      free_recs[MAPSIZE (maxrecs)] = 0;
+      maxrecs += PGBITS;
     }
-  recs[nrecs] = r;
-  recs[nrecs].alloc_map (off, len);
-  return recs + nrecs++;
+  mmap_record *rec = (mmap_record *) cmalloc (HEAP_MMAP, sizeof (mmap_record));
+  if (!rec)
+    return NULL;
+  *rec = r;
+  rec->set_owner (this, nrecs);
+  rec->alloc_map (off, len);
+  recs[nrecs++] = rec;
+  return rec;
+}
+
+void
+list::set_free (int i, BOOL has_free)
+{
+  if (has_free)
+    free_recs[i / PGBITS] |= 1UL << (i % PGBITS);
+  else
+    free_recs[i / PGBITS] &= ~(1UL << (i % PGBITS));
 }
 
 /* Used in mmap() */
@@ -307,95 +412,89 @@ list::match (_off64_t off, DWORD len)
   if (fd == -1 && !off)
     {
       len = PAGE_CNT (len);
-      for (int i = 0; i < nrecs; ++i)
-	if (recs[i].find_empty (len) != (DWORD)-1)
-	  return recs + i;
+      for (int w = 0; w < MAPSIZE (nrecs); ++w)
+	for (DWORD bits = free_recs[w]; bits; bits &= bits - 1)
+	  {
+	    mmap_record *rec = recs[w * PGBITS + low_zeros (bits)];
+	    if (rec->get_free () >= len && rec->find_empty (len) != (DWORD)-1)
+	      return rec;
+	  }
     }
   else
     {
       for (int i = 0; i < nrecs; ++i)
-	if (off >= recs[i].get_offset ()
-	    && off + len <= recs[i].get_offset ()
-			 + (PAGE_CNT (recs[i].get_size ()) * getpagesize ()))
-	  return recs + i;
+	if (off >= recs[i]->get_offset ()
+	    && off + len <= recs[i]->get_offset ()
+			 + (PAGE_CNT (recs[i]->get_size ()) * getpagesize ()))
+	  return recs[i];
     }
   return NULL;
 }
 
-/* Used in munmap() */
-long
-list::match (caddr_t addr, DWORD len, caddr_t &m_addr, DWORD &m_len,
-	     _off_t start)
+/* The order of the records in a list doesn't matter, so the last one
+   simply takes the place of the erased one. */
+void
+list::erase (mmap_record *rec)
 {
-  caddr_t low, high;
-
-  for (int i = start + 1; i < nrecs; ++i)
+  int i = rec->get_index ();
+  rec->free_map ();
+  cfree (rec);
+  set_free (--nrecs, FALSE);
+  if (i < nrecs)
     {
-      low = (addr >= recs[i].get_address ()) ? addr : recs[i].get_address ();
-      high = recs[i].get_address ()
-	     + (PAGE_CNT (recs[i].get_size ()) * getpagesize ());
-      high = (addr + len < high) ? addr + len : high;
-      if (low < high)
-	{
-	  m_addr = low;
-	  m_len = high - low;
-	  return i;
-	}
+      recs[i] = recs[nrecs];
+      recs[i]->set_owner (this, i);
+      recs[i]->note_free ();
     }
-  return -1;
 }
 
-void
-list::erase (int i)
-{
-  recs[i].free_map ();
-  for (; i < nrecs-1; i++)
-    recs[i] = recs[i+1];
-  nrecs--;
-}
+/* Lists are hashed by the identity of the mapped file.  All anonymous
+   mappings share the one list with fd == -1.  Independently of that,
+   `addrs' holds all records of all lists ordered by address.  Views
+   never overlap, so the records intersecting any address range are
+   found by a binary search followed by a short walk. */
 
-void
-list::erase ()
-{
-  erase (nrecs-1);
-}
+#define MAP_HASH_SIZE	64	/* Must be a power of 2. */
 
 class map {
 public:
-  list **lists;
-  int nlists, maxlists;
+  list *buckets[MAP_HASH_SIZE];
+  mmap_record **addrs;
+  int naddrs, maxaddrs;
   map ();
   ~map ();
+  static DWORD bucket (DWORD hash) { return hash & (MAP_HASH_SIZE - 1); }
   list *get_list_by_fd (int fd);
   list *add_list (list *l, int fd);
-  void erase (int i);
+  void erase (list *l);
+  int first_addr (caddr_t addr);
+  BOOL add_addr (mmap_record *rec);
+  void erase_addr (int i);
 };
 
 map::map ()
 {
-  lists = (list **) cmalloc (HEAP_MMAP, 10 * sizeof (list *));
-  nlists = 0;
-  maxlists = 10;
+  memset (buckets, 0, sizeof buckets);
+  addrs = (mmap_record **) cmalloc (HEAP_MMAP, 10 * sizeof (mmap_record *));
+  naddrs = 0;
+  maxaddrs = 10;
 }
 
 map::~map ()
 {
-  cfree (lists);
+  cfree (addrs);
 }
 
 list *
 map::get_list_by_fd (int fd)
 {
-  int i;
-  for (i=0; i<nlists; i++)
-#if 0 /* The fd isn't sufficient since it could already be another file. */
-    if (lists[i]->fd == fd
-#else /* so we use the name hash value to identify the file unless
-	 it's not an anonymous mapping. */
-    if ((fd == -1 && lists[i]->fd == -1)
-	|| (fd != -1 && lists[i]->hash == cygheap->fdtab[fd]->get_namehash ()))
-#endif
-      return lists[i];
+  /* The fd isn't sufficient since it could already be another file,
+     so we use the name hash value to identify the file unless it's
+     an anonymous mapping. */
+  DWORD hash = fd == -1 ? 0 : cygheap->fdtab[fd]->get_namehash ();
+  for (list *l = buckets[bucket (hash)]; l; l = l->next)
+    if (fd == -1 ? l->fd == -1 : (l->fd != -1 && l->hash == hash))
+      return l;
   return 0;
 }
 
@@ -405,29 +504,72 @@ map::add_list (list *l, int fd)
   l->fd = fd;
   if (fd != -1)
     l->hash = cygheap->fdtab[fd]->get_namehash ();
-  if (nlists == maxlists)
+  DWORD b = bucket (l->hash);
+  l->next = buckets[b];
+  buckets[b] = l;
+  return l;
+}
+
+void
+map::erase (list *l)
+{
+  for (list **lp = buckets + bucket (l->hash); *lp; lp = &(*lp)->next)
+    if (*lp == l)
+      {
+	*lp = l->next;
+	break;
+      }
+}
+
+/* Index of the first record ending above `addr'. */
+int
+map::first_addr (caddr_t addr)
+{
+  int lo = 0, hi = naddrs;
+  while (lo < hi)
     {
-      maxlists += 5;
-      lists = (list **) crealloc (lists, maxlists * sizeof (list *));
+      int mid = (lo + hi) / 2;
+      if (addrs[mid]->get_end () <= addr)
+	lo = mid + 1;
+      else
+	hi = mid;
     }
-  lists[nlists++] = l;
-  return lists[nlists-1];
+  return lo;
+}
+
+BOOL
+map::add_addr (mmap_record *rec)
+{
+  if (naddrs == maxaddrs)
+    {
+      mmap_record **new_addrs;
+      new_addrs = (mmap_record **) crealloc (addrs, 2 * maxaddrs
+						    * sizeof (mmap_record *));
+      if (!new_addrs)
+	return FALSE;
+      addrs = new_addrs;
+      maxaddrs *= 2;
+    }
+  int i = first_addr (rec->get_address ());
+  memmove (addrs + i + 1, addrs + i, (naddrs - i) * sizeof (mmap_record *));
+  addrs[i] = rec;
+  naddrs++;
+  return TRUE;
 }
 
 void
-map::erase (int i)
+map::erase_addr (int i)
 {
-  for (; i < nlists-1; i++)
-    lists[i] = lists[i+1];
-  nlists--;
+  memmove (addrs + i, addrs + i + 1, (naddrs - i - 1) * sizeof (mmap_record *));
+  naddrs--;
 }
 
 /*
  * Code to keep a record of all mmap'ed areas in a process.
  * Needed to duplicate tham in a child of fork().
- * mmap_record classes are kept in an STL list in an STL map, keyed
- * by file descriptor. This is *NOT* duplicated across a fork(), it
- * needs to be specially handled by the fork code.
+ * mmap_record classes are kept in lists hashed by file identity and
+ * in an index ordered by address. This is *NOT* duplicated across a
+ * fork(), it needs to be specially handled by the fork code.
  */
 
 static map *mmapped_areas;
@@ -599,8 +741,23 @@ mmap64 (caddr_t addr, size_t len, int prot, int flags, int fd, _off64_t off)
       map_list = mmapped_areas->add_list (map_list, fd);
   }
 
-  /* Insert into the list */
+  /* Insert into the list and the address index */
   mmap_record *rec = map_list->add_record (mmap_rec, off, len > gran_len ? gran_len : len);
+  if (!rec || !mmapped_areas->add_addr (rec))
+    {
+      if (rec)
+	map_list->erase (rec);
+      if (!map_list->nrecs)
+	{
+	  mmapped_areas->erase (map_list);
+	  delete map_list;
+	}
+      fh->munmap (h, base, gran_len);
+      set_errno (ENOMEM);
+      syscall_printf ("-1 = mmap(): ENOMEM");
+      ReleaseResourceLock (LOCK_MMAP_LIST, READ_LOCK | WRITE_LOCK, "mmap");
+      return MAP_FAILED;
+    }
   caddr_t ret = rec->get_address () + (off - gran_off);
   syscall_printf ("%x = mmap() succeeded", ret);
   ReleaseResourceLock (LOCK_MMAP_LIST, READ_LOCK | WRITE_LOCK, "mmap");
@@ -637,31 +794,38 @@ munmap (caddr_t addr, size_t len)
       return 0;
     }
 
-  /* Iterate through the map, unmap pages between addr and addr+len
-     in all maps. */
+  /* Walk the address index, unmap pages between addr and addr+len
+     in all records intersecting that range. */
 
-  for (int it = 0; it < mmapped_areas->nlists; ++it)
+  int i = mmapped_areas->first_addr (addr);
+  while (i < mmapped_areas->naddrs)
     {
-      list *map_list = mmapped_areas->lists[it];
-      if (map_list)
+      mmap_record *rec = mmapped_areas->addrs[i];
+      if (rec->get_address () >= addr + len)
+	break;
+
+      caddr_t u_addr = addr >= rec->get_address () ? addr
+						   : rec->get_address ();
+      caddr_t u_end = addr + len < rec->get_end () ? addr + len
+						  : rec->get_end ();
+      if (!rec->unmap_map (u_addr, u_end - u_addr))
 	{
-	  long li = -1;
-	  caddr_t u_addr;
-	  DWORD u_len;
+	  ++i;
+	  continue;
+	}
 
-	  while ((li = map_list->match(addr, len, u_addr, u_len, li)) >= 0)
-	    {
-	      mmap_record *rec = map_list->recs + li;
-	      if (rec->unmap_map (u_addr, u_len))
-		{
-		  fhandler_base *fh = rec->alloc_fh ();
-		  fh->munmap (rec->get_handle (), addr, len);
-		  rec->free_fh (fh);
-
-		  /* Delete the entry. */
-		  map_list->erase (li);
-		}
-	    }
+      fhandler_base *fh = rec->alloc_fh ();
+      fh->munmap (rec->get_handle (), rec->get_address (), rec->get_size ());
+      rec->free_fh (fh);
+
+      /* Delete the entry, and the list if it's the last one. */
+      list *map_list = rec->get_owner ();
+      mmapped_areas->erase_addr (i);
+      map_list->erase (rec);
+      if (!map_list->nrecs)
+	{
+	  mmapped_areas->erase (map_list);
+	  delete map_list;
 	}
     }
 
@@ -697,37 +861,33 @@ msync (caddr_t addr, size_t len, int flags)
       return -1;
     }
 
-  /* Iterate through the map, looking for the mmapped area.
+  /* Look up the mmapped area in the address index.
      Error if not found. */
 
-  for (int it = 0; it < mmapped_areas->nlists; ++it)
+  int i = mmapped_areas->first_addr (addr);
+  if (i < mmapped_areas->naddrs)
     {
-      list *map_list = mmapped_areas->lists[it];
-      if (map_list != 0)
+      mmap_record *rec = mmapped_areas->addrs[i];
+      if (rec->access (addr))
 	{
-	  for (int li = 0; li < map_list->nrecs; ++li)
-	    {
-	      mmap_record *rec = map_list->recs + li;
-	      if (rec->access (addr))
-		{
-		  /* Check whole area given by len. */
-		  for (DWORD i = getpagesize (); i < len; ++i)
-		    if (!rec->access (addr + i))
-		      goto invalid_address_range;
-		  fhandler_base *fh = rec->alloc_fh ();
-		  int ret = fh->msync (rec->get_handle (), addr, len, flags);
-		  rec->free_fh (fh);
-
-		  if (ret)
-		    syscall_printf ("%d = msync(): %E", ret);
-		  else
-		    syscall_printf ("0 = msync()");
-
-		  ReleaseResourceLock (LOCK_MMAP_LIST, WRITE_LOCK | READ_LOCK,
-				       "msync");
-		  return 0;
-		}
-	    }
+	  /* Check whole area given by len. */
+	  for (DWORD off = getpagesize (); off < len; off += getpagesize ())
+	    if (!rec->access (addr + off))
+	      goto invalid_address_range;
+	  if (len && !rec->access (addr + len - 1))
+	    goto invalid_address_range;
+	  fhandler_base *fh = rec->alloc_fh ();
+	  int ret = fh->msync (rec->get_handle (), addr, len, flags);
+	  rec->free_fh (fh);
+
+	  if (ret)
+	    syscall_printf ("%d = msync(): %E", ret);
+	  else
+	    syscall_printf ("0 = msync()");
+
+	  ReleaseResourceLock (LOCK_MMAP_LIST, WRITE_LOCK | READ_LOCK,
+			       "msync");
+	  return 0;
 	}
     }
 
@@ -955,6 +1115,71 @@ mprotect (caddr_t addr, size_t len, int prot)
   return 0;
 }
 
+/* Describe the mmapped areas for /proc/<pid>/maps, one line each of
+   "address size access offset name", in address order.  access is r,
+   w or c for copy-on-write; name is empty for an anonymous area or
+   one whose file has since been closed.  The records are copied out
+   first so that the fd list isn't locked with the mmap list held.
+   Returns a malloc'd buffer, setting n to its length. */
+char * __stdcall
+mmap_list (size_t &n)
+{
+  struct area
+  {
+    caddr_t addr;
+    DWORD size;
+    DWORD access;
+    _off64_t offset;
+    int fd;
+    DWORD hash;
+  } *areas = NULL;
+  int nareas = 0;
+
+  n = 0;
+  SetResourceLock (LOCK_MMAP_LIST, READ_LOCK, "mmap_list");
+  if (mmapped_areas && mmapped_areas->naddrs
+      && (areas = (area *) malloc (mmapped_areas->naddrs * sizeof *areas)))
+    for (; nareas < mmapped_areas->naddrs; nareas++)
+      {
+	mmap_record *rec = mmapped_areas->addrs[nareas];
+	areas[nareas].addr = rec->get_address ();
+	areas[nareas].size = rec->get_size ();
+	areas[nareas].access = rec->get_access ();
+	areas[nareas].offset = rec->get_offset ();
+	areas[nareas].fd = rec->get_fd ();
+	areas[nareas].hash = rec->get_owner ()->hash;
+      }
+  ReleaseResourceLock (LOCK_MMAP_LIST, READ_LOCK, "mmap_list");
+
+  char *buf = NULL;
+  size_t len = 0;
+  SetResourceLock (LOCK_FD_LIST, READ_LOCK, "mmap_list");
+  for (area *a = areas; a < areas + nareas; a++)
+    {
+      const char *name = NULL;
+      if (!cygheap->fdtab.not_open (a->fd)
+	  && cygheap->fdtab[a->fd]->get_namehash () == a->hash)
+	name = cygheap->fdtab[a->fd]->get_name ();
+      if (!name)
+	name = "";
+      size_t need = n + 48 + strlen (name) + 1;
+      if (need > len)
+	{
+	  char *newbuf = (char *) realloc (buf, len = 2 * need);
+	  if (!newbuf)
+	    break;
+	  buf = newbuf;
+	}
+      n += __small_sprintf (buf + n, "%x %x %c %X %s\n", a->addr, a->size,
+			    a->access == FILE_MAP_COPY ? 'c'
+			    : a->access == FILE_MAP_WRITE ? 'w' : 'r',
+			    a->offset, name);
+    }
+  ReleaseResourceLock (LOCK_FD_LIST, READ_LOCK, "mmap_list");
+  free (areas);
+  return buf;
+}
+
 /*
  * Call to re-create all the file mappings in a forked
  * child. Called from the child in initialization. At this
@@ -974,96 +1199,88 @@ fixup_mmaps_after_fork (HANDLE parent)
   if (mmapped_areas == NULL)
     return 0;
 
-  /* Iterate through the map */
-  for (int it = 0; it < mmapped_areas->nlists; ++it)
+  /* Iterate through the address index */
+  for (int i = 0; i < mmapped_areas->naddrs; ++i)
     {
-      list *map_list = mmapped_areas->lists[it];
-      if (map_list)
+      mmap_record *rec = mmapped_areas->addrs[i];
+
+      debug_printf ("fd %d, h %x, access %x, offset %D, size %u, address %p",
+	  rec->get_fd (), rec->get_handle (), rec->get_access (),
+	  rec->get_offset (), rec->get_size (), rec->get_address ());
+
+      fhandler_base *fh = rec->alloc_fh ();
+      BOOL ret = fh->fixup_mmap_after_fork (rec->get_handle (),
+					    rec->get_access (),
+					    rec->get_offset (),
+					    rec->get_size (),
+					    rec->get_address ());
+      rec->free_fh (fh);
+
+      if (!ret)
+	return -1;
+      if (rec->get_access () == FILE_MAP_COPY)
 	{
-	  int li;
-	  for (li = 0; li < map_list->nrecs; ++li)
-	    {
-	      mmap_record *rec = map_list->recs + li;
-
-	      debug_printf ("fd %d, h %x, access %x, offset %D, size %u, address %p",
-		  rec->get_fd (), rec->get_handle (), rec->get_access (),
-		  rec->get_offset (), rec->get_size (), rec->get_address ());
-
-	      fhandler_base *fh = rec->alloc_fh ();
-	      BOOL ret = fh->fixup_mmap_after_fork (rec->get_handle (),
-						    rec->get_access (),
-						    rec->get_offset (),
-						    rec->get_size (),
-						    rec->get_address ());
-	      rec->free_fh (fh);
-
-	      if (!ret)
-		return -1;
-	      if (rec->get_access () == FILE_MAP_COPY)
-		{
-		  for (char *address = rec->get_address ();
-		       address < rec->get_address () + rec->get_size ();
-		       address += getpagesize ())
-		    if (rec->access (address)
-			&& !ReadProcessMemory (parent, address, address,
-					       getpagesize (), NULL))
+	  for (char *address = rec->get_address ();
+	       address < rec->get_address () + rec->get_size ();
+	       address += getpagesize ())
+	    if (rec->access (address)
+		&& !ReadProcessMemory (parent, address, address,
+				       getpagesize (), NULL))
+	      {
+		DWORD old_prot;
+		DWORD last_error = GetLastError ();
+
+		if (last_error != ERROR_PARTIAL_COPY
+		    && last_error != ERROR_NOACCESS
+		    || !wincap.virtual_protect_works_on_shared_pages ())
+		  {
+		    system_printf ("ReadProcessMemory failed for "
+				   "MAP_PRIVATE address %p, %E",
+				   rec->get_address ());
+		    return -1;
+		  }
+		if (!VirtualProtectEx (parent,
+				       address, getpagesize (),
+				       PAGE_READONLY, &old_prot))
+		  {
+		    system_printf ("VirtualProtectEx failed for "
+				   "MAP_PRIVATE address %p, %E",
+				   rec->get_address ());
+		    return -1;
+		  }
+		else
+		  {
+		    BOOL ret;
+		    DWORD dummy_prot;
+
+		    ret = ReadProcessMemory (parent, address, address,
+					     getpagesize (), NULL);
+		    if (!VirtualProtectEx(parent,
+					  address, getpagesize (),
+					  old_prot, &dummy_prot))
+		      system_printf ("WARNING: VirtualProtectEx to "
+				     "return to previous state "
+				     "in parent failed for "
+				     "MAP_PRIVATE address %p, %E",
+				     rec->get_address ());
+		    if (!VirtualProtect (address, getpagesize (),
+					 old_prot, &dummy_prot))
+		      system_printf ("WARNING: VirtualProtect to copy "
+				     "protection to child failed for"
+				     "MAP_PRIVATE address %p, %E",
+				     rec->get_address ());
+		    if (!ret)
 		      {
-			DWORD old_prot;
-			DWORD last_error = GetLastError ();
-
-			if (last_error != ERROR_PARTIAL_COPY
-			    && last_error != ERROR_NOACCESS
-			    || !wincap.virtual_protect_works_on_shared_pages ())
-			  {
-			    system_printf ("ReadProcessMemory failed for "
-					   "MAP_PRIVATE address %p, %E",
-					   rec->get_address ());
-			    return -1;
-			  }
-			if (!VirtualProtectEx (parent,
-					       address, getpagesize (),
-					       PAGE_READONLY, &old_prot))
-			  {
-			    system_printf ("VirtualProtectEx failed for "
-					   "MAP_PRIVATE address %p, %E",
-					   rec->get_address ());
-			    return -1;
-			  }
-			else
-			  {
-			    BOOL ret;
-			    DWORD dummy_prot;
-
-			    ret = ReadProcessMemory (parent, address, address,
-						     getpagesize (), NULL);
-			    if (!VirtualProtectEx(parent,
-						  address, getpagesize (),
-						  old_prot, &dummy_prot))
-			      system_printf ("WARNING: VirtualProtectEx to "
-					     "return to previous state "
-					     "in parent failed for "
-					     "MAP_PRIVATE address %p, %E",
-					     rec->get_address ());
-			    if (!VirtualProtect (address, getpagesize (),
-						 old_prot, &dummy_prot))
-			      system_printf ("WARNING: VirtualProtect to copy "
-					     "protection to child failed for"
-					     "MAP_PRIVATE address %p, %E",
-					     rec->get_address ());
-			    if (!ret)
-			      {
-				system_printf ("ReadProcessMemory (2nd try) "
-					       "failed for "
-					       "MAP_PRIVATE address %p, %E",
-					       rec->get_address ());
-				return -1;
-			      }
-			  }
+			system_printf ("ReadProcessMemory (2nd try) "
+				       "failed for "
+				       "MAP_PRIVATE address %p, %E",
+				       rec->get_address ());
+			return -1;
 		      }
-		}
-	      rec->fixup_map ();
-	    }
+		  }
+	      }
 	}
+      rec->fixup_map ();
     }
 
   debug_printf ("succeeded");
@@ -1,6 +1,6 @@
 /* msg.cc: Single unix specification IPC interface for Cygwin.
 
-   Copyright 2002 Red Hat, Inc.
+   Copyright 2002, 2003 Red Hat, Inc.
 
    Written by Conrad Scott <conrad.scott@dsl.pipex.com>.
 
@@ -18,6 +18,752 @@ details. */
 
 #include "cygerrno.h"
 
+#ifdef USE_SERVER
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "safe_memory.h"
+#include "sigproc.h"
+
+#include "cygserver_ipc.h"
+#include "cygserver_msg.h"
+
+/*---------------------------------------------------------------------------*
+ * class client_msgmgr
+ *
+ * A singleton class.
+ *
+ * msgsnd (2) and msgrcv (2) are performed on the queue's mapping,
+ * which is attached on first use.  Only a sender finding the queue
+ * full or a receiver finding no suitable message ever waits, and then
+ * on an event of its own that is set by the next process to receive
+ * or send a message respectively.
+ *---------------------------------------------------------------------------*/
+
+#define msgmgr (client_msgmgr::instance ())
+
+class client_msgmgr
+{
+private:
+  class queue_t
+  {
+  public:
+    const int msqid;
+    const HANDLE hFileMap;
+    msgq_shared_t *const shared;
+    long refcnt;		// The list holds one reference.
+
+    queue_t *next;
+
+    queue_t (const int msqid, const HANDLE hFileMap,
+	     msgq_shared_t *const shared)
+      : msqid (msqid), hFileMap (hFileMap), shared (shared),
+	refcnt (1), next (NULL)
+    {}
+  };
+
+public:
+  static client_msgmgr & instance ();
+
+  int msgctl (int msqid, int cmd, struct msqid_ds *);
+  int msgget (key_t, int msgflg);
+  ssize_t msgrcv (int msqid, void *, size_t, long msgtyp, int msgflg);
+  int msgsnd (int msqid, const void *, size_t, int msgflg);
+
+private:
+  static NO_COPY client_msgmgr *_instance;
+
+  CRITICAL_SECTION _queues_lock;
+  static NO_COPY queue_t *_queues_head; // List of attached queues.
+
+  client_msgmgr ();
+  ~client_msgmgr ();
+
+  // Undefined (as this class is a singleton):
+  client_msgmgr (const client_msgmgr &);
+  client_msgmgr & operator= (const client_msgmgr &);
+
+  queue_t *attach (int msqid);
+  void release (queue_t *);
+  void forget (int msqid);
+};
+
+/* static */ NO_COPY client_msgmgr *client_msgmgr::_instance;
+
+/* The list of attached queues is not inherited by child processes
+ * since the mapping handles are not inheritable.  The child attaches
+ * on first use.
+ */
+/* static */ NO_COPY client_msgmgr::queue_t *client_msgmgr::_queues_head;
+
+/*---------------------------------------------------------------------------*
+ * wake_waiters ()
+ *
+ * Called with the queue's lock held.
+ *---------------------------------------------------------------------------*/
+
+static void
+wake_waiters (msgq_shared_t *const shared, const int what)
+{
+  for (int w = 0; w < IPC_WAITERS; w++)
+    if (shared->waiters[w].winpid && shared->waiters[w].what == what)
+      ipc_wake (shared->waiters[w]);
+}
+
+/*---------------------------------------------------------------------------*
+ * client_msgmgr::instance ()
+ *---------------------------------------------------------------------------*/
+
+client_msgmgr &
+client_msgmgr::instance ()
+{
+  if (!_instance)
+    _instance = safe_new0 (client_msgmgr);
+
+  assert (_instance);
+
+  return *_instance;
+}
+
+/*---------------------------------------------------------------------------*
+ * client_msgmgr::msgctl ()
+ *---------------------------------------------------------------------------*/
+
+int
+client_msgmgr::msgctl (const int msqid,
+		       const int cmd,
+		       struct msqid_ds *const buf)
+{
+  syscall_printf ("msgctl (msqid = %d, cmd = 0x%x, buf = %p)",
+		  msqid, cmd, buf);
+
+  // Check parameters and set up in parameters as required.
+
+  const struct msqid_ds *in_buf = NULL;
+
+  switch (cmd)
+    {
+    case IPC_SET:
+      if (__check_invalid_read_ptr_errno (buf, sizeof (struct msqid_ds)))
+	{
+	  syscall_printf (("-1 [EFAULT] = "
+			   "msgctl (msqid = %d, cmd = 0x%x, buf = %p)"),
+			  msqid, cmd, buf);
+	  set_errno (EFAULT);
+	  return -1;
+	}
+      in_buf = buf;
+      break;
+
+    case IPC_STAT:
+    case MSG_STAT:
+      if (__check_null_invalid_struct_errno (buf, sizeof (struct msqid_ds)))
+	{
+	  syscall_printf (("-1 [EFAULT] = "
+			   "msgctl (msqid = %d, cmd = 0x%x, buf = %p)"),
+			  msqid, cmd, buf);
+	  set_errno (EFAULT);
+	  return -1;
+	}
+      break;
+
+    case IPC_INFO:
+      if (__check_null_invalid_struct_errno (buf, sizeof (struct msginfo)))
+	{
+	  syscall_printf (("-1 [EFAULT] = "
+			   "msgctl (msqid = %d, cmd = 0x%x, buf = %p)"),
+			  msqid, cmd, buf);
+	  set_errno (EFAULT);
+	  return -1;
+	}
+      break;
+
+    case MSG_INFO:
+      if (__check_null_invalid_struct_errno (buf, sizeof (struct msg_info)))
+	{
+	  syscall_printf (("-1 [EFAULT] = "
+			   "msgctl (msqid = %d, cmd = 0x%x, buf = %p)"),
+			  msqid, cmd, buf);
+	  set_errno (EFAULT);
+	  return -1;
+	}
+      break;
+    }
+
+  // Create and issue the command.
+
+  client_request_msg request (msqid, cmd, in_buf);
+
+  if (request.make_request () == -1 || request.error_code ())
+    {
+      syscall_printf (("-1 [%d] = "
+		       "msgctl (msqid = %d, cmd = 0x%x, buf = %p)"),
+		      request.error_code (), msqid, cmd, buf);
+      set_errno (request.error_code ());
+      return -1;
+    }
+
+  // Some commands require special processing for their out parameters.
+
+  int result = 0;
+
+  switch (cmd)
+    {
+    case IPC_STAT:
+      *buf = request.ds ();
+      break;
+
+    case IPC_RMID:
+      forget (msqid);
+      break;
+
+    case IPC_INFO:
+      *(struct msginfo *) buf = request.msginfo ();
+      break;
+
+    case MSG_STAT:		// ipcs(8) i'face.
+      result = request.msqid ();
+      *buf = request.ds ();
+      break;
+
+    case MSG_INFO:		// ipcs(8) i'face.
+      result = request.msqid ();
+      *(struct msg_info *) buf = request.msg_info ();
+      break;
+    }
+
+  syscall_printf ("%d = msgctl (msqid = %d, cmd = 0x%x, buf = %p)",
+		  result, msqid, cmd, buf);
+
+  return result;
+}
+
+/*---------------------------------------------------------------------------*
+ * client_msgmgr::msgget ()
+ *---------------------------------------------------------------------------*/
+
+int
+client_msgmgr::msgget (const key_t key, const int msgflg)
+{
+  syscall_printf ("msgget (key = 0x%016X, msgflg = 0%o)", key, msgflg);
+
+  client_request_msg request (key, msgflg);
+
+  if (request.make_request () == -1 || request.error_code ())
+    {
+      syscall_printf ("-1 [%d] = msgget (key = 0x%016X, msgflg = 0%o)",
+		      request.error_code (), key, msgflg);
+      set_errno (request.error_code ());
+      return -1;
+    }
+
+  syscall_printf ("%d = msgget (key = 0x%016X, msgflg = 0%o)",
+		  request.msqid (), key, msgflg);
+
+  return request.msqid ();
+}
+
+/*---------------------------------------------------------------------------*
+ * client_msgmgr::msgrcv ()
+ *---------------------------------------------------------------------------*/
+
+ssize_t
+client_msgmgr::msgrcv (const int msqid, void *const msgp,
+		       const size_t msgsz, const long msgtyp,
+		       const int msgflg)
+{
+  syscall_printf (("msgrcv (msqid = %d, msgp = %p, msgsz = %u, "
+		   "msgtyp = %d, msgflg = 0%o)"),
+		  msqid, msgp, msgsz, msgtyp, msgflg);
+
+  int result = 0;
+
+  if ((ssize_t) msgsz < 0)
+    result = EINVAL;
+  else if (__check_null_invalid_struct_errno (msgp, sizeof (long) + msgsz))
+    result = EFAULT;
+
+  if (result)
+    {
+      syscall_printf (("-1 [%d] = msgrcv (msqid = %d, msgp = %p, "
+		       "msgsz = %u, msgtyp = %d, msgflg = 0%o)"),
+		      result, msqid, msgp, msgsz, msgtyp, msgflg);
+      set_errno (result);
+      return -1;
+    }
+
+  queue_t *const queueptr = attach (msqid);
+
+  if (!queueptr)
+    {
+      syscall_printf (("-1 [%d] = msgrcv (msqid = %d, msgp = %p, "
+		       "msgsz = %u, msgtyp = %d, msgflg = 0%o)"),
+		      get_errno (), msqid, msgp, msgsz, msgtyp, msgflg);
+      return -1;
+    }
+
+  msgq_shared_t *const shared = queueptr->shared;
+
+  // Nothing may fault while the queue's lock is held.
+  char text[MSGMAX];
+  long mtype = 0;
+  size_t len = 0;
+
+  ipc_lock_shared (shared->lock);
+
+  for (;;)
+    {
+      if (shared->deleted)
+	{
+	  result = EIDRM;
+	  break;
+	}
+
+      msgq_msg_t *found = NULL;
+
+      for (msgq_msg_t *msg = shared->first ();
+	   msg < shared->end ();
+	   msg = msg->next ())
+	if (!msgtyp || msg->mtype == msgtyp)
+	  {
+	    found = msg;
+	    break;
+	  }
+	else if (msgtyp < 0 && msg->mtype <= -msgtyp
+		 && (!found || msg->mtype < found->mtype))
+	  found = msg;
+
+      if (found)
+	{
+	  if (found->msize > msgsz && !(msgflg & MSG_NOERROR))
+	    {
+	      result = E2BIG;
+	      break;
+	    }
+
+	  const size_t msize = found->msize;
+
+	  mtype = found->mtype;
+	  len = msize < msgsz ? msize : msgsz;
+	  memcpy (text, found->text (), len);
+
+	  // Close the gap.
+	  char *const tail = (char *) found->next ();
+	  memmove (found, tail, (char *) shared->end () - tail);
+
+	  shared->used -= tail - (char *) found;
+	  shared->cbytes -= msize;
+	  shared->qnum -= 1;
+	  shared->lrpid = getpid ();
+	  shared->rtime = time (NULL);
+
+	  wake_waiters (shared, MSG_WAITSEND);
+	  break;
+	}
+
+      if (msgflg & IPC_NOWAIT)
+	{
+	  result = ENOMSG;
+	  break;
+	}
+
+      if ((result = ipc_wait (shared->lock, shared->waiters, MSG_WAITRECV)))
+	break;
+    }
+
+  ipc_unlock_shared (shared->lock);
+
+  release (queueptr);
+
+  if (result == EIDRM)
+    forget (msqid);
+
+  if (result)
+    {
+      syscall_printf (("-1 [%d] = msgrcv (msqid = %d, msgp = %p, "
+		       "msgsz = %u, msgtyp = %d, msgflg = 0%o)"),
+		      result, msqid, msgp, msgsz, msgtyp, msgflg);
+      set_errno (result);
+      return -1;
+    }
+
+  *(long *) msgp = mtype;
+  memcpy ((char *) msgp + sizeof (long), text, len);
+
+  syscall_printf (("%d = msgrcv (msqid = %d, msgp = %p, msgsz = %u, "
+		   "msgtyp = %d, msgflg = 0%o)"),
+		  len, msqid, msgp, msgsz, msgtyp, msgflg);
+
+  return len;
+}
+
+/*---------------------------------------------------------------------------*
+ * client_msgmgr::msgsnd ()
+ *---------------------------------------------------------------------------*/
+
+int
+client_msgmgr::msgsnd (const int msqid, const void *const msgp,
+		       const size_t msgsz, const int msgflg)
+{
+  syscall_printf ("msgsnd (msqid = %d, msgp = %p, msgsz = %u, msgflg = 0%o)",
+		  msqid, msgp, msgsz, msgflg);
+
+  int result = 0;
+
+  if (msgsz > MSGMAX)
+    result = EINVAL;
+  else if (__check_invalid_read_ptr_errno (msgp, sizeof (long) + msgsz))
+    result = EFAULT;
+  else if (*(const long *) msgp < 1)
+    result = EINVAL;
+
+  if (result)
+    {
+      syscall_printf (("-1 [%d] = "
+		       "msgsnd (msqid = %d, msgp = %p, msgsz = %u, "
+		       "msgflg = 0%o)"),
+		      result, msqid, msgp, msgsz, msgflg);
+      set_errno (result);
+      return -1;
+    }
+
+  // Nothing may fault while the queue's lock is held.
+  const long mtype = *(const long *) msgp;
+  char text[MSGMAX];
+  memcpy (text, (const char *) msgp + sizeof (long), msgsz);
+
+  queue_t *const queueptr = attach (msqid);
+
+  if (!queueptr)
+    {
+      syscall_printf (("-1 [%d] = "
+		       "msgsnd (msqid = %d, msgp = %p, msgsz = %u, "
+		       "msgflg = 0%o)"),
+		      get_errno (), msqid, msgp, msgsz, msgflg);
+      return -1;
+    }
+
+  msgq_shared_t *const shared = queueptr->shared;
+
+  ipc_lock_shared (shared->lock);
+
+  for (;;)
+    {
+      if (shared->deleted)
+	{
+	  result = EIDRM;
+	  break;
+	}
+
+      if (shared->cbytes + (msglen_t) msgsz <= shared->qbytes
+	  && shared->qnum < MSGSEG)
+	{
+	  msgq_msg_t *const msg = shared->end ();
+
+	  assert (shared->used + msgq_msg_t::size (msgsz) <= MSGQ_ARENA);
+
+	  msg->mtype = mtype;
+	  msg->msize = msgsz;
+	  memcpy (msg->text (), text, msgsz);
+
+	  shared->used += msgq_msg_t::size (msgsz);
+	  shared->cbytes += msgsz;
+	  shared->qnum += 1;
+	  shared->lspid = getpid ();
+	  shared->stime = time (NULL);
+
+	  wake_waiters (shared, MSG_WAITRECV);
+	  break;
+	}
+
+      if (msgflg & IPC_NOWAIT)
+	{
+	  result = EAGAIN;
+	  break;
+	}
+
+      if ((result = ipc_wait (shared->lock, shared->waiters, MSG_WAITSEND)))
+	break;
+    }
+
+  ipc_unlock_shared (shared->lock);
+
+  release (queueptr);
+
+  if (result == EIDRM)
+    forget (msqid);
+
+  if (result)
+    {
+      syscall_printf (("-1 [%d] = "
+		       "msgsnd (msqid = %d, msgp = %p, msgsz = %u, "
+		       "msgflg = 0%o)"),
+		      result, msqid, msgp, msgsz, msgflg);
+      set_errno (result);
+      return -1;
+    }
+
+  syscall_printf ("0 = msgsnd (msqid = %d, msgp = %p, msgsz = %u, "
+		  "msgflg = 0%o)",
+		  msqid, msgp, msgsz, msgflg);
+
+  return 0;
+}
+
+/*---------------------------------------------------------------------------*
+ * client_msgmgr::client_msgmgr ()
+ *---------------------------------------------------------------------------*/
+
+client_msgmgr::client_msgmgr ()
+{
+  InitializeCriticalSection (&_queues_lock);
+}
+
+/*---------------------------------------------------------------------------*
+ * client_msgmgr::~client_msgmgr ()
+ *---------------------------------------------------------------------------*/
+
+client_msgmgr::~client_msgmgr ()
+{
+  DeleteCriticalSection (&_queues_lock);
+}
+
+/*---------------------------------------------------------------------------*
+ * client_msgmgr::attach ()
+ *
+ * Return the queue with an additional reference, attaching to it via
+ * cygserver if this process hasn't done so yet.
+ *---------------------------------------------------------------------------*/
+
+client_msgmgr::queue_t *
+client_msgmgr::attach (const int msqid)
+{
+  EnterCriticalSection (&_queues_lock);
+
+  queue_t *queueptr;
+
+  for (queueptr = _queues_head; queueptr; queueptr = queueptr->next)
+    if (queueptr->msqid == msqid)
+      break;
+
+  if (!queueptr)
+    {
+      client_request_msg request (msqid);
+
+      if (request.make_request () == -1 || request.error_code ())
+	{
+	  LeaveCriticalSection (&_queues_lock);
+	  set_errno (request.error_code ());
+	  return NULL;
+	}
+
+      void *const ptr =
+	MapViewOfFile (request.hFileMap (), FILE_MAP_WRITE, 0, 0, 0);
+
+      if (!ptr)
+	{
+	  syscall_printf ("failed to map view [msqid = %d, handle = %p]: %E",
+			  msqid, request.hFileMap ());
+	  (void) CloseHandle (request.hFileMap ());
+	  LeaveCriticalSection (&_queues_lock);
+	  set_errno (EINVAL);	// FIXME
+	  return NULL;
+	}
+
+      queueptr = safe_new (queue_t, msqid, request.hFileMap (),
+			   (msgq_shared_t *) ptr);
+
+      assert (queueptr);
+
+      queueptr->next = _queues_head;
+      _queues_head = queueptr;
+    }
+
+  queueptr->refcnt += 1;
+
+  LeaveCriticalSection (&_queues_lock);
+
+  return queueptr;
+}
+
+/*---------------------------------------------------------------------------*
+ * client_msgmgr::release ()
+ *---------------------------------------------------------------------------*/
+
+void
+client_msgmgr::release (queue_t *const queueptr)
+{
+  EnterCriticalSection (&_queues_lock);
+
+  assert (queueptr->refcnt > 0);
+
+  const bool last = !--queueptr->refcnt;
+
+  LeaveCriticalSection (&_queues_lock);
+
+  if (!last)
+    return;
+
+  if (!UnmapViewOfFile (queueptr->shared))
+    syscall_printf ("failed to unmap view [msqid = %d, shared = %p]: %E",
+		    queueptr->msqid, queueptr->shared);
+
+  if (!CloseHandle (queueptr->hFileMap))
+    syscall_printf (("failed to close file map handle "
+		     "[msqid = %d, handle = %p]: %E"),
+		    queueptr->msqid, queueptr->hFileMap);
+
+  safe_delete (queueptr);
+}
+
+/*---------------------------------------------------------------------------*
+ * client_msgmgr::forget ()
+ *
+ * Drop a queue that has been removed from the list of attached
+ * queues.
+ *---------------------------------------------------------------------------*/
+
+void
+client_msgmgr::forget (const int msqid)
+{
+  EnterCriticalSection (&_queues_lock);
+
+  queue_t *previous = NULL;
+  queue_t *queueptr;
+
+  for (queueptr = _queues_head;
+       queueptr;
+       previous = queueptr, queueptr = queueptr->next)
+    if (queueptr->msqid == msqid)
+      break;
+
+  if (queueptr)
+    {
+      if (previous)
+	previous->next = queueptr->next;
+      else
+	_queues_head = queueptr->next;
+    }
+
+  LeaveCriticalSection (&_queues_lock);
+
+  if (queueptr)
+    release (queueptr);
+}
+
+/*---------------------------------------------------------------------------*
+ * msgctl ()
+ *---------------------------------------------------------------------------*/
+
+extern "C" int
+msgctl (const int msqid, const int cmd, struct msqid_ds *const buf)
+{
+  sigframe thisframe (mainthread);
+  return msgmgr.msgctl (msqid, cmd, buf);
+}
+
+/*---------------------------------------------------------------------------*
+ * msgget ()
+ *---------------------------------------------------------------------------*/
+
+extern "C" int
+msgget (const key_t key, const int msgflg)
+{
+  sigframe thisframe (mainthread);
+  return msgmgr.msgget (key, msgflg);
+}
+
+/*---------------------------------------------------------------------------*
+ * msgrcv ()
+ *---------------------------------------------------------------------------*/
+
+extern "C" ssize_t
+msgrcv (const int msqid, void *const msgp, const size_t msgsz,
+	const long msgtyp, const int msgflg)
+{
+  sigframe thisframe (mainthread);
+  return msgmgr.msgrcv (msqid, msgp, msgsz, msgtyp, msgflg);
+}
+
+/*---------------------------------------------------------------------------*
+ * msgsnd ()
+ *---------------------------------------------------------------------------*/
+
+extern "C" int
+msgsnd (const int msqid, const void *const msgp, const size_t msgsz,
+	const int msgflg)
+{
+  sigframe thisframe (mainthread);
+  return msgmgr.msgsnd (msqid, msgp, msgsz, msgflg);
+}
+
+/*---------------------------------------------------------------------------*
+ * client_request_msg::client_request_msg ()
+ *---------------------------------------------------------------------------*/
+
+client_request_msg::client_request_msg (const int msqid)
+  : client_request (CYGSERVER_REQUEST_MSG, &_parameters, sizeof (_parameters))
+{
+  _parameters.in.msgop = MSGOP_msgattach;
+
+  _parameters.in.msqid = msqid;
+
+  _parameters.in.cygpid = getpid ();
+  _parameters.in.winpid = GetCurrentProcessId ();
+  _parameters.in.uid = geteuid32 ();
+  _parameters.in.gid = getegid32 ();
+
+  msglen (sizeof (_parameters.in));
+}
+
+/*---------------------------------------------------------------------------*
+ * client_request_msg::client_request_msg ()
+ *---------------------------------------------------------------------------*/
+
+client_request_msg::client_request_msg (const int msqid,
+					const int cmd,
+					const struct msqid_ds *const buf)
+  : client_request (CYGSERVER_REQUEST_MSG, &_parameters, sizeof (_parameters))
+{
+  _parameters.in.msgop = MSGOP_msgctl;
+
+  _parameters.in.msqid = msqid;
+  _parameters.in.cmd = cmd;
+  if (buf)
+    _parameters.in.ds = *buf;
+
+  _parameters.in.cygpid = getpid ();
+  _parameters.in.winpid = GetCurrentProcessId ();
+  _parameters.in.uid = geteuid32 ();
+  _parameters.in.gid = getegid32 ();
+
+  msglen (sizeof (_parameters.in));
+}
+
+/*---------------------------------------------------------------------------*
+ * client_request_msg::client_request_msg ()
+ *---------------------------------------------------------------------------*/
+
+client_request_msg::client_request_msg (const key_t key, const int msgflg)
+  : client_request (CYGSERVER_REQUEST_MSG, &_parameters, sizeof (_parameters))
+{
+  _parameters.in.msgop = MSGOP_msgget;
+
+  _parameters.in.key = key;
+  _parameters.in.msgflg = msgflg;
+
+  _parameters.in.cygpid = getpid ();
+  _parameters.in.winpid = GetCurrentProcessId ();
+  _parameters.in.uid = geteuid32 ();
+  _parameters.in.gid = getegid32 ();
+
+  msglen (sizeof (_parameters.in));
+}
+
+#else /* !USE_SERVER */
+
 extern "C" int
 msgctl (int msqid, int cmd, struct msqid_ds *buf)
 {
@@ -45,3 +791,4 @@ msgsnd (int msqid, const void *msgp, size_t msgsz, int msgflg)
   set_errno (ENOSYS);
   return -1;
 }
+#endif /* !USE_SERVER */
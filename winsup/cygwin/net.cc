@@ -509,14 +509,28 @@ cygwin_getprotobynumber (int number)
 fhandler_socket *
 fdsock (int &fd, const char *name, SOCKET soc)
 {
+  bool ifs = false;
   if (!winsock2_active)
     soc = set_socket_inheritance (soc);
   else if (wincap.has_set_handle_information ())
     {
-      /* NT systems apparently set sockets to inheritable by default */
-      SetHandleInformation ((HANDLE) soc, HANDLE_FLAG_INHERIT, 0);
-      debug_printf ("reset socket inheritance since winsock2_active %d",
-		    winsock2_active);
+      /* Sockets of an IFS provider are real file handles, which are
+	 inherited and duplicated like any other handle, so fork and
+	 exec don't need WSADuplicateSocket for them.  Others, e.g.
+	 those of a layered service provider, are not usable when
+	 inherited.  NT systems apparently set sockets to inheritable
+	 by default. */
+      WSAPROTOCOL_INFOA pi;
+      int len = sizeof pi;
+      ifs = !getsockopt (soc, SOL_SOCKET, SO_PROTOCOL_INFOA, (char *) &pi,
+			 &len)
+	    && (pi.dwServiceFlags1 & XP1_IFS_HANDLES);
+      if (!ifs)
+	{
+	  SetHandleInformation ((HANDLE) soc, HANDLE_FLAG_INHERIT, 0);
+	  debug_printf ("reset socket inheritance since winsock2_active %d",
+			winsock2_active);
+	}
     }
   else
     debug_printf ("not setting socket inheritance since winsock2_active %d",
@@ -527,6 +541,7 @@ fdsock (int &fd, const char *name, SOCKET soc)
   if (!fh)
     return NULL;
   fh->set_io_handle ((HANDLE) soc);
+  fh->set_ifs_handle (ifs);
   fh->set_flags (O_RDWR | O_BINARY);
   fh->set_r_no_interrupt (winsock2_active);
   debug_printf ("fd %d, name '%s', soc %p", fd, name, soc);
@@ -2268,7 +2283,7 @@ socketpair (int family, int type, int protocol, int *sb)
     }
 
   {
-    fhandler_socket *fh = NULL;
+    fhandler_socket *fh = NULL, *fh0;
     cygheap_fdnew sb0;
     const char *name;
 
@@ -2285,6 +2300,7 @@ socketpair (int family, int type, int protocol, int *sb)
 	fh->set_addr_family (family);
 	fh->set_socket_type (type);
 	fh->set_connect_state (CONNECTED);
+	fh0 = fh;
 
 	cygheap_fdnew sb1 (sb0, false);
 
@@ -2297,6 +2313,8 @@ socketpair (int family, int type, int protocol, int *sb)
 	    fh->set_addr_family (family);
 	    fh->set_socket_type (type);
 	    fh->set_connect_state (CONNECTED);
+	    if (family == AF_LOCAL && type == SOCK_DGRAM)
+	      fh0->pair_local_dgram (fh);
 
 	    sb[0] = sb0;
 	    sb[1] = sb1;
@@ -72,6 +72,7 @@ details. */
 #include "cygheap.h"
 #include "shared_info.h"
 #include "registry.h"
+#include "syscall_stats.h"
 #include <assert.h>
 
 #ifdef _MT_SAFE
@@ -429,6 +430,7 @@ void
 path_conv::check (const char *src, unsigned opt,
 		  const suffix_info *suffixes)
 {
+  syscall_timer timer (SC_PATH_CONV);
   /* This array is used when expanding symlinks.  It is MAX_PATH * 2
      in length so that we can hold the expanded symlink plus a
      trailer.  */
@@ -3564,6 +3566,86 @@ cygwin_conv_to_full_posix_path (const char *path, char *posix_path)
   return 0;
 }
 
+#define CCP_MAX_SEEN 65536	/* Entries in the table of paths seen */
+
+/* Convert the N paths in SRC, as WHAT says, in one call.  This is for
+   tools like cygpath with many paths to convert; the same paths tend to
+   come up again and again in a build, so a path already converted is
+   not converted again but its result copied.  That is all the work
+   which is shared: paths differing in any way, even only in the last
+   component, are each converted on their own, since path_conv checks
+   every component for symlinks and case and a directory's result
+   doesn't tell what the next component will turn into.  Each result is
+   returned in DST in a malloc'd buffer, or as NULL if the path couldn't
+   be converted, errno then saying why.  Returns the number which
+   couldn't, or -1 if N is negative.
+
+   This is exported to the world as cygwin_foo by cygwin.din.  */
+
+extern "C" int
+cygwin_conv_path_array (unsigned what, int n, const char *const *src,
+			char **dst)
+{
+  int (*conv_func) (const char *, char *);
+  char buf[MAX_PATH];
+  unsigned size, h, nseen = 0;
+  int *seen;
+  int failed = 0;
+
+  if (n < 0)
+    {
+      set_errno (EINVAL);
+      return -1;
+    }
+
+  if (what & CCP_WIN32)
+    conv_func = (what & CCP_ABSOLUTE) ? cygwin_conv_to_full_win32_path
+				      : cygwin_conv_to_win32_path;
+  else
+    conv_func = (what & CCP_ABSOLUTE) ? cygwin_conv_to_full_posix_path
+				      : cygwin_conv_to_posix_path;
+
+  /* An open addressed table of the paths seen so far, by index into SRC.
+     It's kept at most half full.  Paths which don't fit anymore, or all
+     if it can't be allocated, are simply converted. */
+  for (size = 16; size < CCP_MAX_SEEN && size / 2 < (unsigned) n; size <<= 1)
+    continue;
+  seen = (int *) malloc (size * sizeof *seen);
+  if (seen)
+    memset (seen, 0xff, size * sizeof *seen);
+
+  for (int i = 0; i < n; i++)
+    {
+      int dup = -1;
+      if (seen)
+	{
+	  h = 0;
+	  for (const char *p = src[i]; *p; p++)
+	    h = h * 31 + (unsigned char) *p;
+	  for (h &= size - 1; seen[h] >= 0; h = (h + 1) & (size - 1))
+	    if (!strcmp (src[seen[h]], src[i]))
+	      break;
+	  if ((dup = seen[h]) < 0 && nseen < size / 2)
+	    {
+	      seen[h] = i;
+	      nseen++;
+	    }
+	}
+
+      if (dup >= 0)
+	dst[i] = dst[dup] ? strdup (dst[dup]) : NULL;
+      else if (!conv_func (src[i], buf))
+	dst[i] = strdup (buf);
+      else
+	dst[i] = NULL;
+      if (!dst[i])
+	failed++;
+    }
+
+  free (seen);
+  return failed;
+}
+
 /* The realpath function is supported on some UNIX systems.  */
 
 extern "C" char *
@@ -16,6 +16,7 @@ details. */
 #include "fhandler.h"
 #include "path.h"
 #include "dtable.h"
+#include "cygheap.h"
 #include "cygerrno.h"
 #include "sigproc.h"
 #include "pinfo.h"
@@ -27,6 +28,7 @@ details. */
 #include "ntdll.h"
 #include "cygthread.h"
 #include "shared_info.h"
+#include "syscall_stats.h"
 
 static char NO_COPY pinfo_dummy[sizeof (_pinfo)] = {0};
 
@@ -308,6 +310,44 @@ _pinfo::commune_recv ()
 	      sigproc_printf ("WriteFile null failed, %E");
 	      break;
 	    }
+	break;
+      }
+    case PICOM_CYGTHREADS:
+      {
+	unsigned n = sizeof cygthread::stats;
+	CloseHandle (__fromthem); __fromthem = NULL;
+	if (!WriteFile (__tothem, &n, sizeof n, &nr, NULL))
+	  sigproc_printf ("WriteFile sizeof stats failed, %E");
+	else if (!WriteFile (__tothem, &cygthread::stats, n, &nr, NULL))
+	  sigproc_printf ("WriteFile stats failed, %E");
+	break;
+      }
+    case PICOM_SYSCALLS:
+      {
+	syscall_stats st;
+	unsigned n = sizeof st;
+	CloseHandle (__fromthem); __fromthem = NULL;
+	syscall_stats_sum (st);
+	if (!WriteFile (__tothem, &n, sizeof n, &nr, NULL))
+	  sigproc_printf ("WriteFile sizeof syscall stats failed, %E");
+	else if (!WriteFile (__tothem, &st, n, &nr, NULL))
+	  sigproc_printf ("WriteFile syscall stats failed, %E");
+	break;
+      }
+    case PICOM_FDS:
+    case PICOM_MMAPS:
+      {
+	size_t n;
+	CloseHandle (__fromthem); __fromthem = NULL;
+	char *list = code == PICOM_FDS ? cygheap->fdtab.fd_names (n)
+				       : mmap_list (n);
+	if (!WriteFile (__tothem, &n, sizeof n, &nr, NULL))
+	  sigproc_printf ("WriteFile sizeof list failed, %E");
+	else if (n && !WriteFile (__tothem, list, n, &nr, NULL))
+	  sigproc_printf ("WriteFile list failed, %E");
+	if (list)
+	  free (list);
+	break;
       }
     }
 
@@ -395,9 +435,15 @@ _pinfo::commune_send (DWORD code)
   switch (code)
     {
     case PICOM_CMDLINE:
+    case PICOM_CYGTHREADS:
+    case PICOM_SYSCALLS:
+    case PICOM_FDS:
+    case PICOM_MMAPS:
       res.s = (char *) malloc (n);
       char *p;
-      for (p = res.s; ReadFile (fromthem, p, n, &nr, NULL); p += nr)
+      for (p = res.s; (unsigned) (p - res.s) < n
+		      && ReadFile (fromthem, p, n - (p - res.s), &nr, NULL)
+		      && nr; p += nr)
 	continue;
       if ((unsigned) (p - res.s) != n)
 	{
@@ -456,6 +502,74 @@ _pinfo::cmdline (size_t& n)
   return s;
 }
 
+/* Fetch the open fds of this process, as described by dtable::fd_names. */
+char *
+_pinfo::fds (size_t &n)
+{
+  if (!this || !pid)
+    return NULL;
+  if (pid == myself->pid)
+    return cygheap->fdtab.fd_names (n);
+  commune_result cr = commune_send (PICOM_FDS);
+  n = cr.n;
+  return cr.s;
+}
+
+/* Fetch the mmapped areas of this process, as described by mmap_list. */
+char *
+_pinfo::mmaps (size_t &n)
+{
+  if (!this || !pid)
+    return NULL;
+  if (pid == myself->pid)
+    return mmap_list (n);
+  commune_result cr = commune_send (PICOM_MMAPS);
+  n = cr.n;
+  return cr.s;
+}
+
+/* Fetch the thread pool counters of this process. */
+bool
+_pinfo::threadstats (cygthread_stats &stats)
+{
+  if (!this || !pid)
+    return false;
+  if (pid == myself->pid)
+    {
+      stats = cygthread::stats;
+      return true;
+    }
+  commune_result cr = commune_send (PICOM_CYGTHREADS);
+  if (!cr.s)
+    return false;
+  bool res = cr.n == sizeof stats;
+  if (res)
+    memcpy (&stats, cr.s, sizeof stats);
+  free (cr.s);
+  return res;
+}
+
+/* Fetch the call counts and latencies of this process. */
+bool
+_pinfo::syscallstats (syscall_stats &stats)
+{
+  if (!this || !pid)
+    return false;
+  if (pid == myself->pid)
+    {
+      syscall_stats_sum (stats);
+      return true;
+    }
+  commune_result cr = commune_send (PICOM_SYSCALLS);
+  if (!cr.s)
+    return false;
+  bool res = cr.n == sizeof stats;
+  if (res)
+    memcpy (&stats, cr.s, sizeof stats);
+  free (cr.s);
+  return res;
+}
+
 void
 pinfo::release ()
 {
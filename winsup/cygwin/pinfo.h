@@ -33,9 +33,16 @@ struct commune_result
 
 enum picom
 {
-  PICOM_CMDLINE = 1
+  PICOM_CMDLINE = 1,
+  PICOM_CYGTHREADS = 2,
+  PICOM_SYSCALLS = 3,
+  PICOM_FDS = 4,
+  PICOM_MMAPS = 5
 };
 
+struct cygthread_stats;
+struct syscall_stats;
+
 class _pinfo
 {
 public:
@@ -139,6 +146,10 @@ public:
   commune_result commune_send (DWORD);
   bool alive ();
   char *cmdline (size_t &);
+  bool threadstats (cygthread_stats &);
+  bool syscallstats (syscall_stats &);
+  char *fds (size_t &);
+  char *mmaps (size_t &);
 
   friend void __stdcall set_myself (pid_t, HANDLE);
 
@@ -234,6 +245,8 @@ extern HANDLE hexec_proc;
 
 /* For mmaps across fork(). */
 int __stdcall fixup_mmaps_after_fork (HANDLE parent);
+/* For /proc/<pid>/maps. */
+char * __stdcall mmap_list (size_t &);
 /* for shm areas across fork (). */
 int __stdcall fixup_shms_after_fork ();
 
@@ -10,17 +10,75 @@
 
 #include <windows.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/types.h>
 #include <errno.h>
 #include <math.h>
+#include <pthread.h>
 
 #include <profil.h>
 
-#define SLEEPTIME (1000 / PROF_HZ)
-
 /* global profinfo for profil() call */
 static struct profinfo prof;
 
+typedef UINT (WINAPI *timeperiod_fn) (UINT);
+static timeperiod_fn time_begin, time_end;
+
+/* Samples per second: PROF_HZ, or what the PROFIL_HZ environment
+   variable says. */
+
+int
+profil_hz ()
+{
+  static int hz;
+  char *s;
+
+  if (!hz)
+    {
+      s = getenv ("PROFIL_HZ");
+      hz = s ? atoi (s) : 0;
+      if (hz <= 0 || hz > 1000)
+	hz = PROF_HZ;
+    }
+  return hz;
+}
+
+/* The default timer resolution is 10 to 15ms, which is too coarse for
+   rates much above PROF_HZ.  Ask winmm for 1ms, if it's there. */
+
+static void
+set_resolution (int hz, int on)
+{
+  static HMODULE winmm;
+
+  if (hz <= PROF_HZ)
+    return;
+  if (!winmm && (winmm = LoadLibrary ("winmm.dll")))
+    {
+      time_begin = (timeperiod_fn) GetProcAddress (winmm, "timeBeginPeriod");
+      time_end = (timeperiod_fn) GetProcAddress (winmm, "timeEndPeriod");
+    }
+  if (on && time_begin)
+    time_begin (1);
+  else if (!on && time_end)
+    time_end (1);
+}
+
+static inline void
+lock_prof (struct profinfo *p)
+{
+  /* The profiling thread runs at high priority, so give way to the
+     holder for real rather than just yielding. */
+  while (InterlockedExchange (&p->lock, 1))
+    Sleep (1);
+}
+
+static inline void
+unlock_prof (struct profinfo *p)
+{
+  InterlockedExchange (&p->lock, 0);
+}
+
 /* Get the pc for thread THR */
 
 static u_long
@@ -53,29 +111,67 @@ print_prof (struct profinfo *p)
 }
 #endif
 
-/* Everytime we wake up use the main thread pc to hash into the cell in the
-   profile buffer ARG. */
+static void
+sample (struct profinfo *p, HANDLE thr)
+{
+  u_long pc, idx;
+
+  pc = (u_long) get_thrpc (thr);
+  if (pc >= p->lowpc && pc < p->highpc)
+    {
+      idx = PROFIDX (pc, p->lowpc, p->scale);
+      p->counter[idx]++;
+    }
+}
+
+/* Everytime we wake up use the pc of the main thread and of every
+   thread added by profile_thread to hash into the cell in the profile
+   buffer ARG.  Only this thread removes threads from the list, so it
+   can work on a copy of it without holding the lock. */
 
 static DWORD CALLBACK
 profthr_func (LPVOID arg)
 {
   struct profinfo *p = (struct profinfo *) arg;
-  u_long pc, idx;
+  HANDLE thr[PROF_MAXTHR];
+  DWORD period = 1000 / p->hz, next = GetTickCount (), now;
+  int i, j, n;
 
   SetThreadPriority(p->profthr, THREAD_PRIORITY_TIME_CRITICAL);
 
   for (;;)
     {
-      pc = (u_long) get_thrpc (p->targthr);
-      if (pc >= p->lowpc && pc < p->highpc)
-	{
-	  idx = PROFIDX (pc, p->lowpc, p->scale);
-	  p->counter[idx]++;
-	}
+      sample (p, p->targthr);
+
+      lock_prof (p);
+      n = p->nthr;
+      memcpy (thr, p->thr, n * sizeof (HANDLE));
+      unlock_prof (p);
+
+      for (i = 0; i < n; i++)
+	if (WaitForSingleObject (thr[i], 0) != WAIT_OBJECT_0)
+	  sample (p, thr[i]);
+	else
+	  {
+	    lock_prof (p);
+	    for (j = 0; j < p->nthr; j++)
+	      if (p->thr[j] == thr[i])
+		{
+		  p->thr[j] = p->thr[--p->nthr];
+		  break;
+		}
+	    unlock_prof (p);
+	    CloseHandle (thr[i]);
+	  }
 #if 0
       print_prof (p);
 #endif
-      Sleep (SLEEPTIME);
+      next += period;
+      now = GetTickCount ();
+      if ((long) (next - now) < 0)
+	next = now;
+      if (WaitForSingleObject (p->stop, next - now) == WAIT_OBJECT_0)
+	break;
     }
   return 0;
 }
@@ -87,11 +183,17 @@ profile_off (struct profinfo *p)
 {
   if (p->profthr)
     {
-      TerminateThread (p->profthr, 0);
+      /* Rather than killing it, which could leave a thread it was
+	 sampling suspended, or the lock held. */
+      SetEvent (p->stop);
+      WaitForSingleObject (p->profthr, INFINITE);
       CloseHandle (p->profthr);
+      CloseHandle (p->stop);
+      set_resolution (p->hz, 0);
     }
   if (p->targthr)
     CloseHandle (p->targthr);
+  p->profthr = p->targthr = p->stop = 0;
   return 0;
 }
 
@@ -102,6 +204,9 @@ profile_on (struct profinfo *p)
 {
   DWORD thrid;
 
+  p->targid = GetCurrentThreadId ();
+  p->hz = profil_hz ();
+
   /* get handle for this thread */
   if (!DuplicateHandle (GetCurrentProcess (), GetCurrentThread (),
 			GetCurrentProcess (), &p->targthr, 0, FALSE,
@@ -111,11 +216,62 @@ profile_on (struct profinfo *p)
       return -1;
     }
 
-  p->profthr = CreateThread (0, 0, profthr_func, (void *) p, 0, &thrid);
+  p->stop = CreateEvent (0, TRUE, FALSE, 0);
+  p->profthr = p->stop ? CreateThread (0, 0, profthr_func, (void *) p, 0,
+				       &thrid) : 0;
   if (!p->profthr)
     {
+      if (p->stop)
+	CloseHandle (p->stop);
       CloseHandle (p->targthr);
-      p->targthr = 0;
+      p->targthr = p->stop = 0;
+      errno = EAGAIN;
+      return -1;
+    }
+  set_resolution (p->hz, 1);
+  return 0;
+}
+
+/* Threads don't survive fork, and nor do handles to them.  Forget the
+   parent's, and carry on sampling the thread that forked. */
+
+static void
+profile_child ()
+{
+  if (!prof.profthr)
+    return;
+  prof.profthr = prof.targthr = prof.stop = 0;
+  prof.lock = 0;
+  prof.nthr = 0;
+  profile_on (&prof);
+}
+
+/* Sample the calling thread as well, from now until it exits. */
+
+int
+profile_thread (struct profinfo *p)
+{
+  HANDLE thr;
+
+  if (GetCurrentThreadId () == p->targid)
+    return 0;
+  if (!DuplicateHandle (GetCurrentProcess (), GetCurrentThread (),
+			GetCurrentProcess (), &thr, 0, FALSE,
+			DUPLICATE_SAME_ACCESS))
+    {
+      errno = ESRCH;
+      return -1;
+    }
+  lock_prof (p);
+  if (p->nthr < PROF_MAXTHR)
+    {
+      p->thr[p->nthr++] = thr;
+      thr = 0;
+    }
+  unlock_prof (p);
+  if (thr)
+    {
+      CloseHandle (thr);
       errno = EAGAIN;
       return -1;
     }
@@ -138,6 +294,7 @@ int
 profile_ctl (struct profinfo * p, char *samples, size_t size,
 	     u_long offset, u_int scale)
 {
+  static int atfork;
   u_long maxbin;
 
   if (scale > 65536)
@@ -146,16 +303,17 @@ profile_ctl (struct profinfo * p, char *samples, size_t size,
       return -1;
     }
 
+  if (p == &prof && !atfork++)
+    pthread_atfork (NULL, NULL, profile_child);
   profile_off (p);
   if (scale)
     {
       memset (samples, 0, size);
-      memset (p, 0, sizeof *p);
       maxbin = size >> 1;
-      prof.counter = (u_short *) samples;
-      prof.lowpc = offset;
-      prof.highpc = PROFADDR (maxbin, offset, scale);
-      prof.scale = scale;
+      p->counter = (u_short *) samples;
+      p->lowpc = offset;
+      p->highpc = PROFADDR (maxbin, offset, scale);
+      p->scale = scale;
 
       return profile_on (p);
     }
@@ -163,7 +321,7 @@ profile_ctl (struct profinfo * p, char *samples, size_t size,
 }
 
 /* Equivalent to unix profil()
-   Every SLEEPTIME interval, the user's program counter (PC) is examined:
+   profil_hz () times a second, the user's program counter (PC) is examined:
    offset is subtracted and the result is multiplied by scale.
    The word pointed to by this address is incremented.  Buf is unused. */
 
@@ -173,3 +331,11 @@ profil (char *samples, size_t size, u_long offset, u_int scale)
   return profile_ctl (&prof, samples, size, offset, scale);
 }
 
+/* Sample the calling thread too, not just the one that called
+   profil. */
+
+int
+profil_thread ()
+{
+  return profile_thread (&prof);
+}
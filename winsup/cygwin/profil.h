@@ -8,9 +8,13 @@ This software is a copyrighted work licensed under the terms of the
 Cygwin license.  Please consult the file "CYGWIN_LICENSE" for
 details. */
 
-/* profiling frequency.  (No larger than 1000) */
+/* default profiling frequency; the PROFIL_HZ environment variable
+   overrides it.  (No larger than 1000) */
 #define PROF_HZ			100
 
+/* most threads sampled besides the one calling profil */
+#define PROF_MAXTHR		256
+
 /* convert an addr to an index */
 #define PROFIDX(pc, base, scale)	\
   ({									\
@@ -33,12 +37,21 @@ typedef void *_WINHANDLE;
 
 struct profinfo {
     _WINHANDLE targthr;			/* thread to profile */
+    u_long targid;			/* and its id */
     _WINHANDLE profthr;			/* profiling thread */
+    _WINHANDLE stop;			/* tells it to finish */
     u_short *counter;			/* profiling counters */
     u_long lowpc, highpc;		/* range to be profiled */
     u_int scale;			/* scale value of bins */
+    int hz;				/* samples per second */
+    long lock;				/* guards nthr and thr */
+    int nthr;				/* other threads to profile */
+    _WINHANDLE thr[PROF_MAXTHR];
 };
 
 int profile_ctl(struct profinfo *, char *, size_t, u_long, u_int);
+int profile_thread(struct profinfo *);
 int profil(char *, size_t, u_long, u_int);
+int profil_thread(void);
+int profil_hz(void);
 
@@ -0,0 +1,349 @@
+/*
+ * rebench - check and time the regex engine against the `tests' file
+ *
+ * This is a host program, not part of the DLL.  Build it from this
+ * directory with something like
+ *
+ *	cc -O2 -I. -o rebench rebench.c ../regcomp.c ../regexec.c \
+ *		../regerror.c ../regfree.c
+ *
+ * The winsup.h here stands in for the real one.  Add -DREDEBUG -Dlint
+ * to get the engine's assertions; the `L' flag (REG_LARGE) only has an
+ * effect then.  The two `gag me' tests expect -DPOSIX_MISTAKE, which
+ * the DLL isn't built with, so without it `rebench -c' reports them,
+ * tests 52 and 53, as the only 2 failures.
+ *
+ *	rebench -c [tests]		check every test, print failures
+ *	rebench [-k kb] [-r reps] [tests]	time the tests on big inputs
+ *
+ * Checking follows the format described at the top of `tests'.  For
+ * timing, each RE that compiles is run over two generated inputs of
+ * roughly kb kilobytes (default 1024): one long buffer with the test
+ * string at its end, and the same text cut into 80 character lines
+ * with REG_NEWLINE semantics left to the RE's own flags, matched one
+ * line per call the way a log scanner would.
+ */
+#include "winsup.h"
+#include <sys/types.h>
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../regex.h"
+
+#define	MAXF	10
+#define	LINELEN	80
+
+static int nfail;
+static int docheck;
+static int kb = 1024;
+static int reps = 3;
+
+static struct flag {
+	int ch;
+	int cflag;
+	int eflag;
+} flags[] = {
+	{ 'i', REG_ICASE, 0 },
+	{ 'm', REG_NOSPEC, 0 },
+	{ 's', REG_NOSUB, 0 },
+	{ 'n', REG_NEWLINE, 0 },
+	{ '^', 0, REG_NOTBOL },
+	{ '$', 0, REG_NOTEOL },
+	{ '#', 0, REG_STARTEND },
+	{ 'p', REG_PEND, 0 },
+	{ 'L', 0, REG_LARGE },
+	{ 0, 0, 0 }
+};
+
+/* translate the N, S, T and Z escapes; returns the new length */
+static size_t
+fixstr(char *s)
+{
+	char *p;
+
+	if (strcmp(s, "\"\"") == 0) {
+		*s = '\0';
+		return(0);
+	}
+	for (p = s; *p != '\0'; p++)
+		switch (*p) {
+		case 'N':	*p = '\n'; break;
+		case 'S':	*p = ' '; break;
+		case 'T':	*p = '\t'; break;
+		case 'Z':	*p = '\0'; break;
+		}
+	return(p - s);
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return(tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+/* does the match m of string s agree with the expectation want? */
+static int
+agrees(const char *s, regmatch_t *m, char *want)
+{
+	size_t len;
+
+	if (strcmp(want, "-") == 0)
+		return(m->rm_so == -1);
+	if (m->rm_so == -1)
+		return(0);
+	if (*want == '@') {
+		len = fixstr(++want);
+		return(m->rm_so == m->rm_eo &&
+		    strncmp(s + m->rm_eo, want, len) == 0);
+	}
+	len = fixstr(want);
+	return((size_t)(m->rm_eo - m->rm_so) == len &&
+	    memcmp(s + m->rm_so, want, len) == 0);
+}
+
+static void
+check(int lineno, char **f, int nf, int cflags, int eflags, int wanterr)
+{
+	regex_t re;
+	regmatch_t m[MAXF];
+	char pat[1024], str[1024], buf[1024], *sub, *next;
+	size_t plen, slen;
+	int err, i;
+	size_t nm = MAXF;
+
+	strcpy(pat, f[0]);
+	plen = fixstr(pat);
+	if (cflags&REG_PEND)
+		re.re_endp = pat + plen;
+	err = regcomp(&re, pat, cflags);
+	if (wanterr) {
+		if (err == 0) {
+			printf("%d: `%s' compiled, expected %s\n", lineno,
+			    f[0], f[2]);
+			nfail++;
+			regfree(&re);
+		} else {
+			regerror(err|REG_ITOA, NULL, buf, sizeof(buf));
+			if (strcmp(buf + 4, f[2]) != 0) {
+				printf("%d: `%s' gave %s, expected %s\n",
+				    lineno, f[0], buf, f[2]);
+				nfail++;
+			}
+		}
+		return;
+	}
+	if (err != 0) {
+		regerror(err, &re, buf, sizeof(buf));
+		printf("%d: `%s' failed to compile: %s\n", lineno, f[0], buf);
+		nfail++;
+		return;
+	}
+
+	strcpy(str, f[2]);
+	slen = fixstr(str);
+	if (eflags&REG_STARTEND) {
+		m[0].rm_so = (char *)memchr(str, '(', slen) - str + 1;
+		m[0].rm_eo = (char *)memchr(str, ')', slen) - str;
+	}
+	if (cflags&REG_NOSUB)
+		nm = 0;
+	err = regexec(&re, str, nm, m, eflags);
+	if (nf < 4) {
+		if (err != REG_NOMATCH) {
+			printf("%d: `%s' matched `%s', expected no match\n",
+			    lineno, f[0], f[2]);
+			nfail++;
+		}
+	} else if (err != 0) {
+		printf("%d: `%s' didn't match `%s'\n", lineno, f[0], f[2]);
+		nfail++;
+	} else if (!(cflags&REG_NOSUB)) {
+		strcpy(buf, f[3]);
+		if (!agrees(str, &m[0], buf)) {
+			printf("%d: `%s' on `%s' matched %ld-%ld, expected `%s'\n",
+			    lineno, f[0], f[2], (long)m[0].rm_so,
+			    (long)m[0].rm_eo, f[3]);
+			nfail++;
+		}
+		if (nf > 4) {
+			strcpy(buf, f[4]);
+			for (i = 1, sub = buf; sub != NULL; i++, sub = next) {
+				if ((next = strchr(sub, ',')) != NULL)
+					*next++ = '\0';
+				if (i < MAXF && !agrees(str, &m[i], sub)) {
+					printf("%d: `%s' on `%s' subexpression"
+					    " %d wrong\n", lineno, f[0], f[2],
+					    i);
+					nfail++;
+				}
+			}
+		}
+	}
+	regfree(&re);
+}
+
+/* fill buf with len bytes of text which rarely matches anything */
+static void
+filler(char *buf, size_t len)
+{
+	static const char text[] =
+	    "the quick brown fox jumps over the lazy dog 0123456789 ";
+	unsigned long r = 1;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		r = r * 1103515245 + 12345;
+		buf[i] = text[(r >> 16) % (sizeof(text) - 1)];
+	}
+}
+
+static void
+bench(int lineno, char **f, int cflags, int eflags)
+{
+	regex_t re;
+	regmatch_t m[1];
+	static char *big;
+	static size_t biglen;
+	char pat[1024], str[1024];
+	size_t len, slen, off;
+	double t0, t1, t2;
+	int r, hits, lines;
+
+	strcpy(pat, f[0]);
+	len = fixstr(pat);
+	if (cflags&REG_PEND)
+		re.re_endp = pat + len;
+	if (regcomp(&re, pat, cflags) != 0)
+		return;
+	strcpy(str, f[2]);
+	fixstr(str);
+	/* embedded NULs would stop the scan early */
+	slen = strlen(str);
+
+	len = (size_t)kb * 1024;
+	if (biglen < len + slen + 1) {
+		biglen = len + slen + 1;
+		big = realloc(big, biglen);
+		if (big == NULL) {
+			perror("realloc");
+			exit(2);
+		}
+	}
+	filler(big, len);
+	memcpy(big + len, str, slen + 1);
+
+	eflags &= ~REG_STARTEND;
+	t0 = now();
+	for (r = 0, hits = 0; r < reps; r++)
+		hits += regexec(&re, big, 1, m, eflags) == 0;
+	t1 = now();
+	for (r = 0, lines = 0; r < reps; r++)
+		for (off = 0; off < len; off += LINELEN) {
+			char save = big[off + LINELEN];
+
+			big[off + LINELEN] = '\0';
+			lines += regexec(&re, big + off, 1, m, eflags) == 0;
+			big[off + LINELEN] = save;
+		}
+	t2 = now();
+	printf("%4d %-24.24s %5s %8.1f %8.1f %8d\n", lineno, f[0],
+	    (cflags&REG_EXTENDED) ? "ERE" : "BRE",
+	    (double)len * reps / (t1 - t0) / 1e6,
+	    (double)len * reps / (t2 - t1) / 1e6, lines / reps);
+	regfree(&re);
+}
+
+static void
+run(int lineno, char **f, int nf, int extended)
+{
+	int cflags = extended ? REG_EXTENDED : 0;
+	int eflags = 0;
+	int wanterr = 0;
+	char *p;
+	struct flag *fl;
+
+	for (p = f[1]; *p != '\0'; p++) {
+		if (*p == 'C')
+			wanterr = 1;
+		for (fl = flags; fl->ch != 0; fl++)
+			if (fl->ch == *p) {
+				cflags |= fl->cflag;
+				eflags |= fl->eflag;
+			}
+	}
+	if (cflags&REG_NOSPEC)
+		cflags &= ~REG_EXTENDED;
+	if (docheck)
+		check(lineno, f, nf, cflags, eflags, wanterr);
+	else if (!wanterr)
+		bench(lineno, f, cflags, eflags);
+}
+
+int
+main(int argc, char **argv)
+{
+	FILE *fp;
+	char line[1024], *f[MAXF], *p;
+	int c, nf, lineno = 0;
+	const char *name = "../tests";
+
+	while ((c = getopt(argc, argv, "ck:r:")) != -1)
+		switch (c) {
+		case 'c':
+			docheck = 1;
+			break;
+		case 'k':
+			kb = atoi(optarg);
+			break;
+		case 'r':
+			reps = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr,
+			    "usage: rebench [-c] [-k kb] [-r reps] [tests]\n");
+			return(2);
+		}
+	if (optind < argc)
+		name = argv[optind];
+	if ((fp = fopen(name, "r")) == NULL) {
+		perror(name);
+		return(2);
+	}
+	if (!docheck)
+		printf("line %-24s %5s %8s %8s %8s\n", "RE", "", "buf MB/s",
+		    "line MB/s", "hits");
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		lineno++;
+		if ((p = strchr(line, '\n')) != NULL)
+			*p = '\0';
+		if (line[0] == '#' || line[0] == '\0')
+			continue;
+		for (nf = 0, p = line; nf < MAXF && p != NULL; nf++) {
+			f[nf] = p;
+			if ((p = strchr(p, '\t')) != NULL) {
+				*p++ = '\0';
+				while (*p == '\t')
+					p++;
+			}
+		}
+		if (nf < 3) {
+			printf("%d: bad line\n", lineno);
+			nfail++;
+			continue;
+		}
+		if (strchr(f[1], '&') != NULL) {
+			run(lineno, f, nf, 1);
+			run(lineno, f, nf, 0);
+		} else
+			run(lineno, f, nf, strchr(f[1], 'b') == NULL);
+	}
+	fclose(fp);
+	if (docheck)
+		printf("%d failures\n", nfail);
+	return(nfail != 0);
+}
@@ -0,0 +1,8 @@
+/* winsup.h: stand-in for the DLL's winsup.h, so that the regex
+   sources can be built into rebench on the host. */
+
+#include <sys/types.h>
+
+#ifndef _off_t
+#define _off_t off_t
+#endif
@@ -8,6 +8,7 @@
 #ifdef SNAMES
 #define	matcher	smatcher
 #define	fast	sfast
+#define	dfast	sdfast
 #define	slow	sslow
 #define	dissect	sdissect
 #define	backref	sbackref
@@ -19,6 +20,7 @@
 #ifdef LNAMES
 #define	matcher	lmatcher
 #define	fast	lfast
+#define	dfast	ldfast
 #define	slow	lslow
 #define	dissect	ldissect
 #define	backref	lbackref
@@ -79,6 +81,7 @@ int eflags;
 	const register sopno gl = g->laststate;
 	char *start;
 	char *stop;
+	struct re_dfa *d;
 
 	/* simplify the situation where possible */
 	if (g->cflags&REG_NOSUB)
@@ -94,14 +97,13 @@ int eflags;
 		return(REG_INVARG);
 
 	/* prescreening; this does wonders for this rather slow code */
-	if (g->must != NULL) {
-		for (dp = start; dp < stop; dp++)
-			if (*dp == g->must[0] && stop - dp >= g->mlen &&
-				memcmp(dp, g->must, (size_t)g->mlen) == 0)
-				break;
-		if (dp == stop)		/* we didn't find g->must */
-			return(REG_NOMATCH);
-	}
+	if (g->must != NULL && !(g->iflags&PFXMUST) &&
+	    findlit(start, stop, g->must, g->mlen, g->mjump) == NULL)
+		return(REG_NOMATCH);
+	if ((g->iflags&ANCHOR) && !(eflags&REG_NOTBOL) && g->plen > 0 &&
+	    (stop - start < g->plen ||
+	    memcmp(start, g->prefix, (size_t)g->plen) != 0))
+		return(REG_NOMATCH);
 
 	/* match struct setup */
 	m->g = g;
@@ -111,6 +113,12 @@ int eflags;
 	m->offp = string;
 	m->beginp = start;
 	m->endp = stop;
+
+	/* no match can start before the first occurrence of the prefix */
+	if (g->prefix != NULL && !(g->iflags&ANCHOR) &&
+	    (start = findlit(start, stop, g->prefix, g->plen, g->pjump)) == NULL)
+		return(REG_NOMATCH);
+
 	STATESETUP(m, 4);
 	SETUP(m->st);
 	SETUP(m->fresh);
@@ -120,7 +128,11 @@ int eflags;
 
 	/* this loop does only one repetition except for backrefs */
 	for (;;) {
-		endp = fast(m, start, stop, gf, gl);
+		if ((d = dfaget(g, SSIZE)) != NULL) {
+			endp = dfast(m, d, start, stop, gf, gl);
+			dfaput(g);
+		} else
+			endp = fast(m, start, stop, gf, gl);
 		if (endp == NULL) {		/* a miss */
 			STATETEARDOWN(m);
 			return(REG_NOMATCH);
@@ -649,8 +661,12 @@ sopno stopst;
 		/* next character */
 		lastc = c;
 		c = (p == m->endp) ? OUT : *p;
-		if (EQ(st, fresh))
+		if (EQ(st, fresh)) {
 			coldp = p;
+			/* nothing underway and no BOL to come */
+			if ((m->g->iflags&ANCHOR) && p > start)
+				break;	/* NOTE BREAK OUT */
+		}
 
 		/* is there an EOL and/or BOL between lastc and c? */
 		flagch = '\0';
@@ -707,6 +723,120 @@ sopno stopst;
 		return(NULL);
 }
 
+/*
+ - dfast - fast() using the DFA state cache
+ == static char *dfast(register struct match *m, register struct re_dfa *d, \
+ ==	char *start, char *stop, sopno startst, sopno stopst);
+ *
+ * Steps on characters are looked up in the cache, or worked out by
+ * step() once and remembered there.  Steps for BOL, EOL and word
+ * boundaries depend on the neighbouring characters as well, so they
+ * are always done by step() and only the resulting set is looked up.
+ */
+static char *			/* where tentative match ended, or NULL */
+dfast(m, d, start, stop, startst, stopst)
+register struct match *m;
+register struct re_dfa *d;
+char *start;
+char *stop;
+sopno startst;
+sopno stopst;
+{
+	states st = m->st;
+	states tmp = m->tmp;
+	register char *p = start;
+	register int c = (start == m->beginp) ? OUT : *(start-1);
+	register int lastc;	/* previous c */
+	register int flagch;
+	register int i;
+	register int s;		/* current DFA state */
+	register int ns;	/* next DFA state */
+	int flushes;
+	register char *coldp;	/* last p after which no match was underway */
+
+	if (d->nstates == 0) {
+		CLEAR(st);
+		SET1(st, startst);
+		st = step(m->g, startst, stopst, st, NOTHING, st);
+		(void) dfastate(d, SBYTES(st), ISSET(st, stopst) != 0);
+	}
+	s = 0;			/* fresh start */
+	coldp = NULL;
+	for (;;) {
+		/* next character */
+		lastc = c;
+		c = (p == m->endp) ? OUT : *p;
+		if (s == 0) {
+			coldp = p;
+			/* nothing underway and no BOL to come */
+			if ((m->g->iflags&ANCHOR) && p > start)
+				break;	/* NOTE BREAK OUT */
+		}
+
+		/* is there an EOL and/or BOL between lastc and c? */
+		flagch = '\0';
+		i = 0;
+		if ( (lastc == '\n' && m->g->cflags&REG_NEWLINE) ||
+				(lastc == OUT && !(m->eflags&REG_NOTBOL)) ) {
+			flagch = BOL;
+			i = m->g->nbol;
+		}
+		if ( (c == '\n' && m->g->cflags&REG_NEWLINE) ||
+				(c == OUT && !(m->eflags&REG_NOTEOL)) ) {
+			flagch = (flagch == BOL) ? BOLEOL : EOL;
+			i += m->g->neol;
+		}
+		if (i != 0) {
+			memcpy(SBYTES(st), d->sets + s*d->setsize, d->setsize);
+			for (; i > 0; i--)
+				st = step(m->g, startst, stopst, st, flagch, st);
+			s = dfastate(d, SBYTES(st), ISSET(st, stopst) != 0);
+		}
+
+		/* how about a word boundary? */
+		if (!(m->g->iflags&USEWORD))
+			/* no need to ask */;
+		else if ( (flagch == BOL || (lastc != OUT && !ISWORD(lastc))) &&
+					(c != OUT && ISWORD(c)) ) {
+			flagch = BOW;
+		} else if ( (lastc != OUT && ISWORD(lastc)) &&
+				(flagch == EOL || (c != OUT && !ISWORD(c))) ) {
+			flagch = EOW;
+		}
+		if (flagch == BOW || flagch == EOW) {
+			memcpy(SBYTES(st), d->sets + s*d->setsize, d->setsize);
+			st = step(m->g, startst, stopst, st, flagch, st);
+			s = dfastate(d, SBYTES(st), ISSET(st, stopst) != 0);
+		}
+
+		/* are we done? */
+		if (d->accept[s] || p == stop)
+			break;		/* NOTE BREAK OUT */
+
+		/* no, we must deal with this character */
+		assert(c != OUT);
+		ns = d->trans[s*NC + (uch)c];
+		if (ns < 0) {
+			memcpy(SBYTES(tmp), d->sets + s*d->setsize, d->setsize);
+			memcpy(SBYTES(st), d->sets, d->setsize);
+			st = step(m->g, startst, stopst, tmp, c, st);
+			flushes = d->flushes;
+			ns = dfastate(d, SBYTES(st), ISSET(st, stopst) != 0);
+			if (d->flushes == flushes)
+				d->trans[s*NC + (uch)c] = ns;
+		}
+		s = ns;
+		p++;
+	}
+
+	assert(coldp != NULL);
+	m->coldp = coldp;
+	if (d->accept[s])
+		return(p+1);
+	else
+		return(NULL);
+}
+
 /*
  - slow - step through the string more deliberately
  == static char *slow(register struct match *m, char *start, \
@@ -1010,6 +1140,7 @@ int ch;
 
 #undef	matcher
 #undef	fast
+#undef	dfast
 #undef	slow
 #undef	dissect
 #undef	backref
@@ -65,6 +65,8 @@ static char nuls[10];		/* place to point scanner in event of error */
 #define	THERETHERE()	(p->slen - 2)
 #define	DROP(n)	(p->slen -= (n))
 
+#define	MINJUMP	8	/* shortest literal worth a skip table */
+
 #ifndef NDEBUG
 static int never = 0;		/* for use in asserts; shuts lint up */
 #else
@@ -144,6 +146,12 @@ int cflags;
 	g->neol = 0;
 	g->must = NULL;
 	g->mlen = 0;
+	g->mjump = NULL;
+	g->prefix = NULL;
+	g->plen = 0;
+	g->pjump = NULL;
+	g->dfa = NULL;
+	g->dfabusy = 0;
 	g->nsub = 0;
 	g->ncategories = 1;	/* category 0 is "everything else" */
 	g->categories = &g->catspace[-(CHAR_MIN)];
@@ -166,6 +174,7 @@ int cflags;
 	categorize(p, g);
 	stripsnug(p, g);
 	findmust(p, g);
+	findprefix(p, g);
 	g->nplus = pluscount(p, g);
 	g->magic = MAGIC2;
 	preg->re_nsub = g->nsub;
@@ -587,11 +596,13 @@ register struct parse *p;
 	/* Dept of Truly Sickening Special-Case Kludges */
 	if (p->next + 5 < p->end && strncmp(p->next, "[:<:]]", 6) == 0) {
 		EMIT(OBOW, 0);
+		p->g->iflags |= USEWORD;
 		NEXTn(6);
 		return;
 	}
 	if (p->next + 5 < p->end && strncmp(p->next, "[:>:]]", 6) == 0) {
 		EMIT(OEOW, 0);
+		p->g->iflags |= USEWORD;
 		NEXTn(6);
 		return;
 	}
@@ -1507,6 +1518,105 @@ register struct re_guts *g;
 	}
 	assert(cp == g->must + g->mlen);
 	*cp++ = '\0';		/* just on general principles */
+	g->mjump = mkjump(g->must, g->mlen);
+}
+
+/*
+ - findprefix - fill in prefix and plen with literal string starting every match
+ == static void findprefix(register struct parse *p, register struct re_guts *g);
+ *
+ * Also notes whether the RE is anchored at the start of the string,
+ * and whether finding the prefix means must has been found too.
+ * Every repetition operator comes before the thing it repeats, so the
+ * OCHARs at the head of the strip are all mandatory.
+ *
+ * Note that prefix and plen got initialized during setup.
+ */
+static void
+findprefix(p, g)
+struct parse *p;
+register struct re_guts *g;
+{
+	register sop *scan;
+	sop *start;
+	register sop s;
+	register char *cp;
+	register sopno i;
+
+	/* avoid making error situations worse */
+	if (p->error != 0)
+		return;
+
+	scan = g->strip + 1;
+	while (OP(*scan) == OLPAREN)
+		scan++;
+	if (OP(*scan) == OBOL) {
+		if (!(g->cflags&REG_NEWLINE))
+			g->iflags |= ANCHOR;
+		scan++;
+	}
+	start = scan;
+	for (;;) {
+		s = *scan++;
+		if (OP(s) == OCHAR)
+			g->plen++;
+		else if (OP(s) != OLPAREN && OP(s) != ORPAREN)
+			break;
+	}
+
+	if (g->plen == 0)		/* there isn't one */
+		return;
+
+	g->prefix = malloc((size_t)g->plen + 1);
+	if (g->prefix == NULL) {	/* argh; just forget it */
+		g->plen = 0;
+		return;
+	}
+	cp = g->prefix;
+	scan = start;
+	for (i = g->plen; i > 0; i--) {
+		while (OP(s = *scan++) != OCHAR)
+			continue;
+		*cp++ = (char)OPND(s);
+	}
+	*cp = '\0';
+	g->pjump = mkjump(g->prefix, g->plen);
+
+	for (i = 0; i + g->mlen <= g->plen; i++)
+		if (memcmp(g->prefix + i, g->must, (size_t)g->mlen) == 0) {
+			g->iflags |= PFXMUST;
+			break;
+		}
+}
+
+/*
+ - mkjump - make a Horspool skip table for finding a literal string
+ == static uch *mkjump(char *lit, int len);
+ *
+ * Short strings are found faster with memchr(), so they get none.
+ * Skips are capped at UCHAR_MAX; a shorter skip is merely slower.
+ */
+static uch *
+mkjump(lit, len)
+char *lit;
+int len;
+{
+	register uch *jump;
+	register int i;
+	register int skip;
+
+	if (len < MINJUMP)
+		return(NULL);
+	jump = (uch *)malloc(NC);
+	if (jump == NULL)		/* memchr() will do */
+		return(NULL);
+	skip = (len < UCHAR_MAX) ? len : UCHAR_MAX;
+	(void) memset(jump, skip, NC);
+	for (i = 0; i < len - 1; i++) {
+		skip = len - 1 - i;
+		jump[(uch)lit[i]] = (skip < UCHAR_MAX) ? skip : UCHAR_MAX;
+	}
+	return(jump);
 }
 
 /*
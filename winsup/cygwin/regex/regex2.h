@@ -97,6 +97,25 @@ typedef struct {
 /* stuff for character categories */
 typedef unsigned char cat_t;
 
+/*
+ * DFA state cache for fast(), built lazily by regexec() for REs
+ * without back references and kept until regfree().  Each DFA state
+ * is one state set; state 0 is the set for a fresh start.  trans[s*NC
+ * + (uch)c] is the state reached from s on character c, or -1 if that
+ * hasn't been worked out yet.  When maxstates can't grow any further
+ * everything but state 0 is thrown away and flushes is bumped.
+ */
+struct re_dfa {
+	size_t setsize;		/* bytes in one state set */
+	int nstates;		/* states in use */
+	int maxstates;		/* states allocated */
+	int flushes;		/* times the cache was emptied */
+	char *sets;		/* -> char[maxstates][setsize] */
+	char *accept;		/* -> char[maxstates], final state is in set */
+	short *trans;		/* -> short[maxstates][NC] */
+	int *hash;		/* -> int[2*maxstates], set hash to state */
+};
+
 /*
  * main compiled-expression structure
  */
@@ -116,15 +135,24 @@ struct re_guts {
 #		define	USEBOL	01	/* used ^ */
 #		define	USEEOL	02	/* used $ */
 #		define	BAD	04	/* something wrong */
+#		define	ANCHOR	010	/* can only match at start of string */
+#		define	USEWORD	020	/* used [[:<:]] or [[:>:]] */
+#		define	PFXMUST	040	/* prefix contains must */
 	int nbol;		/* number of ^ used */
 	int neol;		/* number of $ used */
 	int ncategories;	/* how many character categories */
 	cat_t *categories;	/* ->catspace[-CHAR_MIN] */
 	char *must;		/* match must contain this string */
 	int mlen;		/* length of must */
+	uch *mjump;		/* skip table for finding must, or NULL */
+	char *prefix;		/* match must start with this string */
+	int plen;		/* length of prefix */
+	uch *pjump;		/* skip table for finding prefix, or NULL */
 	size_t nsub;		/* copy of re_nsub */
 	int backrefs;		/* does it use back references? */
 	sopno nplus;		/* how deep does it nest +s? */
+	struct re_dfa *dfa;	/* DFA state cache, or NULL */
+	volatile int dfabusy;	/* dfa is being used by a regexec() */
 	/* catspace must be last */
 	cat_t catspace[1];	/* actually [NC] */
 };
@@ -21,6 +21,234 @@
 static int nope = 0;		/* for use in asserts; shuts lint up */
 #endif
 
+/*
+ * Helpers shared by both versions of the engine.
+ */
+
+/*
+ - findlit - find the first occurrence of a literal string
+ *
+ * With a skip table this is Horspool's algorithm, otherwise memchr()
+ * for the first character and memcmp() for the rest.
+ */
+static char *			/* where it starts, or NULL */
+findlit(p, stop, lit, len, jump)
+register char *p;
+char *stop;
+char *lit;
+int len;
+uch *jump;
+{
+	register uch last;
+	register uch c;
+
+	if (jump == NULL) {
+		while (stop - p >= len &&
+		    (p = memchr(p, lit[0], (size_t)(stop - p - len + 1))) != NULL) {
+			if (memcmp(p, lit, (size_t)len) == 0)
+				return(p);
+			p++;
+		}
+		return(NULL);
+	}
+	last = (uch)lit[len-1];
+	while (stop - p >= len) {
+		c = (uch)p[len-1];
+		if (c == last && memcmp(p, lit, (size_t)len - 1) == 0)
+			return(p);
+		p += jump[c];
+	}
+	return(NULL);
+}
+
+/*
+ * The DFA state cache.  Only one regexec() at a time uses a given
+ * cache; others fall back to plain fast() rather than wait.
+ */
+#ifndef DFA_MINSTATES
+#define	DFA_MINSTATES	16	/* at least 2 */
+#endif
+#ifndef DFA_MAXSTATES
+#define	DFA_MAXSTATES	256	/* must fit in a short */
+#endif
+
+/* atomically set *p to 1 and return its old value */
+static __inline__ int
+dfatas(p)
+volatile int *p;
+{
+	register int old = 1;
+
+	__asm__ __volatile__ ("xchgl %0,%1" : "+r" (old), "+m" (*p) : : "memory");
+	return(old);
+}
+
+/* hash a state set */
+static unsigned
+dfahashset(set, len)
+register char *set;
+register size_t len;
+{
+	register unsigned h = 2166136261U;
+
+	while (len-- > 0)
+		h = (h ^ (uch)*set++) * 16777619U;
+	return(h);
+}
+
+/* enter state s in the hash table */
+static void
+dfahashin(d, s)
+register struct re_dfa *d;
+int s;
+{
+	register unsigned mask = 2*d->maxstates - 1;
+	register unsigned h;
+
+	h = dfahashset(d->sets + s*d->setsize, d->setsize) & mask;
+	while (d->hash[h] >= 0)
+		h = (h + 1) & mask;
+	d->hash[h] = s;
+}
+
+/* (re)size the cache to maxstates states, 0 success */
+static int
+dfasize(d, maxstates)
+register struct re_dfa *d;
+int maxstates;
+{
+	char *sets;
+	char *accept;
+	short *trans;
+	int *hash;
+	register int i;
+
+	sets = realloc(d->sets, maxstates*d->setsize);
+	if (sets != NULL)
+		d->sets = sets;
+	accept = realloc(d->accept, maxstates);
+	if (accept != NULL)
+		d->accept = accept;
+	trans = (short *)realloc((char *)d->trans,
+						maxstates*NC*sizeof(short));
+	if (trans != NULL)
+		d->trans = trans;
+	hash = (int *)malloc(2*maxstates*sizeof(int));
+	if (sets == NULL || accept == NULL || trans == NULL || hash == NULL) {
+		if (hash != NULL)
+			free((char *)hash);
+		return(-1);
+	}
+	for (i = d->maxstates*NC; i < maxstates*NC; i++)
+		d->trans[i] = -1;
+	if (d->hash != NULL)
+		free((char *)d->hash);
+	d->hash = hash;
+	d->maxstates = maxstates;
+	for (i = 0; i < 2*maxstates; i++)
+		d->hash[i] = -1;
+	for (i = 0; i < d->nstates; i++)
+		dfahashin(d, i);
+	return(0);
+}
+
+/*
+ - dfaget - lock the DFA cache of g, creating it if need be
+ *
+ * Returns NULL if the cache is busy or can't be had.
+ */
+static struct re_dfa *
+dfaget(g, setsize)
+register struct re_guts *g;
+size_t setsize;
+{
+	register struct re_dfa *d;
+
+	if (g->backrefs || dfatas(&g->dfabusy))
+		return(NULL);
+	d = g->dfa;
+	if (d != NULL && d->setsize != setsize) {	/* REG_LARGE */
+		free(d->sets);
+		free(d->accept);
+		free((char *)d->trans);
+		free((char *)d->hash);
+		free((char *)d);
+		d = g->dfa = NULL;
+	}
+	if (d == NULL) {
+		d = (struct re_dfa *)calloc(1, sizeof(struct re_dfa));
+		if (d != NULL) {
+			d->setsize = setsize;
+			if (dfasize(d, DFA_MINSTATES) == 0)
+				g->dfa = d;
+			else {
+				free(d->sets);
+				free(d->accept);
+				free((char *)d->trans);
+				free((char *)d);
+				d = NULL;
+			}
+		}
+	}
+	if (d == NULL)
+		g->dfabusy = 0;
+	return(d);
+}
+
+/* unlock the DFA cache of g */
+static void
+dfaput(g)
+struct re_guts *g;
+{
+	__asm__ __volatile__ ("" : : : "memory");
+	g->dfabusy = 0;
+}
+
+/*
+ - dfastate - map a state set to a DFA state, adding it if it's new
+ *
+ * When the cache is full and can't grow it is emptied except for
+ * state 0, so any state number held by the caller may go stale; they
+ * can tell by flushes changing.
+ */
+static int
+dfastate(d, set, accept)
+register struct re_dfa *d;
+char *set;
+int accept;
+{
+	register unsigned mask = 2*d->maxstates - 1;
+	register unsigned h;
+	register int s;
+
+	h = dfahashset(set, d->setsize) & mask;
+	while ((s = d->hash[h]) >= 0) {
+		if (memcmp(d->sets + s*d->setsize, set, d->setsize) == 0)
+			return(s);
+		h = (h + 1) & mask;
+	}
+	if (d->nstates == d->maxstates &&
+	    (d->maxstates >= DFA_MAXSTATES ||
+	    dfasize(d, 2*d->maxstates) != 0)) {
+		/* flush; state 0 is kept but its transitions may be stale */
+		d->nstates = d->nstates > 0;
+		for (s = 0; s < NC; s++)
+			d->trans[s] = -1;
+		for (s = 0; s < 2*d->maxstates; s++)
+			d->hash[s] = -1;
+		if (d->nstates > 0)
+			dfahashin(d, 0);
+		d->flushes++;
+	}
+	s = d->nstates++;
+	memcpy(d->sets + s*d->setsize, set, d->setsize);
+	d->accept[s] = accept;
+	for (h = 0; h < NC; h++)
+		d->trans[s*NC + h] = -1;
+	dfahashin(d, s);
+	return(s);
+}
+
 /* macros for manipulating states, small version */
 #define	states	unsigned
 #define	states1	unsigned	/* for later use in regexec() decision */
@@ -43,6 +271,9 @@ static int nope = 0;		/* for use in asserts; shuts lint up */
 #define	FWD(dst, src, n)	((dst) |= ((unsigned)(src)&(here)) << (n))
 #define	BACK(dst, src, n)	((dst) |= ((unsigned)(src)&(here)) >> (n))
 #define	ISSETBACK(v, n)	((v) & ((unsigned)here >> (n)))
+/* state sets as bytes, for the DFA cache */
+#define	SSIZE	sizeof(unsigned)
+#define	SBYTES(v)	((char *)&(v))
 /* function names */
 #define SNAMES			/* engine.c looks after details */
 
@@ -67,6 +298,8 @@ static int nope = 0;		/* for use in asserts; shuts lint up */
 #undef	FWD
 #undef	BACK
 #undef	ISSETBACK
+#undef	SSIZE
+#undef	SBYTES
 #undef	SNAMES
 
 /* macros for manipulating states, large version */
@@ -92,6 +325,9 @@ static int nope = 0;		/* for use in asserts; shuts lint up */
 #define	FWD(dst, src, n)	((dst)[here+(n)] |= (src)[here])
 #define	BACK(dst, src, n)	((dst)[here-(n)] |= (src)[here])
 #define	ISSETBACK(v, n)	((v)[here - (n)])
+/* state sets as bytes, for the DFA cache */
+#define	SSIZE	((size_t)m->g->nstates)
+#define	SBYTES(v)	(v)
 /* function names */
 #define	LNAMES			/* flag */
 
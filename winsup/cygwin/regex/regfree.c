@@ -34,5 +34,18 @@ regex_t *preg;
 		free((char *)g->setbits);
 	if (g->must != NULL)
 		free(g->must);
+	if (g->mjump != NULL)
+		free((char *)g->mjump);
+	if (g->prefix != NULL)
+		free(g->prefix);
+	if (g->pjump != NULL)
+		free((char *)g->pjump);
+	if (g->dfa != NULL) {
+		free(g->dfa->sets);
+		free(g->dfa->accept);
+		free((char *)g->dfa->trans);
+		free((char *)g->dfa->hash);
+		free((char *)g->dfa);
+	}
 	free((char *)g);
 }
@@ -18,6 +18,11 @@ details. */
 #include "cygerrno.h"
 #include "pinfo.h"
 #include "psapi.h"
+#include "security.h"
+#include "fhandler.h"
+#include "path.h"
+#include "dtable.h"
+#include "cygheap.h"
 
 /* add timeval values */
 static void
@@ -137,8 +142,6 @@ getrlimit (int resource, struct rlimit *rlp)
       break;
     case RLIMIT_NOFILE:
       rlp->rlim_cur = getdtablesize ();
-      if (rlp->rlim_cur < OPEN_MAX)
-	rlp->rlim_cur = OPEN_MAX;
       break;
     case RLIMIT_CORE:
       rlp->rlim_cur = rlim_core;
@@ -179,9 +182,9 @@ setrlimit (int resource, const struct rlimit *rlp)
       rlim_core = rlp->rlim_cur;
       break;
     case RLIMIT_NOFILE:
-      if (rlp->rlim_cur != RLIM_INFINITY)
-	return setdtablesize (rlp->rlim_cur);
-      break;
+      /* There is no hard limit, so rlim_max is not checked. */
+      return cygheap->fdtab.setlimit (rlp->rlim_cur == RLIM_INFINITY
+				      ? NOFILE_MAX : rlp->rlim_cur);
     default:
       set_errno (EINVAL);
       return -1;
@@ -21,6 +21,7 @@ details. */
 
 #include "winsup.h"
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <stdlib.h>
 #include <sys/time.h>
 
@@ -42,6 +43,8 @@ details. */
 #include "perthread.h"
 #include "tty.h"
 #include "cygthread.h"
+#include "af_local.h"
+#include "syscall_stats.h"
 
 /*
  * All these defines below should be in sys/types.h
@@ -98,6 +101,7 @@ extern "C" int
 cygwin_select (int maxfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
 	       struct timeval *to)
 {
+  syscall_timer timer (SC_SELECT);
   select_stuff sel;
   fd_set *dummy_readfds = allocfd_set (maxfds);
   fd_set *dummy_writefds = allocfd_set (maxfds);
@@ -1373,9 +1377,63 @@ socket_cleanup (select_record *, select_stuff *stuff)
   select_printf ("returning");
 }
 
+/* AF_LOCAL sockets using the shared memory transport don't need the
+   winsock select thread.  We wait for the transport's events directly.
+   The transport raises its select event whenever the socket may have
+   become readable or writable, so reading and writing can be waited for
+   together. */
+static int
+peek_local_socket (select_record *me, bool)
+{
+  fhandler_socket *fh = (fhandler_socket *) me->fh;
+  af_local_conn *lc = fh->get_local_conn ();
+  af_local_dgram *ld = fh->get_local_dgram ();
+
+  if (cygheap->fdtab.not_open (me->fd))
+    {
+      me->saw_error = true;
+      set_sig_errno (EBADF);
+      return -1;
+    }
+  ResetEvent (lc ? lc->select_event () : ld->select_event ());
+  if (me->read_selected && !me->read_ready)
+    me->read_ready = lc ? lc->readable () : ld->readable ();
+  if (me->write_selected && !me->write_ready)
+    me->write_ready = lc ? lc->writable () : ld->writable ();
+  return me->read_ready || me->write_ready;
+}
+
+static int
+verify_local_socket (select_record *me, fd_set *readfds, fd_set *writefds,
+		     fd_set *exceptfds)
+{
+  peek_local_socket (me, true);
+  return set_bits (me, readfds, writefds, exceptfds);
+}
+
+static select_record *
+select_local_socket (select_record *s, HANDLE h)
+{
+  if (!s)
+    s = new select_record;
+  s->startup = no_startup;
+  s->peek = peek_local_socket;
+  s->verify = verify_local_socket;
+  s->h = h;
+  return s;
+}
+
 select_record *
 fhandler_socket::select_read (select_record *s)
 {
+  if (lconn || ldgram)
+    {
+      s = select_local_socket (s, lconn ? lconn->select_event ()
+					: ldgram->select_event ());
+      s->read_selected = true;
+      s->read_ready = saw_shutdown_read ();
+      return s;
+    }
   if (!s)
     {
       s = new select_record;
@@ -1392,6 +1450,14 @@ fhandler_socket::select_read (select_record *s)
 select_record *
 fhandler_socket::select_write (select_record *s)
 {
+  if (lconn || ldgram)
+    {
+      s = select_local_socket (s, lconn ? lconn->select_event ()
+					: ldgram->select_event ());
+      s->write_selected = true;
+      s->write_ready = saw_shutdown_write ();
+      return s;
+    }
   if (!s)
     {
       s = new select_record;
@@ -1413,6 +1479,16 @@ fhandler_socket::select_write (select_record *s)
 select_record *
 fhandler_socket::select_except (select_record *s)
 {
+  if (lconn || ldgram)
+    {
+      /* There's no out-of-band data on the shared memory transport. */
+      if (!s || !s->h)
+	s = select_local_socket (s, lconn ? lconn->select_event ()
+					  : ldgram->select_event ());
+      s->except_selected = true;
+      s->except_ready = saw_shutdown_write () || saw_shutdown_read ();
+      return s;
+    }
   if (!s)
     {
       s = new select_record;
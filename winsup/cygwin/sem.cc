@@ -1,6 +1,6 @@
 /* sem.cc: Single unix specification IPC interface for Cygwin.
 
-   Copyright 2002 Red Hat, Inc.
+   Copyright 2002, 2003 Red Hat, Inc.
 
    Written by Conrad Scott <conrad.scott@dsl.pipex.com>.
 
@@ -18,6 +18,961 @@ details. */
 
 #include "cygerrno.h"
 
+#ifdef USE_SERVER
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "safe_memory.h"
+#include "sigproc.h"
+
+#include "cygserver_ipc.h"
+#include "cygserver_sem.h"
+
+/* The fourth argument of semctl (), which the application has to
+ * declare itself.
+ */
+union semun
+{
+  int val;
+  struct semid_ds *buf;
+  unsigned short *array;
+};
+
+/*---------------------------------------------------------------------------*
+ * class client_semmgr
+ *
+ * A singleton class.
+ *
+ * semop (2) and the value commands of semctl (2) are performed on the
+ * set's mapping, which is attached on first use.  Only blocking
+ * operations ever wait, and then on an event of their own that is set
+ * by the process which changes the semaphore concerned.  The undo
+ * table, and a slot in it, are only requested by the first semop (2)
+ * with SEM_UNDO.
+ *---------------------------------------------------------------------------*/
+
+#define semmgr (client_semmgr::instance ())
+
+class client_semmgr
+{
+private:
+  class set_t
+  {
+  public:
+    const int semid;
+    const HANDLE hFileMap;
+    semset_shared_t *const shared;
+    long refcnt;		// The list holds one reference.
+
+    // Our view of the undo table and our slot in it, changed only
+    // with the set's lock held.  NULL until we first use SEM_UNDO.
+    HANDLE hUndoMap;
+    void *undo_view;
+    semset_slot_t *undo;
+    LONG undo_seq;
+
+    set_t *next;
+
+    set_t (const int semid, const HANDLE hFileMap,
+	   semset_shared_t *const shared)
+      : semid (semid), hFileMap (hFileMap), shared (shared), refcnt (1),
+	hUndoMap (NULL), undo_view (NULL), undo (NULL), undo_seq (0),
+	next (NULL)
+    {}
+  };
+
+public:
+  static client_semmgr & instance ();
+
+  int semctl (int semid, int semnum, int cmd, union semun);
+  int semget (key_t, int nsems, int semflg);
+  int semop (int semid, struct sembuf *, size_t nsops);
+
+private:
+  static NO_COPY client_semmgr *_instance;
+
+  CRITICAL_SECTION _sets_lock;
+  static NO_COPY set_t *_sets_head; // List of attached sets.
+
+  client_semmgr ();
+  ~client_semmgr ();
+
+  // Undefined (as this class is a singleton):
+  client_semmgr (const client_semmgr &);
+  client_semmgr & operator= (const client_semmgr &);
+
+  set_t *attach (int semid);
+  int attach_undo (set_t *);
+  void release (set_t *);
+  void forget (int semid);
+
+  int semctl_values (int semid, int semnum, int cmd, union semun);
+};
+
+/* static */ NO_COPY client_semmgr *client_semmgr::_instance;
+
+/* The list of attached sets is not inherited by child processes: the
+ * mapping handles are not inheritable and a child doesn't inherit its
+ * parent's semadj values either.  The child attaches on first use.
+ */
+/* static */ NO_COPY client_semmgr::set_t *client_semmgr::_sets_head;
+
+/*---------------------------------------------------------------------------*
+ * semop_shared ()
+ *
+ * Perform either all of the operations or none of them.  Returns 0,
+ * an errno value or, if one of the operations would block, EAGAIN
+ * with the index of that operation in `blocked'.  Called with the
+ * set's lock held.  `undo' is our undo slot, which is only needed if
+ * one of the operations has SEM_UNDO set.
+ *---------------------------------------------------------------------------*/
+
+static int
+semop_shared (semset_shared_t *const shared, semset_slot_t *const undo,
+	      const struct sembuf *const ops, const size_t nsops,
+	      size_t & blocked)
+{
+  semset_sem_t *const sem = shared->sem ();
+
+  int result = 0;
+  size_t i;
+
+  for (i = 0; i < nsops; i++)
+    {
+      const struct sembuf & op = ops[i];
+      const int semval = sem[op.sem_num].semval + op.sem_op;
+
+      if (op.sem_op ? semval < 0 : sem[op.sem_num].semval != 0)
+	{
+	  blocked = i;
+	  result = EAGAIN;
+	  break;
+	}
+
+      if (semval > SEMVMX)
+	{
+	  result = ERANGE;
+	  break;
+	}
+
+      if (op.sem_flg & SEM_UNDO)
+	{
+	  semset_adj_t & semadj = undo->semadj[op.sem_num];
+
+	  // Values from before the last SETVAL or SETALL don't count.
+	  if (semadj.gen != sem[op.sem_num].adjgen)
+	    {
+	      semadj.gen = sem[op.sem_num].adjgen;
+	      semadj.value = 0;
+	    }
+
+	  const int adj = semadj.value - op.sem_op;
+
+	  if (adj < -SEMAEM || adj > SEMAEM)
+	    {
+	      result = ERANGE;
+	      break;
+	    }
+	  semadj.value = adj;
+	}
+
+      sem[op.sem_num].semval = semval;
+    }
+
+  if (result)
+    {
+      // Roll back the operations already performed.
+      while (i-- > 0)
+	{
+	  sem[ops[i].sem_num].semval -= ops[i].sem_op;
+	  if (ops[i].sem_flg & SEM_UNDO)
+	    undo->semadj[ops[i].sem_num].value += ops[i].sem_op;
+	}
+      return result;
+    }
+
+  const pid_t pid = getpid ();
+  bool changed = false;
+
+  for (i = 0; i < nsops; i++)
+    {
+      sem[ops[i].sem_num].sempid = pid;
+      if (ops[i].sem_op)
+	changed = true;
+    }
+  shared->otime = time (NULL);
+
+  // Wake up whoever waits on one of the semaphores that changed.
+  if (changed)
+    for (int w = 0; w < IPC_WAITERS; w++)
+      if (shared->waiters[w].winpid)
+	for (i = 0; i < nsops; i++)
+	  if (ops[i].sem_op
+	      && (shared->waiters[w].what & ~SEM_WAITZERO) == ops[i].sem_num)
+	    {
+	      ipc_wake (shared->waiters[w]);
+	      break;
+	    }
+
+  return 0;
+}
+
+/*---------------------------------------------------------------------------*
+ * client_semmgr::instance ()
+ *---------------------------------------------------------------------------*/
+
+client_semmgr &
+client_semmgr::instance ()
+{
+  if (!_instance)
+    _instance = safe_new0 (client_semmgr);
+
+  assert (_instance);
+
+  return *_instance;
+}
+
+/*---------------------------------------------------------------------------*
+ * client_semmgr::semctl ()
+ *---------------------------------------------------------------------------*/
+
+int
+client_semmgr::semctl (const int semid, const int semnum, const int cmd,
+		       const union semun arg)
+{
+  syscall_printf ("semctl (semid = %d, semnum = %d, cmd = 0x%x)",
+		  semid, semnum, cmd);
+
+  // Check parameters and set up in parameters as required.
+
+  const struct semid_ds *in_buf = NULL;
+
+  switch (cmd)
+    {
+    case GETVAL:
+    case GETPID:
+    case GETNCNT:
+    case GETZCNT:
+    case GETALL:
+    case SETVAL:
+    case SETALL:
+      return semctl_values (semid, semnum, cmd, arg);
+
+    case IPC_SET:
+      if (__check_invalid_read_ptr_errno (arg.buf, sizeof (struct semid_ds)))
+	{
+	  syscall_printf (("-1 [EFAULT] = "
+			   "semctl (semid = %d, semnum = %d, cmd = 0x%x)"),
+			  semid, semnum, cmd);
+	  set_errno (EFAULT);
+	  return -1;
+	}
+      in_buf = arg.buf;
+      break;
+
+    case IPC_STAT:
+    case SEM_STAT:
+      if (__check_null_invalid_struct_errno (arg.buf,
+					     sizeof (struct semid_ds)))
+	{
+	  syscall_printf (("-1 [EFAULT] = "
+			   "semctl (semid = %d, semnum = %d, cmd = 0x%x)"),
+			  semid, semnum, cmd);
+	  set_errno (EFAULT);
+	  return -1;
+	}
+      break;
+
+    case IPC_INFO:
+      if (__check_null_invalid_struct_errno (arg.buf,
+					     sizeof (struct seminfo)))
+	{
+	  syscall_printf (("-1 [EFAULT] = "
+			   "semctl (semid = %d, semnum = %d, cmd = 0x%x)"),
+			  semid, semnum, cmd);
+	  set_errno (EFAULT);
+	  return -1;
+	}
+      break;
+
+    case SEM_INFO:
+      if (__check_null_invalid_struct_errno (arg.buf,
+					     sizeof (struct sem_info)))
+	{
+	  syscall_printf (("-1 [EFAULT] = "
+			   "semctl (semid = %d, semnum = %d, cmd = 0x%x)"),
+			  semid, semnum, cmd);
+	  set_errno (EFAULT);
+	  return -1;
+	}
+      break;
+    }
+
+  // Create and issue the command.
+
+  client_request_sem request (semid, cmd, in_buf);
+
+  if (request.make_request () == -1 || request.error_code ())
+    {
+      syscall_printf (("-1 [%d] = "
+		       "semctl (semid = %d, semnum = %d, cmd = 0x%x)"),
+		      request.error_code (), semid, semnum, cmd);
+      set_errno (request.error_code ());
+      return -1;
+    }
+
+  // Some commands require special processing for their out parameters.
+
+  int result = 0;
+
+  switch (cmd)
+    {
+    case IPC_STAT:
+      *arg.buf = request.ds ();
+      break;
+
+    case IPC_RMID:
+      forget (semid);
+      break;
+
+    case IPC_INFO:
+      *(struct seminfo *) arg.buf = request.seminfo ();
+      break;
+
+    case SEM_STAT:		// ipcs(8) i'face.
+      result = request.semid ();
+      *arg.buf = request.ds ();
+      break;
+
+    case SEM_INFO:		// ipcs(8) i'face.
+      result = request.semid ();
+      *(struct sem_info *) arg.buf = request.sem_info ();
+      break;
+    }
+
+  syscall_printf ("%d = semctl (semid = %d, semnum = %d, cmd = 0x%x)",
+		  result, semid, semnum, cmd);
+
+  return result;
+}
+
+/*---------------------------------------------------------------------------*
+ * client_semmgr::semget ()
+ *---------------------------------------------------------------------------*/
+
+int
+client_semmgr::semget (const key_t key, const int nsems, const int semflg)
+{
+  syscall_printf ("semget (key = 0x%016X, nsems = %d, semflg = 0%o)",
+		  key, nsems, semflg);
+
+  client_request_sem request (key, nsems, semflg);
+
+  if (request.make_request () == -1 || request.error_code ())
+    {
+      syscall_printf (("-1 [%d] = "
+		       "semget (key = 0x%016X, nsems = %d, semflg = 0%o)"),
+		      request.error_code (),
+		      key, nsems, semflg);
+      set_errno (request.error_code ());
+      return -1;
+    }
+
+  syscall_printf (("%d = semget (key = 0x%016X, nsems = %d, semflg = 0%o)"),
+		  request.semid (),
+		  key, nsems, semflg);
+
+  return request.semid ();
+}
+
+/*---------------------------------------------------------------------------*
+ * client_semmgr::semop ()
+ *
+ * The common case runs entirely in the set's mapping.  An operation
+ * that has to block enters the set's wait list and sleeps until some
+ * other process changes the semaphore it waits on, then tries again.
+ *---------------------------------------------------------------------------*/
+
+int
+client_semmgr::semop (const int semid,
+		      struct sembuf *const sops,
+		      const size_t nsops)
+{
+  syscall_printf ("semop (semid = %d, sops = %p, nsops = %u)",
+		  semid, sops, nsops);
+
+  if (!nsops || nsops > SEMOPM)
+    {
+      const int error = nsops ? E2BIG : EINVAL;
+      syscall_printf ("-1 [%d] = semop (semid = %d, sops = %p, nsops = %u)",
+		      error, semid, sops, nsops);
+      set_errno (error);
+      return -1;
+    }
+
+  if (__check_invalid_read_ptr_errno (sops, nsops * sizeof (struct sembuf)))
+    {
+      syscall_printf (("-1 [EFAULT] = "
+		       "semop (semid = %d, sops = %p, nsops = %u)"),
+		      semid, sops, nsops);
+      set_errno (EFAULT);
+      return -1;
+    }
+
+  // Nothing may fault while the set's lock is held.
+  struct sembuf ops[SEMOPM];
+  memcpy (ops, sops, nsops * sizeof (struct sembuf));
+
+  set_t *const setptr = attach (semid);
+
+  if (!setptr)
+    {
+      syscall_printf ("-1 [%d] = semop (semid = %d, sops = %p, nsops = %u)",
+		      get_errno (), semid, sops, nsops);
+      return -1;
+    }
+
+  semset_shared_t *const shared = setptr->shared;
+
+  int result = 0;
+  bool undo = false;
+
+  for (size_t i = 0; i < nsops; i++)
+    if (ops[i].sem_num >= shared->nsems)
+      result = EFBIG;
+    else if (ops[i].sem_flg & SEM_UNDO)
+      undo = true;
+
+  if (!result)
+    {
+      ipc_lock_shared (shared->lock);
+
+      for (;;)
+	{
+	  size_t blocked = 0;
+
+	  if (shared->deleted)
+	    result = EIDRM;
+	  else if (undo && (!setptr->undo
+			    || setptr->undo_seq != shared->undo_seq))
+	    {
+	      // We have no undo slot yet, or the table has been replaced.
+	      ipc_unlock_shared (shared->lock);
+	      result = attach_undo (setptr);
+	      ipc_lock_shared (shared->lock);
+	      if (result)
+		break;
+	      continue;
+	    }
+	  else
+	    result = semop_shared (shared, setptr->undo, ops, nsops, blocked);
+
+	  if (result != EAGAIN || (ops[blocked].sem_flg & IPC_NOWAIT))
+	    break;
+
+	  semset_sem_t *const semptr = shared->sem () + ops[blocked].sem_num;
+	  const int what = (ops[blocked].sem_num
+			    | (ops[blocked].sem_op ? 0 : SEM_WAITZERO));
+
+	  if ((result = ipc_wait (shared->lock, shared->waiters, what,
+				  (ops[blocked].sem_op
+				   ? &semptr->npoll : &semptr->zpoll))))
+	    break;
+	}
+
+      ipc_unlock_shared (shared->lock);
+    }
+
+  release (setptr);
+
+  if (result == EIDRM)
+    forget (semid);
+
+  if (result)
+    {
+      syscall_printf ("-1 [%d] = semop (semid = %d, sops = %p, nsops = %u)",
+		      result, semid, sops, nsops);
+      set_errno (result);
+      return -1;
+    }
+
+  syscall_printf ("0 = semop (semid = %d, sops = %p, nsops = %u)",
+		  semid, sops, nsops);
+
+  return 0;
+}
+
+/*---------------------------------------------------------------------------*
+ * client_semmgr::client_semmgr ()
+ *---------------------------------------------------------------------------*/
+
+client_semmgr::client_semmgr ()
+{
+  InitializeCriticalSection (&_sets_lock);
+}
+
+/*---------------------------------------------------------------------------*
+ * client_semmgr::~client_semmgr ()
+ *---------------------------------------------------------------------------*/
+
+client_semmgr::~client_semmgr ()
+{
+  DeleteCriticalSection (&_sets_lock);
+}
+
+/*---------------------------------------------------------------------------*
+ * client_semmgr::attach ()
+ *
+ * Return the set with an additional reference, attaching to it via
+ * cygserver if this process hasn't done so yet.
+ *---------------------------------------------------------------------------*/
+
+client_semmgr::set_t *
+client_semmgr::attach (const int semid)
+{
+  EnterCriticalSection (&_sets_lock);
+
+  set_t *setptr;
+
+  for (setptr = _sets_head; setptr; setptr = setptr->next)
+    if (setptr->semid == semid)
+      break;
+
+  if (!setptr)
+    {
+      client_request_sem request (client_request_sem::SEMOP_semattach,
+				  semid);
+
+      if (request.make_request () == -1 || request.error_code ())
+	{
+	  LeaveCriticalSection (&_sets_lock);
+	  set_errno (request.error_code ());
+	  return NULL;
+	}
+
+      void *const ptr =
+	MapViewOfFile (request.hFileMap (), FILE_MAP_WRITE, 0, 0, 0);
+
+      if (!ptr)
+	{
+	  syscall_printf ("failed to map view [semid = %d, handle = %p]: %E",
+			  semid, request.hFileMap ());
+	  (void) CloseHandle (request.hFileMap ());
+	  LeaveCriticalSection (&_sets_lock);
+	  set_errno (EINVAL);	// FIXME
+	  return NULL;
+	}
+
+      setptr = safe_new (set_t, semid, request.hFileMap (),
+			 (semset_shared_t *) ptr);
+
+      assert (setptr);
+
+      setptr->next = _sets_head;
+      _sets_head = setptr;
+    }
+
+  setptr->refcnt += 1;
+
+  LeaveCriticalSection (&_sets_lock);
+
+  return setptr;
+}
+
+/*---------------------------------------------------------------------------*
+ * client_semmgr::attach_undo ()
+ *
+ * Get an undo slot from cygserver, or map the undo table again after
+ * it has grown.  Returns 0 or an errno value.  The caller rechecks
+ * `undo_seq', as the table may have grown again in the meantime.
+ *---------------------------------------------------------------------------*/
+
+int
+client_semmgr::attach_undo (set_t *const setptr)
+{
+  EnterCriticalSection (&_sets_lock);
+
+  client_request_sem request (client_request_sem::SEMOP_semundo,
+			      setptr->semid);
+
+  if (request.make_request () == -1 || request.error_code ())
+    {
+      LeaveCriticalSection (&_sets_lock);
+      return request.error_code ();
+    }
+
+  void *const ptr =
+    MapViewOfFile (request.hFileMap (), FILE_MAP_WRITE, 0, 0, 0);
+
+  if (!ptr)
+    {
+      syscall_printf (("failed to map undo table "
+		       "[semid = %d, handle = %p]: %E"),
+		      setptr->semid, request.hFileMap ());
+      (void) CloseHandle (request.hFileMap ());
+      LeaveCriticalSection (&_sets_lock);
+      return ENOMEM;
+    }
+
+  const HANDLE old_map = setptr->hUndoMap;
+  void *const old_view = setptr->undo_view;
+
+  ipc_lock_shared (setptr->shared->lock);
+  setptr->hUndoMap = request.hFileMap ();
+  setptr->undo_view = ptr;
+  setptr->undo = (semset_slot_t *)
+    ((char *) ptr
+     + request.slot () * semset_shared_t::slot_size (setptr->shared->nsems));
+  setptr->undo_seq = request.undo_seq ();
+  ipc_unlock_shared (setptr->shared->lock);
+
+  LeaveCriticalSection (&_sets_lock);
+
+  if (old_view)
+    {
+      (void) UnmapViewOfFile (old_view);
+      (void) CloseHandle (old_map);
+    }
+
+  return 0;
+}
+
+/*---------------------------------------------------------------------------*
+ * client_semmgr::release ()
+ *---------------------------------------------------------------------------*/
+
+void
+client_semmgr::release (set_t *const setptr)
+{
+  EnterCriticalSection (&_sets_lock);
+
+  assert (setptr->refcnt > 0);
+
+  const bool last = !--setptr->refcnt;
+
+  LeaveCriticalSection (&_sets_lock);
+
+  if (!last)
+    return;
+
+  if (!UnmapViewOfFile (setptr->shared))
+    syscall_printf ("failed to unmap view [semid = %d, shared = %p]: %E",
+		    setptr->semid, setptr->shared);
+
+  if (!CloseHandle (setptr->hFileMap))
+    syscall_printf (("failed to close file map handle "
+		     "[semid = %d, handle = %p]: %E"),
+		    setptr->semid, setptr->hFileMap);
+
+  if (setptr->undo_view)
+    {
+      (void) UnmapViewOfFile (setptr->undo_view);
+      (void) CloseHandle (setptr->hUndoMap);
+    }
+
+  safe_delete (setptr);
+}
+
+/*---------------------------------------------------------------------------*
+ * client_semmgr::forget ()
+ *
+ * Drop a set that has been removed from the list of attached sets.
+ *---------------------------------------------------------------------------*/
+
+void
+client_semmgr::forget (const int semid)
+{
+  EnterCriticalSection (&_sets_lock);
+
+  set_t *previous = NULL;
+  set_t *setptr;
+
+  for (setptr = _sets_head; setptr; previous = setptr, setptr = setptr->next)
+    if (setptr->semid == semid)
+      break;
+
+  if (setptr)
+    {
+      if (previous)
+	previous->next = setptr->next;
+      else
+	_sets_head = setptr->next;
+    }
+
+  LeaveCriticalSection (&_sets_lock);
+
+  if (setptr)
+    release (setptr);
+}
+
+/*---------------------------------------------------------------------------*
+ * client_semmgr::semctl_values ()
+ *
+ * The semctl (2) commands that read or set semaphore values.
+ *---------------------------------------------------------------------------*/
+
+int
+client_semmgr::semctl_values (const int semid, const int semnum,
+			      const int cmd, const union semun arg)
+{
+  set_t *const setptr = attach (semid);
+
+  if (!setptr)
+    {
+      syscall_printf (("-1 [%d] = "
+		       "semctl (semid = %d, semnum = %d, cmd = 0x%x)"),
+		      get_errno (), semid, semnum, cmd);
+      return -1;
+    }
+
+  semset_shared_t *const shared = setptr->shared;
+  const int nsems = shared->nsems;
+  unsigned short values[SEMMSL];
+
+  int error = 0;
+  int result = 0;
+
+  if (cmd == GETALL || cmd == SETALL)
+    {
+      if (cmd == GETALL
+	  ? __check_null_invalid_struct_errno (arg.array,
+					       nsems * sizeof (*arg.array))
+	  : __check_invalid_read_ptr_errno (arg.array,
+					    nsems * sizeof (*arg.array)))
+	error = EFAULT;
+      else if (cmd == SETALL)
+	{
+	  memcpy (values, arg.array, nsems * sizeof (*values));
+	  for (int i = 0; i < nsems; i++)
+	    if (values[i] > SEMVMX)
+	      error = ERANGE;
+	}
+    }
+  else if (semnum < 0 || semnum >= nsems)
+    error = EINVAL;
+  else if (cmd == SETVAL && (arg.val < 0 || arg.val > SEMVMX))
+    error = ERANGE;
+
+  if (!error)
+    {
+      semset_sem_t *const sem = shared->sem ();
+
+      ipc_lock_shared (shared->lock);
+
+      if (shared->deleted)
+	error = EIDRM;
+      else
+	switch (cmd)
+	  {
+	  case GETVAL:
+	    result = sem[semnum].semval;
+	    break;
+
+	  case GETPID:
+	    result = sem[semnum].sempid;
+	    break;
+
+	  case GETNCNT:
+	  case GETZCNT:
+	    {
+	      const int what =
+		semnum | (cmd == GETZCNT ? SEM_WAITZERO : 0);
+
+	      for (int w = 0; w < IPC_WAITERS; w++)
+		if (shared->waiters[w].winpid
+		    && shared->waiters[w].what == what)
+		  result += 1;
+	      // Those which found the wait list full poll instead.
+	      result += (cmd == GETZCNT
+			 ? sem[semnum].zpoll : sem[semnum].npoll);
+	    }
+	    break;
+
+	  case GETALL:
+	    for (int i = 0; i < nsems; i++)
+	      values[i] = sem[i].semval;
+	    break;
+
+	  case SETVAL:
+	  case SETALL:
+	    {
+	      const pid_t pid = getpid ();
+
+	      for (int i = 0; i < nsems; i++)
+		if (cmd == SETALL || i == semnum)
+		  {
+		    sem[i].semval = cmd == SETALL ? values[i] : arg.val;
+		    sem[i].sempid = pid;
+		    sem[i].adjgen += 1; // Clears all semadj values.
+		  }
+	      shared->ctime = time (NULL);
+
+	      for (int w = 0; w < IPC_WAITERS; w++)
+		if (shared->waiters[w].winpid
+		    && (cmd == SETALL
+			|| ((shared->waiters[w].what & ~SEM_WAITZERO)
+			    == semnum)))
+		  ipc_wake (shared->waiters[w]);
+	    }
+	    break;
+	  }
+
+      ipc_unlock_shared (shared->lock);
+    }
+
+  release (setptr);
+
+  if (error == EIDRM)
+    forget (semid);
+
+  if (error)
+    {
+      syscall_printf (("-1 [%d] = "
+		       "semctl (semid = %d, semnum = %d, cmd = 0x%x)"),
+		      error, semid, semnum, cmd);
+      set_errno (error);
+      return -1;
+    }
+
+  if (cmd == GETALL)
+    memcpy (arg.array, values, nsems * sizeof (*values));
+
+  syscall_printf ("%d = semctl (semid = %d, semnum = %d, cmd = 0x%x)",
+		  result, semid, semnum, cmd);
+
+  return result;
+}
+
+/*---------------------------------------------------------------------------*
+ * semctl ()
+ *---------------------------------------------------------------------------*/
+
+extern "C" int
+semctl (const int semid, const int semnum, const int cmd, ...)
+{
+  union semun arg;
+
+  arg.buf = NULL;
+
+  switch (cmd)
+    {
+    case IPC_STAT:
+    case IPC_SET:
+    case IPC_INFO:
+    case SEM_STAT:
+    case SEM_INFO:
+    case GETALL:
+    case SETVAL:
+    case SETALL:
+      {
+	va_list ap;
+	va_start (ap, cmd);
+	arg = va_arg (ap, union semun);
+	va_end (ap);
+      }
+      break;
+    }
+
+  sigframe thisframe (mainthread);
+  return semmgr.semctl (semid, semnum, cmd, arg);
+}
+
+/*---------------------------------------------------------------------------*
+ * semget ()
+ *---------------------------------------------------------------------------*/
+
+extern "C" int
+semget (const key_t key, const int nsems, const int semflg)
+{
+  sigframe thisframe (mainthread);
+  return semmgr.semget (key, nsems, semflg);
+}
+
+/*---------------------------------------------------------------------------*
+ * semop ()
+ *---------------------------------------------------------------------------*/
+
+extern "C" int
+semop (const int semid, struct sembuf *const sops, const size_t nsops)
+{
+  sigframe thisframe (mainthread);
+  return semmgr.semop (semid, sops, nsops);
+}
+
+/*---------------------------------------------------------------------------*
+ * client_request_sem::client_request_sem ()
+ *---------------------------------------------------------------------------*/
+
+client_request_sem::client_request_sem (const semop_t semop,
+					const int semid)
+  : client_request (CYGSERVER_REQUEST_SEM, &_parameters, sizeof (_parameters))
+{
+  assert (semop == SEMOP_semattach || semop == SEMOP_semundo);
+
+  _parameters.in.semop = semop;
+
+  _parameters.in.semid = semid;
+
+  _parameters.in.cygpid = getpid ();
+  _parameters.in.winpid = GetCurrentProcessId ();
+  _parameters.in.uid = geteuid32 ();
+  _parameters.in.gid = getegid32 ();
+
+  msglen (sizeof (_parameters.in));
+}
+
+/*---------------------------------------------------------------------------*
+ * client_request_sem::client_request_sem ()
+ *---------------------------------------------------------------------------*/
+
+client_request_sem::client_request_sem (const int semid,
+					const int cmd,
+					const struct semid_ds *const buf)
+  : client_request (CYGSERVER_REQUEST_SEM, &_parameters, sizeof (_parameters))
+{
+  _parameters.in.semop = SEMOP_semctl;
+
+  _parameters.in.semid = semid;
+  _parameters.in.cmd = cmd;
+  if (buf)
+    _parameters.in.ds = *buf;
+
+  _parameters.in.cygpid = getpid ();
+  _parameters.in.winpid = GetCurrentProcessId ();
+  _parameters.in.uid = geteuid32 ();
+  _parameters.in.gid = getegid32 ();
+
+  msglen (sizeof (_parameters.in));
+}
+
+/*---------------------------------------------------------------------------*
+ * client_request_sem::client_request_sem ()
+ *---------------------------------------------------------------------------*/
+
+client_request_sem::client_request_sem (const key_t key,
+					const int nsems,
+					const int semflg)
+  : client_request (CYGSERVER_REQUEST_SEM, &_parameters, sizeof (_parameters))
+{
+  _parameters.in.semop = SEMOP_semget;
+
+  _parameters.in.key = key;
+  _parameters.in.nsems = nsems;
+  _parameters.in.semflg = semflg;
+
+  _parameters.in.cygpid = getpid ();
+  _parameters.in.winpid = GetCurrentProcessId ();
+  _parameters.in.uid = geteuid32 ();
+  _parameters.in.gid = getegid32 ();
+
+  msglen (sizeof (_parameters.in));
+}
+
+#else /* !USE_SERVER */
+
 extern "C" int
 semctl (int semid, int semnum, int cmd, ...)
 {
@@ -38,3 +993,4 @@ semop (int semid, struct sembuf *sops, size_t nsops)
   set_errno (ENOSYS);
   return -1;
 }
+#endif /* !USE_SERVER */
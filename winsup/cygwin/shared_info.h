@@ -9,6 +9,7 @@ Cygwin license.  Please consult the file "CYGWIN_LICENSE" for
 details. */
 
 #include "tty.h"
+#include "loadavg.h"
 
 /* Mount table entry */
 
@@ -138,9 +139,9 @@ public:
 				  cygwin_version.api_minor)
 #define SHARED_VERSION_MAGIC CYGWIN_VERSION_MAGIC (SHARED_MAGIC, SHARED_VERSION)
 
-#define SHARED_INFO_CB 47112
+#define SHARED_INFO_CB 47224
 
-#define CURR_SHARED_MAGIC 0x359218a2U
+#define CURR_SHARED_MAGIC 0xd9653a8bU
 
 /* NOTE: Do not make gratuitous changes to the names or organization of the
    below class.  The layout is checksummed to determine compatibility between
@@ -155,6 +156,7 @@ class shared_info
 
   tty_list tty;
   delqueue_list delqueue;
+  loadavginfo loadavg;
   void initialize ();
   unsigned heap_chunk_size ();
 };
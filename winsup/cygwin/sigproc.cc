@@ -31,6 +31,7 @@ details. */
 #include "perthread.h"
 #include "shared_info.h"
 #include "cygthread.h"
+#include "syscall_stats.h"
 
 /*
  * Convenience defines
@@ -643,6 +644,7 @@ sigproc_terminate (void)
 int __stdcall
 sig_send (_pinfo *p, int sig, DWORD ebp, bool exception)
 {
+  syscall_timer timer (SC_SIG_SEND);
   int rc = 1;
   DWORD tid = GetCurrentThreadId ();
   BOOL its_me;
@@ -22,7 +22,7 @@ static char *
 rn (char *dst, int base, int dosign, long long val, int len, int pad)
 {
   /* longest number is ULLONG_MAX, 18446744073709551615, 20 digits */
-  unsigned uval;
+  unsigned long long uval;
   char res[20];
   static const char str[16] = "0123456789ABCDEF";
   int l = 0;
@@ -115,7 +115,7 @@ __small_vsprintf (char *dst, const char *fmt, va_list ap)
 		      {
 			*dst++ = '0';
 			*dst++ = 'x';
-			dst = rn (dst, 16, 0, c, len, pad);
+			dst = rn (dst, 16, 0, (unsigned) c, len, pad);
 		      }
 		  }
 		  break;
@@ -130,7 +130,7 @@ __small_vsprintf (char *dst, const char *fmt, va_list ap)
 		  dst = rn (dst, 10, addsign, va_arg (ap, long long), len, pad);
 		  break;
 		case 'u':
-		  dst = rn (dst, 10, 0, va_arg (ap, int), len, pad);
+		  dst = rn (dst, 10, 0, va_arg (ap, unsigned), len, pad);
 		  break;
 		case 'U':
 		  dst = rn (dst, 10, 0, va_arg (ap, long long), len, pad);
@@ -143,7 +143,7 @@ __small_vsprintf (char *dst, const char *fmt, va_list ap)
 		  *dst++ = 'x';
 		  /* fall through */
 		case 'x':
-		  dst = rn (dst, 16, 0, va_arg (ap, int), len, pad);
+		  dst = rn (dst, 16, 0, va_arg (ap, unsigned), len, pad);
 		  break;
 		case 'X':
 		  dst = rn (dst, 16, 0, va_arg (ap, long long), len, pad);
@@ -240,4 +240,18 @@ console_printf (const char *fmt,...)
   WriteFile (console_handle, buf, count, &done, NULL);
   FlushFileBuffers (console_handle);
 }
+
+/* Only %D, %U and %X take 64 bit arguments.  The others must not be sign
+   extended on their way to rn. */
+void
+small_printf_check ()
+{
+  char buf[80];
+
+  __small_sprintf (buf, "%x %u %p %c %X", 0xffffffff, 0xffffffff,
+		   (void *) 0xffffffff, -1, 0xffffffffffffffffULL);
+  if (strcmp (buf, "FFFFFFFF 4294967295 0xFFFFFFFF 0xFFFFFFFF "
+		   "FFFFFFFFFFFFFFFF"))
+    console_printf ("__small_sprintf is broken: %s\n", buf);
+}
 #endif
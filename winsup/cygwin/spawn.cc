@@ -34,6 +34,7 @@ details. */
 #include "registry.h"
 #include "environ.h"
 #include "cygthread.h"
+#include "syscall_stats.h"
 
 #define LINE_BUF_CHUNK (MAX_PATH * 2)
 
@@ -327,6 +328,7 @@ static int __stdcall
 spawn_guts (const char * prog_arg, const char *const *argv,
 	    const char *const envp[], int mode)
 {
+  syscall_timer timer (SC_SPAWN);
   BOOL rc;
   pid_t cygpid;
   sigframe thisframe (mainthread);
@@ -606,7 +608,8 @@ spawn_guts (const char * prog_arg, const char *const *argv,
      parent after CreateProcess and before copying the datastructures
      to the child. So we have to start the child in suspend state,
      unfortunately, to avoid a race condition. */
-  if (cygheap->fdtab.need_fixup_before ())
+  bool fixup_before = cygheap->fdtab.need_fixup_before ();
+  if (fixup_before)
     flags |= CREATE_SUSPENDED;
 
 
@@ -635,7 +638,7 @@ spawn_guts (const char * prog_arg, const char *const *argv,
       PSECURITY_ATTRIBUTES sec_attribs = sec_user_nih (sa_buf);
       ciresrv.moreinfo->envp = build_env (envp, envblock, ciresrv.moreinfo->envc,
 					  real_path.iscygexec ());
-      newheap = cygheap_setup_for_child (&ciresrv, cygheap->fdtab.need_fixup_before ());
+      newheap = cygheap_setup_for_child (&ciresrv, fixup_before);
       rc = CreateProcess (runpath,	/* image name - with full path */
 			  one_line.buf,	/* what was passed to exec */
 			  sec_attribs,	/* process security attrs */
@@ -676,7 +679,7 @@ spawn_guts (const char * prog_arg, const char *const *argv,
 
       ciresrv.moreinfo->envp = build_env (envp, envblock, ciresrv.moreinfo->envc,
 					  real_path.iscygexec ());
-      newheap = cygheap_setup_for_child (&ciresrv, cygheap->fdtab.need_fixup_before ());
+      newheap = cygheap_setup_for_child (&ciresrv, fixup_before);
       rc = CreateProcessAsUser (cygheap->user.token (),
 		       runpath,		/* image name - with full path */
 		       one_line.buf,	/* what was passed to exec */
@@ -714,7 +717,7 @@ spawn_guts (const char * prog_arg, const char *const *argv,
 
   /* Fixup the parent datastructure if needed and resume the child's
      main thread. */
-  if (!cygheap->fdtab.need_fixup_before ())
+  if (!fixup_before)
     cygheap_setup_for_child_cleanup (newheap, &ciresrv, 0);
   else
     {
@@ -741,6 +744,9 @@ spawn_guts (const char * prog_arg, const char *const *argv,
 
   if (mode == _P_OVERLAY)
     {
+      /* This process only waits for the new one from here on, and never
+	 returns. */
+      timer.stop ();
       /* These are both duplicated in the child code.  We do this here,
 	 primarily for strace. */
       strace.execing = 1;
@@ -756,6 +762,8 @@ spawn_guts (const char * prog_arg, const char *const *argv,
       pinfo child (cygpid, 1);
       if (!child)
 	{
+	  if (fixup_before)
+	    cygheap->fdtab.fixup_before_failed (true);
 	  set_errno (EAGAIN);
 	  syscall_printf ("-1 = spawnve (), process table full");
 	  return -1;
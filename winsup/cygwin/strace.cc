@@ -33,14 +33,43 @@ class strace NO_COPY strace;
 
 #ifndef NOSTRACE
 
+/* Tell strace.exe where our activation flag lives.  It writes 1 to it,
+   or _STRACE_INTERFACE_RING if it has created a ring buffer for us. */
 void
-strace::hello ()
+strace::activate ()
 {
-  char buf[30];
+  char buf[40];
+
+  __small_sprintf (buf, "cYg%8x %x", _STRACE_INTERFACE_ACTIVATE_ADDR, &active);
+  OutputDebugString (buf);
+
+  if (active != _STRACE_INTERFACE_RING)
+    return;
+
+  __small_sprintf (buf, _STRACE_RING_NAME, GetCurrentProcessId ());
+  HANDLE h = OpenFileMapping (FILE_MAP_WRITE, FALSE, buf);
+  if (h)
+    {
+      _strace_ring *r = (_strace_ring *) MapViewOfFile (h, FILE_MAP_WRITE,
+							0, 0, 0);
+      if (r && r->magic == _STRACE_RING_MAGIC)
+	ring = r;
+      else if (r)
+	UnmapViewOfFile (r);
+      CloseHandle (h);
+    }
+  active = 1;
+}
 
+void
+strace::hello ()
+{
   if (inited)
     {
       active ^= 1;
+      /* Give an attached strace.exe the chance to set up a ring buffer. */
+      if (active && !ring && being_debugged ())
+	activate ();
       return;
     }
 
@@ -48,8 +77,7 @@ strace::hello ()
   if (!being_debugged ())
     return;
 
-  __small_sprintf (buf, "cYg%8x %x", _STRACE_INTERFACE_ACTIVATE_ADDR, &active);
-  OutputDebugString (buf);
+  activate ();
 
   if (active)
     {
@@ -111,6 +139,23 @@ getfunc (char *in_dst, const char *func)
 
 extern "C" char *__progname;
 
+static void __stdcall
+getprogname (char *progname)
+{
+  char *p, *pn = __progname ?: (myself ? myself->progname : NULL);
+  if (!pn)
+    p = (char *) "*** unknown ***";
+  else if ((p = strrchr (pn, '\\')) != NULL)
+    p++;
+  else if ((p = strrchr (pn, '/')) != NULL)
+    p++;
+  else
+    p = pn;
+  strcpy (progname, p);
+  if ((p = strrchr (progname, '.')) != NULL && strcasematch (p, ".exe"))
+    *p = '\000';
+}
+
 /* sprintf analog for use by output routines. */
 int
 strace::vsprntf (char *buf, const char *func, const char *infmt, va_list ap)
@@ -120,7 +165,6 @@ strace::vsprntf (char *buf, const char *func, const char *infmt, va_list ap)
   static NO_COPY int nonewline = FALSE;
   DWORD err = GetLastError ();
   const char *tn = cygthread::name ();
-  char *pn = __progname ?: (myself ? myself->progname : NULL);
 
   int microsec = microseconds ();
   lmicrosec = microsec;
@@ -134,17 +178,7 @@ strace::vsprntf (char *buf, const char *func, const char *infmt, va_list ap)
   else
     {
       char *p, progname[MAX_PATH + 1];
-      if (!pn)
-	p = (char *) "*** unknown ***";
-      else if ((p = strrchr (pn, '\\')) != NULL)
-	p++;
-      else if ((p = strrchr (pn, '/')) != NULL)
-	p++;
-      else
-	p = pn;
-      strcpy (progname, p);
-      if ((p = strrchr (progname, '.')) != NULL && strcasematch (p, ".exe"))
-	*p = '\000';
+      getprogname (progname);
       p = progname;
       count = __small_sprintf (buf, fmt, p && *p ? p : "?",
 			       myself->pid ?: GetCurrentProcessId (),
@@ -193,6 +227,116 @@ strace::write (unsigned category, const char *buf, int count)
 #undef PREFIX
 }
 
+/* Copy a string argument into the event's string area.  Returns its
+   offset, truncating it if the area is full. */
+static unsigned long __stdcall
+ring_str (_strace_ring_event *ev, char *&s, const char *arg)
+{
+  char *e = ev->str + sizeof (ev->str) - 1;
+  unsigned long off = s - ev->str;
+
+  if (!arg)
+    return (unsigned long) -1;
+  while (*arg && s < e)
+    *s++ = *arg++;
+  *s = '\0';
+  if (s < e)
+    s++;
+  return off;
+}
+
+/* Record an event in the ring buffer without formatting it.  The
+   argument walk mirrors __small_vsprintf. */
+void
+strace::ring_record (unsigned category, const char *func, const char *fmt,
+		     va_list ap, unsigned long err)
+{
+  _strace_ring *r = ring;
+  long h;
+
+  if (!(r->mask & category)
+      && (!(r->mask & _STRACE_ALL) || (category & _STRACE_NOTALL)))
+    return;
+
+  do
+    {
+      h = r->head;
+      if ((unsigned long) (h - r->tail) >= r->nslots)
+	{
+	  InterlockedIncrement ((long *) &r->dropped);
+	  return;
+	}
+    }
+  while (InterlockedCompareExchange ((long *) &r->head, h + 1, h) != h);
+
+  if (!r->progname[0])
+    {
+      char progname[MAX_PATH + 1];
+      getprogname (progname);
+      strncpy (r->progname, progname, sizeof (r->progname) - 1);
+    }
+
+  _strace_ring_event *ev = r->ev + (h & (r->nslots - 1));
+  ev->category = category;
+  ev->usecs = lmicrosec = microseconds ();
+  ev->pid = myself->pid ?: GetCurrentProcessId ();
+  ev->err = err;
+  ev->func = func;
+  ev->fmt = fmt;
+  ev->execing = execing;
+
+  char *s = ev->str;
+  ring_str (ev, s, cygthread::name ());
+
+  unsigned n = 0;
+  char tmp[MAX_PATH + 1];
+  for (const char *p = fmt; *p && n < _STRACE_RING_MAXARGS - 1; )
+    {
+      if (*p++ != '%')
+	continue;
+      if (*p == '+')
+	p++;
+      else if (*p == '%')
+	{
+	  p++;
+	  continue;
+	}
+      while ((*p >= '0' && *p <= '9') || *p == 'l')
+	p++;
+      switch (*p++)
+	{
+	case 'c': case 'd': case 'u': case 'o': case 'p': case 'x':
+	  ev->args[n++] = va_arg (ap, unsigned long);
+	  break;
+	case 'D': case 'U': case 'X':
+	  {
+	    unsigned long long ll = va_arg (ap, unsigned long long);
+	    ev->args[n++] = (unsigned long) ll;
+	    ev->args[n++] = (unsigned long) (ll >> 32);
+	  }
+	  break;
+	case 'P':
+	  ev->args[n++] = ring_str (ev, s, GetModuleFileName (NULL, tmp, MAX_PATH)
+				    ? tmp : "cygwin program");
+	  break;
+	case '.':
+	  while (*p >= '0' && *p <= '9')
+	    p++;
+	  if (*p++ != 's')
+	    break;
+	  /* fall through */
+	case 's':
+	  ev->args[n++] = ring_str (ev, s, va_arg (ap, const char *));
+	  break;
+	case '\0':
+	  p--;
+	  break;
+	}
+    }
+  ev->nargs = n;
+  InterlockedExchange ((long *) &ev->seq, h + 1);
+}
+
 /* Printf function used when tracing system calls.
    Warning: DO NOT SET ERRNO HERE! */
 
@@ -203,6 +347,24 @@ strace::vprntf (unsigned category, const char *func, const char *fmt, va_list ap
   int count;
   char buf[10000];
 
+#ifndef NOSTRACE
+  /* Leave the formatting to strace.exe. */
+  if (active && ring)
+    {
+      /* ring_record walks the arguments, and a _STRACE_SYSTEM message
+	 needs them again below. */
+      va_list aq;
+      va_copy (aq, ap);
+      ring_record (category, func, fmt, aq, err);
+      va_end (aq);
+      if (!(category & _STRACE_SYSTEM))
+	{
+	  SetLastError (err);
+	  return;
+	}
+    }
+#endif
+
   PROTECT (buf);
   SetLastError (err);
 
@@ -216,7 +378,7 @@ strace::vprntf (unsigned category, const char *func, const char *fmt, va_list ap
     }
 
 #ifndef NOSTRACE
-  if (active)
+  if (active && !ring)
     write (category, buf, count);
 #endif
   SetLastError (err);
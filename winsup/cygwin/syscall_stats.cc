@@ -0,0 +1,157 @@
+/* syscall_stats.cc: call counts and latencies of the main entry points
+
+   Copyright 2003 Red Hat, Inc.
+
+This software is a copyrighted work licensed under the terms of the
+Cygwin license.  Please consult the file "CYGWIN_LICENSE" for
+details. */
+
+#include "winsup.h"
+#include <windows.h>
+#include <string.h>
+#include "syscall_stats.h"
+
+#undef CloseHandle
+
+const char *syscall_stat_names[SC_NSTATS] =
+{
+  "read",
+  "write",
+  "open",
+  "stat",
+  "path_conv",
+  "fork",
+  "spawn",
+  "select",
+  "sig_send"
+};
+
+/* Each thread records into a slot of its own, so that the counters
+   cost no more than the QueryPerformanceCounter calls around them.  A
+   thread takes over the slot of one which has exited, counts and all,
+   so nothing is lost.  Should SC_SLOTS threads be running at once,
+   the rest share the last slot under the lock.
+
+   The slots are allocated on first use rather than being a static
+   array, so as not to add their size to the DLL.  A forked child
+   starts again with none. */
+#define SC_SLOTS 64
+
+struct syscall_slot
+{
+  HANDLE thread;
+  syscall_stats stats;
+};
+
+static NO_COPY syscall_slot *slots;
+static NO_COPY DWORD slot_tls = TLS_OUT_OF_INDEXES;
+static NO_COPY LONG slot_lock;
+static NO_COPY LONGLONG freq;
+
+static void
+lock_slots ()
+{
+  while (InterlockedExchange (&slot_lock, 1))
+    low_priority_sleep (0);
+}
+
+static void
+unlock_slots ()
+{
+  InterlockedExchange (&slot_lock, 0);
+}
+
+static syscall_slot * __stdcall
+claim_slot ()
+{
+  HANDLE h;
+  syscall_slot *s = NULL;
+
+  if (!DuplicateHandle (hMainProc, GetCurrentThread (), hMainProc, &h, 0,
+			FALSE, DUPLICATE_SAME_ACCESS))
+    return NULL;
+
+  lock_slots ();
+  if (slot_tls == TLS_OUT_OF_INDEXES)
+    slot_tls = TlsAlloc ();
+  if (!slots)
+    {
+      LARGE_INTEGER f;
+      if (QueryPerformanceFrequency (&f))
+	freq = f.QuadPart;
+      slots = (syscall_slot *) VirtualAlloc (NULL, (SC_SLOTS + 1)
+							* sizeof *slots,
+					     MEM_COMMIT, PAGE_READWRITE);
+    }
+  if (slots && slot_tls != TLS_OUT_OF_INDEXES)
+    {
+      for (s = slots; s < slots + SC_SLOTS; s++)
+	if (!s->thread || WaitForSingleObject (s->thread, 0) == WAIT_OBJECT_0)
+	  break;
+      if (s < slots + SC_SLOTS)
+	{
+	  if (s->thread)
+	    CloseHandle (s->thread);
+	  s->thread = h;
+	  h = NULL;
+	}
+      TlsSetValue (slot_tls, s);
+    }
+  unlock_slots ();
+
+  if (h)
+    CloseHandle (h);
+  return s;
+}
+
+/* Charge the time since START, a performance counter value, to ID. */
+void __stdcall
+syscall_stat_record (syscall_stat_id id, LONGLONG start)
+{
+  LARGE_INTEGER now;
+  syscall_slot *s;
+  unsigned long long ticks, usecs;
+  int b;
+
+  QueryPerformanceCounter (&now);
+  if (slot_tls == TLS_OUT_OF_INDEXES
+      || !(s = (syscall_slot *) TlsGetValue (slot_tls)))
+    if (!(s = claim_slot ()))
+      return;
+
+  /* Not ticks * 1000000 / freq, which overflows after an hour or so
+     with a cycle counter for a clock. */
+  ticks = now.QuadPart - start;
+  usecs = freq ? ticks / freq * 1000000 + ticks % freq * 1000000 / freq : 0;
+  b = 0;
+  for (unsigned long long u = usecs; u && b < SC_HIST - 1; u >>= 1)
+    b++;
+
+  bool shared = s == slots + SC_SLOTS;
+  if (shared)
+    lock_slots ();
+  syscall_stat &sc = s->stats.sc[id];
+  sc.calls++;
+  sc.usecs += usecs;
+  sc.hist[b]++;
+  if (shared)
+    unlock_slots ();
+}
+
+/* Total up the slots.  A thread may be updating its own meanwhile, so
+   the result can be a call or so out, but no more. */
+void __stdcall
+syscall_stats_sum (syscall_stats &st)
+{
+  memset (&st, 0, sizeof st);
+  if (!slots)
+    return;
+  for (syscall_slot *s = slots; s <= slots + SC_SLOTS; s++)
+    for (int i = 0; i < SC_NSTATS; i++)
+      {
+	st.sc[i].calls += s->stats.sc[i].calls;
+	st.sc[i].usecs += s->stats.sc[i].usecs;
+	for (int b = 0; b < SC_HIST; b++)
+	  st.sc[i].hist[b] += s->stats.sc[i].hist[b];
+      }
+}
@@ -0,0 +1,65 @@
+/* syscall_stats.h: call counts and latencies of the main entry points
+
+   Copyright 2003 Red Hat, Inc.
+
+This software is a copyrighted work licensed under the terms of the
+Cygwin license.  Please consult the file "CYGWIN_LICENSE" for
+details. */
+
+/* The entry points timed, in the order /proc/<pid>/syscalls lists them. */
+enum syscall_stat_id
+{
+  SC_READ,
+  SC_WRITE,
+  SC_OPEN,
+  SC_STAT,
+  SC_PATH_CONV,
+  SC_FORK,
+  SC_SPAWN,
+  SC_SELECT,
+  SC_SIG_SEND,
+  SC_NSTATS
+};
+
+/* hist[0] counts calls taking under 1us, hist[n] those taking under 2^n us,
+   and the last those taking longer still. */
+#define SC_HIST 24
+
+struct syscall_stat
+{
+  DWORD calls;
+  unsigned long long usecs;
+  DWORD hist[SC_HIST];
+};
+
+struct syscall_stats
+{
+  syscall_stat sc[SC_NSTATS];
+};
+
+extern const char *syscall_stat_names[SC_NSTATS];
+
+void __stdcall syscall_stat_record (syscall_stat_id, LONGLONG)
+  __attribute__ ((regparm (2)));
+void __stdcall syscall_stats_sum (syscall_stats &);
+
+/* Times the scope it is declared in, and charges it to ID.  stop ends
+   the timing early, for a scope which is never left, and cancel drops
+   it, for the child of a fork. */
+class syscall_timer
+{
+  syscall_stat_id id;
+  bool running;
+  LARGE_INTEGER start;
+public:
+  syscall_timer (syscall_stat_id n): id (n), running (true)
+    {QueryPerformanceCounter (&start);}
+  ~syscall_timer () {stop ();}
+  void stop ()
+    {
+      if (running)
+	syscall_stat_record (id, start.QuadPart);
+      running = false;
+    }
+  void cancel () {running = false;}
+};
@@ -59,6 +59,7 @@ details. */
 #include "pwdgrp.h"
 #include "cpuid.h"
 #include "registry.h"
+#include "syscall_stats.h"
 
 #undef _close
 #undef _lseek
@@ -369,6 +370,7 @@ extern "C" ssize_t _write (int fd, const void *ptr, size_t len)
 extern "C" ssize_t
 readv (int fd, const struct iovec *const iov, const int iovcnt)
 {
+  syscall_timer timer (SC_READ);
   extern int sigcatchers;
   const int e = get_errno ();
 
@@ -455,6 +457,7 @@ done:
 extern "C" ssize_t
 writev (const int fd, const struct iovec *const iov, const int iovcnt)
 {
+  syscall_timer timer (SC_WRITE);
   int res = -1;
   sig_dispatch_pending ();
   const ssize_t tot = check_iovec_for_write (iov, iovcnt);
@@ -509,6 +512,7 @@ done:
 extern "C" int
 open (const char *unix_path, int flags, ...)
 {
+  syscall_timer timer (SC_OPEN);
   int res = -1;
   va_list ap;
   mode_t mode = 0;
@@ -1120,6 +1124,7 @@ int __stdcall
 stat_worker (const char *name, struct __stat64 *buf, int nofollow,
 	     path_conv *pc)
 {
+  syscall_timer timer (SC_STAT);
   int res = -1;
   path_conv real_path;
   fhandler_base *fh = NULL;
@@ -1505,19 +1510,22 @@ system (const char *cmdstring)
   return res;
 }
 
+/* Like it always did, this only ever makes room for more fds.  Use
+   setrlimit (RLIMIT_NOFILE) to lower the limit. */
 extern "C" int
 setdtablesize (int size)
 {
-  if (size <= (int)cygheap->fdtab.size || cygheap->fdtab.extend (size - cygheap->fdtab.size))
+  if (size <= cygheap->fdtab.limit)
     return 0;
-
-  return -1;
+  return cygheap->fdtab.setlimit (size);
 }
 
+/* The limit open enforces, not the number of slots allocated so far,
+   which never was a limit since the table grows on demand. */
 extern "C" int
 getdtablesize ()
 {
-  return cygheap->fdtab.size > OPEN_MAX ? cygheap->fdtab.size : OPEN_MAX;
+  return cygheap->fdtab.limit;
 }
 
 extern "C" size_t
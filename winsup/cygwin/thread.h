@@ -89,6 +89,11 @@ struct _winsup_t
   int _process_facility;
   int _process_logmask;
 
+  /* localtime.cc */
+  int _tm_day_valid;
+  long _tm_day;			/* Days since the epoch of _tm_date */
+  struct tm _tm_date;
+
   /* times.cc */
   char timezone_buf[20];
   struct tm _localtime_buf;
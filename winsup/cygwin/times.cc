@@ -21,6 +21,7 @@ details. */
 #include "path.h"
 #include "pinfo.h"
 #include "hires.h"
+#include <cygwin/time.h>
 
 #define FACTOR (0x19db1ded53e8000LL)
 #define NSPERSEC 10000000LL
@@ -172,6 +173,155 @@ gettimeofday (struct timeval *tv, struct timezone *tz)
 extern "C" int _gettimeofday (struct timeval *, struct timezone *)
   __attribute__((alias ("gettimeofday")));
 
+/* 64 by 32 bit division for quotients which fit into 32 bits.  gcc would
+   call __udivdi3 instead. */
+static inline DWORD
+divl (ULONGLONG n, DWORD d, DWORD &rem)
+{
+  DWORD q;
+  __asm__ ("divl %4"
+	   : "=a" (q), "=d" (rem)
+	   : "0" ((DWORD) n), "1" ((DWORD) (n >> 32)), "rm" (d));
+  return q;
+}
+
+static void
+filetime_to_timespec (ULONGLONG x, struct timespec *tp)
+{
+  DWORD rem;
+  tp->tv_sec = divl (x, (DWORD) NSPERSEC, rem);
+  tp->tv_nsec = rem * 100;
+}
+
+static hires_ns monotonic_clock;
+
+extern "C" int
+clock_gettime (clockid_t clk_id, struct timespec *tp)
+{
+  FILETIME f, creation, exit, kernel, user;
+  LONGLONG ns;
+  DWORD rem;
+
+  switch (clk_id)
+    {
+    case CLOCK_REALTIME:
+      GetSystemTimeAsFileTime (&f);
+      filetime_to_timespec ((((ULONGLONG) f.dwHighDateTime << 32)
+			     | f.dwLowDateTime) - FACTOR, tp);
+      break;
+
+    case CLOCK_MONOTONIC:
+      if ((ns = monotonic_clock.nsecs ()) < 0)
+	return -1;
+      tp->tv_sec = divl (ns, 1000000000, rem);
+      tp->tv_nsec = rem;
+      break;
+
+    case CLOCK_PROCESS_CPUTIME_ID:
+    case CLOCK_THREAD_CPUTIME_ID:
+      if (clk_id == CLOCK_PROCESS_CPUTIME_ID
+	  ? !GetProcessTimes (hMainProc, &creation, &exit, &kernel, &user)
+	  : !GetThreadTimes (GetCurrentThread (), &creation, &exit, &kernel,
+			     &user))
+	{
+	  __seterrno ();
+	  return -1;
+	}
+      filetime_to_timespec ((((ULONGLONG) kernel.dwHighDateTime << 32)
+			     | kernel.dwLowDateTime)
+			    + (((ULONGLONG) user.dwHighDateTime << 32)
+			       | user.dwLowDateTime), tp);
+      break;
+
+    default:
+      set_errno (EINVAL);
+      return -1;
+    }
+
+  return 0;
+}
+
+extern "C" int
+clock_getres (clockid_t clk_id, struct timespec *tp)
+{
+  DWORD adjust, incr;
+  BOOL noadjust;
+  LONGLONG ns;
+
+  switch (clk_id)
+    {
+    case CLOCK_REALTIME:
+    case CLOCK_PROCESS_CPUTIME_ID:
+    case CLOCK_THREAD_CPUTIME_ID:
+      /* All of these advance with the system clock interrupt. */
+      if (!GetSystemTimeAdjustment (&adjust, &incr, &noadjust))
+	incr = 100000;
+      ns = incr * 100LL;
+      break;
+
+    case CLOCK_MONOTONIC:
+      if ((ns = monotonic_clock.resolution ()) < 0)
+	return -1;
+      break;
+
+    default:
+      set_errno (EINVAL);
+      return -1;
+    }
+
+  if (tp)
+    {
+      tp->tv_sec = ns / 1000000000;
+      tp->tv_nsec = ns % 1000000000;
+    }
+  syscall_printf ("0 = clock_getres (%d, %D ns)", clk_id, ns);
+  return 0;
+}
+
+/* Returns an error number instead of setting errno, as specified by
+   POSIX. */
+extern "C" int
+clock_nanosleep (clockid_t clk_id, int flags, const struct timespec *rqtp,
+		 struct timespec *rmtp)
+{
+  save_errno save;
+  struct timespec req = *rqtp;
+
+  switch (clk_id)
+    {
+    case CLOCK_REALTIME:
+    case CLOCK_MONOTONIC:
+      break;
+    case CLOCK_PROCESS_CPUTIME_ID:
+      return ENOTSUP;
+    default:
+      return EINVAL;
+    }
+  if (req.tv_nsec < 0 || req.tv_nsec > 999999999)
+    return EINVAL;
+
+  if (flags & TIMER_ABSTIME)
+    {
+      struct timespec now;
+      if (clock_gettime (clk_id, &now))
+	return get_errno ();
+      req.tv_sec -= now.tv_sec;
+      if ((req.tv_nsec -= now.tv_nsec) < 0)
+	{
+	  req.tv_nsec += 1000000000;
+	  req.tv_sec--;
+	}
+      if (req.tv_sec < 0)
+	return 0;
+      /* The remaining time is meaningless for an absolute timeout. */
+      rmtp = NULL;
+    }
+
+  if (nanosleep (&req, rmtp))
+    return get_errno ();
+  return 0;
+}
+
 /* Cygwin internal */
 void
 time_t_to_filetime (time_t time_in, FILETIME *out)
@@ -593,7 +743,7 @@ hires_us::prime ()
   primed_ft.LowPart = f.dwLowDateTime;
   primed_ft.QuadPart -= FACTOR;
   primed_ft.QuadPart /= 10;
-  freq = (double) ((double) 1000000. / (double) ifreq.QuadPart);
+  freq.init (ifreq.QuadPart, 1000000LL);
   return;
 }
 
@@ -615,11 +765,60 @@ hires_us::usecs (bool justdelta)
       return -1;
     }
 
-  // FIXME: Use round() here?
-  now.QuadPart = (LONGLONG) (freq * (double) (now.QuadPart - primed_pc.QuadPart));
+  now.QuadPart = freq.scale (now.QuadPart - primed_pc.QuadPart);
   return justdelta ? now.QuadPart : primed_ft.QuadPart + now.QuadPart;
 }
 
+void
+hires_ns::prime ()
+{
+  LARGE_INTEGER ifreq;
+  if (!QueryPerformanceFrequency (&ifreq)
+      || !QueryPerformanceCounter (&primed_pc))
+    {
+      inited = -1;
+      return;
+    }
+
+  freq.init (ifreq.QuadPart, 1000000000LL);
+  res = 1000000000LL / ifreq.QuadPart ?: 1;
+  inited = 1;
+}
+
+LONGLONG
+hires_ns::nsecs ()
+{
+  if (!inited)
+    prime ();
+  if (inited < 0)
+    {
+      set_errno (ENOSYS);
+      return (long long) -1;
+    }
+
+  LARGE_INTEGER now;
+  if (!QueryPerformanceCounter (&now))
+    {
+      set_errno (ENOSYS);
+      return -1;
+    }
+
+  return freq.scale (now.QuadPart - primed_pc.QuadPart);
+}
+
+LONGLONG
+hires_ns::resolution ()
+{
+  if (!inited)
+    prime ();
+  if (inited < 0)
+    {
+      set_errno (ENOSYS);
+      return (long long) -1;
+    }
+  return res;
+}
+
 void
 hires_ms::prime ()
 {
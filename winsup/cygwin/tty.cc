@@ -442,6 +442,9 @@ tty::common_init (fhandler_pty_master *ptym)
   if (!(ptym->input_available_event = get_event (INPUT_AVAILABLE_EVENT, TRUE)))
     return FALSE;
 
+  if (!(ptym->output_available_event = get_event (OUTPUT_AVAILABLE_EVENT, TRUE)))
+    return FALSE;
+
   char buf[40];
   __small_sprintf (buf, OUTPUT_MUTEX, ntty);
   if (!(ptym->output_mutex = CreateMutex (&sec_all, FALSE, buf)))
@@ -23,6 +23,7 @@ details. */
 #define IOCTL_DONE_EVENT	"cygtty%d.ioctl.done"
 #define RESTART_OUTPUT_EVENT	"cygtty%d.output.restart"
 #define INPUT_AVAILABLE_EVENT	"cygtty%d.input.avail"
+#define OUTPUT_AVAILABLE_EVENT	"cygtty%d.output.avail"
 #define OUTPUT_MUTEX		"cygtty%d.output.mutex"
 #define INPUT_MUTEX		"cygtty%d.input.mutex"
 #define TTY_SLAVE_ALIVE		"cygtty%x.slave_alive"
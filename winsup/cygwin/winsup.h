@@ -142,6 +142,25 @@ extern unsigned int signal_shift_subtract;
 #define isabspath(p) \
   (isdirsep (*(p)) || (isalpha (*(p)) && (p)[1] == ':' && (!(p)[2] || isdirsep ((p)[2]))))
 
+/* Number of trailing zero bits in a non-zero word.  Used for scanning
+   bitmaps a word at a time. */
+static inline DWORD
+low_zeros (DWORD w)
+{
+  DWORD n = 0;
+  if (!(w & 0xffff))
+    n += 16, w >>= 16;
+  if (!(w & 0xff))
+    n += 8, w >>= 8;
+  if (!(w & 0xf))
+    n += 4, w >>= 4;
+  if (!(w & 0x3))
+    n += 2, w >>= 2;
+  if (!(w & 0x1))
+    n += 1;
+  return n;
+}
+
 /******************** Initialization/Termination **********************/
 
 class per_process;
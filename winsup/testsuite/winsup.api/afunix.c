@@ -0,0 +1,359 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <signal.h>
+
+/* AF_LOCAL stream sockets: data transfer in both directions, select,
+   EOF on close and descriptor passing with msg_accrights.  Also select
+   for reading and writing at once on a connection whose ring is full,
+   which must wake up when the peer drains it.  Two processes writing
+   with descriptors attached into the same connection at once, which
+   must each arrive with the data they were sent with.  Socket
+   descriptors can't be passed and fail with EOPNOTSUPP.  Peeking
+   doesn't return descriptors.  Datagram sockets: message
+   boundaries, truncation and the sender's address, through bound sockets
+   and socketpair. */
+
+#define SOCKNAME "afunix.sock"
+#define SOCKNAME2 "afunix.sock2"
+#define DGRAMNAME "afunix.dgram"
+#define DGRAMNAME2 "afunix.dgram2"
+#define TMPNAME "afunix.dat"
+#define NMSGS 10000
+#define WMSGS 50
+#define WLEN 40000
+
+int
+fail(const char *what)
+{
+  perror(what);
+  exit(1);
+}
+
+int
+server(int s)
+{
+  char buf[4096];
+  int fd, n, i, total;
+  struct iovec iov = { buf, 1 };
+  struct msghdr msg = { NULL, 0, &iov, 1, &fd, sizeof fd };
+
+  for (i = 0; i < NMSGS; i++)
+    {
+      if (read(s, buf, 4) != 4 || memcmp(buf, "ping", 4))
+	fail("server read");
+      if (write(s, "pong", 4) != 4)
+	fail("server write");
+    }
+
+  /* Receive a descriptor and read from it.  Peeking must leave it
+     alone. */
+  if (recvmsg(s, &msg, MSG_PEEK) != 1 || msg.msg_accrightslen != 0)
+    fail("recvmsg peek");
+  msg.msg_accrightslen = sizeof fd;
+  if (recvmsg(s, &msg, 0) != 1 || msg.msg_accrightslen != sizeof fd)
+    fail("recvmsg");
+  lseek(fd, 0, SEEK_SET);
+  if ((n = read(fd, buf, sizeof buf)) != 5 || memcmp(buf, "hello", 5))
+    fail("read passed fd");
+  close(fd);
+
+  /* Let the client fill the ring and block in select, then drain it
+     until the client closed its end. */
+  sleep(1);
+  for (total = 0; (n = read(s, buf, sizeof buf)) > 0; total += n)
+    continue;
+  if (n < 0 || total == 0)
+    fail("drain");
+  return 0;
+}
+
+int
+client()
+{
+  struct sockaddr_un sun;
+  struct timeval tv = { 5, 0 };
+  char buf[4096];
+  fd_set fds, wfds;
+  int s, fd, i;
+  struct iovec iov = { "x", 1 };
+  struct msghdr msg = { NULL, 0, &iov, 1, &fd, sizeof fd };
+
+  if ((s = socket(AF_LOCAL, SOCK_STREAM, 0)) < 0)
+    fail("socket");
+  sun.sun_family = AF_LOCAL;
+  strcpy(sun.sun_path, SOCKNAME);
+  if (connect(s, (struct sockaddr *) &sun, sizeof sun))
+    fail("connect");
+
+  for (i = 0; i < NMSGS; i++)
+    {
+      if (write(s, "ping", 4) != 4)
+	fail("client write");
+      FD_ZERO(&fds);
+      FD_SET(s, &fds);
+      if (select(s + 1, &fds, NULL, NULL, &tv) != 1)
+	fail("select");
+      if (read(s, buf, 4) != 4 || memcmp(buf, "pong", 4))
+	fail("client read");
+    }
+
+  if ((fd = open(TMPNAME, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0)
+    fail(TMPNAME);
+  write(fd, "hello", 5);
+  if (sendmsg(s, &msg, 0) != 1)
+    fail("sendmsg");
+  close(fd);
+  fd = s;
+  if (sendmsg(s, &msg, 0) != -1 || errno != EOPNOTSUPP)
+    fail("sendmsg socket");
+
+  /* Fill the ring, then wait for it to drain with no timeout.  The alarm
+     kills us should select never wake up. */
+  memset(buf, 'x', sizeof buf);
+  fcntl(s, F_SETFL, O_NONBLOCK);
+  while (write(s, buf, sizeof buf) > 0)
+    continue;
+  alarm(10);
+  FD_ZERO(&fds);
+  FD_SET(s, &fds);
+  FD_ZERO(&wfds);
+  FD_SET(s, &wfds);
+  if (select(s + 1, &fds, &wfds, NULL, NULL) != 1 || !FD_ISSET(s, &wfds))
+    fail("select for writing");
+  alarm(0);
+  close(s);
+  return 0;
+}
+
+int
+writer(int s, char id)
+{
+  static char buf[WLEN];
+  char name[] = "afunix.X";
+  int fd, i;
+  struct iovec iov = { buf, sizeof buf };
+  struct msghdr msg = { NULL, 0, &iov, 1, &fd, sizeof fd };
+
+  name[7] = id;
+  if ((fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0)
+    fail(name);
+  write(fd, &id, 1);
+  memset(buf, id, sizeof buf);
+  for (i = 0; i < WMSGS; i++)
+    {
+      if (sendmsg(s, &msg, 0) != sizeof buf)
+	fail("writer sendmsg");
+      if (i % 4 == 0)
+	usleep(1000);
+    }
+  close(fd);
+  return 0;
+}
+
+int
+writers()
+{
+  struct sockaddr_un sun;
+  static char buf[3000];
+  int l, s, fd, n, status, nrights;
+  long total;
+  char c;
+  struct iovec iov = { buf, sizeof buf };
+  struct msghdr msg = { NULL, 0, &iov, 1, &fd, sizeof fd };
+  pid_t pid, wpid;
+
+  unlink(SOCKNAME2);
+  if ((l = socket(AF_LOCAL, SOCK_STREAM, 0)) < 0)
+    fail("socket");
+  sun.sun_family = AF_LOCAL;
+  strcpy(sun.sun_path, SOCKNAME2);
+  if (bind(l, (struct sockaddr *) &sun, sizeof sun) || listen(l, 5))
+    fail("bind");
+
+  switch (pid = fork())
+    {
+    case -1:
+      fail("fork");
+    case 0:
+      close(l);
+      if ((s = socket(AF_LOCAL, SOCK_STREAM, 0)) < 0)
+	fail("socket");
+      if (connect(s, (struct sockaddr *) &sun, sizeof sun))
+	fail("connect");
+      switch (wpid = fork())
+	{
+	case -1:
+	  fail("fork");
+	case 0:
+	  _exit(writer(s, 'B'));
+	}
+      writer(s, 'A');
+      if (waitpid(wpid, &status, 0) != wpid || status)
+	fail("writer");
+      _exit(0);
+    }
+
+  if ((s = accept(l, NULL, NULL)) < 0)
+    fail("accept");
+  /* Read in small pieces, so that the ring stays full and the writers
+     have to wait for space with their descriptors pending. */
+  for (total = nrights = 0; total < 2L * WMSGS * WLEN; total += n)
+    {
+      msg.msg_accrightslen = sizeof fd;
+      if ((n = recvmsg(s, &msg, 0)) <= 0)
+	fail("recvmsg");
+      if (msg.msg_accrightslen != sizeof fd)
+	continue;
+      lseek(fd, 0, SEEK_SET);
+      if (read(fd, &c, 1) != 1 || c != buf[0])
+	fail("descriptor arrived with the wrong data");
+      close(fd);
+      nrights++;
+    }
+  if (nrights != 2 * WMSGS)
+    fail("descriptors lost");
+  close(s);
+  close(l);
+  if (waitpid(pid, &status, 0) != pid || status)
+    fail("writers");
+  unlink(SOCKNAME2);
+  unlink("afunix.A");
+  unlink("afunix.B");
+  return 0;
+}
+
+int
+dgram_client()
+{
+  struct sockaddr_un sun;
+  char buf[2000];
+  int s, i;
+
+  if ((s = socket(AF_LOCAL, SOCK_DGRAM, 0)) < 0)
+    fail("dgram socket");
+  sun.sun_family = AF_LOCAL;
+  strcpy(sun.sun_path, DGRAMNAME2);
+  if (bind(s, (struct sockaddr *) &sun, sizeof sun))
+    fail("dgram bind");
+  strcpy(sun.sun_path, DGRAMNAME);
+  for (i = 0; i < 100; i++)
+    {
+      memset(buf, i, i * 10);
+      if (sendto(s, buf, i * 10, 0, (struct sockaddr *) &sun, sizeof sun)
+	  != i * 10)
+	fail("dgram sendto");
+    }
+  alarm(10);
+  if (recv(s, buf, sizeof buf, 0) != 4 || memcmp(buf, "done", 4))
+    fail("dgram reply");
+  alarm(0);
+  close(s);
+  return 0;
+}
+
+int
+dgram()
+{
+  struct sockaddr_un sun, from;
+  char buf[2000];
+  int s, sv[2], i, n, fromlen, status;
+  pid_t pid;
+
+  unlink(DGRAMNAME);
+  unlink(DGRAMNAME2);
+  if ((s = socket(AF_LOCAL, SOCK_DGRAM, 0)) < 0)
+    fail("dgram socket");
+  sun.sun_family = AF_LOCAL;
+  strcpy(sun.sun_path, DGRAMNAME);
+  if (bind(s, (struct sockaddr *) &sun, sizeof sun))
+    fail("dgram bind");
+
+  switch (pid = fork())
+    {
+    case -1:
+      fail("fork");
+    case 0:
+      close(s);
+      _exit(dgram_client());
+    }
+
+  for (i = 0; i < 100; i++)
+    {
+      fromlen = sizeof from;
+      n = recvfrom(s, buf, sizeof buf, 0, (struct sockaddr *) &from,
+		   &fromlen);
+      if (n != i * 10 || (n && (buf[0] != i || buf[n - 1] != i)))
+	fail("dgram recvfrom");
+      if (fromlen <= 0 || strcmp(from.sun_path, DGRAMNAME2))
+	fail("dgram sender address");
+    }
+  if (sendto(s, "done", 4, 0, (struct sockaddr *) &from, fromlen) != 4)
+    fail("dgram reply");
+  if (waitpid(pid, &status, 0) != pid || status)
+    fail("dgram client");
+  close(s);
+  unlink(DGRAMNAME);
+  unlink(DGRAMNAME2);
+
+  /* The rest of a datagram which doesn't fit is discarded. */
+  if (socketpair(AF_LOCAL, SOCK_DGRAM, 0, sv))
+    fail("socketpair");
+  if (write(sv[0], "abcdef", 6) != 6 || write(sv[0], "gh", 2) != 2)
+    fail("socketpair write");
+  if (read(sv[1], buf, 3) != 3 || memcmp(buf, "abc", 3))
+    fail("socketpair truncated read");
+  if (read(sv[1], buf, sizeof buf) != 2 || memcmp(buf, "gh", 2))
+    fail("socketpair read");
+  if (write(sv[1], "ij", 2) != 2 || read(sv[0], buf, sizeof buf) != 2)
+    fail("socketpair reverse");
+  close(sv[0]);
+  close(sv[1]);
+  return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+  struct sockaddr_un sun;
+  int l, s, status;
+  pid_t pid;
+
+  unlink(SOCKNAME);
+  if ((l = socket(AF_LOCAL, SOCK_STREAM, 0)) < 0)
+    fail("socket");
+  sun.sun_family = AF_LOCAL;
+  strcpy(sun.sun_path, SOCKNAME);
+  if (bind(l, (struct sockaddr *) &sun, sizeof sun) || listen(l, 5))
+    fail("bind");
+
+  switch (pid = fork())
+    {
+    case -1:
+      fail("fork");
+    case 0:
+      close(l);
+      _exit(client());
+    }
+
+  if ((s = accept(l, NULL, NULL)) < 0)
+    fail("accept");
+  server(s);
+  close(s);
+  close(l);
+  if (waitpid(pid, &status, 0) != pid || status)
+    fail("client");
+
+  unlink(SOCKNAME);
+  unlink(TMPNAME);
+  writers();
+  return dgram();
+}
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <cygwin/time.h>
+
+/* clock_gettime, clock_getres and clock_nanosleep. */
+
+int
+fail(const char *what)
+{
+  perror(what);
+  return 1;
+}
+
+long long
+ns(struct timespec *ts)
+{
+  return ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+int
+main(int argc, char **argv)
+{
+  struct timespec a, b, res;
+  volatile int i;
+  long long d;
+
+  if (clock_getres(CLOCK_MONOTONIC, &res) || res.tv_sec || res.tv_nsec <= 0)
+    return fail("clock_getres");
+  if (clock_getres(CLOCK_REALTIME, &res) || res.tv_nsec <= 0)
+    return fail("clock_getres realtime");
+  if (clock_gettime(1234, &a) == 0 || errno != EINVAL)
+    return fail("clock_gettime invalid clock");
+
+  /* Monotonic time never goes backwards. */
+  clock_gettime(CLOCK_MONOTONIC, &a);
+  for (i = 0; i < 100000; i++)
+    {
+      clock_gettime(CLOCK_MONOTONIC, &b);
+      if (ns(&b) < ns(&a))
+	return fail("monotonic clock went backwards");
+      a = b;
+    }
+
+  /* Relative and absolute sleeps of 100ms. */
+  clock_gettime(CLOCK_MONOTONIC, &a);
+  b.tv_sec = 0;
+  b.tv_nsec = 100000000;
+  if (clock_nanosleep(CLOCK_MONOTONIC, 0, &b, NULL))
+    return fail("clock_nanosleep");
+  clock_gettime(CLOCK_MONOTONIC, &b);
+  d = ns(&b) - ns(&a);
+  if (d < 90000000 || d > 1000000000)
+    {
+      fprintf(stderr, "relative sleep took %lld ns\n", d);
+      return 1;
+    }
+
+  clock_gettime(CLOCK_REALTIME, &a);
+  b = a;
+  b.tv_nsec += 100000000;
+  if (b.tv_nsec >= 1000000000)
+    {
+      b.tv_nsec -= 1000000000;
+      b.tv_sec++;
+    }
+  if (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &b, NULL))
+    return fail("clock_nanosleep absolute");
+  clock_gettime(CLOCK_REALTIME, &b);
+  d = ns(&b) - ns(&a);
+  if (d < 90000000 || d > 1000000000)
+    {
+      fprintf(stderr, "absolute sleep took %lld ns\n", d);
+      return 1;
+    }
+
+  if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &a)
+      || clock_gettime(CLOCK_THREAD_CPUTIME_ID, &b))
+    return fail("cpu time clocks");
+
+  return 0;
+}
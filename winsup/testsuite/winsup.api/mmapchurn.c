@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <windows.h>
+
+/* Map, touch, protect, sync and unmap a few thousand regions in
+   shuffled order, anonymous and file backed, and report the time
+   each phase takes.  With a linear mmap bookkeeping the later phases
+   grow quadratically with the number of regions. */
+
+#define NMAPS 2000
+#define FILESZ (64 * 1024)
+
+char *maps[NMAPS];
+int order[NMAPS];
+
+unsigned long start_tic;
+
+void
+start()
+{
+  start_tic = GetTickCount();
+}
+
+unsigned long
+end()
+{
+  return GetTickCount() - start_tic;
+}
+
+void
+shuffle()
+{
+  int i, j, t;
+
+  for (i = 0; i < NMAPS; i++)
+    order[i] = i;
+  for (i = NMAPS - 1; i > 0; i--)
+    {
+      j = rand() % (i + 1);
+      t = order[i]; order[i] = order[j]; order[j] = t;
+    }
+}
+
+int
+churn(const char *what, int fd)
+{
+  int pagesize = getpagesize();
+  int flags = fd < 0 ? MAP_PRIVATE | MAP_ANONYMOUS : MAP_SHARED;
+  int i, n;
+  unsigned long ms[4];
+
+  start();
+  for (i = 0; i < NMAPS; i++)
+    {
+      maps[i] = mmap(NULL, pagesize, PROT_READ | PROT_WRITE, flags, fd,
+		     fd < 0 ? 0 : (i % (FILESZ / pagesize)) * pagesize);
+      if (maps[i] == MAP_FAILED)
+	{
+	  printf("%s: mmap %d failed\n", what, i);
+	  return 0;
+	}
+    }
+  ms[0] = end();
+
+  shuffle();
+  start();
+  for (i = 0; i < NMAPS; i++)
+    {
+      n = order[i];
+      maps[n][0] = (char) n;
+      if (mprotect(maps[n], pagesize, PROT_READ))
+	{
+	  printf("%s: mprotect %d failed\n", what, n);
+	  return 0;
+	}
+    }
+  ms[1] = end();
+
+  start();
+  for (i = 0; i < NMAPS; i++)
+    if (fd >= 0 && msync(maps[order[i]], pagesize, MS_ASYNC))
+      {
+	printf("%s: msync %d failed\n", what, order[i]);
+	return 0;
+      }
+  ms[2] = end();
+
+  shuffle();
+  start();
+  for (i = 0; i < NMAPS; i++)
+    if (munmap(maps[order[i]], pagesize))
+      {
+	printf("%s: munmap %d failed\n", what, order[i]);
+	return 0;
+      }
+  ms[3] = end();
+
+  printf("%-6s %6d %6lu %8lu %6lu %6lu\n", what, NMAPS,
+	 ms[0], ms[1], ms[2], ms[3]);
+  return 1;
+}
+
+int
+main(int argc, char **argv)
+{
+  char name[] = "mmapchurn.XXXXXX";
+  char buf[FILESZ];
+  int fd, ok = 1;
+
+  setbuf(stdout, 0);
+  srand(1);
+
+  fd = mkstemp(name);
+  if (fd < 0)
+    {
+      perror("mkstemp");
+      return 1;
+    }
+  memset(buf, 0, sizeof buf);
+  if (write(fd, buf, sizeof buf) != sizeof buf)
+    {
+      perror("write");
+      return 1;
+    }
+
+  printf("kind    maps   mmap mprotect  msync munmap (ms)\n");
+  ok &= churn("anon", -1);
+  ok &= churn("file", fd);
+
+  close(fd);
+  unlink(name);
+  return !ok;
+}
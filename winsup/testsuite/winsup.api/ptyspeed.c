@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/wait.h>
+#include <windows.h>
+
+/* Measure pty master read throughput and round trip latency.  The
+   child writes to the slave side, the parent reads from the master. */
+
+extern char *ptsname (int);
+
+int verbose = 0;
+
+void
+v(char *fmt, ...)
+{
+  va_list ap;
+  if (!verbose) return;
+  va_start(ap, fmt);
+  vfprintf(stdout, fmt, ap);
+  va_end(ap);
+}
+
+#define TSIZE (1024 * 1024)
+#define NPINGS 200
+
+unsigned long start_tic;
+
+void
+start()
+{
+  start_tic = GetTickCount();
+}
+
+unsigned long
+end()
+{
+  return GetTickCount() - start_tic;
+}
+
+int
+open_pty(int *slave)
+{
+  struct termios ti;
+  char *name;
+  int master = open("/dev/ptmx", O_RDWR);
+
+  if (master < 0)
+    {
+      perror("/dev/ptmx");
+      exit(1);
+    }
+  name = ptsname(master);
+  if (!name || (*slave = open(name, O_RDWR)) < 0)
+    {
+      perror("ptsname");
+      exit(1);
+    }
+  v("opened %s\n", name);
+
+  tcgetattr(*slave, &ti);
+  ti.c_iflag &= ~(ICRNL | INLCR | IXON);
+  ti.c_oflag &= ~OPOST;
+  ti.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+  ti.c_cc[VMIN] = 1;
+  ti.c_cc[VTIME] = 0;
+  tcsetattr(*slave, TCSANOW, &ti);
+  return master;
+}
+
+int
+throughput(int bufsz)
+{
+  char buf[65536];
+  int master, slave, n, total = 0;
+  unsigned long ms;
+  pid_t pid;
+
+  master = open_pty(&slave);
+  switch (pid = fork())
+    {
+    case -1:
+      perror("fork");
+      exit(1);
+    case 0:
+      close(master);
+      memset(buf, 'x', bufsz);
+      for (n = 0; n < TSIZE; n += bufsz)
+	write(slave, buf, bufsz);
+      _exit(0);
+    }
+  close(slave);
+
+  start();
+  while (total < TSIZE && (n = read(master, buf, sizeof buf)) > 0)
+    total += n;
+  ms = end();
+  waitpid(pid, NULL, 0);
+  close(master);
+
+  printf("%6d %8d %6lu %8lu\n", bufsz, total, ms,
+	 ms ? (unsigned long) total / ms : 0);
+  return total == TSIZE;
+}
+
+int
+latency()
+{
+  char c = 'x';
+  int master, slave, i;
+  unsigned long ms;
+  pid_t pid;
+
+  master = open_pty(&slave);
+  switch (pid = fork())
+    {
+    case -1:
+      perror("fork");
+      exit(1);
+    case 0:
+      close(master);
+      for (i = 0; i < NPINGS; i++)
+	if (read(slave, &c, 1) != 1 || write(slave, &c, 1) != 1)
+	  _exit(1);
+      _exit(0);
+    }
+  close(slave);
+
+  start();
+  for (i = 0; i < NPINGS; i++)
+    if (write(master, &c, 1) != 1 || read(master, &c, 1) != 1)
+      break;
+  ms = end();
+  waitpid(pid, NULL, 0);
+  close(master);
+
+  printf("%d round trips in %lu ms (%lu us each)\n", i, ms,
+	 i ? ms * 1000 / i : 0);
+  return i == NPINGS;
+}
+
+int
+main(int argc, char **argv)
+{
+  int ok = 1;
+
+  if (argc > 1 && strcmp(argv[1],"-v") == 0)
+    verbose = 1;
+
+  setbuf(stdout, 0);
+
+  printf(" bufsz    bytes     ms  bytes/ms\n");
+  ok &= throughput(16);
+  ok &= throughput(256);
+  ok &= throughput(4096);
+  ok &= latency();
+
+  return !ok;
+}
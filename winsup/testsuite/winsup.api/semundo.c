@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/ipc.h>
+#include <sys/sem.h>
+
+/* More processes than there used to be semadj slots in a set, each one
+   raising one semaphore with SEM_UNDO and then blocking on the other.
+   There are also more of them than fit into the wait list, so GETNCNT
+   has to count those polling as well.  Once released, their semadj
+   values must bring the first semaphore back to 0.  Skipped if
+   cygserver isn't running. */
+
+#define NPROCS 70
+
+union semun
+{
+  int val;
+  struct semid_ds *buf;
+  unsigned short *array;
+};
+
+int
+fail(const char *what)
+{
+  perror(what);
+  exit(1);
+}
+
+int
+child(int semid)
+{
+  struct sembuf up = { 0, 1, SEM_UNDO };
+  struct sembuf down = { 1, -1, 0 };
+
+  if (semop(semid, &up, 1))
+    fail("semop SEM_UNDO");
+  if (semop(semid, &down, 1))
+    fail("semop wait");
+  return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+  union semun arg;
+  int semid, i, n, status, ret = 0;
+
+  if ((semid = semget(IPC_PRIVATE, 2, IPC_CREAT | 0600)) < 0)
+    {
+      if (errno == ENOSYS)
+	return 0;
+      fail("semget");
+    }
+
+  for (i = 0; i < NPROCS; i++)
+    switch (fork())
+      {
+      case -1:
+	fail("fork");
+      case 0:
+	_exit(child(semid));
+      }
+
+  for (i = 0; (n = semctl(semid, 1, GETNCNT)) < NPROCS && i < 600; i++)
+    usleep(100000);
+  if (n != NPROCS)
+    {
+      fprintf(stderr, "GETNCNT %d, expected %d\n", n, NPROCS);
+      ret = 1;
+    }
+  if ((n = semctl(semid, 0, GETVAL)) != NPROCS)
+    {
+      fprintf(stderr, "GETVAL %d, expected %d\n", n, NPROCS);
+      ret = 1;
+    }
+
+  arg.val = NPROCS;
+  if (semctl(semid, 1, SETVAL, arg))
+    fail("SETVAL");
+  for (i = 0; i < NPROCS; i++)
+    if (wait(&status) < 0 || status)
+      ret = 1;
+
+  /* cygserver applies the semadj values once it notices the exit. */
+  for (i = 0; (n = semctl(semid, 0, GETVAL)) != 0 && i < 100; i++)
+    usleep(100000);
+  if (n != 0)
+    {
+      fprintf(stderr, "GETVAL %d after exit, expected 0\n", n);
+      ret = 1;
+    }
+  semctl(semid, 0, IPC_RMID);
+  return ret;
+}
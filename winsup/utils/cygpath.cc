@@ -14,6 +14,8 @@ details. */
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <errno.h>
+#include <unistd.h>
 #include <getopt.h>
 #include <windows.h>
 #include <io.h>
@@ -29,10 +31,14 @@ static int path_flag, unix_flag, windows_flag, absolute_flag;
 static int shortname_flag, longname_flag;
 static int ignore_flag, allusers_flag, output_flag;
 static int mixed_flag;
+static int options_from_file_flag, batch_flag, null_flag;
+static char output_option;
+static char delim = '\n';
 static const char *format_type_arg;
 
 static struct option long_options[] = {
   {(char *) "absolute", no_argument, NULL, 'a'},
+  {(char *) "batch", no_argument, NULL, 'b'},
   {(char *) "close", required_argument, NULL, 'c'},
   {(char *) "dos", no_argument, NULL, 'd'},
   {(char *) "file", required_argument, NULL, 'f'},
@@ -47,6 +53,7 @@ static struct option long_options[] = {
   {(char *) "unix", no_argument, NULL, 'u'},
   {(char *) "version", no_argument, NULL, 'v'},
   {(char *) "windows", no_argument, NULL, 'w'},
+  {(char *) "null", no_argument, NULL, 'z'},
   {(char *) "allusers", no_argument, NULL, 'A'},
   {(char *) "desktop", no_argument, NULL, 'D'},
   {(char *) "homeroot", no_argument, NULL, 'H'},
@@ -56,7 +63,7 @@ static struct option long_options[] = {
   {0, no_argument, 0, 0}
 };
 
-static char options[] = "ac:df:hilmopst:uvwADHPSW";
+static char options[] = "abc:df:hilmopst:uvwzADHPSW";
 
 static void
 usage (FILE * stream, int status)
@@ -92,6 +99,9 @@ System information:\n\
 Other options:\n\
   -f, --file FILE       read FILE for input; use - to read from STDIN\n\
   -o, --option          read options from FILE as well (for use with --file)\n\
+  -b, --batch           answer NAMEs from STDIN as they come, giving an empty\n\
+                        answer for any that can't be converted (coprocess)\n\
+  -z, --null            NAMEs in FILE and answers end in NUL, not newline\n\
   -c, --close HANDLE    close HANDLE (for use in captured process)\n\
   -i, --ignore		ignore missing argument\n\
   -h, --help            output usage information and exit\n\
@@ -103,6 +113,8 @@ Other options:\n\
   exit (ignore_flag ? 0 : status);
 }
 
+/* The short names of a Win32 PATH list, in a malloc'd buffer, or NULL
+   having said why not.  The helpers below return the same way. */
 static char *
 get_short_paths (char *path)
 {
@@ -125,7 +137,7 @@ get_short_paths (char *path)
 	{
 	  fprintf (stderr, "%s: cannot create short name of %s\n", prog_name,
 		   next);
-	  exit (2);
+	  return NULL;
 	}
       acc += len + 1;
     }
@@ -143,7 +155,8 @@ get_short_paths (char *path)
 	{
 	  fprintf (stderr, "%s: cannot create short name of %s\n", prog_name,
 		   ptr);
-	  exit (2);
+	  free (sbuf);
+	  return NULL;
 	}
 
       ptr = strrchr (ptr, 0);
@@ -166,7 +179,7 @@ get_short_name (const char *filename)
     {
       fprintf (stderr, "%s: cannot create short name of %s\n", prog_name,
 	       filename);
-      exit (2);
+      return NULL;
     }
   sbuf = (char *) malloc (++len);
   if (sbuf == NULL)
@@ -237,7 +250,7 @@ get_long_name (const char *filename, DWORD& len)
     {
       fprintf (stderr, "%s: cannot create long name of %s\n", prog_name,
 	       filename);
-      exit (2);
+      return NULL;
     }
   sbuf = (char *) malloc (len + 1);
   if (!sbuf)
@@ -276,6 +289,12 @@ get_long_paths (char *path)
       if (ptr)
 	*ptr++ = 0;
       paths[i] = get_long_name (next, len);
+      if (!paths[i])
+	{
+	  while (i--)
+	    free (paths[i]);
+	  return NULL;
+	}
       acc += len + 1;
     }
 
@@ -309,21 +328,53 @@ convert_slashes (char* name)
 }
 
 static char *
-get_mixed_name (const char* filename)
+xstrdup (const char *s)
 {
-  char* mixed_buf = strdup (filename);
+  char *buf = strdup (s);
 
-  if (mixed_buf == NULL)
+  if (buf == NULL)
     {
       fprintf (stderr, "%s: out of memory\n", prog_name);
       exit (1);
     }
+  return buf;
+}
+
+static char *
+get_mixed_name (const char* filename)
+{
+  char* mixed_buf = xstrdup (filename);
 
   convert_slashes (mixed_buf);
 
   return mixed_buf;
 }
 
+/* Free BUF for NEW_BUF, which was made from it. */
+static char *
+replace (char *buf, char *new_buf)
+{
+  free (buf);
+  return new_buf;
+}
+
+/* Write out BUF, which is freed, ending it as the requests end.  NULL
+   means there is no answer, the reason having been given, which ends
+   the run with STATUS.  In batch mode it gets an empty answer instead,
+   so that the answers keep in step with the requests. */
+static void
+answer (char *buf, int status)
+{
+  if (buf)
+    {
+      fputs (buf, stdout);
+      free (buf);
+    }
+  else if (!batch_flag)
+    exit (status);
+  putchar (delim);
+}
+
 static void
 dowin (char option)
 {
@@ -392,38 +443,59 @@ dowin (char option)
   if (!windows_flag)
     {
       cygwin_conv_to_posix_path (buf, buf2);
-      buf = buf2;
+      buf = xstrdup (buf2);
     }
   else
     {
+      buf = xstrdup (buf);
       if (shortname_flag)
-	buf = get_short_name (buf);
-      if (mixed_flag)
-	buf = get_mixed_name (buf);
+	buf = replace (buf, get_short_name (buf));
+      if (buf && mixed_flag)
+	buf = replace (buf, get_mixed_name (buf));
     }
-  printf ("%s\n", buf);
-  exit (0);
+  answer (buf, 2);
 }
 
-static void
-doit (char *filename)
+/* Apply -m, -s and -l to BUF, the Windows form of a single NAME. */
+static char *
+finish_win32 (char *buf)
+{
+  DWORD len;
+
+  if (mixed_flag)
+    buf = replace (buf, get_mixed_name (buf));
+  if (buf && shortname_flag)
+    buf = replace (buf, get_short_name (buf));
+  if (buf && longname_flag)
+    buf = replace (buf, get_long_name (buf, len));
+  return buf;
+}
+
+/* Convert FILENAME as the options say.  Returns the answer in a malloc'd
+   buffer, or NULL with the exit status for it in STATUS, having said why
+   if there is anything to say. */
+static char *
+convert (const char *filename, int &status)
 {
   char *buf;
   DWORD len;
-  int retval;
   int (*conv_func) (const char *, char *);
 
+  status = 1;
   if (!path_flag)
     {
       len = strlen (filename);
       if (len)
 	len += MAX_PATH + 1001;
       else if (ignore_flag)
-	exit (0);
+	{
+	  status = 0;
+	  return NULL;
+	}
       else
 	{
 	  fprintf (stderr, "%s: can't convert empty path\n", prog_name);
-	  exit (1);
+	  return NULL;
 	}
     }
   else if (unix_flag)
@@ -446,11 +518,11 @@ doit (char *filename)
 	{
 	  cygwin_posix_to_win32_path_list (filename, buf);
 	  if (shortname_flag)
-	    buf = get_short_paths (buf);
-	  if (longname_flag)
-	    buf = get_long_paths (buf);
-	  if (mixed_flag)
-	    buf = get_mixed_name (buf);
+	    buf = replace (buf, get_short_paths (buf));
+	  if (buf && longname_flag)
+	    buf = replace (buf, get_long_paths (buf));
+	  if (buf && mixed_flag)
+	    buf = replace (buf, get_mixed_name (buf));
 	}
     }
   else
@@ -461,25 +533,224 @@ doit (char *filename)
       else
 	conv_func = (absolute_flag ? cygwin_conv_to_full_win32_path :
 		     cygwin_conv_to_win32_path);
-      retval = conv_func (filename, buf);
-      if (mixed_flag)
-	buf = get_mixed_name (buf);
-      if (retval < 0)
+      if (conv_func (filename, buf) < 0)
 	{
 	  fprintf (stderr, "%s: error converting \"%s\"\n",
 		   prog_name, filename);
-	  exit (1);
+	  free (buf);
+	  return NULL;
 	}
       if (!unix_flag)
+	buf = finish_win32 (buf);
+    }
+
+  if (!buf)
+    status = 2;
+  return buf;
+}
+
+static void
+doit (char *filename)
+{
+  int status;
+  char *buf = convert (filename, status);
+
+  answer (buf, status);
+}
+
+/* Convert the N single NAMEs in NAMES in one call into Cygwin, which
+   converts any NAME given more than once only the once. */
+static void
+convert_names (const char **names, int n)
+{
+  char **bufs;
+  unsigned what;
+
+  if (!n)
+    return;
+  bufs = (char **) malloc (n * sizeof *bufs);
+  if (bufs == NULL)
+    {
+      fprintf (stderr, "%s: out of memory\n", prog_name);
+      exit (1);
+    }
+
+  what = (unix_flag ? CCP_POSIX : CCP_WIN32)
+	 | (absolute_flag ? CCP_ABSOLUTE : 0);
+  cygwin_conv_path_array (what, n, names, bufs);
+  for (int i = 0; i < n; i++)
+    {
+      char *buf = bufs[i];
+      int status = 1;
+
+      if (!buf)
+	fprintf (stderr, "%s: error converting \"%s\"\n", prog_name,
+		 names[i]);
+      else if (!unix_flag && !(buf = finish_win32 (buf)))
+	status = 2;
+      answer (buf, status);
+    }
+  free (bufs);
+}
+
+/* Set the options given at the start of a request, returning what
+   follows them. */
+static char *
+file_options (char *s)
+{
+  char c;
+  for (c = *++s; c && !isspace (c); c = *++s)
+    switch (c)
+      {
+      case 'a':
+	absolute_flag = 1;
+	break;
+      case 'i':
+	ignore_flag = 1;
+	break;
+      case 's':
+	shortname_flag = 1;
+	longname_flag = 0;
+	break;
+      case 'l':
+	shortname_flag = 0;
+	longname_flag = 1;
+	break;
+      case 'm':
+	unix_flag = 0;
+	windows_flag = 1;
+	mixed_flag = 1;
+      case 'w':
+	unix_flag = 0;
+	windows_flag = 1;
+	break;
+      case 'u':
+	windows_flag = 0;
+	unix_flag = 1;
+	break;
+      case 'p':
+	path_flag = 1;
+	break;
+      case 'D':
+      case 'H':
+      case 'P':
+      case 'S':
+      case 'W':
+	output_flag = 1;
+	output_option = c;
+	break;
+      }
+  if (*s)
+    do
+      s++;
+    while (*s && isspace (*s));
+  return s;
+}
+
+/* Answer the requests from BUF up to END, each ending in DELIM.  Runs of
+   single NAMEs converted the same way go into Cygwin together; anything
+   else is converted by itself. */
+static void
+do_requests (char *buf, char *end)
+{
+  const char **names;
+  int n = 0, max = 0;
+  char *s, *p;
+
+  for (s = buf; s < end; s++)
+    if (*s == delim)
+      max++;
+  names = (const char **) malloc (max * sizeof *names);
+  if (names == NULL)
+    {
+      fprintf (stderr, "%s: out of memory\n", prog_name);
+      exit (1);
+    }
+
+  for (s = buf; s < end; s = p + 1)
+    {
+      p = (char *) memchr (s, delim, end - s);
+      *p = '\0';
+      if (options_from_file_flag && *s == '-')
 	{
-	  if (shortname_flag)
-	    buf = get_short_name (buf);
-	  if (longname_flag)
-	    buf = get_long_name (buf, len);
+	  convert_names (names, n);
+	  n = 0;
+	  s = file_options (s);
+	}
+      else if (!*s && !output_flag && batch_flag)
+	{
+	  convert_names (names, n);
+	  n = 0;
+	  answer (NULL, 0);
+	}
+      if (*s && !output_flag)
+	{
+	  if (!path_flag)
+	    names[n++] = s;
+	  else
+	    {
+	      convert_names (names, n);
+	      n = 0;
+	      doit (s);
+	    }
+	}
+      if (!*s && output_flag)
+	{
+	  convert_names (names, n);
+	  n = 0;
+	  dowin (output_option);
+	  output_flag = 0;
 	}
     }
+  convert_names (names, n);
+  free (names);
+}
 
-  puts (buf);
+/* Answer the requests read from FD.  Whatever has arrived is taken at
+   once and converted in a few calls, so a file of thousands of NAMEs
+   costs little more than one, while a coprocess sending a request at a
+   time still gets each answer as soon as it is ready. */
+static void
+do_file (int fd)
+{
+  size_t size = 65536, have = 0, used;
+  char *buf = (char *) malloc (size);
+  int got;
+
+  do
+    {
+      if (buf && have == size)
+	buf = (char *) realloc (buf, size *= 2);
+      if (buf == NULL)
+	{
+	  fprintf (stderr, "%s: out of memory\n", prog_name);
+	  exit (1);
+	}
+      got = read (fd, buf + have, size - have);
+      if (got < 0 && errno == EINTR)
+	continue;
+      if (got < 0)
+	{
+	  perror ("cygpath");
+	  exit (1);
+	}
+      if (got)
+	have += got;
+      else if (have)
+	buf[have++] = delim;
+
+      for (used = have; used && buf[used - 1] != delim; used--)
+	continue;
+      if (used)
+	{
+	  do_requests (buf, buf + used);
+	  memmove (buf, buf + used, have - used);
+	  have -= used;
+	  fflush (stdout);
+	}
+    }
+  while (got);
+  free (buf);
 }
 
 static void
@@ -508,8 +779,7 @@ Compiled on %s\n\
 int
 main (int argc, char **argv)
 {
-  int c, o = 0;
-  int options_from_file_flag;
+  int c;
   char *filename;
 
   prog_name = strrchr (argv[0], '/');
@@ -539,6 +809,10 @@ main (int argc, char **argv)
 	  absolute_flag = 1;
 	  break;
 
+	case 'b':
+	  batch_flag = 1;
+	  break;
+
 	case 'c':
 	  CloseHandle ((HANDLE) strtoul (optarg, NULL, 16));
 	  break;
@@ -625,6 +899,11 @@ main (int argc, char **argv)
 	    usage (stderr, 1);
 	  break;
 
+	case 'z':
+	  null_flag = 1;
+	  delim = '\0';
+	  break;
+
 	case 'A':
 	  allusers_flag = 1;
 	  break;
@@ -637,7 +916,7 @@ main (int argc, char **argv)
 	  if (output_flag)
 	    usage (stderr, 1);
 	  output_flag = 1;
-	  o = c;
+	  output_option = c;
 	  break;
 
 	case 'i':
@@ -658,6 +937,13 @@ main (int argc, char **argv)
 	}
     }
 
+  if (batch_flag)
+    {
+      if (file_arg && strcmp (file_arg, "-") != 0)
+	usage (stderr, 1);
+      file_arg = (char *) "-";
+    }
+
   if (options_from_file_flag && !file_arg)
     usage (stderr, 1);
 
@@ -673,7 +959,10 @@ main (int argc, char **argv)
   if (!file_arg)
     {
       if (output_flag)
-	dowin (o);
+	{
+	  dowin (output_option);
+	  exit (0);
+	}
 
       if (optind != argc - 1)
 	usage (stderr, 1);
@@ -683,86 +972,26 @@ main (int argc, char **argv)
     }
   else
     {
-      FILE *fp;
-      char buf[PATH_MAX * 2 + 1];
+      int fd;
+      int mode = null_flag ? O_BINARY : O_TEXT;
 
       if (argv[optind])
 	usage (stderr, 1);
 
       if (strcmp (file_arg, "-") != 0)
-	fp = fopen (file_arg, "rt");
+	fd = open (file_arg, O_RDONLY | mode);
       else
 	{
-	  fp = stdin;
-	  setmode (0, O_TEXT);
+	  fd = 0;
+	  setmode (0, mode);
 	}
-      if (fp == NULL)
+      if (fd < 0)
 	{
 	  perror ("cygpath");
 	  exit (1);
 	}
 
-      setbuf (stdout, NULL);
-      while (fgets (buf, sizeof (buf), fp) != NULL)
-	{
-	  char *s = buf;
-	  char *p = strchr (s, '\n');
-	  if (p)
-	    *p = '\0';
-	  if (options_from_file_flag && *s == '-')
-	    {
-	      char c;
-	      for (c = *++s; c && !isspace (c); c = *++s)
-		switch (c)
-		  {
-		  case 'a':
-		    absolute_flag = 1;
-		    break;
-		  case 'i':
-		    ignore_flag = 1;
-		    break;
-		  case 's':
-		    shortname_flag = 1;
-		    longname_flag = 0;
-		    break;
-		  case 'l':
-		    shortname_flag = 0;
-		    longname_flag = 1;
-		    break;
-		  case 'm':
-		    unix_flag = 0;
-		    windows_flag = 1;
-		    mixed_flag = 1;
-		  case 'w':
-		    unix_flag = 0;
-		    windows_flag = 1;
-		    break;
-		  case 'u':
-		    windows_flag = 0;
-		    unix_flag = 1;
-		    break;
-		  case 'p':
-		    path_flag = 1;
-		    break;
-		  case 'D':
-		  case 'H':
-		  case 'P':
-		  case 'S':
-		  case 'W':
-		    output_flag = 1;
-		    o = c;
-		    break;
-		  }
-	      if (*s)
-		do
-		  s++;
-		while (*s && isspace (*s));
-	    }
-	  if (*s && !output_flag)
-	    doit (s);
-	  if (!*s && output_flag)
-	    dowin (o);
-	}
+      do_file (fd);
     }
 
   exit (0);
@@ -30,16 +30,19 @@ static struct option longopts[] =
   {"console-trace", no_argument, NULL, 'c' },
   {"disable", no_argument, NULL, 'd' },
   {"enable", no_argument, NULL, 'e' },
+  {"frequency", required_argument, NULL, 'f' },
   {"help", no_argument, NULL, 'h' },
   {"dll", no_argument, NULL, 'l' },
+  {"sample", no_argument, NULL, 'S' },
   {"sub-threads", no_argument, NULL, 's' },
+  {"per-thread", no_argument, NULL, 'T' },
   {"trace-eip", no_argument, NULL, 't' },
   {"verbose", no_argument, NULL, 'v' },
   {"version", no_argument, NULL, 'V' },
   {NULL, 0, NULL, 0}
 };
 
-static char opts[] = "cdehlstvV";
+static char opts[] = "cdef:hlSstTvV";
 
 #define KERNEL_ADDR 0x77000000
 
@@ -92,6 +95,9 @@ int trace_console = 0;
 int trace_all_threads = 0;
 int dll_counts = 0;
 int verbose = 0;
+int sampling = 0;
+int sample_rate = 100;
+int per_thread = 0;
 
 #define MAXTHREADS 100
 DWORD active_thread_ids[MAXTHREADS];
@@ -248,18 +254,18 @@ typedef struct Edge {
 Edge *edges[4096];
 
 void
-store_call_edge (unsigned int from_pc, unsigned int to_pc)
+store_call_edge (Edge **table, unsigned int from_pc, unsigned int to_pc)
 {
   Edge *e;
   unsigned int h = ((from_pc + to_pc)>>4) & 4095;
-  for (e=edges[h]; e; e=e->next)
+  for (e=table[h]; e; e=e->next)
     if (e->from_pc == from_pc && e->to_pc == to_pc)
       break;
   if (!e)
     {
       e = (Edge *)malloc (sizeof (Edge));
-      e->next = edges[h];
-      edges[h] = e;
+      e->next = table[h];
+      table[h] = e;
       e->from_pc = from_pc;
       e->to_pc = to_pc;
       e->count = 0;
@@ -268,15 +274,216 @@ store_call_edge (unsigned int from_pc, unsigned int to_pc)
 }
 
 void
-write_call_edges (FILE *f)
+write_call_edges (FILE *f, Edge **table)
 {
   int h;
   Edge *e;
   for (h=0; h<4096; h++)
-    for (e=edges[h]; e; e=e->next)
+    for (e=table[h]; e; e=e->next)
       fwrite (&(e->from_pc), 1, 3*sizeof (unsigned int), f);
 }
 
+static void
+write_gmon (const char *name, HISTCOUNTER *h, Edge **table, int rate)
+{
+  FILE *gmon;
+
+  hdr.lpc = low_pc;
+  hdr.hpc = high_pc;
+  hdr.ncnt = high_pc-low_pc + sizeof (hdr);
+  hdr.version = GMONVERSION;
+  hdr.profrate = rate;
+
+  gmon = fopen (name, "wb");
+  if (!gmon)
+    {
+      perror (name);
+      return;
+    }
+  fwrite (&hdr, 1, sizeof (hdr), gmon);
+  fwrite (h, 1, high_pc-low_pc, gmon);
+  write_call_edges (gmon, table);
+  fclose (gmon);
+}
+
+static void
+count_dll (unsigned int addr, int main_thread)
+{
+  int i;
+  for (i=num_dlls-1; i>=0; i--)
+    {
+      if (dll_info[i].base_address < addr)
+	{
+	  if (main_thread)
+	    dll_info[i].pcount++;
+	  else
+	    dll_info[i].scount++;
+	  break;
+	}
+    }
+}
+
+/* Sampling mode.  Instead of stepping, the debug loop wakes up
+   sample_rate times a second, suspends each profiled thread in turn,
+   and records its EIP in the histogram and its frame-pointer chain
+   as call graph arcs from each return address to the pc below it.
+   The arc counts gprof shows as "calls" are therefore the number of
+   samples in which that call was on the stack. */
+
+#define MAXFRAMES 32
+
+typedef struct ThreadProfile {
+  struct ThreadProfile *next;	/* on the finished list */
+  DWORD id;
+  int samples;
+  unsigned int last_pc;
+  unsigned long long last_cpu;
+  HISTCOUNTER *hits;		/* per-thread copies, only with -T */
+  Edge *edges[4096];
+} ThreadProfile;
+
+ThreadProfile *thread_profile[MAXTHREADS];
+ThreadProfile *finished_threads, **finished_tail = &finished_threads;
+DWORD next_sample, last_round, sample_ticks;
+int sample_rounds;
+
+/* The rate actually achieved, so that gprof's seconds are real ones. */
+static int
+sample_hz ()
+{
+  return sample_ticks ? (int)(sample_rounds * 1000 / sample_ticks) : 1;
+}
+
+static void
+new_thread_profile (int tix)
+{
+  ThreadProfile *tp;
+
+  thread_profile[tix] = 0;
+  if (!sampling || (tix && !trace_all_threads))
+    return;
+  tp = (ThreadProfile *)calloc (1, sizeof (ThreadProfile));
+  if (!tp)
+    return;
+  tp->id = active_thread_ids[tix];
+  if (per_thread)
+    tp->hits = (HISTCOUNTER *)calloc (1, high_pc-low_pc+4);
+  thread_profile[tix] = tp;
+}
+
+static void
+end_thread_profile (int tix)
+{
+  ThreadProfile *tp = thread_profile[tix];
+  char name[32];
+
+  if (!tp)
+    return;
+  thread_profile[tix] = 0;
+  if (tp->hits)
+    {
+      sprintf (name, "gmon.out.%08lx", tp->id);
+      write_gmon (name, tp->hits, tp->edges, sample_hz ());
+      free (tp->hits);
+      tp->hits = 0;
+    }
+  *finished_tail = tp;
+  finished_tail = &tp->next;
+}
+
+static void
+record_sample (HISTCOUNTER *h, Edge **table, unsigned int *chain, int n)
+{
+  int i;
+  if (chain[0] >= low_pc && chain[0] < high_pc
+      && h[(chain[0] - low_pc)/2] < 0xffff)
+    h[(chain[0] - low_pc)/2] ++;
+  for (i=1; i<n; i++)
+    store_call_edge (table, chain[i], chain[i-1]);
+}
+
+static void
+sample_thread (int tix)
+{
+  ThreadProfile *tp = thread_profile[tix];
+  HANDLE thread = active_threads[tix];
+  CONTEXT ctx;
+  FILETIME created, exited, kernel, user;
+  unsigned long long cpu;
+  unsigned int chain[MAXFRAMES+1], frame[2], fp;
+  DWORD rv;
+  int n = 0;
+
+  if (SuspendThread (thread) == (DWORD)-1)
+    return;
+  ctx.ContextFlags = CONTEXT_CONTROL;
+  if (GetThreadContext (thread, &ctx)
+      && GetThreadTimes (thread, &created, &exited, &kernel, &user))
+    {
+      cpu = ((unsigned long long)kernel.dwHighDateTime << 32)
+	    + kernel.dwLowDateTime
+	    + ((unsigned long long)user.dwHighDateTime << 32)
+	    + user.dwLowDateTime;
+      /* A thread that is blocked has neither moved nor used any CPU
+	 since the last round; don't charge its wait to anything. */
+      if (ctx.Eip != tp->last_pc || cpu != tp->last_cpu)
+	{
+	  chain[n++] = ctx.Eip;
+	  fp = ctx.Ebp;
+	  while (n <= MAXFRAMES && fp >= ctx.Esp && !(fp & 3)
+		 && ReadProcessMemory (hProcess, (void *)fp, frame,
+				       sizeof (frame), &rv)
+		 && rv == sizeof (frame) && frame[1])
+	    {
+	      chain[n++] = frame[1];
+	      if (frame[0] <= fp)
+		break;
+	      fp = frame[0];
+	    }
+	}
+      tp->last_pc = ctx.Eip;
+      tp->last_cpu = cpu;
+    }
+  ResumeThread (thread);
+
+  if (!n)
+    return;
+  tp->samples++;
+  opcode_count++;
+  record_sample (hits, edges, chain, n);
+  if (tp->hits)
+    record_sample (tp->hits, tp->edges, chain, n);
+  if (dll_counts)
+    count_dll (chain[0], thread == procinfo.hThread);
+}
+
+/* Take a round of samples if one is due, and return how long the
+   debug loop may wait for an event before the next. */
+static DWORD
+sample_wait ()
+{
+  DWORD now = GetTickCount ();
+  DWORD period = 1000 / sample_rate;
+  int i;
+
+  if ((long)(now - next_sample) >= 0)
+    {
+      if (stepping_enabled)
+	{
+	  for (i=0; i<num_active_threads; i++)
+	    if (thread_profile[i])
+	      sample_thread (i);
+	  sample_ticks += now - last_round;
+	  sample_rounds++;
+	}
+      last_round = now;
+      next_sample += period;
+      if ((long)(now - next_sample) >= 0)
+	next_sample = now + period;
+    }
+  return next_sample - now;
+}
+
 char *
 wide_strdup (char *cp)
 {
@@ -321,8 +528,9 @@ run_program (char *cmdline)
 
   active_threads[0] = procinfo.hThread;
   active_thread_ids[0] = procinfo.dwThreadId;
-  thread_step_flags[0] = stepping_enabled;
+  thread_step_flags[0] = sampling ? 0 : stepping_enabled;
   num_active_threads = 1;
+  new_thread_profile (0);
 
   dll_info[0].base_address = 0;
   dll_info[0].pcount = 0;
@@ -330,13 +538,17 @@ run_program (char *cmdline)
   dll_info[0].name = cmdline;
   num_dlls = 1;
 
-  SetThreadPriority (procinfo.hThread, THREAD_PRIORITY_IDLE);
+  if (sampling)
+    SetThreadPriority (GetCurrentThread (), THREAD_PRIORITY_TIME_CRITICAL);
+  else
+    SetThreadPriority (procinfo.hThread, THREAD_PRIORITY_IDLE);
 
   context.ContextFlags = CONTEXT_FULL;
 
   ResumeThread (procinfo.hThread);
 
   total_cycles = 0;
+  next_sample = last_round = GetTickCount ();
 
   if (tracing_enabled)
     {
@@ -357,7 +569,12 @@ run_program (char *cmdline)
       int contv = DBG_CONTINUE;
 
       event.dwDebugEventCode = -1;
-      if (!WaitForDebugEvent (&event, INFINITE))
+      if (sampling)
+	{
+	  while (!WaitForDebugEvent (&event, sample_wait ()))
+	    ;
+	}
+      else if (!WaitForDebugEvent (&event, INFINITE))
 	{
 	  printf ("idle...\n");
 	}
@@ -395,9 +612,10 @@ run_program (char *cmdline)
 	  active_thread_ids[num_active_threads] = event.dwThreadId;
 	  active_threads[num_active_threads] = event.u.CreateThread.hThread;
 	  thread_return_address[num_active_threads] = 0;
+	  new_thread_profile (num_active_threads);
 	  num_active_threads++;
 
-	  if (trace_all_threads && stepping_enabled)
+	  if (trace_all_threads && stepping_enabled && !sampling)
 	    {
 	      thread_step_flags[num_active_threads-1] = stepping_enabled;
 	      add_breakpoint ((int)event.u.CreateThread.lpStartAddress);
@@ -411,17 +629,35 @@ run_program (char *cmdline)
 		   event.dwThreadId,
 		   event.u.ExitThread.dwExitCode);
 
+	  if (hThread)
+	    end_thread_profile (tix);
 	  for (src=0, dest=0; src<num_active_threads; src++)
 	    if (active_thread_ids[src] != event.dwThreadId)
 	      {
 		active_thread_ids[dest] = active_thread_ids[src];
 		active_threads[dest] = active_threads[src];
+		thread_profile[dest] = thread_profile[src];
 		dest++;
 	      }
 	  num_active_threads = dest;
 	  break;
 
 	case EXCEPTION_DEBUG_EVENT:
+	  if (sampling)
+	    {
+	      /* The program runs normally, so let it see its own
+		 exceptions; only the loader's breakpoint is ours. */
+	      if (event.u.Exception.ExceptionRecord.ExceptionCode
+		  != STATUS_BREAKPOINT)
+		{
+		  if (verbose)
+		    printf ("exception %ld, code: %lx\n",
+			    event.u.Exception.dwFirstChance,
+			    event.u.Exception.ExceptionRecord.ExceptionCode);
+		  contv = DBG_EXCEPTION_NOT_HANDLED;
+		}
+	      break;
+	    }
 	  rv = GetThreadContext (hThread, &context);
 	  switch (event.u.Exception.ExceptionRecord.ExceptionCode)
 	    {
@@ -448,20 +684,7 @@ run_program (char *cmdline)
 		}
 
 	      if (dll_counts)
-		{
-		  int i;
-		  for (i=num_dlls-1; i>=0; i--)
-		    {
-		      if (dll_info[i].base_address < context.Eip)
-			{
-			  if (hThread == procinfo.hThread)
-			    dll_info[i].pcount++;
-			  else
-			    dll_info[i].scount++;
-			  break;
-			}
-		    }
-		}
+		count_dll (context.Eip, hThread == procinfo.hThread);
 
 	      if (pc < last_pc || pc > last_pc+10)
 		{
@@ -474,7 +697,7 @@ run_program (char *cmdline)
 		  if (sp == last_sp-4)
 		    {
 		      ncalls++;
-		      store_call_edge (last_pc, pc);
+		      store_call_edge (edges, last_pc, pc);
 		      if (last_pc < KERNEL_ADDR && pc > KERNEL_ADDR)
 			{
 			  int retaddr;
@@ -554,13 +777,15 @@ run_program (char *cmdline)
 	  if (strcmp (string, "ssp on") == 0)
 	    {
 	      stepping_enabled = 1;
-	      set_step_threads (event.dwThreadId, 1);
+	      if (!sampling)
+		set_step_threads (event.dwThreadId, 1);
 	    }
 
 	  if (strcmp (string, "ssp off") == 0)
 	    {
 	      stepping_enabled = 0;
-	      set_step_threads (event.dwThreadId, 0);
+	      if (!sampling)
+		set_step_threads (event.dwThreadId, 0);
 	    }
 
 	  break;
@@ -631,12 +856,19 @@ run_program (char *cmdline)
       ContinueDebugEvent (event.dwProcessId, event.dwThreadId, contv);
     }
 
+  for (i=0; i<num_active_threads; i++)
+    end_thread_profile (i);
+
   count = 0;
   for (pc=low_pc; pc<high_pc; pc+=2)
     {
       count += hits[(pc - low_pc)/2];
     }
-  printf ("total cycles: %d, counted cycles: %d\n", total_cycles, count);
+  if (sampling)
+    printf ("total samples: %d, counted samples: %d, %d rounds at %d Hz\n",
+	    opcode_count, count, sample_rounds, sample_hz ());
+  else
+    printf ("total cycles: %d, counted cycles: %d\n", total_cycles, count);
 
   if (tracing_enabled)
     fclose (tracefile);
@@ -655,11 +887,16 @@ usage (FILE * stream)
   "                      OutputDebugString (\"ssp on\") to enable stepping\n"
   " -e, --enable         enable single-stepping by default; use\n"
   "                      OutputDebugString (\"ssp off\") to disable stepping\n"
+  " -f, --frequency=HZ   sample HZ times a second with -S (default 100)\n"
   " -h, --help           output usage information and exit\n"
   " -l, --dll            enable dll profiling.  A chart of relative DLL usage\n"
   "                      is produced after the run.\n"
+  " -S, --sample         sample EIP and the call chain periodically instead\n"
+  "                      of single-stepping.  Runs at nearly full speed.\n"
   " -s, --sub-threads    trace sub-threads too.  Dangerous if you have\n" 
   "                      race conditions.\n"
+  " -T, --per-thread     with -S, sample all threads and also write a\n"
+  "                      gmon.out.<thread id> for each\n"
   " -t, --trace-eip      trace every EIP value to a file TRACE.SSP.  This\n"
   "                      gets big *fast*.\n"
   " -v, --verbose        output verbose messages about debug events.\n"
@@ -796,6 +1033,23 @@ usage (FILE * stream)
     "spent in each dll the program used.  No sense optimizing a function in\n"
     "your program if most of the time is spent in the DLL.\n"
     "\n"
+    "\"-S\" - sampling.  Rather than stepping, ssp lets the program run and\n"
+    "100 times a second (or as often as \"-f\" says) stops each thread\n"
+    "just long enough to note its EIP and follow its frame pointers up\n"
+    "the stack.  The program runs at close to full speed, so this is the\n"
+    "mode to use on real workloads.  gmon.out is written as usual, but the\n"
+    "seconds gprof reports are real seconds, and the call counts are the\n"
+    "number of samples in which that call was on the stack.  Code built\n"
+    "with -fomit-frame-pointer loses its callers from the call graph.\n"
+    "Threads that are blocked are not charged for the time.  Rates above\n"
+    "the system clock's resolution give fewer samples than asked for; the\n"
+    "rate achieved is printed at the end.  \"-d\" and OutputDebugString work\n"
+    "as for stepping, but switch sampling on and off for all threads.\n"
+    "\n"
+    "\"-T\" - per-thread profiles.  With \"-S\", samples every thread, prints\n"
+    "how many samples each got, and writes a gmon.out.<thread id> for each\n"
+    "one as well as the combined gmon.out.\n"
+    "\n"
     "I usually use the -v, -s, and -l options:\n"
     "\n"
     "	ssp -v -s -l -d 0x61001000 0x61080000 hello.exe\n"
@@ -833,7 +1087,6 @@ main (int argc, char **argv)
 {
   int c, i;
   int total_pcount = 0, total_scount = 0;
-  FILE *gmon;
 
   setbuf (stdout, 0);
 
@@ -860,6 +1113,15 @@ main (int argc, char **argv)
         printf ("stepping enabled; disable via OutputDebugString (\"ssp off\")\n");
         stepping_enabled = 1;
         break;
+      case 'f':
+        sample_rate = atoi (optarg);
+        if (sample_rate < 1 || sample_rate > 1000)
+          {
+            fprintf (stderr, "%s: frequency must be between 1 and 1000\n",
+                     prog_name);
+            exit (1);
+          }
+        break;
       case 'h':
         usage (stdout);
         break;
@@ -867,10 +1129,19 @@ main (int argc, char **argv)
         printf ("profiling dll usage\n");
         dll_counts = 1;
         break;
+      case 'S':
+        printf ("sampling instead of stepping\n");
+        sampling = 1;
+        break;
       case 's':
         printf ("tracing all sub-threads too, not just the main one\n");
         trace_all_threads = 1;
         break;
+      case 'T':
+        printf ("writing a gmon.out.<thread id> for each thread\n");
+        per_thread = 1;
+        trace_all_threads = 1;
+        break;
       case 't':
         printf ("tracing all $eip to trace.ssp\n");
         tracing_enabled = 1;
@@ -888,6 +1159,17 @@ main (int argc, char **argv)
 
   if ( (argc - optind) < 3 )
     usage (stderr);
+  if (per_thread && !sampling)
+    {
+      fprintf (stderr, "%s: --per-thread needs --sample\n", prog_name);
+      exit (1);
+    }
+  if (sampling && (tracing_enabled || trace_console))
+    {
+      fprintf (stderr, "%s: can't trace every EIP when sampling\n",
+	       prog_name);
+      exit (1);
+    }
   sscanf (argv[optind++], "%i", &low_pc); 
   sscanf (argv[optind++], "%i", &high_pc); 
 
@@ -905,17 +1187,16 @@ main (int argc, char **argv)
 
   run_program (argv[optind]);
 
-  hdr.lpc = low_pc;
-  hdr.hpc = high_pc;
-  hdr.ncnt = high_pc-low_pc + sizeof (hdr);
-  hdr.version = GMONVERSION;
-  hdr.profrate = 100;
+  write_gmon ("gmon.out", hits, edges, sampling ? sample_hz () : 100);
 
-  gmon = fopen ("gmon.out", "wb");
-  fwrite (&hdr, 1, sizeof (hdr), gmon);
-  fwrite (hits, 1, high_pc-low_pc, gmon);
-  write_call_edges (gmon);
-  fclose (gmon);
+  if (sampling && finished_threads && finished_threads->next)
+    {
+      ThreadProfile *tp;
+      printf ("  Thread  Samples\n");
+      for (tp=finished_threads; tp; tp=tp->next)
+	printf ("%08lx %8d %3d%%\n", tp->id, tp->samples,
+		opcode_count ? (tp->samples*100)/opcode_count : 0);
+    }
 
   if (dll_counts)
     {
@@ -21,6 +21,7 @@ details. */
 #include <windows.h>
 #include <signal.h>
 #include <errno.h>
+#include <ctype.h>
 #include "cygwin/include/sys/strace.h"
 #include "cygwin/include/sys/cygwin.h"
 #include "path.h"
@@ -47,6 +48,7 @@ static int hhmmss = 0;
 static int bufsize = 0;
 static int new_window = 0;
 static long flush_period = 0;
+static unsigned long ring_size = 0;
 
 static BOOL close_handle (HANDLE h, DWORD ok);
 
@@ -60,9 +62,15 @@ struct child_list
   char nfields;
   long long start_time;
   DWORD last_usecs;
+  HANDLE ring_map;
+  struct _strace_ring *ring;
+  long dropped;
+  int nonewline;
+  struct string_cache *strings;
   struct child_list *next;
     child_list ():id (0), hproc (NULL), saw_stars (0), nfields (0),
-    start_time (0), last_usecs (0), next (NULL)
+    start_time (0), last_usecs (0), ring_map (NULL), ring (NULL),
+    dropped (0), nonewline (0), strings (NULL), next (NULL)
   {
   }
 };
@@ -143,6 +151,13 @@ remove_child (DWORD id)
       {
 	child_list *c1 = c->next;
 	c->next = c1->next;
+	if (c1->ring)
+	  {
+	    UnmapViewOfFile (c1->ring);
+	    CloseHandle (c1->ring_map);
+	  }
+	if (c1->strings)
+	  free (c1->strings);
 	free (c1);
 	return;
       }
@@ -392,6 +407,341 @@ syst (long long t)
   return &st;
 }
 
+/* Binary ring buffer support.  The traced process records the format
+   string and function name as pointers, which are read here on demand
+   and cached since there are only a few hundred distinct ones. */
+
+#define STRING_CACHE_SIZE 1024
+#define STRING_MAX 1024
+#define RING_MIN_SLOTS 64
+
+static void output_message (child_list *, unsigned, char *, unsigned, FILE *);
+
+struct string_cache
+{
+  const char *addr[STRING_CACHE_SIZE];
+  char *str[STRING_CACHE_SIZE];
+};
+
+static const char *
+child_string (child_list *child, const char *addr)
+{
+  if (!addr)
+    return NULL;
+  if (!child->strings)
+    child->strings = (string_cache *) calloc (1, sizeof (string_cache));
+
+  unsigned h = ((unsigned long) addr >> 2) % STRING_CACHE_SIZE;
+  if (child->strings->addr[h] == addr)
+    return child->strings->str[h];
+
+  /* Read page by page so that a string near the end of a mapping
+     doesn't make the whole read fail. */
+  char buf[STRING_MAX + 1];
+  size_t len = 0;
+  while (len < STRING_MAX)
+    {
+      DWORD nbytes;
+      size_t chunk = 4096 - (((unsigned long) addr + len) & 4095);
+      if (chunk > STRING_MAX - len)
+	chunk = STRING_MAX - len;
+      if (!ReadProcessMemory (child->hproc, addr + len, buf + len, chunk,
+			      &nbytes) || !nbytes)
+	break;
+      if (memchr (buf + len, '\0', nbytes))
+	{
+	  len += nbytes;
+	  break;
+	}
+      len += nbytes;
+    }
+  buf[len] = '\0';
+
+  free (child->strings->str[h]);
+  child->strings->addr[h] = addr;
+  return child->strings->str[h] = strdup (buf);
+}
+
+static char *
+ring_number (char *dst, int base, int dosign, long long val, int len, int pad)
+{
+  static const char digits[] = "0123456789ABCDEF";
+  unsigned long long uval;
+  char res[24];
+  int l = 0;
+
+  if (dosign && val < 0)
+    {
+      *dst++ = '-';
+      uval = -val;
+    }
+  else if (dosign > 0 && val > 0)
+    {
+      *dst++ = '+';
+      uval = val;
+    }
+  else
+    uval = val;
+
+  do
+    res[l++] = digits[uval % base];
+  while ((uval /= base));
+  while (len-- > l)
+    *dst++ = pad;
+  while (l > 0)
+    *dst++ = res[--l];
+  return dst;
+}
+
+/* Same as strace::vsprntf in the DLL but working on a recorded event. */
+static void
+format_ring_event (child_list *child, _strace_ring_event *ev, char *dst,
+		   char *end)
+{
+  char *start = dst;
+  const char *fmt = child_string (child, ev->fmt);
+  const char *func = child_string (child, ev->func);
+  unsigned a = 0;
+  const char *s;
+  char *p;
+
+  if (!fmt)
+    fmt = "";
+  if (!child->nonewline)
+    {
+      dst += sprintf (dst, "%7lu [%s] %s %lu%s ", ev->usecs, ev->str,
+		      *child->ring->progname ? child->ring->progname : "?",
+		      ev->pid, ev->execing ? "!" : "");
+      if (func)
+	{
+	  /* Reduce __PRETTY_FUNCTION__ to the function name, as getfunc
+	     does in the DLL. */
+	  const char *pe, *q;
+	  for (q = func; (pe = strchr (q, '(')); q = pe + 1)
+	    if (isalnum (pe[-1]) || pe[-1] == '_')
+	      break;
+	    else if (isspace (pe[-1]))
+	      {
+		pe--;
+		break;
+	      }
+	  if (!pe)
+	    pe = strchr (func, '\0');
+	  for (q = pe; q > func; q--)
+	    if (q != pe && *q == ' ')
+	      {
+		q++;
+		break;
+	      }
+	  if (*q == '*')
+	    q++;
+	  while (q < pe)
+	    *dst++ = *q++;
+	  *dst++ = ':';
+	  *dst++ = ' ';
+	}
+    }
+
+  end -= 64;
+  while (*fmt && dst < end)
+    {
+      int len = 0, n = 0x7fff;
+      char pad = ' ';
+      int addsign = -1;
+      unsigned long long ll;
+
+      if (*fmt != '%')
+	{
+	  *dst++ = *fmt++;
+	  continue;
+	}
+      if (*++fmt == '+')
+	{
+	  addsign = 1;
+	  fmt++;
+	}
+      else if (*fmt == '%')
+	{
+	  *dst++ = *fmt++;
+	  continue;
+	}
+      while (*fmt == 'l' || (*fmt >= '0' && *fmt <= '9'))
+	if (*fmt == 'l')
+	  fmt++;
+	else if (*fmt == '0' && !len)
+	  {
+	    pad = '0';
+	    fmt++;
+	  }
+	else
+	  len = len * 10 + (*fmt++ - '0');
+
+#define ARG (a < ev->nargs ? ev->args[a++] : 0)
+      switch (*fmt++)
+	{
+	case 'c':
+	  {
+	    int c = ARG;
+	    if (c > ' ' && c <= 127)
+	      *dst++ = c;
+	    else
+	      {
+		*dst++ = '0';
+		*dst++ = 'x';
+		dst = ring_number (dst, 16, 0, c, len, pad);
+	      }
+	  }
+	  break;
+	case 'E':
+	  dst += sprintf (dst, "Win32 error ");
+	  dst = ring_number (dst, 10, 0, ev->err, len, pad);
+	  break;
+	case 'd':
+	  dst = ring_number (dst, 10, addsign, (long) ARG, len, pad);
+	  break;
+	case 'u':
+	  dst = ring_number (dst, 10, 0, ARG, len, pad);
+	  break;
+	case 'o':
+	  dst = ring_number (dst, 8, 0, ARG, len, pad);
+	  break;
+	case 'p':
+	  *dst++ = '0';
+	  *dst++ = 'x';
+	  /* fall through */
+	case 'x':
+	  dst = ring_number (dst, 16, 0, ARG, len, pad);
+	  break;
+	case 'D':
+	case 'U':
+	case 'X':
+	  ll = ARG;
+	  ll |= (unsigned long long) ARG << 32;
+	  dst = ring_number (dst, fmt[-1] == 'X' ? 16 : 10,
+			     fmt[-1] == 'D' ? addsign : 0, ll, len, pad);
+	  break;
+	case '.':
+	  n = strtol (fmt, (char **) &fmt, 10);
+	  if (*fmt++ != 's')
+	    break;
+	  /* fall through */
+	case 'P':
+	case 's':
+	  {
+	    unsigned long off = ARG;
+	    s = off < sizeof (ev->str) ? ev->str + off : "(null)";
+	    for (int i = 0; *s && i < n && dst < end; i++)
+	      *dst++ = *s++;
+	  }
+	  break;
+	case '\0':
+	  fmt--;
+	  break;
+	default:
+	  *dst++ = '?';
+	  *dst++ = fmt[-1];
+	}
+#undef ARG
+    }
+
+  /* Strip trailing newlines and add exactly one, unless the message ends
+     in a backspace, which means the next one continues the line. */
+  for (p = dst; p > start && p[-1] == '\n'; p--)
+    ;
+  if (p > start && p[-1] == '\b')
+    {
+      *--p = '\0';
+      child->nonewline = 1;
+    }
+  else
+    {
+      *p++ = '\n';
+      *p = '\0';
+      child->nonewline = 0;
+    }
+}
+
+/* Create the ring buffer for a process which has just announced its
+   strace interface.  The process maps it by name. */
+static bool
+create_ring (child_list *child, unsigned mask)
+{
+  char name[sizeof (_STRACE_RING_NAME) + 8];
+  unsigned long nslots;
+
+  if (child->ring)
+    return true;
+  if (!ring_size)
+    return false;
+  for (nslots = RING_MIN_SLOTS;
+       nslots * 2 * sizeof (_strace_ring_event) <= ring_size;
+       nslots *= 2)
+    continue;
+
+  sprintf (name, _STRACE_RING_NAME, (unsigned) child->id);
+  DWORD size = sizeof (_strace_ring) + nslots * sizeof (_strace_ring_event);
+  child->ring_map = CreateFileMapping (INVALID_HANDLE_VALUE, NULL,
+				       PAGE_READWRITE, 0, size, name);
+  if (!child->ring_map)
+    {
+      warn (0, "couldn't create ring buffer for process %d, windows error %d",
+	    child->id, GetLastError ());
+      return false;
+    }
+  child->ring = (_strace_ring *) MapViewOfFile (child->ring_map,
+						FILE_MAP_WRITE, 0, 0, 0);
+  if (!child->ring)
+    {
+      warn (0, "couldn't map ring buffer for process %d, windows error %d",
+	    child->id, GetLastError ());
+      CloseHandle (child->ring_map);
+      child->ring_map = NULL;
+      return false;
+    }
+  child->ring->nslots = nslots;
+  child->ring->mask = mask;
+  child->ring->magic = _STRACE_RING_MAGIC;
+  return true;
+}
+
+/* Format and print all complete events in a process' ring buffer. */
+static void
+drain_ring (child_list *child, unsigned mask, FILE *ofile)
+{
+  _strace_ring *r = child->ring;
+  _strace_ring_event ev;
+  char line[16384];
+
+  if (!r)
+    return;
+  for (long tail = r->tail;
+       r->ev[tail & (r->nslots - 1)].seq == tail + 1;
+       r->tail = ++tail)
+    {
+      ev = r->ev[tail & (r->nslots - 1)];
+      ev.str[sizeof (ev.str) - 1] = '\0';
+      /* Leave room in front of the message for output_message. */
+      format_ring_event (child, &ev, line + 32, line + sizeof (line));
+      output_message (child, ev.category, line + 32, mask, ofile);
+    }
+
+  if (r->dropped != child->dropped)
+    {
+      fprintf (ofile, "*** %ld trace events dropped by process %lu\n",
+	       r->dropped - child->dropped, child->id);
+      child->dropped = r->dropped;
+      if (!bufsize)
+	fflush (ofile);
+    }
+}
+
+static void
+drain_rings (unsigned mask, FILE *ofile)
+{
+  for (child_list *c = &children; (c = c->next) != NULL;)
+    drain_ring (c, mask, ofile);
+}
+
 static void __stdcall
 handle_output_debug_string (DWORD id, LPVOID p, unsigned mask, FILE *ofile)
 {
@@ -447,7 +797,7 @@ handle_output_debug_string (DWORD id, LPVOID p, unsigned mask, FILE *ofile)
 
   if (special == _STRACE_INTERFACE_ACTIVATE_ADDR)
     {
-      DWORD new_flag = 1;
+      DWORD new_flag = create_ring (child, mask) ? _STRACE_INTERFACE_RING : 1;
       if (!WriteProcessMemory (hchild, (LPVOID) n, &new_flag,
 			       sizeof (new_flag), &nbytes))
 	error (0,
@@ -456,6 +806,15 @@ handle_output_debug_string (DWORD id, LPVOID p, unsigned mask, FILE *ofile)
       return;
     }
 
+  output_message (child, n, s, mask, ofile);
+}
+
+/* Print one trace line.  S must be preceded by some scratch space since
+   the timestamp fields are rewritten in place. */
+static void
+output_message (child_list *child, unsigned n, char *s, unsigned mask,
+		FILE *ofile)
+{
   char *origs = s;
 
   if (mask & n)
@@ -582,9 +941,13 @@ proc_child (unsigned mask, FILE *ofile, pid_t pid)
   last_time = time (NULL);
   while (1)
     {
-      BOOL debug_event = WaitForDebugEvent (&ev, 1000);
+      /* Ring buffers are polled, the traced processes never wait for us. */
+      BOOL debug_event = WaitForDebugEvent (&ev, ring_size ? 20 : 1000);
       DWORD status = DBG_CONTINUE;
 
+      if (ring_size)
+	drain_rings (mask, ofile);
+
       if (bufsize && flush_period > 0 &&
 	  (cur_time = time (NULL)) >= last_time + flush_period)
 	{
@@ -619,12 +982,14 @@ proc_child (unsigned mask, FILE *ofile, pid_t pid)
 	  break;
 
 	case OUTPUT_DEBUG_STRING_EVENT:
+	  drain_ring (get_child (ev.dwProcessId), mask, ofile);
 	  handle_output_debug_string (ev.dwProcessId,
 				      ev.u.DebugString.lpDebugStringData,
 				      mask, ofile);
 	  break;
 
 	case EXIT_PROCESS_DEBUG_EVENT:
+	  drain_ring (get_child (ev.dwProcessId), mask, ofile);
 	  remove_child (ev.dwProcessId);
 	  break;
 	case EXCEPTION_DEBUG_EVENT:
@@ -811,6 +1176,10 @@ Trace system calls and signals\n\
                                numbers for Windows errors\n\
   -o, --output=FILENAME        set output file to FILENAME\n\
   -p, --pid=n                  attach to executing program with cygwin pid n\n\
+  -r, --ring-buffer=SIZE       record trace events in a shared memory ring\n\
+                               buffer of SIZE bytes instead of sending each\n\
+                               line to strace.  Events are dropped rather\n\
+                               than slowing down the traced process\n\
   -S, --flush-period=PERIOD    flush buffered strace output every PERIOD secs\n\
   -t, --timestamp              use an absolute hh:mm:ss timestamp insted of \n\
                                the default microsecond timestamp.  Implies -d\n\
@@ -861,6 +1230,7 @@ struct option longopts[] = {
   {"output", required_argument, NULL, 'o'},
   {"no-delta", no_argument, NULL, 'd'},
   {"pid", required_argument, NULL, 'p'},
+  {"ring-buffer", required_argument, NULL, 'r'},
   {"timestamp", no_argument, NULL, 't'},
   {"toggle", no_argument, NULL, 'T'},
   {"trace-children", no_argument, NULL, 'f'},
@@ -870,7 +1240,7 @@ struct option longopts[] = {
   {NULL, 0, NULL, 0}
 };
 
-static const char *const opts = "b:dhfm:no:p:S:tTuvw";
+static const char *const opts = "b:dhfm:no:p:r:S:tTuvw";
 
 static void
 print_version ()
@@ -950,6 +1320,9 @@ character #%d.\n", optarg, (int) (endptr - optarg), endptr);
       case 'p':
 	pid = strtoul (optarg, NULL, 10);
 	break;
+      case 'r':
+	ring_size = strtoul (optarg, NULL, 0);
+	break;
       case 'S':
 	flush_period = strtoul (optarg, NULL, 10);
 	break;